@@ -171,6 +171,7 @@ export CONFIG_COMPAT_MAC80211_RC_DEFAULT=minstrel_ht
 export CONFIG_MAC80211_RC_PID=y
 export CONFIG_MAC80211_RC_MINSTREL=y
 export CONFIG_MAC80211_RC_MINSTREL_HT=y
+export CONFIG_MAC80211_RC_AIRTIME=y
 ifdef CONFIG_LEDS_TRIGGERS
 export CONFIG_MAC80211_LEDS=y
 endif #CONFIG_LEDS_TRIGGERS
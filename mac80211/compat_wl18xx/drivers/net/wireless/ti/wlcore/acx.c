@@ -735,6 +735,7 @@ int wl1271_acx_sta_rate_policies(struct wl1271 *wl, struct wl12xx_vif *wlvif)
 {
 	struct acx_rate_policy *acx;
 	struct conf_tx_rate_class *c = &wl->conf.tx.sta_rc_conf;
+	u32 ap_rates;
 	int ret = 0;
 
 	wl1271_debug(DEBUG_ACX, "acx rate policies");
@@ -766,8 +767,13 @@ int wl1271_acx_sta_rate_policies(struct wl1271 *wl, struct wl12xx_vif *wlvif)
 	acx->rate_policy_idx = cpu_to_le32(wlvif->sta.ap_rate_idx);
 
 	/* the AP policy is HW specific */
-	acx->rate_policy.enabled_rates =
-		cpu_to_le32(wlcore_hw_sta_get_ap_rate_mask(wl, wlvif));
+	ap_rates = wlcore_hw_sta_get_ap_rate_mask(wl, wlvif);
+
+	/* narrow it down to the rates chosen by the mac80211 rate control */
+	if (ap_rates & wlvif->sta.rc_rate_mask)
+		ap_rates &= wlvif->sta.rc_rate_mask | ~CONF_TX_RATE_MASK_ALL;
+
+	acx->rate_policy.enabled_rates = cpu_to_le32(ap_rates);
 	acx->rate_policy.short_retry_limit = c->short_retry_limit;
 	acx->rate_policy.long_retry_limit = c->long_retry_limit;
 	acx->rate_policy.aflags = c->aflags;
@@ -442,6 +442,9 @@ struct conf_rx_settings {
 	CONF_HW_BIT_RATE_MCS_5 | CONF_HW_BIT_RATE_MCS_6 |        \
 	CONF_HW_BIT_RATE_MCS_7)
 
+/* all rate bits of a rate policy, excluding chip specific flags */
+#define CONF_TX_RATE_MASK_ALL ((CONF_HW_BIT_RATE_MCS_15 << 1) - 1)
+
 #define CONF_TX_MIMO_RATES (CONF_HW_BIT_RATE_MCS_8 |             \
 	CONF_HW_BIT_RATE_MCS_9 | CONF_HW_BIT_RATE_MCS_10 |       \
 	CONF_HW_BIT_RATE_MCS_11 | CONF_HW_BIT_RATE_MCS_12 |      \
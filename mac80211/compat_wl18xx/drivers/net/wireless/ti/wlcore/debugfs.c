@@ -561,6 +561,10 @@ static ssize_t driver_state_read(struct file *file, char __user *user_buf,
 	DRIVER_STATE_PRINT_INT(tx_queue_count[1]);
 	DRIVER_STATE_PRINT_INT(tx_queue_count[2]);
 	DRIVER_STATE_PRINT_INT(tx_queue_count[3]);
+	DRIVER_STATE_PRINT_INT(queue_stop_events[0]);
+	DRIVER_STATE_PRINT_INT(queue_stop_events[1]);
+	DRIVER_STATE_PRINT_INT(queue_stop_events[2]);
+	DRIVER_STATE_PRINT_INT(queue_stop_events[3]);
 	DRIVER_STATE_PRINT_INT(tx_packets_count);
 	DRIVER_STATE_PRINT_INT(tx_results_count);
 	DRIVER_STATE_PRINT_LHEX(flags);
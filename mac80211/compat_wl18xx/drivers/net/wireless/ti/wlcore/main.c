@@ -218,6 +218,32 @@ out:
 	mutex_unlock(&wl->mutex);
 }
 
+static void wlcore_rc_policy_work(struct work_struct *work)
+{
+	int ret;
+	struct wl12xx_vif *wlvif = container_of(work, struct wl12xx_vif,
+						rc_policy_work);
+	struct wl1271 *wl = wlvif->wl;
+
+	mutex_lock(&wl->mutex);
+
+	if (unlikely(wl->state != WLCORE_STATE_ON))
+		goto out;
+
+	if (!test_bit(WLVIF_FLAG_STA_ASSOCIATED, &wlvif->flags))
+		goto out;
+
+	ret = wl1271_ps_elp_wakeup(wl);
+	if (ret < 0)
+		goto out;
+
+	wl1271_acx_sta_rate_policies(wl, wlvif);
+
+	wl1271_ps_elp_sleep(wl);
+out:
+	mutex_unlock(&wl->mutex);
+}
+
 static void wl1271_rx_streaming_timer(unsigned long data)
 {
 	struct wl12xx_vif *wlvif = (struct wl12xx_vif *)data;
@@ -2069,6 +2095,7 @@ static int wl12xx_init_vif_data(struct wl1271 *wl, struct ieee80211_vif *vif)
 	    wlvif->bss_type == BSS_TYPE_IBSS) {
 		/* init sta/ibss data */
 		wlvif->sta.hlid = WL12XX_INVALID_LINK_ID;
+		wlvif->sta.rc_last_rate = WLCORE_RC_RATE_UNKNOWN;
 		wl12xx_allocate_rate_policy(wl, &wlvif->sta.basic_rate_idx);
 		wl12xx_allocate_rate_policy(wl, &wlvif->sta.ap_rate_idx);
 		wl12xx_allocate_rate_policy(wl, &wlvif->sta.p2p_rate_idx);
@@ -2113,6 +2140,7 @@ static int wl12xx_init_vif_data(struct wl1271 *wl, struct ieee80211_vif *vif)
 		  wl1271_rx_streaming_enable_work);
 	INIT_WORK(&wlvif->rx_streaming_disable_work,
 		  wl1271_rx_streaming_disable_work);
+	INIT_WORK(&wlvif->rc_policy_work, wlcore_rc_policy_work);
 	INIT_LIST_HEAD(&wlvif->list);
 
 	setup_timer(&wlvif->rx_streaming_timer, wl1271_rx_streaming_timer,
@@ -2491,6 +2519,7 @@ unlock:
 	del_timer_sync(&wlvif->rx_streaming_timer);
 	cancel_work_sync(&wlvif->rx_streaming_enable_work);
 	cancel_work_sync(&wlvif->rx_streaming_disable_work);
+	cancel_work_sync(&wlvif->rc_policy_work);
 
 	mutex_lock(&wl->mutex);
 }
@@ -3733,6 +3762,38 @@ out:
 	return ret;
 }
 
+/*
+ * The fw maintains the TIM of AP beacons itself (we run with
+ * IEEE80211_HW_AP_LINK_PS), so leave it and the DTIM count out when
+ * deciding whether a new beacon differs from the uploaded template.
+ */
+static u32 wlcore_beacon_crc(struct sk_buff *beacon, int ieoffset,
+			     u32 min_rate)
+{
+	const u8 *tim = cfg80211_find_ie(WLAN_EID_TIM,
+					 beacon->data + ieoffset,
+					 beacon->len - ieoffset);
+	const u8 *end = beacon->data + beacon->len;
+	u32 crc;
+
+	/* timestamp and seq_ctrl change on every beacon, skip them */
+	crc = crc32(~0, (u8 *)&min_rate, sizeof(min_rate));
+	crc = crc32(crc, beacon->data,
+		    offsetof(struct ieee80211_mgmt, seq_ctrl));
+	crc = crc32(crc, beacon->data + offsetof(struct ieee80211_mgmt,
+						 u.beacon.beacon_int),
+		    ieoffset - offsetof(struct ieee80211_mgmt,
+					u.beacon.beacon_int));
+	if (!tim)
+		return crc32(crc, beacon->data + ieoffset,
+			     beacon->len - ieoffset);
+
+	crc = crc32(crc, beacon->data + ieoffset,
+		    tim - (beacon->data + ieoffset));
+	tim += tim[1] + 2;
+	return crc32(crc, tim, end - tim);
+}
+
 static int wlcore_set_beacon_template(struct wl1271 *wl,
 				      struct ieee80211_vif *vif,
 				      bool is_ap)
@@ -3745,12 +3806,31 @@ static int wlcore_set_beacon_template(struct wl1271 *wl,
 				u.beacon.variable);
 	struct sk_buff *beacon = ieee80211_beacon_get(wl->hw, vif);
 	u16 tmpl_id;
+	u32 crc = 0;
 
 	if (!beacon) {
 		ret = -EINVAL;
 		goto out;
 	}
 
+	min_rate = wl1271_tx_min_rate_get(wl, wlvif->basic_rate_set);
+
+	/*
+	 * hostapd reconfigures the beacon for many reasons that leave its
+	 * contents untouched; don't re-upload (and re-derive the probe
+	 * response from) an identical template.
+	 */
+	if (is_ap) {
+		crc = wlcore_beacon_crc(beacon, ieoffset, min_rate);
+		if (wlvif->beacon_crc_valid && wlvif->beacon_crc == crc) {
+			wl1271_debug(DEBUG_MASTER, "beacon unchanged");
+			dev_kfree_skb(beacon);
+			ret = 0;
+			goto out;
+		}
+		wlvif->beacon_crc_valid = false;
+	}
+
 	wl1271_debug(DEBUG_MASTER, "beacon updated");
 
 	ret = wl1271_ssid_set(vif, beacon, ieoffset);
@@ -3758,7 +3838,6 @@ static int wlcore_set_beacon_template(struct wl1271 *wl,
 		dev_kfree_skb(beacon);
 		goto out;
 	}
-	min_rate = wl1271_tx_min_rate_get(wl, wlvif->basic_rate_set);
 	tmpl_id = is_ap ? CMD_TEMPL_AP_BEACON :
 		CMD_TEMPL_BEACON;
 	ret = wl1271_cmd_template_set(wl, wlvif->role_id, tmpl_id,
@@ -3816,6 +3895,11 @@ end_bcn:
 	if (ret < 0)
 		goto out;
 
+	if (is_ap) {
+		wlvif->beacon_crc = crc;
+		wlvif->beacon_crc_valid = true;
+	}
+
 out:
 	return ret;
 }
@@ -3918,6 +4002,7 @@ static void wl1271_bss_info_changed_ap(struct wl1271 *wl,
 				clear_bit(WLVIF_FLAG_AP_STARTED, &wlvif->flags);
 				clear_bit(WLVIF_FLAG_AP_PROBE_RESP_SET,
 					  &wlvif->flags);
+				wlvif->beacon_crc_valid = false;
 				wl1271_debug(DEBUG_AP, "stopped AP");
 			}
 		}
@@ -4053,6 +4138,10 @@ sta_not_found:
 								sta_rate_set,
 								wlvif->band);
 
+			wlvif->sta.rc_rate_mask = 0;
+			wlvif->sta.rc_last_rate = WLCORE_RC_RATE_UNKNOWN;
+			wlcore_tx_reset_rc_stats(wlvif);
+
 			ret = wl1271_acx_sta_rate_policies(wl, wlvif);
 			if (ret < 0)
 				goto out;
@@ -4075,6 +4164,7 @@ sta_not_found:
 			wlvif->basic_rate =
 				wl1271_tx_min_rate_get(wl,
 						       wlvif->basic_rate_set);
+			wlvif->sta.rc_rate_mask = 0;
 			ret = wl1271_acx_sta_rate_policies(wl, wlvif);
 			if (ret < 0)
 				goto out;
@@ -5343,6 +5433,49 @@ static struct ieee80211_supported_band wl1271_band_5ghz = {
 	.n_bitrates = ARRAY_SIZE(wl1271_rates_5ghz),
 };
 
+/*
+ * Called by the mac80211 rate control in response to the statistics
+ * reported from wlcore_tx_rc_stats(), i.e. with wl->mutex held.
+ */
+static void wlcore_op_set_rate_policy(struct ieee80211_hw *hw,
+				      struct ieee80211_vif *vif,
+				      struct ieee80211_sta *sta,
+				      const struct ieee80211_rate_policy *policy)
+{
+	struct wl12xx_vif *wlvif = wl12xx_vif_to_data(vif);
+	struct wl1271 *wl = hw->priv;
+	struct ieee80211_supported_band *band;
+	const struct ieee80211_tx_rate *rate;
+	u32 rate_mask = 0;
+	int i;
+
+	if (wlvif->bss_type != BSS_TYPE_STA_BSS)
+		return;
+
+	band = wl->hw->wiphy->bands[wlvif->band];
+	for (i = 0; i < IEEE80211_TX_MAX_RATES; i++) {
+		rate = &policy->rates[i];
+		if (rate->idx < 0)
+			break;
+
+		if (rate->flags & IEEE80211_TX_RC_MCS) {
+			if (rate->idx < 16)
+				rate_mask |= CONF_HW_BIT_RATE_MCS_0 << rate->idx;
+		} else if (rate->idx < band->n_bitrates) {
+			rate_mask |= band->bitrates[rate->idx].hw_value;
+		}
+	}
+
+	wl1271_debug(DEBUG_MAC80211, "mac80211 set rate policy 0x%x",
+		     rate_mask);
+
+	if (!rate_mask || rate_mask == wlvif->sta.rc_rate_mask)
+		return;
+
+	wlvif->sta.rc_rate_mask = rate_mask;
+	ieee80211_queue_work(hw, &wlvif->rc_policy_work);
+}
+
 static const struct ieee80211_ops wl1271_ops = {
 	.start = wl1271_op_start,
 	.stop = wlcore_op_stop,
@@ -5380,6 +5513,7 @@ static const struct ieee80211_ops wl1271_ops = {
 	.set_priority = wl12xx_op_set_priority,
 	.cancel_priority = wl12xx_op_cancel_priority,
 	.sta_rc_update = wlcore_op_sta_rc_update,
+	.set_rate_policy = wlcore_op_set_rate_policy,
 	CFG80211_TESTMODE_CMD(wl1271_tm_cmd)
 };
 
@@ -5744,6 +5878,11 @@ static int wl1271_init_ieee80211(struct wl1271 *wl)
 	wl->hw->channel_change_time = 10000;
 	wl->hw->max_listen_interval = wl->conf.conn.max_listen_interval;
 
+	/*
+	 * The FW initiates TX BA sessions by itself, see
+	 * wl12xx_acx_set_ba_initiator_policy(). Hence TX_AMPDU_SETUP_IN_HW,
+	 * and neither TX_AMPDU_AUTO nor a max_tx_ba_sessions limit.
+	 */
 	wl->hw->flags = IEEE80211_HW_SIGNAL_DBM |
 		IEEE80211_HW_SUPPORTS_PS |
 		IEEE80211_HW_SUPPORTS_DYNAMIC_PS |
@@ -5810,6 +5949,17 @@ static int wl1271_init_ieee80211(struct wl1271 *wl)
 	wl->hw->queues = 4;
 	wl->hw->max_rates = 1;
 
+	/*
+	 * Steer the FW rate policies from the aggregated tx statistics, on
+	 * chips whose TX results tell the rate and retries of each frame.
+	 * wl18xx only reports whether a frame was acked, so its FW keeps
+	 * full control of the rates.
+	 */
+	if (wl->quirks & WLCORE_QUIRK_TX_RATE_STATUS) {
+		wl->hw->flags |= IEEE80211_HW_RC_AGGREGATED_STATS;
+		wl->hw->rate_control_algorithm = "airtime";
+	}
+
 	wl->hw->wiphy->reg_notifier = wl1271_reg_notify;
 
 	/* the FW answers probe-requests in AP-mode */
@@ -835,6 +835,114 @@ static u8 wl1271_tx_get_rate_flags(u8 rate_class_index)
 	return flags;
 }
 
+void wlcore_tx_reset_rc_stats(struct wl12xx_vif *wlvif)
+{
+	memset(wlvif->sta.rc_attempts, 0, sizeof(wlvif->sta.rc_attempts));
+	memset(wlvif->sta.rc_success, 0, sizeof(wlvif->sta.rc_success));
+	wlvif->sta.rc_stats_start = jiffies;
+}
+
+/*
+ * The FW does its own rate control and only tells us the final rate and
+ * retry count of each frame. Aggregate these per FW rate and periodically
+ * hand them to the mac80211 rate control, which may answer with a new rate
+ * policy (see wlcore_op_set_rate_policy).  Only chips with
+ * WLCORE_QUIRK_TX_RATE_STATUS get here, the others have no rate control
+ * registered.
+ */
+static void wlcore_tx_rc_stats(struct wl1271 *wl, struct wl12xx_vif *wlvif,
+			       struct sk_buff *skb,
+			       struct wl1271_tx_hw_res_descr *result)
+{
+	struct ieee80211_vif *vif = wl12xx_wlvif_to_vif(wlvif);
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)skb->data;
+	struct ieee80211_rate_stats stats;
+	struct ieee80211_sta *sta;
+	u8 rate = result->rate_class_index;
+	s8 idx;
+	u8 flags;
+	int i, j, n_rates;
+
+	if (wlvif->bss_type != BSS_TYPE_STA_BSS ||
+	    !test_bit(WLVIF_FLAG_STA_ASSOCIATED, &wlvif->flags))
+		return;
+
+	/* only unicast data is sent with the AP rate policy */
+	if (!ieee80211_is_data(hdr->frame_control) ||
+	    is_multicast_ether_addr(ieee80211_get_DA(hdr)))
+		return;
+
+	if (result->status == TX_SUCCESS) {
+		if (rate >= min_t(int, wl->hw_tx_rate_tbl_size,
+				  WLCORE_RC_STATS_RATES))
+			return;
+
+		wlvif->sta.rc_attempts[rate] += 1 + result->ack_failures;
+		wlvif->sta.rc_success[rate]++;
+		wlvif->sta.rc_last_rate = rate;
+	} else if (result->status == TX_RETRY_EXCEEDED) {
+		/*
+		 * The FW doesn't tell the rate, charge the last one used.
+		 * Before the first ack there's none, don't guess.
+		 */
+		if (wlvif->sta.rc_last_rate == WLCORE_RC_RATE_UNKNOWN)
+			return;
+
+		wlvif->sta.rc_attempts[wlvif->sta.rc_last_rate] +=
+			result->ack_failures;
+	} else {
+		return;
+	}
+
+	if (time_before(jiffies, wlvif->sta.rc_stats_start +
+			msecs_to_jiffies(WLCORE_RC_STATS_INTERVAL)))
+		return;
+
+	stats.interval = jiffies_to_msecs(jiffies - wlvif->sta.rc_stats_start);
+	n_rates = 0;
+	for (i = 0; i < WLCORE_RC_STATS_RATES; i++) {
+		if (!wlvif->sta.rc_attempts[i])
+			continue;
+
+		idx = wlcore_rate_to_idx(wl, i, wlvif->band);
+		/* FW rate tables list the MCS rates first */
+		flags = i <= wl->hw_min_ht_rate ? IEEE80211_TX_RC_MCS : 0;
+
+		/* several FW rates (e.g. MCS7 with and without SGI) share one */
+		for (j = 0; j < n_rates; j++)
+			if (stats.rates[j].rate.idx == idx &&
+			    stats.rates[j].rate.flags == flags)
+				break;
+
+		if (j == n_rates) {
+			if (n_rates == IEEE80211_RATE_STATS_MAX)
+				break;
+
+			stats.rates[j].rate.idx = idx;
+			stats.rates[j].rate.flags = flags;
+			stats.rates[j].rate.count = 0;
+			stats.rates[j].attempts = 0;
+			stats.rates[j].success = 0;
+			n_rates++;
+		}
+
+		stats.rates[j].attempts += wlvif->sta.rc_attempts[i];
+		stats.rates[j].success += wlvif->sta.rc_success[i];
+	}
+	stats.n_rates = n_rates;
+
+	wlcore_tx_reset_rc_stats(wlvif);
+
+	if (!n_rates)
+		return;
+
+	rcu_read_lock();
+	sta = ieee80211_find_sta(vif, vif->bss_conf.bssid);
+	if (sta)
+		ieee80211_report_rate_stats(wl->hw, sta, &stats);
+	rcu_read_unlock();
+}
+
 static void wl1271_tx_complete_packet(struct wl1271 *wl,
 				      struct wl1271_tx_hw_res_descr *result)
 {
@@ -907,6 +1015,8 @@ static void wl1271_tx_complete_packet(struct wl1271 *wl,
 	/* remove private header from packet */
 	skb_pull(skb, sizeof(struct wl1271_tx_hw_descr));
 
+	wlcore_tx_rc_stats(wl, wlvif, skb, result);
+
 	/* remove TKIP header space if present */
 	if ((wl->quirks & WLCORE_QUIRK_TKIP_HEADER_SPACE) &&
 	    info->control.hw_key &&
@@ -1158,6 +1268,7 @@ void wlcore_stop_queue_locked(struct wl1271 *wl, u8 queue,
 	if (stopped)
 		return;
 
+	wl->queue_stop_events[queue]++;
 	ieee80211_stop_queue(wl->hw, wl1271_tx_get_mac80211_queue(queue));
 }
 
@@ -234,6 +234,9 @@ struct wl1271 {
 	int tx_queue_count[NUM_TX_QUEUES];
 	unsigned long queue_stop_reasons[NUM_TX_QUEUES];
 
+	/* times each queue was stopped towards mac80211 (flow control) */
+	u32 queue_stop_events[NUM_TX_QUEUES];
+
 	/* Frames received, not handled yet by mac80211 */
 	struct sk_buff_head deferred_rx_queue;
 
@@ -491,6 +494,9 @@ wlcore_set_min_fw_ver(struct wl1271 *wl, unsigned int chip,
 /* separate probe response templates for one-shot and sched scans */
 #define WLCORE_QUIRK_DUAL_PROBE_TMPL		BIT(10)
 
+/* TX results carry the final rate and retry count of every frame */
+#define WLCORE_QUIRK_TX_RATE_STATUS		BIT(11)
+
 /* TODO: move to the lower drivers when all usages are abstracted */
 #define CHIP_ID_1271_PG10              (0x4030101)
 #define CHIP_ID_1271_PG20              (0x4030111)
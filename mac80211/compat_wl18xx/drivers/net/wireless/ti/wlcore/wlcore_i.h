@@ -69,6 +69,13 @@
 #define WLCORE_NUM_BANDS           2
 
 #define WL12XX_MAX_RATE_POLICIES 16
+
+/* FW rate indexes tracked for the mac80211 rate control statistics */
+#define WLCORE_RC_STATS_RATES      32
+/* interval between tx statistics reports to mac80211 (ms) */
+#define WLCORE_RC_STATS_INTERVAL   100
+/* no frame acked yet, nothing to charge failed frames to */
+#define WLCORE_RC_RATE_UNKNOWN     0xff
 #define WLCORE_MAX_KLV_TEMPLATES 4
 
 /* Defined by FW as 0. Will not be freed or allocated. */
@@ -347,6 +354,15 @@ struct wl12xx_vif {
 			bool qos;
 			/* channel type we started the STA role with */
 			enum nl80211_channel_type role_chan_type;
+
+			/* rates chosen by the mac80211 rate control (0: all) */
+			u32 rc_rate_mask;
+
+			/* tx results per FW rate, reported to the rate control */
+			unsigned long rc_stats_start;
+			u8 rc_last_rate;
+			u16 rc_attempts[WLCORE_RC_STATS_RATES];
+			u16 rc_success[WLCORE_RC_STATS_RATES];
 		} sta;
 		struct {
 			u8 global_hlid;
@@ -396,6 +412,10 @@ struct wl12xx_vif {
 	/* Beaconing interval (needed for ad-hoc) */
 	u32 beacon_int;
 
+	/* crc of the last AP beacon template uploaded, TIM excluded */
+	u32 beacon_crc;
+	bool beacon_crc_valid;
+
 	/* Default key (for WEP) */
 	u32 default_key;
 
@@ -429,6 +449,9 @@ struct wl12xx_vif {
 	struct work_struct rx_streaming_disable_work;
 	struct timer_list rx_streaming_timer;
 
+	/* reprogram the FW rate policies after a rate control decision */
+	struct work_struct rc_policy_work;
+
 	bool pending_roc;
 
 	/*
@@ -1313,6 +1313,19 @@ enum nl80211_commands {
  * @NL80211_ATTR_ROAMING_DISABLED: indicates that the driver can't do roaming
  *      currently.
  *
+ * @NL80211_ATTR_SCAN_DUMP_GENERATION: u32 scan generation, when given to
+ *	%NL80211_CMD_GET_SCAN only the BSSes that changed after that
+ *	generation (as reported in %NL80211_ATTR_GENERATION of an earlier
+ *	dump) are returned. If any BSS was removed since, the full list is
+ *	dumped instead; every message then carries this attribute with the
+ *	generation actually applied, 0 meaning a full dump.
+ * @NL80211_ATTR_SCAN_DUMP_BANDS: u32 bitmap of &enum nl80211_band, only
+ *	dump the BSSes found on these bands.
+ * @NL80211_ATTR_SCAN_DUMP_MIN_RSSI: only dump the BSSes received stronger
+ *	than this (negative) value in dBm, u32. Ignored by wiphys that don't
+ *	report the signal in mBm. %NL80211_ATTR_SSID may be given along with
+ *	%NL80211_CMD_GET_SCAN to only dump the BSSes with that SSID.
+ *
  * @NL80211_ATTR_MAX: highest attribute number currently defined
  * @__NL80211_ATTR_AFTER_LAST: internal use
  */
@@ -1581,6 +1594,10 @@ enum nl80211_attrs {
 
 	NL80211_ATTR_ROAMING_DISABLED,
 
+	NL80211_ATTR_SCAN_DUMP_GENERATION,
+	NL80211_ATTR_SCAN_DUMP_BANDS,
+	NL80211_ATTR_SCAN_DUMP_MIN_RSSI,
+
 	/* add attributes here, update the policy in nl80211.c */
 
 	__NL80211_ATTR_AFTER_LAST,
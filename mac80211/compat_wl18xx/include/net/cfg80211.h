@@ -2686,6 +2686,10 @@ int ieee80211_data_from_8023(struct sk_buff *skb, const u8 *addr,
  * 802.3 frames. The @list will be empty if the decode fails. The
  * @skb is consumed after the function returns.
  *
+ * If the head of @skb is a page fragment the subframes reference its
+ * pages instead of copying the payload, except for subframes that are
+ * too small to make sharing worthwhile. Linear buffers are copied.
+ *
  * @skb: The input IEEE 802.11n A-MSDU frame.
  * @list: The output list of 802.3 frames. It must be allocated and
  *	initialized by by the caller.
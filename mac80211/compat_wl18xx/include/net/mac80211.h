@@ -489,6 +489,9 @@ enum mac80211_rate_control_flags {
 /* maximum number of rate stages */
 #define IEEE80211_TX_MAX_RATES	4
 
+/* maximum number of rates in a &struct ieee80211_rate_stats report */
+#define IEEE80211_RATE_STATS_MAX	16
+
 /**
  * struct ieee80211_tx_rate - rate selection/status
  *
@@ -523,6 +526,40 @@ struct ieee80211_tx_rate {
 	u8 flags;
 } __packed;
 
+/**
+ * struct ieee80211_rate_stats - aggregated per-rate transmit statistics
+ *
+ * Reported by drivers whose hardware does not provide per-frame status
+ * for rate control, see ieee80211_report_rate_stats().
+ *
+ * @interval: time in milliseconds covered by this report
+ * @n_rates: number of valid entries in @rates
+ * @rates: per-rate counters; @rate uses the same encoding as the
+ *	&struct ieee80211_tx_info status rates, its @count is unused
+ * @rates.attempts: number of transmission attempts at this rate
+ * @rates.success: number of those attempts that were acknowledged
+ */
+struct ieee80211_rate_stats {
+	u32 interval;
+	int n_rates;
+	struct {
+		struct ieee80211_tx_rate rate;
+		u32 attempts;
+		u32 success;
+	} rates[IEEE80211_RATE_STATS_MAX];
+};
+
+/**
+ * struct ieee80211_rate_policy - rate policy for hardware rate selection
+ *
+ * @rates: retry chain in the order the rates should be tried, using the
+ *	same encoding as the &struct ieee80211_tx_info control rates; the
+ *	chain ends at the first entry with a negative @idx
+ */
+struct ieee80211_rate_policy {
+	struct ieee80211_tx_rate rates[IEEE80211_TX_MAX_RATES];
+};
+
 /**
  * struct ieee80211_tx_info - skb transmit information
  *
@@ -1215,6 +1252,22 @@ enum sta_notify_cmd {
  *	queue mapping in order to use different queues (not just one per AC)
  *	for different virtual interfaces. See the doc section on HW queue
  *	control for more details.
+ *
+ * @IEEE80211_HW_RC_AGGREGATED_STATS: The device selects rates per frame
+ *	in hardware (%IEEE80211_HW_HAS_RATE_CONTROL) but accepts rate
+ *	policies from the host. A rate control algorithm is instantiated
+ *	for stations; it is fed with per-rate statistics aggregated by the
+ *	driver through ieee80211_report_rate_stats() and hands its decisions
+ *	back through the @set_rate_policy callback. Algorithms that do not
+ *	implement the @stats_report callback are not used for such devices,
+ *	and algorithms that do are only used for such devices.
+ *
+ * @IEEE80211_HW_TX_AMPDU_AUTO: Let mac80211 start and stop TX aggregation
+ *	sessions by itself, based on the frame rate seen on each TID, instead
+ *	of relying on the rate control algorithm to request them. See the
+ *	"TX A-MPDU aggregation" documentation section. Has no effect with
+ *	%IEEE80211_HW_TX_AMPDU_SETUP_IN_HW, where the device sets up the
+ *	sessions.
  */
 enum ieee80211_hw_flags {
 	IEEE80211_HW_HAS_RATE_CONTROL			= 1<<0,
@@ -1242,6 +1295,8 @@ enum ieee80211_hw_flags {
 	IEEE80211_HW_AP_LINK_PS				= 1<<22,
 	IEEE80211_HW_TX_AMPDU_SETUP_IN_HW		= 1<<23,
 	IEEE80211_HW_SCAN_WHILE_IDLE			= 1<<24,
+	IEEE80211_HW_RC_AGGREGATED_STATS		= 1<<25,
+	IEEE80211_HW_TX_AMPDU_AUTO			= 1<<26,
 };
 
 /**
@@ -1308,6 +1363,10 @@ enum ieee80211_hw_flags {
  *	aggregate an HT driver will transmit, used by the peer as a
  *	hint to size its reorder buffer.
  *
+ * @max_tx_ba_sessions: maximum number of TX aggregation sessions the device
+ *	can hold at the same time, across all stations; further requests are
+ *	refused with -ENOSPC. 0 means no limit.
+ *
  * @offchannel_tx_hw_queue: HW queue ID to use for offchannel TX
  *	(if %IEEE80211_HW_QUEUE_CONTROL is set)
  *
@@ -1339,6 +1398,7 @@ struct ieee80211_hw {
 	u8 max_rate_tries;
 	u8 max_rx_aggregation_subframes;
 	u8 max_tx_aggregation_subframes;
+	u8 max_tx_ba_sessions;
 	u8 offchannel_tx_hw_queue;
 	u8 radiotap_mcs_details;
 	netdev_features_t netdev_features;
@@ -2006,6 +2066,11 @@ enum ieee80211_rate_control_changed {
  *
  * @set_tim: Set TIM bit. mac80211 calls this function when a TIM bit
  * 	must be set or cleared for a given STA. Must be atomic.
+ *	It is only called when the bit actually changes, and nothing but
+ *	the TIM element of the beacon changes along with it, so drivers
+ *	that keep the beacon in hardware can update just the TIM (the
+ *	offset and length are returned by ieee80211_beacon_get_tim())
+ *	rather than uploading a whole new template.
  *
  * @set_key: See the section "Hardware crypto acceleration"
  *	This callback is only called between add_interface and
@@ -2106,6 +2171,11 @@ enum ieee80211_rate_control_changed {
  *	otherwise the rate control algorithm is notified directly.
  *	Must be atomic.
  *
+ * @set_rate_policy: Program the rate policy selected by the rate control
+ *	algorithm for the station, see %IEEE80211_HW_RC_AGGREGATED_STATS.
+ *	The policy remains valid until the next call for the same station.
+ *	Must be atomic.
+ *
  * @conf_tx: Configure TX queue parameters (EDCF (aifs, cw_min, cw_max),
  *	bursting) for a hardware TX queue.
  *	Returns a negative error code on failure.
@@ -2351,6 +2421,10 @@ struct ieee80211_ops {
 			      struct ieee80211_vif *vif,
 			      struct ieee80211_sta *sta,
 			      u32 changed);
+	void (*set_rate_policy)(struct ieee80211_hw *hw,
+				struct ieee80211_vif *vif,
+				struct ieee80211_sta *sta,
+				const struct ieee80211_rate_policy *policy);
 	int (*conf_tx)(struct ieee80211_hw *hw,
 		       struct ieee80211_vif *vif, u16 ac,
 		       const struct ieee80211_tx_queue_params *params);
@@ -3739,6 +3813,9 @@ struct rate_control_ops {
 			  struct sk_buff *skb);
 	void (*get_rate)(void *priv, struct ieee80211_sta *sta, void *priv_sta,
 			 struct ieee80211_tx_rate_control *txrc);
+	void (*stats_report)(void *priv, struct ieee80211_supported_band *sband,
+			     struct ieee80211_sta *sta, void *priv_sta,
+			     const struct ieee80211_rate_stats *stats);
 
 	void (*add_sta_debugfs)(void *priv, void *priv_sta,
 				struct dentry *dir);
@@ -3774,6 +3851,36 @@ bool rate_control_send_low(struct ieee80211_sta *sta,
 			   void *priv_sta,
 			   struct ieee80211_tx_rate_control *txrc);
 
+/**
+ * rate_control_set_rate_policy - hand a rate policy to the driver
+ *
+ * Used by rate control algorithms implementing the @stats_report callback
+ * to program the rates the hardware should use for a station.
+ *
+ * @sta: the station the policy applies to
+ * @policy: the new rate policy
+ */
+void rate_control_set_rate_policy(struct ieee80211_sta *sta,
+				  const struct ieee80211_rate_policy *policy);
+
+/**
+ * ieee80211_report_rate_stats - report aggregated transmit statistics
+ *
+ * Drivers setting %IEEE80211_HW_RC_AGGREGATED_STATS call this periodically
+ * with the per-rate statistics collected for a station since the previous
+ * report. The rate control algorithm may respond by calling the driver's
+ * @set_rate_policy callback before this function returns.
+ *
+ * Must be called under RCU read lock; may be called in atomic context.
+ *
+ * @hw: the hardware the statistics were collected on
+ * @sta: the station the statistics apply to
+ * @stats: the statistics
+ */
+void ieee80211_report_rate_stats(struct ieee80211_hw *hw,
+				 struct ieee80211_sta *sta,
+				 const struct ieee80211_rate_stats *stats);
+
 
 static inline s8
 rate_lowest_index(struct ieee80211_supported_band *sband,
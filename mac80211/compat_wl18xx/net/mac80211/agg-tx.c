@@ -57,6 +57,15 @@
  * and the driver must later call ieee80211_stop_tx_ba_cb_irqsafe().
  * Note that the sta can get destroyed before the BA tear down is
  * complete.
+ *
+ * Drivers setting %IEEE80211_HW_TX_AMPDU_AUTO leave the decision when
+ * to aggregate to mac80211: the frame rate of each TID is measured in
+ * the TX path, a session is started once it exceeds %HT_AGG_START_PPS
+ * and stopped again after it stayed below %HT_AGG_STOP_PPS for a while.
+ * A TID whose session was stopped this way isn't restarted for
+ * %HT_AGG_HOLDDOWN, so traffic hovering around the thresholds doesn't
+ * cause constant session churn. Devices that can only keep a limited
+ * number of sessions set @max_tx_ba_sessions in &struct ieee80211_hw.
  */
 
 static void ieee80211_send_addba_request(struct ieee80211_sub_if_data *sdata,
@@ -177,7 +186,7 @@ int ___ieee80211_stop_tx_ba_session(struct sta_info *sta, u16 tid,
 		/* not even started yet! */
 		ieee80211_assign_tid_tx(sta, tid, NULL);
 		spin_unlock_bh(&sta->lock);
-		kfree_rcu(tid_tx, rcu_head);
+		ieee80211_free_tid_tx(local, tid_tx, true);
 		return 0;
 	}
 
@@ -376,7 +385,7 @@ void ieee80211_tx_ba_session_handle_start(struct sta_info *sta, int tid)
 		ieee80211_agg_splice_finish(sdata, tid);
 		spin_unlock_bh(&sta->lock);
 
-		kfree_rcu(tid_tx, rcu_head);
+		ieee80211_free_tid_tx(local, tid_tx, true);
 		return;
 	}
 
@@ -434,6 +443,33 @@ static void sta_tx_agg_session_timer_expired(unsigned long data)
 	ieee80211_stop_tx_ba_session(&sta->sta, *ptid);
 }
 
+/*
+ * Take one of the device's TX aggregation sessions, a running count is
+ * kept from allocating a tid_tx until ieee80211_free_tid_tx().
+ */
+static bool ieee80211_tx_ba_session_get(struct ieee80211_local *local)
+{
+	int sessions = atomic_inc_return(&local->tx_ba_sessions);
+
+	if (!local->hw.max_tx_ba_sessions ||
+	    sessions <= local->hw.max_tx_ba_sessions)
+		return true;
+
+	atomic_dec(&local->tx_ba_sessions);
+	return false;
+}
+
+/* @rcu if the tid_tx may still be seen by RCU readers */
+void ieee80211_free_tid_tx(struct ieee80211_local *local,
+			   struct tid_ampdu_tx *tid_tx, bool rcu)
+{
+	atomic_dec(&local->tx_ba_sessions);
+	if (rcu)
+		kfree_rcu(tid_tx, rcu_head);
+	else
+		kfree(tid_tx);
+}
+
 int ieee80211_start_tx_ba_session(struct ieee80211_sta *pubsta, u16 tid,
 				  u16 timeout)
 {
@@ -522,9 +558,18 @@ int ieee80211_start_tx_ba_session(struct ieee80211_sta *pubsta, u16 tid,
 		goto err_unlock_sta;
 	}
 
+	if (!ieee80211_tx_ba_session_get(local)) {
+		ht_dbg(sdata,
+		       "BA request denied - device session limit (%d) reached\n",
+		       local->hw.max_tx_ba_sessions);
+		ret = -ENOSPC;
+		goto err_unlock_sta;
+	}
+
 	/* prepare A-MPDU MLME for Tx aggregation */
 	tid_tx = kzalloc(sizeof(struct tid_ampdu_tx), GFP_ATOMIC);
 	if (!tid_tx) {
+		atomic_dec(&local->tx_ba_sessions);
 		ret = -ENOMEM;
 		goto err_unlock_sta;
 	}
@@ -563,6 +608,68 @@ int ieee80211_start_tx_ba_session(struct ieee80211_sta *pubsta, u16 tid,
 }
 EXPORT_SYMBOL(ieee80211_start_tx_ba_session);
 
+/*
+ * Called for every QoS data frame to a station on devices that set
+ * IEEE80211_HW_TX_AMPDU_AUTO, under RCU and in TX (softirq) context.
+ */
+void ieee80211_agg_tx_track(struct sta_info *sta, u16 tid,
+			    struct tid_ampdu_tx *tid_tx)
+{
+	struct tid_tx_stats *ts = &sta->ampdu_mlme.tx_stats[tid];
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - ts->window_start;
+	unsigned int pps;
+	int ret;
+
+	ts->window_pkts++;
+	if (elapsed < HT_AGG_RATE_WINDOW)
+		return;
+
+	/* average over the windows, unless traffic was idle in between */
+	pps = ts->window_pkts * HZ / elapsed;
+	if (elapsed < 2 * HT_AGG_RATE_WINDOW)
+		ts->pps = (ts->pps + pps) / 2;
+	else
+		ts->pps = pps;
+	ts->window_start = now;
+	ts->window_pkts = 0;
+
+	if (!tid_tx) {
+		if (ts->pps < HT_AGG_START_PPS ||
+		    ieee80211_ac_from_tid(tid) == IEEE80211_AC_VO ||
+		    (ts->last_stop &&
+		     time_before(now, ts->last_stop + HT_AGG_HOLDDOWN)))
+			return;
+
+		ret = ieee80211_start_tx_ba_session(&sta->sta, tid,
+						    HT_AGG_SESSION_TIMEOUT);
+		if (!ret)
+			ts->starts++;
+		else if (ret == -ENOSPC)
+			ts->refused++;
+		ts->low_windows = 0;
+		return;
+	}
+
+	if (ts->pps >= HT_AGG_STOP_PPS) {
+		ts->low_windows = 0;
+		return;
+	}
+
+	if (++ts->low_windows < HT_AGG_STOP_WINDOWS ||
+	    !test_bit(HT_AGG_STATE_OPERATIONAL, &tid_tx->state))
+		return;
+
+	ht_dbg(sta->sdata, "tid %u below %d pps, stopping Tx BA session\n",
+	       tid, HT_AGG_STOP_PPS);
+
+	if (!ieee80211_stop_tx_ba_session(&sta->sta, tid)) {
+		ts->stops++;
+		ts->last_stop = now;
+	}
+	ts->low_windows = 0;
+}
+
 static void ieee80211_agg_tx_operational(struct ieee80211_local *local,
 					 struct sta_info *sta, u16 tid)
 {
@@ -768,7 +875,7 @@ void ieee80211_stop_tx_ba_cb(struct ieee80211_vif *vif, u8 *ra, u8 tid)
 
 	ieee80211_agg_splice_finish(sta->sdata, tid);
 
-	kfree_rcu(tid_tx, rcu_head);
+	ieee80211_free_tid_tx(local, tid_tx, true);
 
  unlock_sta:
 	spin_unlock_bh(&sta->lock);
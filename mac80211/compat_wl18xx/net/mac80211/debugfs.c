@@ -10,6 +10,8 @@
 
 #include <linux/debugfs.h>
 #include <linux/rtnetlink.h>
+#include <linux/ktime.h>
+#include <asm/unaligned.h>
 #include "ieee80211_i.h"
 #include "driver-ops.h"
 #include "rate.h"
@@ -67,6 +69,8 @@ DEBUGFS_READONLY_FILE(frequency, "%d",
 		      local->hw.conf.channel->center_freq);
 DEBUGFS_READONLY_FILE(total_ps_buffered, "%d",
 		      local->total_ps_buffered);
+DEBUGFS_READONLY_FILE(total_ps_buf_bytes, "%d",
+		      atomic_read(&local->total_ps_buf_bytes));
 DEBUGFS_READONLY_FILE(wep_iv, "%#08x",
 		      local->wep_iv & 0xffffff);
 DEBUGFS_READONLY_FILE(rate_ctrl_alg, "%s",
@@ -91,6 +95,146 @@ static const struct file_operations reset_ops = {
 	.llseek = noop_llseek,
 };
 
+/*
+ * Beacon parsing benchmark: write the elements of captured beacons, as
+ * hex with one beacon per line, and read back the time a full parse and
+ * the CRC-only pass of the beacon path take per beacon.
+ */
+#define BEACON_BENCH_MAX_INPUT	(4 * PAGE_SIZE)
+#define BEACON_BENCH_ITERATIONS	1000
+
+static int beacon_bench_decode(char *text, u8 *out, size_t *out_len)
+{
+	char *line;
+	u8 *rec, *pos = out;
+	int hi, lo, beacons = 0;
+
+	while ((line = strsep(&text, "\n"))) {
+		rec = pos;
+		pos += 2;
+		while (*line) {
+			hi = hex_to_bin(*line++);
+			if (hi < 0)
+				continue;
+			lo = *line ? hex_to_bin(*line++) : -1;
+			if (lo < 0)
+				return -EINVAL;
+			*pos++ = (hi << 4) | lo;
+		}
+		if (pos - rec == 2) {
+			pos = rec;
+			continue;
+		}
+		put_unaligned_le16(pos - rec - 2, rec);
+		beacons++;
+	}
+
+	*out_len = pos - out;
+	return beacons;
+}
+
+static ssize_t beacon_bench_write(struct file *file,
+				  const char __user *user_buf,
+				  size_t count, loff_t *ppos)
+{
+	struct ieee80211_local *local = file->private_data;
+	struct ieee802_11_elems elems;
+	struct ieee80211_tim_ie *tim;
+	char *text;
+	u8 *ies, *pos, tim_len;
+	size_t ies_len;
+	u16 len;
+	ktime_t start;
+	int i, beacons;
+
+	if (count > BEACON_BENCH_MAX_INPUT)
+		return -E2BIG;
+
+	text = kmalloc(count + 1, GFP_KERNEL);
+	/* every beacon needs two bytes more than its text had characters */
+	ies = kmalloc(2 * count + 2, GFP_KERNEL);
+	if (!text || !ies) {
+		beacons = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(text, user_buf, count)) {
+		beacons = -EFAULT;
+		goto out;
+	}
+	text[count] = '\0';
+
+	beacons = beacon_bench_decode(text, ies, &ies_len);
+	if (beacons <= 0) {
+		if (!beacons)
+			beacons = -EINVAL;
+		goto out;
+	}
+
+	start = ktime_get();
+	for (i = 0; i < BEACON_BENCH_ITERATIONS; i++) {
+		for (pos = ies; pos < ies + ies_len; pos += 2 + len) {
+			len = get_unaligned_le16(pos);
+			ieee802_11_parse_elems_crc(pos + 2, len, &elems,
+						   IEEE80211_BEACON_CRC_IES, 0);
+		}
+		cond_resched();
+	}
+	local->beacon_bench.parse_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							     start));
+
+	start = ktime_get();
+	for (i = 0; i < BEACON_BENCH_ITERATIONS; i++) {
+		for (pos = ies; pos < ies + ies_len; pos += 2 + len) {
+			len = get_unaligned_le16(pos);
+			ieee802_11_elems_crc(pos + 2, len,
+					     IEEE80211_BEACON_CRC_IES, 0,
+					     &tim, &tim_len);
+		}
+		cond_resched();
+	}
+	local->beacon_bench.crc_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							   start));
+
+	local->beacon_bench.beacons = beacons;
+	local->beacon_bench.iterations = BEACON_BENCH_ITERATIONS;
+ out:
+	kfree(text);
+	kfree(ies);
+	return beacons < 0 ? beacons : count;
+}
+
+static ssize_t beacon_bench_read(struct file *file, char __user *user_buf,
+				 size_t count, loff_t *ppos)
+{
+	struct ieee80211_local *local = file->private_data;
+	unsigned int n = local->beacon_bench.beacons *
+			 local->beacon_bench.iterations;
+	char buf[128];
+	int len;
+
+	if (!n)
+		return simple_read_from_buffer(user_buf, count, ppos, "", 0);
+
+	len = scnprintf(buf, sizeof(buf),
+			"beacons: %u x %u\n"
+			"full parse: %llu ns/beacon\n"
+			"crc only: %llu ns/beacon\n",
+			local->beacon_bench.beacons,
+			local->beacon_bench.iterations,
+			div_u64(local->beacon_bench.parse_ns, n),
+			div_u64(local->beacon_bench.crc_ns, n));
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static const struct file_operations beacon_bench_ops = {
+	.read = beacon_bench_read,
+	.write = beacon_bench_write,
+	.open = simple_open,
+	.llseek = default_llseek,
+};
+
 static ssize_t channel_type_read(struct file *file, char __user *user_buf,
 		       size_t count, loff_t *ppos)
 {
@@ -122,7 +266,7 @@ static ssize_t hwflags_read(struct file *file, char __user *user_buf,
 			    size_t count, loff_t *ppos)
 {
 	struct ieee80211_local *local = file->private_data;
-	int mxln = 500;
+	int mxln = 600;
 	ssize_t rv;
 	char *buf = kzalloc(mxln, GFP_KERNEL);
 	int sf = 0; /* how many written so far */
@@ -180,6 +324,10 @@ static ssize_t hwflags_read(struct file *file, char __user *user_buf,
 		sf += snprintf(buf + sf, mxln - sf, "TX_AMPDU_SETUP_IN_HW\n");
 	if (local->hw.flags & IEEE80211_HW_SCAN_WHILE_IDLE)
 		sf += snprintf(buf + sf, mxln - sf, "SCAN_WHILE_IDLE\n");
+	if (local->hw.flags & IEEE80211_HW_RC_AGGREGATED_STATS)
+		sf += snprintf(buf + sf, mxln - sf, "RC_AGGREGATED_STATS\n");
+	if (local->hw.flags & IEEE80211_HW_TX_AMPDU_AUTO)
+		sf += snprintf(buf + sf, mxln - sf, "TX_AMPDU_AUTO\n");
 
 	rv = simple_read_from_buffer(user_buf, count, ppos, buf, strlen(buf));
 	kfree(buf);
@@ -204,9 +352,63 @@ static ssize_t queues_read(struct file *file, char __user *user_buf,
 	return simple_read_from_buffer(user_buf, count, ppos, buf, res);
 }
 
+static ssize_t scan_stats_read(struct file *file, char __user *user_buf,
+			       size_t count, loff_t *ppos)
+{
+	struct ieee80211_local *local = file->private_data;
+	struct ieee80211_scan_stats last, total;
+	char buf[400];
+	int res;
+
+	mutex_lock(&local->mtx);
+	last = local->scan_stats;
+	total = local->scan_stats_total;
+	mutex_unlock(&local->mtx);
+
+	res = scnprintf(buf, sizeof(buf),
+			"                  last      total\n"
+			"scans:      %10u %10u\n"
+			"channels:   %10u %10u\n"
+			"bursts:     %10u %10u\n"
+			"stalls:     %10u %10u\n"
+			"extended:   %10u %10u\n"
+			"max queued: %10u %10u\n"
+			"off-channel ms: %6u %10u\n"
+			"max burst ms:   %6u %10u\n",
+			last.scans, total.scans,
+			last.channels, total.channels,
+			last.bursts, total.bursts,
+			last.stalls, total.stalls,
+			last.extended, total.extended,
+			last.max_queued, total.max_queued,
+			jiffies_to_msecs(last.off_channel),
+			jiffies_to_msecs(total.off_channel),
+			jiffies_to_msecs(last.max_burst),
+			jiffies_to_msecs(total.max_burst));
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, res);
+}
+
+static ssize_t queue_events_read(struct file *file, char __user *user_buf,
+				 size_t count, loff_t *ppos)
+{
+	struct ieee80211_local *local = file->private_data;
+	char buf[IEEE80211_MAX_QUEUES * 32];
+	int q, res = 0;
+
+	for (q = 0; q < local->hw.queues; q++)
+		res += sprintf(buf + res, "%02d: stop %u wake %u\n", q,
+				local->queue_stop_events[q],
+				local->queue_wake_events[q]);
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, res);
+}
+
 DEBUGFS_READONLY_FILE_OPS(hwflags);
 DEBUGFS_READONLY_FILE_OPS(channel_type);
 DEBUGFS_READONLY_FILE_OPS(queues);
+DEBUGFS_READONLY_FILE_OPS(queue_events);
+DEBUGFS_READONLY_FILE_OPS(scan_stats);
 
 /* statistics stuff */
 
@@ -274,13 +476,17 @@ void debugfs_hw_add(struct ieee80211_local *local)
 
 	DEBUGFS_ADD(frequency);
 	DEBUGFS_ADD(total_ps_buffered);
+	DEBUGFS_ADD(total_ps_buf_bytes);
 	DEBUGFS_ADD(wep_iv);
 	DEBUGFS_ADD(queues);
+	DEBUGFS_ADD(queue_events);
+	DEBUGFS_ADD(scan_stats);
 	DEBUGFS_ADD_MODE(reset, 0200);
 	DEBUGFS_ADD(channel_type);
 	DEBUGFS_ADD(hwflags);
 	DEBUGFS_ADD(user_power);
 	DEBUGFS_ADD(power);
+	DEBUGFS_ADD_MODE(beacon_bench, 0600);
 
 	statsd = debugfs_create_dir("statistics", phyd);
 
@@ -335,6 +541,14 @@ void debugfs_hw_add(struct ieee80211_local *local)
 		local->rx_expand_skb_head2);
 	DEBUGFS_STATS_ADD(rx_handlers_fragments,
 		local->rx_handlers_fragments);
+	DEBUGFS_STATS_ADD(rx_amsdu_subframes_shared,
+		local->rx_amsdu_subframes_shared);
+	DEBUGFS_STATS_ADD(rx_amsdu_subframes_copied,
+		local->rx_amsdu_subframes_copied);
+	DEBUGFS_STATS_ADD(rx_beacons_unchanged,
+		local->rx_beacons_unchanged);
+	DEBUGFS_STATS_ADD(tx_tim_unchanged,
+		local->tx_tim_unchanged);
 	DEBUGFS_STATS_ADD(tx_status_drop,
 		local->tx_status_drop);
 #endif
@@ -22,6 +22,7 @@
 #include "debugfs.h"
 #include "debugfs_netdev.h"
 #include "driver-ops.h"
+#include "mesh.h"
 
 static ssize_t ieee80211_if_read(
 	struct ieee80211_sub_if_data *sdata,
@@ -29,7 +30,7 @@ static ssize_t ieee80211_if_read(
 	size_t count, loff_t *ppos,
 	ssize_t (*format)(const struct ieee80211_sub_if_data *, char *, int))
 {
-	char buf[70];
+	char buf[200];
 	ssize_t ret = -EINVAL;
 
 	read_lock(&dev_base_lock);
@@ -475,6 +476,40 @@ IEEE80211_IF_FILE(dropped_frames_congestion,
 IEEE80211_IF_FILE(dropped_frames_no_route,
 		  u.mesh.mshstats.dropped_frames_no_route, DEC);
 IEEE80211_IF_FILE(estab_plinks, u.mesh.mshstats.estab_plinks, ATOMIC);
+IEEE80211_IF_FILE(preqs_sent, u.mesh.mshstats.preqs_sent, DEC);
+IEEE80211_IF_FILE(preqs_coalesced, u.mesh.mshstats.preqs_coalesced, DEC);
+IEEE80211_IF_FILE(preqs_ratelimited, u.mesh.mshstats.preqs_ratelimited, DEC);
+
+static ssize_t ieee80211_if_fmt_discovery_latency(
+	const struct ieee80211_sub_if_data *sdata, char *buf, int buflen)
+{
+	const u32 *hist = sdata->u.mesh.mshstats.discovery_latency;
+	char *p = buf;
+	int i;
+
+	for (i = 0; i < MESH_DISC_LATENCY_BUCKETS - 1; i++)
+		p += scnprintf(p, buflen + buf - p, "<%u %u\n",
+			       mesh_disc_latency_bounds[i], hist[i]);
+	p += scnprintf(p, buflen + buf - p, ">=%u %u\n",
+		       mesh_disc_latency_bounds[i - 1], hist[i]);
+	return p - buf;
+}
+__IEEE80211_IF_FILE(discovery_latency, NULL);
+
+/* the path tables are shared by all mesh interfaces */
+static ssize_t ieee80211_if_fmt_mpath_table(
+	const struct ieee80211_sub_if_data *sdata, char *buf, int buflen)
+{
+	return mesh_pathtbl_stats_fmt(false, buf, buflen);
+}
+__IEEE80211_IF_FILE(mpath_table, NULL);
+
+static ssize_t ieee80211_if_fmt_mpp_table(
+	const struct ieee80211_sub_if_data *sdata, char *buf, int buflen)
+{
+	return mesh_pathtbl_stats_fmt(true, buf, buflen);
+}
+__IEEE80211_IF_FILE(mpp_table, NULL);
 
 /* Mesh parameters */
 IEEE80211_IF_FILE(dot11MeshMaxRetries,
@@ -519,6 +554,26 @@ IEEE80211_IF_FILE(dot11MeshHWMProotInterval,
 		  u.mesh.mshcfg.dot11MeshHWMProotInterval, DEC);
 IEEE80211_IF_FILE(dot11MeshHWMPconfirmationInterval,
 		  u.mesh.mshcfg.dot11MeshHWMPconfirmationInterval, DEC);
+IEEE80211_IF_FMT_DEC(preq_burst, u.mesh.preq_burst);
+
+static ssize_t ieee80211_if_parse_preq_burst(
+	struct ieee80211_sub_if_data *sdata, const char *buf, int buflen)
+{
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret)
+		return -EINVAL;
+
+	if (val < 1 || val > MESH_PREQ_MAX_BURST)
+		return -ERANGE;
+
+	sdata->u.mesh.preq_burst = val;
+
+	return buflen;
+}
+__IEEE80211_IF_FILE_W(preq_burst);
 #endif
 
 #define DEBUGFS_ADD_MODE(name, mode) \
@@ -590,6 +645,12 @@ static void add_mesh_stats(struct ieee80211_sub_if_data *sdata)
 	MESHSTATS_ADD(dropped_frames_no_route);
 	MESHSTATS_ADD(dropped_frames_congestion);
 	MESHSTATS_ADD(estab_plinks);
+	MESHSTATS_ADD(preqs_sent);
+	MESHSTATS_ADD(preqs_coalesced);
+	MESHSTATS_ADD(preqs_ratelimited);
+	MESHSTATS_ADD(discovery_latency);
+	MESHSTATS_ADD(mpath_table);
+	MESHSTATS_ADD(mpp_table);
 #undef MESHSTATS_ADD
 }
 
@@ -625,6 +686,7 @@ static void add_mesh_config(struct ieee80211_sub_if_data *sdata)
 	MESHPARAMS_ADD(dot11MeshHWMPactivePathToRootTimeout);
 	MESHPARAMS_ADD(dot11MeshHWMProotInterval);
 	MESHPARAMS_ADD(dot11MeshHWMPconfirmationInterval);
+	MESHPARAMS_ADD(preq_burst);
 #undef MESHPARAMS_ADD
 }
 #endif
@@ -238,6 +238,31 @@ static ssize_t sta_agg_status_write(struct file *file, const char __user *userbu
 }
 STA_OPS_RW(agg_status);
 
+static ssize_t sta_agg_stats_read(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	char buf[64 + STA_TID_NUM * 64], *p = buf;
+	struct sta_info *sta = file->private_data;
+	struct tid_tx_stats *ts;
+	int i;
+
+	p += scnprintf(p, sizeof(buf) + buf - p,
+		       "TID\tpps\tstarts\tstops\trefused\tampdus\tavg len\n");
+
+	for (i = 0; i < STA_TID_NUM; i++) {
+		ts = &sta->ampdu_mlme.tx_stats[i];
+
+		p += scnprintf(p, sizeof(buf) + buf - p,
+			       "%02d\t%u\t%u\t%u\t%u\t%u\t%lu\n", i,
+			       ts->pps, ts->starts, ts->stops, ts->refused,
+			       ts->ampdus,
+			       ts->ampdus ? ts->mpdus / ts->ampdus : 0);
+	}
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, p - buf);
+}
+STA_OPS(agg_stats);
+
 static ssize_t sta_ht_capa_read(struct file *file, char __user *userbuf,
 				size_t count, loff_t *ppos)
 {
@@ -363,6 +388,7 @@ void ieee80211_sta_debugfs_add(struct sta_info *sta)
 	DEBUGFS_ADD(connected_time);
 	DEBUGFS_ADD(last_seq_ctrl);
 	DEBUGFS_ADD(agg_status);
+	DEBUGFS_ADD(agg_stats);
 	DEBUGFS_ADD(dev);
 	DEBUGFS_ADD(last_signal);
 	DEBUGFS_ADD(ht_capa);
@@ -376,6 +402,10 @@ void ieee80211_sta_debugfs_add(struct sta_info *sta)
 	DEBUGFS_ADD_COUNTER(rx_dropped, rx_dropped);
 	DEBUGFS_ADD_COUNTER(tx_fragments, tx_fragments);
 	DEBUGFS_ADD_COUNTER(tx_filtered, tx_filtered_count);
+	DEBUGFS_ADD_COUNTER(ps_buf_bytes, ps_buf_bytes);
+	DEBUGFS_ADD_COUNTER(ps_buf_dropped, ps_buf_dropped);
+	DEBUGFS_ADD_COUNTER(ps_buf_evicted, ps_buf_evicted);
+	DEBUGFS_ADD_COUNTER(ps_buf_expired, ps_buf_expired);
 	DEBUGFS_ADD_COUNTER(tx_retry_failed, tx_retry_failed);
 	DEBUGFS_ADD_COUNTER(tx_retry_count, tx_retry_count);
 	DEBUGFS_ADD_COUNTER(wep_weak_iv_count, wep_weak_iv_count);
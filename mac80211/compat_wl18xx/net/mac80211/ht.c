@@ -232,7 +232,8 @@ void ieee80211_ba_session_work(struct work_struct *work)
 			sta->ampdu_mlme.tid_start_tx[tid] = NULL;
 			/* could there be a race? */
 			if (sta->ampdu_mlme.tid_tx[tid])
-				kfree(tid_tx);
+				ieee80211_free_tid_tx(sta->local, tid_tx,
+						      false);
 			else
 				ieee80211_assign_tid_tx(sta, tid, tid_tx);
 			spin_unlock_bh(&sta->lock);
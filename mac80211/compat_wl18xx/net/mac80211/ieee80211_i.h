@@ -43,6 +43,11 @@ struct ieee80211_local;
  * frame can be up to about 2 kB long. */
 #define TOTAL_MAX_TX_BUFFER 512
 
+/* Memory (skb truesize) that unicast frames buffered for power saving STAs
+ * may take up in total. When exceeded, frames are evicted from the STAs that
+ * use more than their share. */
+#define TOTAL_MAX_PS_BUF_BYTES (1024 * 1024)
+
 /* Required encryption head and tailroom */
 #define IEEE80211_ENCRYPT_HEADROOM 8
 #define IEEE80211_ENCRYPT_TAILROOM 18
@@ -290,6 +295,16 @@ struct ieee80211_if_ap {
 	 * bitmap_empty :)
 	 * NB: don't touch this bitmap, use sta_info_{set,clear}_tim_bit */
 	u8 tim[sizeof(unsigned long) * BITS_TO_LONGS(IEEE80211_MAX_AID + 1)];
+	/*
+	 * Number of bits set in @tim and the first/last byte holding
+	 * them, kept up to date as bits change so the beacon doesn't
+	 * have to scan the bitmap; tim_rescan means a boundary byte
+	 * was emptied and the bounds need tightening (within the old
+	 * range) before use. All protected by local->tim_lock.
+	 */
+	int tim_count;
+	int tim_first, tim_last;
+	bool tim_rescan;
 	struct sk_buff_head ps_bc_buf;
 	atomic_t num_sta_ps; /* number of stations in PS mode */
 	atomic_t num_mcast_sta; /* number of stations receiving multicast */
@@ -309,6 +324,9 @@ struct ieee80211_if_vlan {
 	struct sta_info __rcu *sta;
 };
 
+/* Path discovery latency histogram, see mesh_disc_latency_bounds */
+#define MESH_DISC_LATENCY_BUCKETS	10
+
 struct mesh_stats {
 	__u32 fwded_mcast;		/* Mesh forwarded multicast frames */
 	__u32 fwded_unicast;		/* Mesh forwarded unicast frames */
@@ -317,6 +335,11 @@ struct mesh_stats {
 	__u32 dropped_frames_no_route;	/* Not transmitted, no route found */
 	__u32 dropped_frames_congestion;/* Not forwarded due to congestion */
 	atomic_t estab_plinks;
+	__u32 preqs_sent;		/* PREQ frames originated */
+	__u32 preqs_coalesced;		/* Targets sent in another's PREQ */
+	__u32 preqs_ratelimited;	/* Discoveries held back by rate limit */
+	/* Path discoveries completed, by latency */
+	__u32 discovery_latency[MESH_DISC_LATENCY_BUCKETS];
 };
 
 #define PREQ_Q_F_START		0x1
@@ -592,6 +615,12 @@ struct ieee80211_if_mesh {
 	unsigned long next_perr;
 	/* Timestamp of last PREQ sent */
 	unsigned long last_preq;
+	/* PREQ rate limit: when the token bucket will be full again */
+	unsigned long preq_tat;
+	/* PREQs that may be sent back to back, 1 keeps
+	 * dot11MeshHWMPpreqMinInterval between any two of them
+	 */
+	u8 preq_burst;
 	struct mesh_rmc *rmc;
 	spinlock_t mesh_preq_queue_lock;
 	struct mesh_preq_queue preq_queue;
@@ -832,6 +861,30 @@ enum mac80211_scan_state {
 	SCAN_RESUME,
 };
 
+/**
+ * struct ieee80211_scan_stats - software scan scheduling statistics
+ *
+ * @scans: number of software scans run
+ * @channels: channels visited
+ * @bursts: times the operating channel was left to scan
+ * @stalls: bursts ended because frames were waiting to go out
+ * @extended: returns to the operating channel that were extended
+ *	because the queues hadn't drained yet
+ * @max_queued: most frames seen waiting at a scan decision
+ * @off_channel: total time (in jiffies) away from the operating channel
+ * @max_burst: longest single time (in jiffies) away from it
+ */
+struct ieee80211_scan_stats {
+	unsigned int scans;
+	unsigned int channels;
+	unsigned int bursts;
+	unsigned int stalls;
+	unsigned int extended;
+	unsigned int max_queued;
+	unsigned long off_channel;
+	unsigned long max_burst;
+};
+
 struct ieee80211_local {
 	/* embed the driver visible part.
 	 * don't cast (use the static inlines below), but we keep
@@ -846,9 +899,16 @@ struct ieee80211_local {
 	 */
 	struct workqueue_struct *workqueue;
 
+	/*
+	 * bitmaps of enum queue_stop_reason; modified with atomic bitops
+	 * under queue_stop_reason_lock, may be tested without it
+	 */
 	unsigned long queue_stop_reasons[IEEE80211_MAX_QUEUES];
 	/* also used to protect ampdu_ac_queue and amdpu_ac_stop_refcnt */
 	spinlock_t queue_stop_reason_lock;
+	/* flow control transitions (running <-> stopped) per queue */
+	unsigned int queue_stop_events[IEEE80211_MAX_QUEUES];
+	unsigned int queue_wake_events[IEEE80211_MAX_QUEUES];
 
 	int open_count;
 	int monitors, cooked_mntrs;
@@ -938,11 +998,25 @@ struct ieee80211_local {
 	struct timer_list sta_cleanup;
 	int sta_generation;
 
+	/*
+	 * Stations with power save buffered frames, hashed by the time
+	 * their oldest frame expires; sta_cleanup runs the due slots. The
+	 * slot at ps_expiry_cursor is due at ps_expiry_next (jiffies).
+	 */
+	spinlock_t ps_expiry_lock;
+	struct list_head ps_expiry_wheel[STA_PS_EXPIRY_SLOTS];
+	unsigned long ps_expiry_next;
+	unsigned int ps_expiry_cursor;
+	unsigned int ps_expiry_count;
+
 	struct sk_buff_head pending[IEEE80211_MAX_QUEUES];
 	struct tasklet_struct tx_pending_tasklet;
 
 	atomic_t agg_queue_stop[IEEE80211_MAX_QUEUES];
 
+	/* TX aggregation sessions set up or being set up, all stations */
+	atomic_t tx_ba_sessions;
+
 	/* number of interfaces with corresponding IFF_ flags */
 	atomic_t iff_allmultis, iff_promiscs;
 
@@ -981,6 +1055,10 @@ struct ieee80211_local {
 
 	unsigned long leave_oper_channel_time;
 	enum mac80211_scan_state next_scan_state;
+	bool scan_off_channel;
+	int scan_extensions;
+	/* statistics of the last (or current) and all software scans */
+	struct ieee80211_scan_stats scan_stats, scan_stats_total;
 	struct delayed_work scan_work;
 	struct ieee80211_sub_if_data __rcu *scan_sdata;
 	enum nl80211_channel_type _oper_channel_type;
@@ -1029,6 +1107,10 @@ struct ieee80211_local {
 	unsigned int rx_expand_skb_head;
 	unsigned int rx_expand_skb_head2;
 	unsigned int rx_handlers_fragments;
+	unsigned int rx_amsdu_subframes_shared;
+	unsigned int rx_amsdu_subframes_copied;
+	unsigned int rx_beacons_unchanged;
+	unsigned int tx_tim_unchanged;
 	unsigned int tx_status_drop;
 #define I802_DEBUG_INC(c) (c)++
 #else /* CONFIG_MAC80211_DEBUG_COUNTERS */
@@ -1039,6 +1121,8 @@ struct ieee80211_local {
 	int total_ps_buffered; /* total number of all buffered unicast and
 				* multicast packets for power saving stations
 				*/
+	atomic_t total_ps_buf_bytes; /* truesize of the unicast ones */
+	atomic_t ps_buf_stations; /* stations with frames buffered */
 
 	bool pspolling;
 	bool offchannel_ps_enabled;
@@ -1073,6 +1157,12 @@ struct ieee80211_local {
 		struct dentry *rcdir;
 		struct dentry *keys;
 	} debugfs;
+
+	/* results of the last beacon parsing benchmark, see debugfs.c */
+	struct {
+		unsigned int beacons, iterations;
+		u64 parse_ns, crc_ns;
+	} beacon_bench;
 #endif
 
 	/*
@@ -1360,6 +1450,10 @@ void ieee80211_start_tx_ba_cb(struct ieee80211_vif *vif, u8 *ra, u16 tid);
 void ieee80211_stop_tx_ba_cb(struct ieee80211_vif *vif, u8 *ra, u8 tid);
 void ieee80211_ba_session_work(struct work_struct *work);
 void ieee80211_tx_ba_session_handle_start(struct sta_info *sta, int tid);
+void ieee80211_agg_tx_track(struct sta_info *sta, u16 tid,
+			    struct tid_ampdu_tx *tid_tx);
+void ieee80211_free_tid_tx(struct ieee80211_local *local,
+			   struct tid_ampdu_tx *tid_tx, bool rcu);
 void ieee80211_release_reorder_timeout(struct sta_info *sta, int tid);
 
 /* Spectrum management */
@@ -1420,11 +1514,22 @@ static void inline ieee80211_tx_skb(struct ieee80211_sub_if_data *sdata,
 	ieee80211_tx_skb_tid(sdata, skb, 7);
 }
 
+/* elements whose changes make the beacon of our AP be processed again */
+#define IEEE80211_BEACON_CRC_IES			\
+	((1ULL << WLAN_EID_COUNTRY) |			\
+	 (1ULL << WLAN_EID_ERP_INFO) |			\
+	 (1ULL << WLAN_EID_CHANNEL_SWITCH) |		\
+	 (1ULL << WLAN_EID_PWR_CONSTRAINT) |		\
+	 (1ULL << WLAN_EID_HT_CAPABILITY) |		\
+	 (1ULL << WLAN_EID_HT_OPERATION))
+
 void ieee802_11_parse_elems(u8 *start, size_t len,
 			    struct ieee802_11_elems *elems);
 u32 ieee802_11_parse_elems_crc(u8 *start, size_t len,
 			       struct ieee802_11_elems *elems,
 			       u64 filter, u32 crc);
+u32 ieee802_11_elems_crc(u8 *start, size_t len, u64 filter, u32 crc,
+			 struct ieee80211_tim_ie **tim, u8 *tim_len);
 u32 ieee80211_mandatory_rates(struct ieee80211_local *local,
 			      enum ieee80211_band band);
 
@@ -1142,12 +1142,18 @@ static int __init ieee80211_init(void)
 	if (ret)
 		goto err_pid;
 
+	ret = rc80211_airtime_init();
+	if (ret)
+		goto err_airtime;
+
 	ret = ieee80211_iface_init();
 	if (ret)
 		goto err_netdev;
 
 	return 0;
  err_netdev:
+	rc80211_airtime_exit();
+ err_airtime:
 	rc80211_pid_exit();
  err_pid:
 	rc80211_minstrel_ht_exit();
@@ -1159,6 +1165,7 @@ static int __init ieee80211_init(void)
 
 static void __exit ieee80211_exit(void)
 {
+	rc80211_airtime_exit();
 	rc80211_pid_exit();
 	rc80211_minstrel_ht_exit();
 	rc80211_minstrel_exit();
@@ -107,6 +107,7 @@ enum mesh_deferred_task_flags {
  * @last_preq_to_root: Timestamp of last PREQ sent to root
  * @is_root: the destination station of this path is a root node
  * @is_gate: the destination station of this path is a mesh gate
+ * @discovery_start: in jiffies, when the current path discovery started
  *
  *
  * The combination of dst and sdata is unique in the mesh path table. Since the
@@ -135,6 +136,36 @@ struct mesh_path {
 	unsigned long last_preq_to_root;
 	bool is_root;
 	bool is_gate;
+	unsigned long discovery_start;
+};
+
+/**
+ * struct mesh_table_stats - statistics of a path table
+ *
+ * @entries: number of entries in the table
+ * @lookups: number of lookups, counted per CPU to keep the forwarding path
+ *	off a shared cache line
+ * @rate_lookups: value of @lookups when @lookup_rate was last sampled
+ * @rate_time: when @lookup_rate was last sampled, in jiffies
+ * @lookup_rate: lookups per second over the last sample period
+ * @resizes: number of completed resizes
+ * @resize_usecs: duration of the last resize, in microseconds
+ * @migrated_on_access: buckets moved to a bigger table by a lookup, an add or
+ *	a delete rather than by the resize worker
+ *
+ * These outlive the tables themselves: a table that replaces a smaller one
+ * takes over its statistics.  The counters other than @entries and @lookups
+ * are only updated by resizes and migrations, without locking.
+ */
+struct mesh_table_stats {
+	atomic_t entries;
+	unsigned long __percpu *lookups;
+	unsigned long rate_lookups;
+	unsigned long rate_time;
+	unsigned long lookup_rate;
+	unsigned int resizes;
+	unsigned int resize_usecs;
+	unsigned int migrated_on_access;
 };
 
 /**
@@ -144,15 +175,18 @@ struct mesh_path {
  * @hashwlock: array of locks to protect write operations, one per bucket
  * @hash_mask: 2^size_order - 1, used to compute hash idx
  * @hash_rnd: random value used for hash computations
- * @entries: number of entries in the table
  * @free_node: function to free nodes of the table
- * @copy_node: function to copy nodes of the table
  * @size_order: determines size of the table, there will be 2^size_order hash
  *	buckets
  * @mean_chain_len: maximum average length for the hash buckets' list, if it is
  *	reached, the table will grow
  * @known_gates: list of known mesh gates and their mpaths by the station. The
  * gate's mpath may or may not be resolved and active.
+ * @stats: statistics, including the number of entries in the table
+ * @resize_src: while the table is being resized, the smaller table it
+ *	replaces.  Paths not moved over yet are still found there.
+ * @migrating: buckets of @resize_src may be moved over on access
+ * @resize_start: when the resize started
  *
  * rcu_head: RCU head to free the table
  */
@@ -162,13 +196,16 @@ struct mesh_table {
 	spinlock_t *hashwlock;		/* One per bucket, for add/del */
 	unsigned int hash_mask;		/* (2^size_order) - 1 */
 	__u32 hash_rnd;			/* Used for hash generation */
-	atomic_t entries;		/* Up to MAX_MESH_NEIGHBOURS */
 	void (*free_node) (struct hlist_node *p, bool free_leafs);
-	int (*copy_node) (struct hlist_node *p, struct mesh_table *newtbl);
 	int size_order;
 	int mean_chain_len;
 	struct hlist_head *known_gates;
 	spinlock_t gates_lock;
+	struct mesh_table_stats *stats;
+
+	struct mesh_table __rcu *resize_src;
+	bool migrating;
+	ktime_t resize_start;
 
 	struct rcu_head rcu_head;
 };
@@ -215,6 +252,9 @@ struct mesh_rmc {
 /* Maximum number of paths per interface */
 #define MESH_MAX_MPATHS		1024
 
+/* Most PREQs the rate limit can be configured to let out back to back */
+#define MESH_PREQ_MAX_BURST	8
+
 /* Public interfaces */
 /* Various */
 int ieee80211_fill_mesh_addresses(struct ieee80211_hdr *hdr, __le16 *fc,
@@ -261,6 +301,9 @@ int mesh_nexthop_lookup(struct sk_buff *skb,
 int mesh_nexthop_resolve(struct sk_buff *skb,
 			 struct ieee80211_sub_if_data *sdata);
 void mesh_path_start_discovery(struct ieee80211_sub_if_data *sdata);
+bool mesh_path_preq_allowed(struct ieee80211_sub_if_data *sdata);
+extern const unsigned int
+mesh_disc_latency_bounds[MESH_DISC_LATENCY_BUCKETS - 1];
 struct mesh_path *mesh_path_lookup(u8 *dst,
 		struct ieee80211_sub_if_data *sdata);
 struct mesh_path *mpp_path_lookup(u8 *dst,
@@ -295,6 +338,7 @@ void mesh_rx_plink_frame(struct ieee80211_sub_if_data *sdata,
 /* Mesh tables */
 void mesh_mpath_table_grow(void);
 void mesh_mpp_table_grow(void);
+int mesh_pathtbl_stats_fmt(bool mpp, char *buf, int buflen);
 /* Mesh paths */
 int mesh_path_error_tx(u8 ttl, u8 *target, __le32 target_sn, __le16 target_rcode,
 		       const u8 *ra, struct ieee80211_sub_if_data *sdata);
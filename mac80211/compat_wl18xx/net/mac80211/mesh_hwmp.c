@@ -21,6 +21,8 @@
 #define MESH_FRAME_QUEUE_LEN	10
 #define MAX_PREQ_QUEUE_LEN	64
 
+/* Most targets a single PREQ element can carry */
+#define MESH_PREQ_MAX_TARGETS	20
 /* Destination only */
 #define MP_F_DO	0x1
 /* Reply and forward */
@@ -31,6 +33,7 @@
 #define MP_F_RCODE  0x02
 
 static void mesh_queue_preq(struct mesh_path *, u8);
+static unsigned long mesh_preq_next_allowed(struct ieee80211_sub_if_data *sdata);
 
 static inline u32 u32_field_get(u8 *preq_elem, int offset, bool ae)
 {
@@ -57,9 +60,14 @@ static inline u32 u16_field_get(u8 *preq_elem, int offset, bool ae)
 #define PREQ_IE_ORIG_SN(x)	u32_field_get(x, 13, 0)
 #define PREQ_IE_LIFETIME(x)	u32_field_get(x, 17, AE_F_SET(x))
 #define PREQ_IE_METRIC(x) 	u32_field_get(x, 21, AE_F_SET(x))
-#define PREQ_IE_TARGET_F(x)	(*(AE_F_SET(x) ? x + 32 : x + 26))
-#define PREQ_IE_TARGET_ADDR(x) 	(AE_F_SET(x) ? x + 33 : x + 27)
-#define PREQ_IE_TARGET_SN(x) 	u32_field_get(x, 33, AE_F_SET(x))
+#define PREQ_IE_TARGET_COUNT(x)	(*(AE_F_SET(x) ? x + 31 : x + 25))
+
+/* Per target fields, PREQs without AE only */
+#define PREQ_TARGET_LEN		11
+#define PREQ_IE_TARGET_N(x, i)	(x + 26 + (i) * PREQ_TARGET_LEN)
+#define PREQ_TARGET_F(t)	(*(t))
+#define PREQ_TARGET_ADDR(t)	(t + 1)
+#define PREQ_TARGET_SN(t)	get_unaligned_le32(t + 7)
 
 
 #define PREP_IE_FLAGS(x)	PREQ_IE_FLAGS(x)
@@ -103,24 +111,38 @@ enum mpath_frame_type {
 
 static const u8 broadcast_addr[ETH_ALEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 
-static int mesh_path_sel_frame_tx(enum mpath_frame_type action, u8 flags,
-		u8 *orig_addr, __le32 orig_sn, u8 target_flags, u8 *target,
-		__le32 target_sn, const u8 *da, u8 hop_count, u8 ttl,
-		__le32 lifetime, __le32 metric, __le32 preq_id,
-		struct ieee80211_sub_if_data *sdata)
+/* Path discovery latency histogram bucket bounds, in ms */
+const unsigned int mesh_disc_latency_bounds[MESH_DISC_LATENCY_BUCKETS - 1] = {
+	10, 20, 50, 100, 200, 500, 1000, 2000, 5000
+};
+
+/**
+ * struct mesh_preq_target - one target of a PREQ element
+ *
+ * @flags: per target flags (MP_F_DO, MP_F_RF)
+ * @addr: target address
+ * @sn: target sequence number
+ */
+struct mesh_preq_target {
+	u8 flags;
+	u8 addr[ETH_ALEN];
+	u32 sn;
+};
+
+static struct sk_buff *mesh_path_sel_frame_alloc(
+		struct ieee80211_sub_if_data *sdata, const u8 *da, int ie_len)
 {
 	struct ieee80211_local *local = sdata->local;
 	struct sk_buff *skb;
 	struct ieee80211_mgmt *mgmt;
-	u8 *pos, ie_len;
 	int hdr_len = offsetof(struct ieee80211_mgmt, u.action.u.mesh_action) +
 		      sizeof(mgmt->u.action.u.mesh_action);
 
 	skb = dev_alloc_skb(local->tx_headroom +
 			    hdr_len +
-			    2 + 37); /* max HWMP IE */
+			    2 + ie_len);
 	if (!skb)
-		return -1;
+		return NULL;
 	skb_reserve(skb, local->tx_headroom);
 	mgmt = (struct ieee80211_mgmt *) skb_put(skb, hdr_len);
 	memset(mgmt, 0, hdr_len);
@@ -134,6 +156,21 @@ static int mesh_path_sel_frame_tx(enum mpath_frame_type action, u8 flags,
 	mgmt->u.action.category = WLAN_CATEGORY_MESH_ACTION;
 	mgmt->u.action.u.mesh_action.action_code =
 					WLAN_MESH_ACTION_HWMP_PATH_SELECTION;
+	return skb;
+}
+
+static int mesh_path_sel_frame_tx(enum mpath_frame_type action, u8 flags,
+		u8 *orig_addr, __le32 orig_sn, u8 target_flags, u8 *target,
+		__le32 target_sn, const u8 *da, u8 hop_count, u8 ttl,
+		__le32 lifetime, __le32 metric, __le32 preq_id,
+		struct ieee80211_sub_if_data *sdata)
+{
+	struct sk_buff *skb;
+	u8 *pos, ie_len;
+
+	skb = mesh_path_sel_frame_alloc(sdata, da, 37); /* max HWMP IE */
+	if (!skb)
+		return -1;
 
 	switch (action) {
 	case MPATH_PREQ:
@@ -200,6 +237,71 @@ static int mesh_path_sel_frame_tx(enum mpath_frame_type action, u8 flags,
 	return 0;
 }
 
+/**
+ * mesh_path_preq_tx - send a PREQ for one or more targets
+ *
+ * @flags: PREQ flags
+ * @orig_addr: originator address
+ * @orig_sn: originator sequence number
+ * @targets: targets of the PREQ
+ * @n_targets: number of @targets, 1 to MESH_PREQ_MAX_TARGETS
+ * @da: address the frame is sent to
+ * @hop_count: hop count
+ * @ttl: element TTL
+ * @lifetime: path lifetime, in TUs
+ * @metric: metric to the originator
+ * @preq_id: PREQ ID
+ * @sdata: local mesh subif
+ *
+ * All targets share the originator fields, so several path discoveries of
+ * this station can be carried in one frame.
+ */
+static int mesh_path_preq_tx(u8 flags, const u8 *orig_addr, u32 orig_sn,
+			     const struct mesh_preq_target *targets,
+			     int n_targets, const u8 *da, u8 hop_count, u8 ttl,
+			     u32 lifetime, u32 metric, u32 preq_id,
+			     struct ieee80211_sub_if_data *sdata)
+{
+	struct sk_buff *skb;
+	u8 *pos, ie_len;
+	int i;
+
+	ie_len = 26 + n_targets * PREQ_TARGET_LEN;
+	skb = mesh_path_sel_frame_alloc(sdata, da, ie_len);
+	if (!skb)
+		return -1;
+
+	mhwmp_dbg(sdata, "sending PREQ to %pM (%d targets)\n",
+		  targets[0].addr, n_targets);
+	pos = skb_put(skb, 2 + ie_len);
+	*pos++ = WLAN_EID_PREQ;
+	*pos++ = ie_len;
+	*pos++ = flags;
+	*pos++ = hop_count;
+	*pos++ = ttl;
+	put_unaligned_le32(preq_id, pos);
+	pos += 4;
+	memcpy(pos, orig_addr, ETH_ALEN);
+	pos += ETH_ALEN;
+	put_unaligned_le32(orig_sn, pos);
+	pos += 4;
+	put_unaligned_le32(lifetime, pos);
+	pos += 4;
+	put_unaligned_le32(metric, pos);
+	pos += 4;
+	*pos++ = n_targets;
+	for (i = 0; i < n_targets; i++) {
+		*pos++ = targets[i].flags;
+		memcpy(pos, targets[i].addr, ETH_ALEN);
+		pos += ETH_ALEN;
+		put_unaligned_le32(targets[i].sn, pos);
+		pos += 4;
+	}
+
+	ieee80211_tx_skb(sdata, skb);
+	return 0;
+}
+
 
 /*  Headroom is not adjusted.  Caller should ensure that skb has sufficient
  *  headroom in case the frame is encrypted. */
@@ -346,6 +448,27 @@ static u32 airtime_link_metric_get(struct ieee80211_local *local,
 	return (u32)result;
 }
 
+/*
+ * Account for the path discovery that @mpath may be in the middle of, now that
+ * routing information for it has arrived.  Called with mpath->state_lock held.
+ */
+static void hwmp_discovery_done(struct ieee80211_sub_if_data *sdata,
+				struct mesh_path *mpath)
+{
+	unsigned int msecs;
+	int i;
+
+	if (!(mpath->flags & MESH_PATH_RESOLVING) || !mpath->discovery_start)
+		return;
+
+	msecs = jiffies_to_msecs(jiffies - mpath->discovery_start);
+	mpath->discovery_start = 0;
+	for (i = 0; i < ARRAY_SIZE(mesh_disc_latency_bounds); i++)
+		if (msecs < mesh_disc_latency_bounds[i])
+			break;
+	sdata->u.mesh.mshstats.discovery_latency[i]++;
+}
+
 /**
  * hwmp_route_info_get - Update routing info to originator and transmitter
  *
@@ -452,6 +575,7 @@ static u32 hwmp_route_info_get(struct ieee80211_sub_if_data *sdata,
 			mpath->sn = orig_sn;
 			mpath->exp_time = time_after(mpath->exp_time, exp_time)
 					  ?  mpath->exp_time : exp_time;
+			hwmp_discovery_done(sdata, mpath);
 			mesh_path_activate(mpath);
 			spin_unlock_bh(&mpath->state_lock);
 			mesh_path_tx_pending(mpath);
@@ -491,6 +615,7 @@ static u32 hwmp_route_info_get(struct ieee80211_sub_if_data *sdata,
 			mpath->metric = last_hop_metric;
 			mpath->exp_time = time_after(mpath->exp_time, exp_time)
 					  ?  mpath->exp_time : exp_time;
+			hwmp_discovery_done(sdata, mpath);
 			mesh_path_activate(mpath);
 			spin_unlock_bh(&mpath->state_lock);
 			mesh_path_tx_pending(mpath);
@@ -503,101 +628,136 @@ static u32 hwmp_route_info_get(struct ieee80211_sub_if_data *sdata,
 	return process ? new_metric : 0;
 }
 
+static bool hwmp_preq_len_ok(u8 *preq_elem, u8 preq_len)
+{
+	int n_targets;
+
+	/* Right now we support no AE */
+	if (preq_len < 26 || AE_F_SET(preq_elem))
+		return false;
+
+	n_targets = PREQ_IE_TARGET_COUNT(preq_elem);
+	return n_targets >= 1 && n_targets <= MESH_PREQ_MAX_TARGETS &&
+	       preq_len == 26 + n_targets * PREQ_TARGET_LEN;
+}
+
 static void hwmp_preq_frame_process(struct ieee80211_sub_if_data *sdata,
 				    struct ieee80211_mgmt *mgmt,
 				    u8 *preq_elem, u32 metric)
 {
 	struct ieee80211_if_mesh *ifmsh = &sdata->u.mesh;
-	struct mesh_path *mpath = NULL;
-	u8 *target_addr, *orig_addr;
+	struct mesh_preq_target fwd[MESH_PREQ_MAX_TARGETS];
+	struct mesh_path *mpath;
+	u8 *target, *target_addr, *orig_addr;
+	u8 root_addr[ETH_ALEN];
 	const u8 *da;
 	u8 target_flags, ttl, flags;
-	u32 orig_sn, target_sn, lifetime, orig_metric;
-	bool reply = false;
-	bool forward = true;
+	u32 orig_sn, target_sn, lifetime, target_metric;
+	bool reply, forward;
 	bool root_is_gate;
+	bool to_root = false;
+	int i, n_targets, n_fwd = 0;
 
-	/* Update target SN, if present */
-	target_addr = PREQ_IE_TARGET_ADDR(preq_elem);
 	orig_addr = PREQ_IE_ORIG_ADDR(preq_elem);
-	target_sn = PREQ_IE_TARGET_SN(preq_elem);
 	orig_sn = PREQ_IE_ORIG_SN(preq_elem);
-	target_flags = PREQ_IE_TARGET_F(preq_elem);
-	orig_metric = metric;
+	n_targets = PREQ_IE_TARGET_COUNT(preq_elem);
 	/* Proactive PREQ gate announcements */
 	flags = PREQ_IE_FLAGS(preq_elem);
 	root_is_gate = !!(flags & RANN_FLAG_IS_GATE);
 
 	mhwmp_dbg(sdata, "received PREQ from %pM\n", orig_addr);
 
-	if (ether_addr_equal(target_addr, sdata->vif.addr)) {
-		mhwmp_dbg(sdata, "PREQ is for us\n");
-		forward = false;
-		reply = true;
-		metric = 0;
-		if (time_after(jiffies, ifmsh->last_sn_update +
-					net_traversal_jiffies(sdata)) ||
-		    time_before(jiffies, ifmsh->last_sn_update)) {
-			target_sn = ++ifmsh->sn;
-			ifmsh->last_sn_update = jiffies;
-		}
-	} else if (is_broadcast_ether_addr(target_addr) &&
-		   (target_flags & IEEE80211_PREQ_TO_FLAG)) {
+	for (i = 0; i < n_targets; i++) {
+		/* Update target SN, if present */
+		target = PREQ_IE_TARGET_N(preq_elem, i);
+		target_addr = PREQ_TARGET_ADDR(target);
+		target_sn = PREQ_TARGET_SN(target);
+		target_flags = PREQ_TARGET_F(target);
+		target_metric = metric;
+		reply = false;
+		forward = true;
+		mpath = NULL;
+
 		rcu_read_lock();
-		mpath = mesh_path_lookup(orig_addr, sdata);
-		if (mpath) {
-			if (flags & IEEE80211_PREQ_PROACTIVE_PREP_FLAG) {
-				reply = true;
-				target_addr = sdata->vif.addr;
+		if (ether_addr_equal(target_addr, sdata->vif.addr)) {
+			mhwmp_dbg(sdata, "PREQ is for us\n");
+			forward = false;
+			reply = true;
+			target_metric = 0;
+			if (time_after(jiffies, ifmsh->last_sn_update +
+						net_traversal_jiffies(sdata)) ||
+			    time_before(jiffies, ifmsh->last_sn_update)) {
 				target_sn = ++ifmsh->sn;
-				metric = 0;
 				ifmsh->last_sn_update = jiffies;
 			}
-			if (root_is_gate)
-				mesh_path_add_gate(mpath);
+		} else if (is_broadcast_ether_addr(target_addr) &&
+			   (target_flags & IEEE80211_PREQ_TO_FLAG)) {
+			mpath = mesh_path_lookup(orig_addr, sdata);
+			if (mpath) {
+				if (flags & IEEE80211_PREQ_PROACTIVE_PREP_FLAG) {
+					reply = true;
+					target_addr = sdata->vif.addr;
+					target_sn = ++ifmsh->sn;
+					target_metric = 0;
+					ifmsh->last_sn_update = jiffies;
+				}
+				if (root_is_gate)
+					mesh_path_add_gate(mpath);
+			}
+		} else {
+			mpath = mesh_path_lookup(target_addr, sdata);
+			if (mpath) {
+				if ((!(mpath->flags & MESH_PATH_SN_VALID)) ||
+						SN_LT(mpath->sn, target_sn)) {
+					mpath->sn = target_sn;
+					mpath->flags |= MESH_PATH_SN_VALID;
+				} else if ((!(target_flags & MP_F_DO)) &&
+						(mpath->flags & MESH_PATH_ACTIVE)) {
+					reply = true;
+					target_metric = mpath->metric;
+					target_sn = mpath->sn;
+					if (target_flags & MP_F_RF)
+						target_flags |= MP_F_DO;
+					else
+						forward = false;
+				}
+			}
+		}
+		if (forward && mpath && mpath->is_root) {
+			memcpy(root_addr, mpath->rann_snd_addr, ETH_ALEN);
+			to_root = true;
 		}
 		rcu_read_unlock();
-	} else {
-		rcu_read_lock();
-		mpath = mesh_path_lookup(target_addr, sdata);
-		if (mpath) {
-			if ((!(mpath->flags & MESH_PATH_SN_VALID)) ||
-					SN_LT(mpath->sn, target_sn)) {
-				mpath->sn = target_sn;
-				mpath->flags |= MESH_PATH_SN_VALID;
-			} else if ((!(target_flags & MP_F_DO)) &&
-					(mpath->flags & MESH_PATH_ACTIVE)) {
-				reply = true;
-				metric = mpath->metric;
-				target_sn = mpath->sn;
-				if (target_flags & MP_F_RF)
-					target_flags |= MP_F_DO;
-				else
-					forward = false;
+
+		if (reply) {
+			lifetime = PREQ_IE_LIFETIME(preq_elem);
+			ttl = ifmsh->mshcfg.element_ttl;
+			if (ttl != 0) {
+				mhwmp_dbg(sdata, "replying to the PREQ\n");
+				mesh_path_sel_frame_tx(MPATH_PREP, 0, orig_addr,
+					cpu_to_le32(orig_sn), 0, target_addr,
+					cpu_to_le32(target_sn), mgmt->sa, 0,
+					ttl, cpu_to_le32(lifetime),
+					cpu_to_le32(target_metric), 0, sdata);
+			} else {
+				ifmsh->mshstats.dropped_frames_ttl++;
 			}
 		}
-		rcu_read_unlock();
-	}
 
-	if (reply) {
-		lifetime = PREQ_IE_LIFETIME(preq_elem);
-		ttl = ifmsh->mshcfg.element_ttl;
-		if (ttl != 0) {
-			mhwmp_dbg(sdata, "replying to the PREQ\n");
-			mesh_path_sel_frame_tx(MPATH_PREP, 0, orig_addr,
-				cpu_to_le32(orig_sn), 0, target_addr,
-				cpu_to_le32(target_sn), mgmt->sa, 0, ttl,
-				cpu_to_le32(lifetime), cpu_to_le32(metric),
-				0, sdata);
-		} else {
-			ifmsh->mshstats.dropped_frames_ttl++;
+		if (!forward)
+			continue;
+
+		if (flags & IEEE80211_PREQ_PROACTIVE_PREP_FLAG) {
+			target_addr = PREQ_TARGET_ADDR(target);
+			target_sn = PREQ_TARGET_SN(target);
 		}
+		fwd[n_fwd].flags = target_flags;
+		memcpy(fwd[n_fwd].addr, target_addr, ETH_ALEN);
+		fwd[n_fwd].sn = target_sn;
+		n_fwd++;
 	}
 
-	if (forward && ifmsh->mshcfg.dot11MeshForwarding) {
-		u32 preq_id;
-		u8 hopcount;
-
+	if (n_fwd && ifmsh->mshcfg.dot11MeshForwarding) {
 		ttl = PREQ_IE_TTL(preq_elem);
 		lifetime = PREQ_IE_LIFETIME(preq_elem);
 		if (ttl <= 1) {
@@ -606,23 +766,16 @@ static void hwmp_preq_frame_process(struct ieee80211_sub_if_data *sdata,
 		}
 		mhwmp_dbg(sdata, "forwarding the PREQ from %pM\n", orig_addr);
 		--ttl;
-		preq_id = PREQ_IE_PREQ_ID(preq_elem);
-		hopcount = PREQ_IE_HOPCOUNT(preq_elem) + 1;
-		da = (mpath && mpath->is_root) ?
-			mpath->rann_snd_addr : broadcast_addr;
-
-		if (flags & IEEE80211_PREQ_PROACTIVE_PREP_FLAG) {
-			target_addr = PREQ_IE_TARGET_ADDR(preq_elem);
-			target_sn = PREQ_IE_TARGET_SN(preq_elem);
-			metric = orig_metric;
-		}
+		/* only a single target PREQ can follow the path to a root */
+		da = (n_targets == 1 && to_root) ? root_addr : broadcast_addr;
 
-		mesh_path_sel_frame_tx(MPATH_PREQ, flags, orig_addr,
-				cpu_to_le32(orig_sn), target_flags, target_addr,
-				cpu_to_le32(target_sn), da,
-				hopcount, ttl, cpu_to_le32(lifetime),
-				cpu_to_le32(metric), cpu_to_le32(preq_id),
-				sdata);
+		/* the metric forwarded is the one to the originator, even for
+		 * targets we also replied to
+		 */
+		mesh_path_preq_tx(flags, orig_addr, orig_sn, fwd, n_fwd, da,
+				  PREQ_IE_HOPCOUNT(preq_elem) + 1, ttl,
+				  lifetime, metric, PREQ_IE_PREQ_ID(preq_elem),
+				  sdata);
 		if (!is_multicast_ether_addr(da))
 			ifmsh->mshstats.fwded_unicast++;
 		else
@@ -876,8 +1029,7 @@ void mesh_rx_path_sel_frame(struct ieee80211_sub_if_data *sdata,
 			len - baselen, &elems);
 
 	if (elems.preq) {
-		if (elems.preq_len != 37)
-			/* Right now we support just 1 destination and no AE */
+		if (!hwmp_preq_len_ok(elems.preq, elems.preq_len))
 			return;
 		last_hop_metric = hwmp_route_info_get(sdata, mgmt, elems.preq,
 						      MPATH_PREQ);
@@ -953,73 +1105,159 @@ static void mesh_queue_preq(struct mesh_path *mpath, u8 flags)
 	++ifmsh->preq_queue_len;
 	spin_unlock_bh(&ifmsh->mesh_preq_queue_lock);
 
-	if (time_after(jiffies, ifmsh->last_preq + min_preq_int_jiff(sdata)))
+	if (mesh_path_preq_allowed(sdata)) {
 		ieee80211_queue_work(&sdata->local->hw, &sdata->work);
-
-	else if (time_before(jiffies, ifmsh->last_preq)) {
-		/* avoid long wait if did not send preqs for a long time
-		 * and jiffies wrapped around
-		 */
-		ifmsh->last_preq = jiffies - min_preq_int_jiff(sdata) - 1;
-		ieee80211_queue_work(&sdata->local->hw, &sdata->work);
-	} else
-		mod_timer(&ifmsh->mesh_path_timer, ifmsh->last_preq +
-						min_preq_int_jiff(sdata));
+	} else {
+		ifmsh->mshstats.preqs_ratelimited++;
+		mod_timer(&ifmsh->mesh_path_timer,
+			  mesh_preq_next_allowed(sdata));
+	}
 }
 
-/**
- * mesh_path_start_discovery - launch a path discovery from the PREQ queue
- *
- * @sdata: local mesh subif
+/*
+ * PREQ rate limiting: a token bucket that holds up to ifmsh->preq_burst PREQs
+ * and gains one every dot11MeshHWMPpreqMinInterval.  It is kept as the time
+ * at which it will be full again, ifmsh->preq_tat, which is in the past
+ * while it is full.  The default burst of 1 makes the interval a hard floor
+ * between two PREQs, as the standard requires; a bigger burst is only set
+ * on purpose, through debugfs.
  */
-void mesh_path_start_discovery(struct ieee80211_sub_if_data *sdata)
+static unsigned long mesh_preq_next_allowed(struct ieee80211_sub_if_data *sdata)
 {
 	struct ieee80211_if_mesh *ifmsh = &sdata->u.mesh;
-	struct mesh_preq_queue *preq_node;
-	struct mesh_path *mpath;
-	u8 ttl, target_flags;
-	const u8 *da;
-	u32 lifetime;
 
-	spin_lock_bh(&ifmsh->mesh_preq_queue_lock);
-	if (!ifmsh->preq_queue_len ||
-		time_before(jiffies, ifmsh->last_preq +
-				min_preq_int_jiff(sdata))) {
-		spin_unlock_bh(&ifmsh->mesh_preq_queue_lock);
-		return;
+	if (time_before(jiffies, ifmsh->last_preq)) {
+		/* did not send preqs for a long time and jiffies wrapped
+		 * around
+		 */
+		ifmsh->last_preq = jiffies;
+		ifmsh->preq_tat = jiffies;
 	}
+	return ifmsh->preq_tat -
+	       (ifmsh->preq_burst - 1) * min_preq_int_jiff(sdata);
+}
 
-	preq_node = list_first_entry(&ifmsh->preq_queue.list,
-			struct mesh_preq_queue, list);
-	list_del(&preq_node->list);
-	--ifmsh->preq_queue_len;
-	spin_unlock_bh(&ifmsh->mesh_preq_queue_lock);
+bool mesh_path_preq_allowed(struct ieee80211_sub_if_data *sdata)
+{
+	return !time_before(jiffies, mesh_preq_next_allowed(sdata));
+}
 
-	rcu_read_lock();
-	mpath = mesh_path_lookup(preq_node->dst, sdata);
-	if (!mpath)
-		goto enddiscovery;
+static void mesh_preq_consume(struct ieee80211_sub_if_data *sdata)
+{
+	struct ieee80211_if_mesh *ifmsh = &sdata->u.mesh;
 
+	if (time_before(ifmsh->preq_tat, jiffies))
+		ifmsh->preq_tat = jiffies;
+	ifmsh->preq_tat += min_preq_int_jiff(sdata);
+	ifmsh->last_preq = jiffies;
+}
+
+/*
+ * Move @mpath into the resolving state for a queued discovery and fill in its
+ * PREQ target.  Returns false if the discovery turned out to be unnecessary.
+ */
+static bool mesh_path_preq_target(struct ieee80211_sub_if_data *sdata,
+				  struct mesh_path *mpath, u8 preq_flags,
+				  struct mesh_preq_target *target)
+{
 	spin_lock_bh(&mpath->state_lock);
 	mpath->flags &= ~MESH_PATH_REQ_QUEUED;
-	if (preq_node->flags & PREQ_Q_F_START) {
+	if (preq_flags & PREQ_Q_F_START) {
 		if (mpath->flags & MESH_PATH_RESOLVING) {
 			spin_unlock_bh(&mpath->state_lock);
-			goto enddiscovery;
+			return false;
 		} else {
 			mpath->flags &= ~MESH_PATH_RESOLVED;
 			mpath->flags |= MESH_PATH_RESOLVING;
 			mpath->discovery_retries = 0;
 			mpath->discovery_timeout = disc_timeout_jiff(sdata);
+			mpath->discovery_start = jiffies;
 		}
 	} else if (!(mpath->flags & MESH_PATH_RESOLVING) ||
 			mpath->flags & MESH_PATH_RESOLVED) {
 		mpath->flags &= ~MESH_PATH_RESOLVING;
 		spin_unlock_bh(&mpath->state_lock);
-		goto enddiscovery;
+		return false;
 	}
 
-	ifmsh->last_preq = jiffies;
+	if (preq_flags & PREQ_Q_F_REFRESH)
+		target->flags = MP_F_DO;
+	else
+		target->flags = MP_F_RF;
+	memcpy(target->addr, mpath->dst, ETH_ALEN);
+	target->sn = mpath->sn;
+	spin_unlock_bh(&mpath->state_lock);
+	return true;
+}
+
+/**
+ * mesh_path_start_discovery - launch path discoveries from the PREQ queue
+ *
+ * @sdata: local mesh subif
+ *
+ * Queued discoveries are merged into a single PREQ of up to
+ * MESH_PREQ_MAX_TARGETS targets, taking destinations that have frames waiting
+ * for the path first.  A path towards a root is discovered with a unicast
+ * PREQ of its own.  Whatever does not fit is left queued for the next PREQ
+ * the rate limit allows.
+ */
+void mesh_path_start_discovery(struct ieee80211_sub_if_data *sdata)
+{
+	struct ieee80211_if_mesh *ifmsh = &sdata->u.mesh;
+	struct mesh_preq_target targets[MESH_PREQ_MAX_TARGETS];
+	struct mesh_path *mpaths[MESH_PREQ_MAX_TARGETS];
+	struct mesh_preq_queue *preq_node, *tmp;
+	struct mesh_path *mpath;
+	LIST_HEAD(pending);
+	const u8 *da = broadcast_addr;
+	int i, n = 0, left = 0;
+	bool waiting;
+	u8 ttl;
+	u32 lifetime;
+
+	spin_lock_bh(&ifmsh->mesh_preq_queue_lock);
+	if (!ifmsh->preq_queue_len || !mesh_path_preq_allowed(sdata)) {
+		spin_unlock_bh(&ifmsh->mesh_preq_queue_lock);
+		return;
+	}
+	list_splice_init(&ifmsh->preq_queue.list, &pending);
+	ifmsh->preq_queue_len = 0;
+	spin_unlock_bh(&ifmsh->mesh_preq_queue_lock);
+
+	rcu_read_lock();
+	/* first pass: destinations with frames waiting, second: the rest */
+	for (waiting = true; ; waiting = false) {
+		list_for_each_entry_safe(preq_node, tmp, &pending, list) {
+			if (n == MESH_PREQ_MAX_TARGETS || da != broadcast_addr)
+				goto send;
+
+			mpath = mesh_path_lookup(preq_node->dst, sdata);
+			if (mpath) {
+				if (waiting &&
+				    skb_queue_empty(&mpath->frame_queue))
+					continue;
+				if (mpath->is_root && n)
+					continue;
+			}
+
+			list_del(&preq_node->list);
+			if (mpath &&
+			    mesh_path_preq_target(sdata, mpath,
+						  preq_node->flags,
+						  &targets[n])) {
+				if (mpath->is_root)
+					da = mpath->rann_snd_addr;
+				mpaths[n++] = mpath;
+			}
+			kfree(preq_node);
+		}
+		if (!waiting)
+			break;
+	}
+
+send:
+	if (!n)
+		goto requeue;
 
 	if (time_after(jiffies, ifmsh->last_sn_update +
 				net_traversal_jiffies(sdata)) ||
@@ -1030,28 +1268,33 @@ void mesh_path_start_discovery(struct ieee80211_sub_if_data *sdata)
 	lifetime = default_lifetime(sdata);
 	ttl = sdata->u.mesh.mshcfg.element_ttl;
 	if (ttl == 0) {
-		sdata->u.mesh.mshstats.dropped_frames_ttl++;
-		spin_unlock_bh(&mpath->state_lock);
-		goto enddiscovery;
+		sdata->u.mesh.mshstats.dropped_frames_ttl += n;
+		goto requeue;
 	}
 
-	if (preq_node->flags & PREQ_Q_F_REFRESH)
-		target_flags = MP_F_DO;
-	else
-		target_flags = MP_F_RF;
+	mesh_path_preq_tx(0, sdata->vif.addr, ifmsh->sn, targets, n, da, 0,
+			  ttl, lifetime, 0, ifmsh->preq_id++, sdata);
+	mesh_preq_consume(sdata);
+	ifmsh->mshstats.preqs_sent++;
+	ifmsh->mshstats.preqs_coalesced += n - 1;
+	for (i = 0; i < n; i++)
+		mod_timer(&mpaths[i]->timer,
+			  jiffies + mpaths[i]->discovery_timeout);
 
-	spin_unlock_bh(&mpath->state_lock);
-	da = (mpath->is_root) ? mpath->rann_snd_addr : broadcast_addr;
-	mesh_path_sel_frame_tx(MPATH_PREQ, 0, sdata->vif.addr,
-			cpu_to_le32(ifmsh->sn), target_flags, mpath->dst,
-			cpu_to_le32(mpath->sn), da, 0,
-			ttl, cpu_to_le32(lifetime), 0,
-			cpu_to_le32(ifmsh->preq_id++), sdata);
-	mod_timer(&mpath->timer, jiffies + mpath->discovery_timeout);
-
-enddiscovery:
+requeue:
 	rcu_read_unlock();
-	kfree(preq_node);
+
+	list_for_each_entry(preq_node, &pending, list)
+		left++;
+
+	spin_lock_bh(&ifmsh->mesh_preq_queue_lock);
+	/* ahead of anything queued in the meantime */
+	list_splice(&pending, &ifmsh->preq_queue.list);
+	ifmsh->preq_queue_len += left;
+	if (ifmsh->preq_queue_len)
+		mod_timer(&ifmsh->mesh_path_timer,
+			  mesh_preq_next_allowed(sdata));
+	spin_unlock_bh(&ifmsh->mesh_preq_queue_lock);
 }
 
 /* mesh_nexthop_resolve - lookup next hop for given skb and start path
@@ -13,6 +13,9 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <asm/unaligned.h>
 #include <net/mac80211.h>
 #include "wme.h"
 #include "ieee80211_i.h"
@@ -40,27 +43,32 @@ struct mpath_node {
 static struct mesh_table __rcu *mesh_paths;
 static struct mesh_table __rcu *mpp_paths; /* Store paths for MPP&MAP */
 
+static DEFINE_PER_CPU(unsigned long, mesh_paths_lookups);
+static DEFINE_PER_CPU(unsigned long, mpp_paths_lookups);
+
+static struct mesh_table_stats mesh_paths_stats = {
+	.lookups = &mesh_paths_lookups,
+};
+static struct mesh_table_stats mpp_paths_stats = {
+	.lookups = &mpp_paths_lookups,
+};
+
 int mesh_paths_generation;
 
-/* This lock will have the grow table function as writer and add / delete nodes
- * as readers. RCU provides sufficient protection only when reading the table
- * (i.e. doing lookups).  Adding or adding or removing nodes requires we take
- * the read lock or we risk operating on an old table.  The write lock is only
- * needed when modifying the number of buckets a table.
+/* Serializes the resize workers.  Adding, deleting and looking up paths never
+ * take it: adds and deletes only lock the buckets they touch, and a table
+ * that is being resized keeps a pointer to the smaller table it replaces
+ * until every bucket of that table has been moved over, either by the resize
+ * worker or by whoever touches the bucket first.
  */
-static DEFINE_RWLOCK(pathtbl_resize_lock);
+static DEFINE_MUTEX(pathtbl_resize_mutex);
 
 
-static inline struct mesh_table *resize_dereference_mesh_paths(void)
+static inline struct mesh_table *resize_dereference_paths(
+	struct mesh_table __rcu **ptbl)
 {
-	return rcu_dereference_protected(mesh_paths,
-		lockdep_is_held(&pathtbl_resize_lock));
-}
-
-static inline struct mesh_table *resize_dereference_mpp_paths(void)
-{
-	return rcu_dereference_protected(mpp_paths,
-		lockdep_is_held(&pathtbl_resize_lock));
+	return rcu_dereference_protected(*ptbl,
+		lockdep_is_held(&pathtbl_resize_mutex));
 }
 
 /*
@@ -73,13 +81,24 @@ static inline struct mesh_table *resize_dereference_mpp_paths(void)
 	for (i = 0; i <= tbl->hash_mask; i++) \
 		hlist_for_each_entry_rcu(node, p, &tbl->hash_buckets[i], list)
 
+/*
+ * Visit the table that "tbl" is being filled from, if any, and then "tbl"
+ * itself.  The old table must be walked first: a bucket being moved has its
+ * nodes linked into the new table before they are unlinked from the old one,
+ * so walking in this order never misses a path, although it may see one
+ * twice.  Same restriction on "tbl" as for for_each_mesh_entry().
+ */
+#define for_each_mesh_table(tbl, t) \
+	for (t = rcu_dereference(tbl->resize_src) ?: tbl; t; \
+	     t = (t != tbl) ? tbl : NULL)
+
 
 static struct mesh_table *mesh_table_alloc(int size_order)
 {
 	int i;
 	struct mesh_table *newtbl;
 
-	newtbl = kmalloc(sizeof(struct mesh_table), GFP_ATOMIC);
+	newtbl = kzalloc(sizeof(struct mesh_table), GFP_ATOMIC);
 	if (!newtbl)
 		return NULL;
 
@@ -101,7 +120,6 @@ static struct mesh_table *mesh_table_alloc(int size_order)
 
 	newtbl->size_order = size_order;
 	newtbl->hash_mask = (1 << size_order) - 1;
-	atomic_set(&newtbl->entries,  0);
 	get_random_bytes(&newtbl->hash_rnd,
 			sizeof(newtbl->hash_rnd));
 	for (i = 0; i <= newtbl->hash_mask; i++)
@@ -118,22 +136,35 @@ static void __mesh_table_free(struct mesh_table *tbl)
 	kfree(tbl);
 }
 
-static void mesh_table_free(struct mesh_table *tbl, bool free_leafs)
+static void mesh_table_free_nodes(struct mesh_table *tbl, bool free_leafs)
 {
 	struct hlist_head *mesh_hash;
 	struct hlist_node *p, *q;
-	struct mpath_node *gate;
 	int i;
 
 	mesh_hash = tbl->hash_buckets;
 	for (i = 0; i <= tbl->hash_mask; i++) {
 		spin_lock_bh(&tbl->hashwlock[i]);
-		hlist_for_each_safe(p, q, &mesh_hash[i]) {
+		hlist_for_each_safe(p, q, &mesh_hash[i])
 			tbl->free_node(p, free_leafs);
-			atomic_dec(&tbl->entries);
-		}
 		spin_unlock_bh(&tbl->hashwlock[i]);
 	}
+}
+
+static void mesh_table_free(struct mesh_table *tbl, bool free_leafs)
+{
+	struct mesh_table *oldtbl;
+	struct hlist_node *p, *q;
+	struct mpath_node *gate;
+
+	/* only possible on the exit path, when a resize never completed */
+	oldtbl = rcu_dereference_protected(tbl->resize_src, 1);
+	if (oldtbl) {
+		mesh_table_free_nodes(oldtbl, free_leafs);
+		__mesh_table_free(oldtbl);
+	}
+
+	mesh_table_free_nodes(tbl, free_leafs);
 	if (free_leafs) {
 		spin_lock_bh(&tbl->gates_lock);
 		hlist_for_each_entry_safe(gate, p, q,
@@ -148,47 +179,252 @@ static void mesh_table_free(struct mesh_table *tbl, bool free_leafs)
 	__mesh_table_free(tbl);
 }
 
-static int mesh_table_grow(struct mesh_table *oldtbl,
-			   struct mesh_table *newtbl)
+static void mesh_table_free_rcu(struct rcu_head *rcu)
+{
+	struct mesh_table *tbl = container_of(rcu, struct mesh_table, rcu_head);
+
+	mesh_table_free(tbl, false);
+}
+
+static u32 mesh_table_hash(u8 *addr, struct ieee80211_sub_if_data *sdata,
+			   struct mesh_table *tbl)
+{
+	/* Hash all six octets of the hw addr and the interface index.  The
+	 * seed is inherited when the table grows, so doubling the table splits
+	 * old bucket i into new buckets i and i + old size and nothing else.
+	 */
+	return jhash_3words(get_unaligned((u32 *)addr),
+			    get_unaligned((u16 *)(addr + 4)),
+			    sdata->dev->ifindex, tbl->hash_rnd)
+		& tbl->hash_mask;
+}
+
+static int mesh_nodes_alloc(struct hlist_head *spare, int count, gfp_t gfp)
+{
+	struct mpath_node *node;
+
+	while (count--) {
+		node = kmalloc(sizeof(struct mpath_node), gfp);
+		if (!node)
+			return -ENOMEM;
+		hlist_add_head(&node->list, spare);
+	}
+	return 0;
+}
+
+static void mesh_nodes_free(struct hlist_head *spare)
 {
-	struct hlist_head *oldhash;
+	struct mpath_node *node;
 	struct hlist_node *p, *q;
-	int i;
 
-	if (atomic_read(&oldtbl->entries)
+	hlist_for_each_entry_safe(node, p, q, spare, list) {
+		hlist_del(&node->list);
+		kfree(node);
+	}
+}
+
+static int mesh_bucket_len(struct mesh_table *tbl, u32 idx)
+{
+	struct hlist_node *p;
+	int len = 0;
+
+	hlist_for_each(p, &tbl->hash_buckets[idx])
+		len++;
+	return len;
+}
+
+/**
+ * mesh_table_migrate_bucket - move one bucket of a table being resized
+ *
+ * @oldtbl: table being replaced
+ * @newtbl: table replacing it
+ * @idx: bucket of @oldtbl to move
+ * @spare: preallocated nodes, at least as many as there are in the bucket
+ *
+ * Returns: number of paths moved
+ *
+ * The nodes are linked into @newtbl before they are unlinked from @oldtbl,
+ * see for_each_mesh_table().
+ *
+ * Locking: the hashwlock of bucket @idx of @oldtbl must be held.  The locks of
+ * the destination buckets are taken here, so the lock order is always old
+ * table bucket first.
+ */
+static int mesh_table_migrate_bucket(struct mesh_table *oldtbl,
+				     struct mesh_table *newtbl, u32 idx,
+				     struct hlist_head *spare)
+{
+	struct hlist_head *bucket = &oldtbl->hash_buckets[idx];
+	struct mpath_node *node, *new_node;
+	struct hlist_node *p, *q;
+	u32 hash_idx;
+	int moved = 0;
+
+	hlist_for_each_entry(node, p, bucket, list) {
+		new_node = hlist_entry(spare->first, struct mpath_node, list);
+		hlist_del(&new_node->list);
+		new_node->mpath = node->mpath;
+		hash_idx = mesh_table_hash(node->mpath->dst,
+					   node->mpath->sdata, newtbl);
+		spin_lock(&newtbl->hashwlock[hash_idx]);
+		hlist_add_head_rcu(&new_node->list,
+				   &newtbl->hash_buckets[hash_idx]);
+		spin_unlock(&newtbl->hashwlock[hash_idx]);
+		moved++;
+	}
+
+	/* pairs with smp_rmb() in mpath_lookup() */
+	smp_wmb();
+
+	hlist_for_each_entry_safe(node, p, q, bucket, list) {
+		hlist_del_rcu(&node->list);
+		kfree_rcu(node, rcu);
+	}
+
+	return moved;
+}
+
+/**
+ * mesh_table_lock_old - lock the bucket of the table being replaced
+ *
+ * @tbl: current table
+ * @dst: destination the caller is about to add or delete
+ * @sdata: local subif
+ * @old_idx: set to the bucket of the old table that @dst hashes to
+ *
+ * Returns: the old table if its bucket is still locked and may still hold
+ * @dst, NULL otherwise.  The bucket must be released with
+ * mesh_table_unlock_old().
+ *
+ * Once the resize worker has allowed it, the bucket is moved to @tbl right
+ * away so the caller only has to deal with @tbl.  Until then the old bucket
+ * stays locked while the caller looks at both tables.
+ *
+ * Locking: must be called within a read rcu section.
+ */
+static struct mesh_table *mesh_table_lock_old(struct mesh_table *tbl, u8 *dst,
+					      struct ieee80211_sub_if_data *sdata,
+					      u32 *old_idx)
+{
+	struct mesh_table *oldtbl = rcu_dereference(tbl->resize_src);
+	struct hlist_head spare;
+
+	if (!oldtbl)
+		return NULL;
+
+	*old_idx = mesh_table_hash(dst, sdata, oldtbl);
+	spin_lock_bh(&oldtbl->hashwlock[*old_idx]);
+	if (!ACCESS_ONCE(tbl->migrating))
+		return oldtbl;
+
+	INIT_HLIST_HEAD(&spare);
+	if (!hlist_empty(&oldtbl->hash_buckets[*old_idx])) {
+		if (mesh_nodes_alloc(&spare,
+				     mesh_bucket_len(oldtbl, *old_idx),
+				     GFP_ATOMIC)) {
+			/* leave it to the resize worker */
+			mesh_nodes_free(&spare);
+			return oldtbl;
+		}
+		mesh_table_migrate_bucket(oldtbl, tbl, *old_idx, &spare);
+		tbl->stats->migrated_on_access++;
+	}
+	spin_unlock_bh(&oldtbl->hashwlock[*old_idx]);
+	return NULL;
+}
+
+static void mesh_table_unlock_old(struct mesh_table *oldtbl, u32 old_idx)
+{
+	if (oldtbl)
+		spin_unlock_bh(&oldtbl->hashwlock[old_idx]);
+}
+
+/**
+ * mesh_table_resize - grow a path table without stalling forwarding
+ *
+ * @ptbl: table to grow
+ *
+ * The bigger table is published right away with a pointer to the one it
+ * replaces.  Once no lookup can be using the old table alone any more, its
+ * buckets are moved over one at a time, each under its own lock only, and
+ * the old table is freed when it is empty.  If a previous resize of @ptbl
+ * did not complete, it is resumed instead.
+ */
+static void mesh_table_resize(struct mesh_table __rcu **ptbl)
+{
+	struct mesh_table *tbl, *oldtbl, *newtbl;
+	struct hlist_head spare;
+	int i, len;
+
+	mutex_lock(&pathtbl_resize_mutex);
+	tbl = resize_dereference_paths(ptbl);
+	oldtbl = rcu_dereference_protected(tbl->resize_src,
+			lockdep_is_held(&pathtbl_resize_mutex));
+	if (oldtbl) {
+		newtbl = tbl;
+		goto migrate;
+	}
+
+	oldtbl = tbl;
+	if (atomic_read(&oldtbl->stats->entries)
 			< oldtbl->mean_chain_len * (oldtbl->hash_mask + 1))
-		return -EAGAIN;
+		goto out;
+
+	newtbl = mesh_table_alloc(oldtbl->size_order + 1);
+	if (!newtbl)
+		goto out;
 
 	newtbl->free_node = oldtbl->free_node;
 	newtbl->mean_chain_len = oldtbl->mean_chain_len;
-	newtbl->copy_node = oldtbl->copy_node;
 	newtbl->known_gates = oldtbl->known_gates;
-	atomic_set(&newtbl->entries, atomic_read(&oldtbl->entries));
+	newtbl->stats = oldtbl->stats;
+	newtbl->hash_rnd = oldtbl->hash_rnd;
+	newtbl->resize_start = ktime_get();
+	rcu_assign_pointer(newtbl->resize_src, oldtbl);
+	rcu_assign_pointer(*ptbl, newtbl);
+
+	/* Wait for lookups that only know about the old table.  Until then,
+	 * adds and deletes lock the old bucket and check both tables.
+	 */
+	synchronize_rcu();
+	newtbl->migrating = true;
+
+migrate:
+	for (i = 0; i <= oldtbl->hash_mask; i++) {
+		INIT_HLIST_HEAD(&spare);
+
+		/* Nothing is ever added to the old table, so a bucket can only
+		 * shrink while its lock is dropped to allocate nodes.
+		 */
+		spin_lock_bh(&oldtbl->hashwlock[i]);
+		len = mesh_bucket_len(oldtbl, i);
+		spin_unlock_bh(&oldtbl->hashwlock[i]);
+		if (!len)
+			continue;
 
-	oldhash = oldtbl->hash_buckets;
-	for (i = 0; i <= oldtbl->hash_mask; i++)
-		hlist_for_each(p, &oldhash[i])
-			if (oldtbl->copy_node(p, newtbl) < 0)
-				goto errcopy;
+		if (mesh_nodes_alloc(&spare, len, GFP_KERNEL)) {
+			/* resumed on the next grow request */
+			mesh_nodes_free(&spare);
+			goto out;
+		}
 
-	return 0;
+		spin_lock_bh(&oldtbl->hashwlock[i]);
+		mesh_table_migrate_bucket(oldtbl, newtbl, i, &spare);
+		spin_unlock_bh(&oldtbl->hashwlock[i]);
 
-errcopy:
-	for (i = 0; i <= newtbl->hash_mask; i++) {
-		hlist_for_each_safe(p, q, &newtbl->hash_buckets[i])
-			oldtbl->free_node(p, 0);
+		mesh_nodes_free(&spare);
+		cond_resched();
 	}
-	return -ENOMEM;
-}
 
-static u32 mesh_table_hash(u8 *addr, struct ieee80211_sub_if_data *sdata,
-			   struct mesh_table *tbl)
-{
-	/* Use last four bytes of hw addr and interface index as hash index */
-	return jhash_2words(*(u32 *)(addr+2), sdata->dev->ifindex, tbl->hash_rnd)
-		& tbl->hash_mask;
-}
+	RCU_INIT_POINTER(newtbl->resize_src, NULL);
+	call_rcu(&oldtbl->rcu_head, mesh_table_free_rcu);
 
+	newtbl->stats->resizes++;
+	newtbl->stats->resize_usecs =
+		ktime_to_us(ktime_sub(ktime_get(), newtbl->resize_start));
+ out:
+	mutex_unlock(&pathtbl_resize_mutex);
+}
 
 /**
  *
@@ -329,30 +565,70 @@ static void mesh_path_move_to_queue(struct mesh_path *gate_mpath,
 }
 
 
-static struct mesh_path *mpath_lookup(struct mesh_table *tbl, u8 *dst,
-					  struct ieee80211_sub_if_data *sdata)
+static struct mpath_node *mesh_bucket_find(struct mesh_table *tbl, u32 idx,
+					   u8 *dst,
+					   struct ieee80211_sub_if_data *sdata)
 {
-	struct mesh_path *mpath;
 	struct hlist_node *n;
-	struct hlist_head *bucket;
 	struct mpath_node *node;
 
-	bucket = &tbl->hash_buckets[mesh_table_hash(dst, sdata, tbl)];
-	hlist_for_each_entry_rcu(node, n, bucket, list) {
-		mpath = node->mpath;
-		if (mpath->sdata == sdata &&
-		    ether_addr_equal(dst, mpath->dst)) {
-			if (MPATH_EXPIRED(mpath)) {
-				spin_lock_bh(&mpath->state_lock);
-				mpath->flags &= ~MESH_PATH_ACTIVE;
-				spin_unlock_bh(&mpath->state_lock);
-			}
-			return mpath;
-		}
+	hlist_for_each_entry_rcu(node, n, &tbl->hash_buckets[idx], list) {
+		if (node->mpath->sdata == sdata &&
+		    ether_addr_equal(dst, node->mpath->dst))
+			return node;
 	}
 	return NULL;
 }
 
+static struct mesh_path *mpath_lookup(struct mesh_table *tbl, u8 *dst,
+					  struct ieee80211_sub_if_data *sdata)
+{
+	struct mesh_table *oldtbl;
+	struct mesh_path *mpath;
+	struct mpath_node *node = NULL;
+	struct hlist_head spare;
+	u32 old_idx = 0;
+
+	this_cpu_inc(*tbl->stats->lookups);
+
+	oldtbl = rcu_dereference(tbl->resize_src);
+	if (oldtbl) {
+		old_idx = mesh_table_hash(dst, sdata, oldtbl);
+		node = mesh_bucket_find(oldtbl, old_idx, dst, sdata);
+		/* pairs with smp_wmb() in mesh_table_migrate_bucket() */
+		smp_rmb();
+	}
+
+	if (node && ACCESS_ONCE(tbl->migrating) &&
+	    spin_trylock_bh(&oldtbl->hashwlock[old_idx])) {
+		/* move the bucket of a path in use ahead of the resize worker,
+		 * unless someone else is busy with it
+		 */
+		INIT_HLIST_HEAD(&spare);
+		if (!mesh_nodes_alloc(&spare,
+				      mesh_bucket_len(oldtbl, old_idx),
+				      GFP_ATOMIC) &&
+		    mesh_table_migrate_bucket(oldtbl, tbl, old_idx, &spare))
+			tbl->stats->migrated_on_access++;
+		mesh_nodes_free(&spare);
+		spin_unlock_bh(&oldtbl->hashwlock[old_idx]);
+	}
+
+	if (!node)
+		node = mesh_bucket_find(tbl, mesh_table_hash(dst, sdata, tbl),
+					dst, sdata);
+	if (!node)
+		return NULL;
+
+	mpath = node->mpath;
+	if (MPATH_EXPIRED(mpath)) {
+		spin_lock_bh(&mpath->state_lock);
+		mpath->flags &= ~MESH_PATH_ACTIVE;
+		spin_unlock_bh(&mpath->state_lock);
+	}
+	return mpath;
+}
+
 /**
  * mesh_path_lookup - look up a path in the mesh path table
  * @dst: hardware address (ETH_ALEN length) of destination
@@ -380,17 +656,24 @@ struct mesh_path *mpp_path_lookup(u8 *dst, struct ieee80211_sub_if_data *sdata)
  *
  * Returns: pointer to the mesh path structure, or NULL if not found.
  *
- * Locking: must be called within a read rcu section.
+ * Locking: must be called within a read rcu section.  While the table is
+ * being resized, paths move from the smaller table to the bigger one between
+ * two calls, so walking the indexes (as the path dump does) may return a
+ * path twice or skip one.  Taking the resize mutex here would stall the dump
+ * behind the whole resize, so a dump that races with one is only
+ * approximate.
  */
 struct mesh_path *mesh_path_lookup_by_idx(int idx, struct ieee80211_sub_if_data *sdata)
 {
 	struct mesh_table *tbl = rcu_dereference(mesh_paths);
+	struct mesh_table *t;
 	struct mpath_node *node;
 	struct hlist_node *p;
 	int i;
 	int j = 0;
 
-	for_each_mesh_entry(tbl, p, node, i) {
+	for_each_mesh_table(tbl, t)
+	for_each_mesh_entry(t, p, node, i) {
 		if (sdata && node->mpath->sdata != sdata)
 			continue;
 		if (j++ == idx) {
@@ -501,14 +784,13 @@ int mesh_path_add(u8 *dst, struct ieee80211_sub_if_data *sdata)
 {
 	struct ieee80211_if_mesh *ifmsh = &sdata->u.mesh;
 	struct ieee80211_local *local = sdata->local;
-	struct mesh_table *tbl;
-	struct mesh_path *mpath, *new_mpath;
-	struct mpath_node *node, *new_node;
+	struct mesh_table *tbl, *oldtbl;
+	struct mesh_path *new_mpath;
+	struct mpath_node *new_node;
 	struct hlist_head *bucket;
-	struct hlist_node *n;
 	int grow = 0;
 	int err = 0;
-	u32 hash_idx;
+	u32 hash_idx, old_idx = 0;
 
 	if (ether_addr_equal(dst, sdata->vif.addr))
 		/* never add ourselves as neighbours */
@@ -529,7 +811,6 @@ int mesh_path_add(u8 *dst, struct ieee80211_sub_if_data *sdata)
 	if (!new_node)
 		goto err_node_alloc;
 
-	read_lock_bh(&pathtbl_resize_lock);
 	memcpy(new_mpath->dst, dst, ETH_ALEN);
 	memset(new_mpath->rann_snd_addr, 0xff, ETH_ALEN);
 	new_mpath->is_root = false;
@@ -543,30 +824,32 @@ int mesh_path_add(u8 *dst, struct ieee80211_sub_if_data *sdata)
 	spin_lock_init(&new_mpath->state_lock);
 	init_timer(&new_mpath->timer);
 
-	tbl = resize_dereference_mesh_paths();
+	rcu_read_lock();
+	tbl = rcu_dereference(mesh_paths);
+	oldtbl = mesh_table_lock_old(tbl, dst, sdata, &old_idx);
 
 	hash_idx = mesh_table_hash(dst, sdata, tbl);
 	bucket = &tbl->hash_buckets[hash_idx];
 
-	spin_lock(&tbl->hashwlock[hash_idx]);
+	spin_lock_bh(&tbl->hashwlock[hash_idx]);
 
 	err = -EEXIST;
-	hlist_for_each_entry(node, n, bucket, list) {
-		mpath = node->mpath;
-		if (mpath->sdata == sdata &&
-		    ether_addr_equal(dst, mpath->dst))
-			goto err_exists;
-	}
+	if ((oldtbl && mesh_bucket_find(oldtbl, old_idx, dst, sdata)) ||
+	    mesh_bucket_find(tbl, hash_idx, dst, sdata))
+		goto err_exists;
 
 	hlist_add_head_rcu(&new_node->list, bucket);
-	if (atomic_inc_return(&tbl->entries) >=
-	    tbl->mean_chain_len * (tbl->hash_mask + 1))
+	/* also kick the resize worker if a resize was left unfinished */
+	if (atomic_inc_return(&tbl->stats->entries) >=
+	    tbl->mean_chain_len * (tbl->hash_mask + 1) ||
+	    rcu_access_pointer(tbl->resize_src))
 		grow = 1;
 
 	mesh_paths_generation++;
 
-	spin_unlock(&tbl->hashwlock[hash_idx]);
-	read_unlock_bh(&pathtbl_resize_lock);
+	spin_unlock_bh(&tbl->hashwlock[hash_idx]);
+	mesh_table_unlock_old(oldtbl, old_idx);
+	rcu_read_unlock();
 	if (grow) {
 		set_bit(MESH_WORK_GROW_MPATH_TABLE,  &ifmsh->wrkq_flags);
 		ieee80211_queue_work(&local->hw, &sdata->work);
@@ -574,8 +857,9 @@ int mesh_path_add(u8 *dst, struct ieee80211_sub_if_data *sdata)
 	return 0;
 
 err_exists:
-	spin_unlock(&tbl->hashwlock[hash_idx]);
-	read_unlock_bh(&pathtbl_resize_lock);
+	spin_unlock_bh(&tbl->hashwlock[hash_idx]);
+	mesh_table_unlock_old(oldtbl, old_idx);
+	rcu_read_unlock();
 	kfree(new_node);
 err_node_alloc:
 	kfree(new_mpath);
@@ -584,66 +868,27 @@ err_path_alloc:
 	return err;
 }
 
-static void mesh_table_free_rcu(struct rcu_head *rcu)
-{
-	struct mesh_table *tbl = container_of(rcu, struct mesh_table, rcu_head);
-
-	mesh_table_free(tbl, false);
-}
-
 void mesh_mpath_table_grow(void)
 {
-	struct mesh_table *oldtbl, *newtbl;
-
-	write_lock_bh(&pathtbl_resize_lock);
-	oldtbl = resize_dereference_mesh_paths();
-	newtbl = mesh_table_alloc(oldtbl->size_order + 1);
-	if (!newtbl)
-		goto out;
-	if (mesh_table_grow(oldtbl, newtbl) < 0) {
-		__mesh_table_free(newtbl);
-		goto out;
-	}
-	rcu_assign_pointer(mesh_paths, newtbl);
-
-	call_rcu(&oldtbl->rcu_head, mesh_table_free_rcu);
-
- out:
-	write_unlock_bh(&pathtbl_resize_lock);
+	mesh_table_resize(&mesh_paths);
 }
 
 void mesh_mpp_table_grow(void)
 {
-	struct mesh_table *oldtbl, *newtbl;
-
-	write_lock_bh(&pathtbl_resize_lock);
-	oldtbl = resize_dereference_mpp_paths();
-	newtbl = mesh_table_alloc(oldtbl->size_order + 1);
-	if (!newtbl)
-		goto out;
-	if (mesh_table_grow(oldtbl, newtbl) < 0) {
-		__mesh_table_free(newtbl);
-		goto out;
-	}
-	rcu_assign_pointer(mpp_paths, newtbl);
-	call_rcu(&oldtbl->rcu_head, mesh_table_free_rcu);
-
- out:
-	write_unlock_bh(&pathtbl_resize_lock);
+	mesh_table_resize(&mpp_paths);
 }
 
 int mpp_path_add(u8 *dst, u8 *mpp, struct ieee80211_sub_if_data *sdata)
 {
 	struct ieee80211_if_mesh *ifmsh = &sdata->u.mesh;
 	struct ieee80211_local *local = sdata->local;
-	struct mesh_table *tbl;
-	struct mesh_path *mpath, *new_mpath;
-	struct mpath_node *node, *new_node;
+	struct mesh_table *tbl, *oldtbl;
+	struct mesh_path *new_mpath;
+	struct mpath_node *new_node;
 	struct hlist_head *bucket;
-	struct hlist_node *n;
 	int grow = 0;
 	int err = 0;
-	u32 hash_idx;
+	u32 hash_idx, old_idx = 0;
 
 	if (ether_addr_equal(dst, sdata->vif.addr))
 		/* never add ourselves as neighbours */
@@ -661,7 +906,6 @@ int mpp_path_add(u8 *dst, u8 *mpp, struct ieee80211_sub_if_data *sdata)
 	if (!new_node)
 		goto err_node_alloc;
 
-	read_lock_bh(&pathtbl_resize_lock);
 	memcpy(new_mpath->dst, dst, ETH_ALEN);
 	memcpy(new_mpath->mpp, mpp, ETH_ALEN);
 	new_mpath->sdata = sdata;
@@ -672,28 +916,30 @@ int mpp_path_add(u8 *dst, u8 *mpp, struct ieee80211_sub_if_data *sdata)
 	new_mpath->exp_time = jiffies;
 	spin_lock_init(&new_mpath->state_lock);
 
-	tbl = resize_dereference_mpp_paths();
+	rcu_read_lock();
+	tbl = rcu_dereference(mpp_paths);
+	oldtbl = mesh_table_lock_old(tbl, dst, sdata, &old_idx);
 
 	hash_idx = mesh_table_hash(dst, sdata, tbl);
 	bucket = &tbl->hash_buckets[hash_idx];
 
-	spin_lock(&tbl->hashwlock[hash_idx]);
+	spin_lock_bh(&tbl->hashwlock[hash_idx]);
 
 	err = -EEXIST;
-	hlist_for_each_entry(node, n, bucket, list) {
-		mpath = node->mpath;
-		if (mpath->sdata == sdata &&
-		    ether_addr_equal(dst, mpath->dst))
-			goto err_exists;
-	}
+	if ((oldtbl && mesh_bucket_find(oldtbl, old_idx, dst, sdata)) ||
+	    mesh_bucket_find(tbl, hash_idx, dst, sdata))
+		goto err_exists;
 
 	hlist_add_head_rcu(&new_node->list, bucket);
-	if (atomic_inc_return(&tbl->entries) >=
-	    tbl->mean_chain_len * (tbl->hash_mask + 1))
+	/* also kick the resize worker if a resize was left unfinished */
+	if (atomic_inc_return(&tbl->stats->entries) >=
+	    tbl->mean_chain_len * (tbl->hash_mask + 1) ||
+	    rcu_access_pointer(tbl->resize_src))
 		grow = 1;
 
-	spin_unlock(&tbl->hashwlock[hash_idx]);
-	read_unlock_bh(&pathtbl_resize_lock);
+	spin_unlock_bh(&tbl->hashwlock[hash_idx]);
+	mesh_table_unlock_old(oldtbl, old_idx);
+	rcu_read_unlock();
 	if (grow) {
 		set_bit(MESH_WORK_GROW_MPP_TABLE,  &ifmsh->wrkq_flags);
 		ieee80211_queue_work(&local->hw, &sdata->work);
@@ -701,8 +947,9 @@ int mpp_path_add(u8 *dst, u8 *mpp, struct ieee80211_sub_if_data *sdata)
 	return 0;
 
 err_exists:
-	spin_unlock(&tbl->hashwlock[hash_idx]);
-	read_unlock_bh(&pathtbl_resize_lock);
+	spin_unlock_bh(&tbl->hashwlock[hash_idx]);
+	mesh_table_unlock_old(oldtbl, old_idx);
+	rcu_read_unlock();
 	kfree(new_node);
 err_node_alloc:
 	kfree(new_mpath);
@@ -721,7 +968,7 @@ err_path_alloc:
  */
 void mesh_plink_broken(struct sta_info *sta)
 {
-	struct mesh_table *tbl;
+	struct mesh_table *tbl, *t;
 	static const u8 bcast[ETH_ALEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 	struct mesh_path *mpath;
 	struct mpath_node *node;
@@ -732,7 +979,8 @@ void mesh_plink_broken(struct sta_info *sta)
 
 	rcu_read_lock();
 	tbl = rcu_dereference(mesh_paths);
-	for_each_mesh_entry(tbl, p, node, i) {
+	for_each_mesh_table(tbl, t)
+	for_each_mesh_entry(t, p, node, i) {
 		mpath = node->mpath;
 		if (rcu_dereference(mpath->next_hop) == sta &&
 		    mpath->flags & MESH_PATH_ACTIVE &&
@@ -760,7 +1008,10 @@ static void mesh_path_node_reclaim(struct rcu_head *rp)
 	kfree(node);
 }
 
-/* needs to be called with the corresponding hashwlock taken */
+/*
+ * needs to be called with the hashwlock of the bucket holding @node taken;
+ * @tbl is the current table even if @node still is in the one it replaces
+ */
 static void __mesh_path_del(struct mesh_table *tbl, struct mpath_node *node)
 {
 	struct mesh_path *mpath;
@@ -772,7 +1023,44 @@ static void __mesh_path_del(struct mesh_table *tbl, struct mpath_node *node)
 	hlist_del_rcu(&node->list);
 	call_rcu(&node->rcu, mesh_path_node_reclaim);
 	spin_unlock(&mpath->state_lock);
-	atomic_dec(&tbl->entries);
+	atomic_dec(&tbl->stats->entries);
+}
+
+static bool mesh_path_match_nexthop(struct mesh_path *mpath, void *data)
+{
+	return rcu_dereference(mpath->next_hop) == data;
+}
+
+static bool mesh_path_match_iface(struct mesh_path *mpath, void *data)
+{
+	return mpath->sdata == data;
+}
+
+/*
+ * Delete every path of @tbl, and of the table it is being filled from, that
+ * @match accepts.  Each bucket is walked with its lock held so that a bucket
+ * being moved by a resize is seen either before or after the move.
+ */
+static void table_flush(struct mesh_table *tbl,
+			bool (*match)(struct mesh_path *mpath, void *data),
+			void *data)
+{
+	struct mesh_table *t;
+	struct mpath_node *node;
+	struct hlist_node *p, *q;
+	int i;
+
+	WARN_ON(!rcu_read_lock_held());
+	for_each_mesh_table(tbl, t) {
+		for (i = 0; i <= t->hash_mask; i++) {
+			spin_lock_bh(&t->hashwlock[i]);
+			hlist_for_each_entry_safe(node, p, q,
+						  &t->hash_buckets[i], list)
+				if (match(node->mpath, data))
+					__mesh_path_del(tbl, node);
+			spin_unlock_bh(&t->hashwlock[i]);
+		}
+	}
 }
 
 /**
@@ -788,46 +1076,11 @@ static void __mesh_path_del(struct mesh_table *tbl, struct mpath_node *node)
  */
 void mesh_path_flush_by_nexthop(struct sta_info *sta)
 {
-	struct mesh_table *tbl;
-	struct mesh_path *mpath;
-	struct mpath_node *node;
-	struct hlist_node *p;
-	int i;
-
 	rcu_read_lock();
-	read_lock_bh(&pathtbl_resize_lock);
-	tbl = resize_dereference_mesh_paths();
-	for_each_mesh_entry(tbl, p, node, i) {
-		mpath = node->mpath;
-		if (rcu_dereference(mpath->next_hop) == sta) {
-			spin_lock(&tbl->hashwlock[i]);
-			__mesh_path_del(tbl, node);
-			spin_unlock(&tbl->hashwlock[i]);
-		}
-	}
-	read_unlock_bh(&pathtbl_resize_lock);
+	table_flush(rcu_dereference(mesh_paths), mesh_path_match_nexthop, sta);
 	rcu_read_unlock();
 }
 
-static void table_flush_by_iface(struct mesh_table *tbl,
-				 struct ieee80211_sub_if_data *sdata)
-{
-	struct mesh_path *mpath;
-	struct mpath_node *node;
-	struct hlist_node *p;
-	int i;
-
-	WARN_ON(!rcu_read_lock_held());
-	for_each_mesh_entry(tbl, p, node, i) {
-		mpath = node->mpath;
-		if (mpath->sdata != sdata)
-			continue;
-		spin_lock_bh(&tbl->hashwlock[i]);
-		__mesh_path_del(tbl, node);
-		spin_unlock_bh(&tbl->hashwlock[i]);
-	}
-}
-
 /**
  * mesh_path_flush_by_iface - Deletes all mesh paths associated with a given iface
  *
@@ -838,15 +1091,9 @@ static void table_flush_by_iface(struct mesh_table *tbl,
  */
 void mesh_path_flush_by_iface(struct ieee80211_sub_if_data *sdata)
 {
-	struct mesh_table *tbl;
-
 	rcu_read_lock();
-	read_lock_bh(&pathtbl_resize_lock);
-	tbl = resize_dereference_mesh_paths();
-	table_flush_by_iface(tbl, sdata);
-	tbl = resize_dereference_mpp_paths();
-	table_flush_by_iface(tbl, sdata);
-	read_unlock_bh(&pathtbl_resize_lock);
+	table_flush(rcu_dereference(mesh_paths), mesh_path_match_iface, sdata);
+	table_flush(rcu_dereference(mpp_paths), mesh_path_match_iface, sdata);
 	rcu_read_unlock();
 }
 
@@ -860,34 +1107,30 @@ void mesh_path_flush_by_iface(struct ieee80211_sub_if_data *sdata)
  */
 int mesh_path_del(u8 *addr, struct ieee80211_sub_if_data *sdata)
 {
-	struct mesh_table *tbl;
-	struct mesh_path *mpath;
-	struct mpath_node *node;
-	struct hlist_head *bucket;
-	struct hlist_node *n;
-	int hash_idx;
+	struct mesh_table *tbl, *oldtbl;
+	struct mpath_node *node = NULL;
+	u32 hash_idx, old_idx = 0;
 	int err = 0;
 
-	read_lock_bh(&pathtbl_resize_lock);
-	tbl = resize_dereference_mesh_paths();
+	rcu_read_lock();
+	tbl = rcu_dereference(mesh_paths);
+	oldtbl = mesh_table_lock_old(tbl, addr, sdata, &old_idx);
 	hash_idx = mesh_table_hash(addr, sdata, tbl);
-	bucket = &tbl->hash_buckets[hash_idx];
 
-	spin_lock(&tbl->hashwlock[hash_idx]);
-	hlist_for_each_entry(node, n, bucket, list) {
-		mpath = node->mpath;
-		if (mpath->sdata == sdata &&
-		    ether_addr_equal(addr, mpath->dst)) {
-			__mesh_path_del(tbl, node);
-			goto enddel;
-		}
-	}
+	spin_lock_bh(&tbl->hashwlock[hash_idx]);
+	if (oldtbl)
+		node = mesh_bucket_find(oldtbl, old_idx, addr, sdata);
+	if (!node)
+		node = mesh_bucket_find(tbl, hash_idx, addr, sdata);
+	if (node)
+		__mesh_path_del(tbl, node);
+	else
+		err = -ENXIO;
 
-	err = -ENXIO;
-enddel:
 	mesh_paths_generation++;
-	spin_unlock(&tbl->hashwlock[hash_idx]);
-	read_unlock_bh(&pathtbl_resize_lock);
+	spin_unlock_bh(&tbl->hashwlock[hash_idx]);
+	mesh_table_unlock_old(oldtbl, old_idx);
+	rcu_read_unlock();
 	return err;
 }
 
@@ -1024,25 +1267,6 @@ static void mesh_path_node_free(struct hlist_node *p, bool free_leafs)
 	kfree(node);
 }
 
-static int mesh_path_node_copy(struct hlist_node *p, struct mesh_table *newtbl)
-{
-	struct mesh_path *mpath;
-	struct mpath_node *node, *new_node;
-	u32 hash_idx;
-
-	new_node = kmalloc(sizeof(struct mpath_node), GFP_ATOMIC);
-	if (new_node == NULL)
-		return -ENOMEM;
-
-	node = hlist_entry(p, struct mpath_node, list);
-	mpath = node->mpath;
-	new_node->mpath = mpath;
-	hash_idx = mesh_table_hash(mpath->dst, mpath->sdata, newtbl);
-	hlist_add_head(&new_node->list,
-			&newtbl->hash_buckets[hash_idx]);
-	return 0;
-}
-
 int mesh_pathtbl_init(void)
 {
 	struct mesh_table *tbl_path, *tbl_mpp;
@@ -1052,7 +1276,7 @@ int mesh_pathtbl_init(void)
 	if (!tbl_path)
 		return -ENOMEM;
 	tbl_path->free_node = &mesh_path_node_free;
-	tbl_path->copy_node = &mesh_path_node_copy;
+	tbl_path->stats = &mesh_paths_stats;
 	tbl_path->mean_chain_len = MEAN_CHAIN_LEN;
 	tbl_path->known_gates = kzalloc(sizeof(struct hlist_head), GFP_ATOMIC);
 	if (!tbl_path->known_gates) {
@@ -1068,7 +1292,7 @@ int mesh_pathtbl_init(void)
 		goto free_path;
 	}
 	tbl_mpp->free_node = &mesh_path_node_free;
-	tbl_mpp->copy_node = &mesh_path_node_copy;
+	tbl_mpp->stats = &mpp_paths_stats;
 	tbl_mpp->mean_chain_len = MEAN_CHAIN_LEN;
 	tbl_mpp->known_gates = kzalloc(sizeof(struct hlist_head), GFP_ATOMIC);
 	if (!tbl_mpp->known_gates) {
@@ -1092,7 +1316,7 @@ free_path:
 
 void mesh_path_expire(struct ieee80211_sub_if_data *sdata)
 {
-	struct mesh_table *tbl;
+	struct mesh_table *tbl, *t;
 	struct mesh_path *mpath;
 	struct mpath_node *node;
 	struct hlist_node *p;
@@ -1100,7 +1324,8 @@ void mesh_path_expire(struct ieee80211_sub_if_data *sdata)
 
 	rcu_read_lock();
 	tbl = rcu_dereference(mesh_paths);
-	for_each_mesh_entry(tbl, p, node, i) {
+	for_each_mesh_table(tbl, t)
+	for_each_mesh_entry(t, p, node, i) {
 		if (node->mpath->sdata != sdata)
 			continue;
 		mpath = node->mpath;
@@ -1118,3 +1343,55 @@ void mesh_pathtbl_unregister(void)
 	mesh_table_free(rcu_dereference_protected(mesh_paths, 1), true);
 	mesh_table_free(rcu_dereference_protected(mpp_paths, 1), true);
 }
+
+/**
+ * mesh_pathtbl_stats_fmt - format the statistics of a path table
+ *
+ * @mpp: true for the mesh portal table, false for the mesh path table
+ * @buf: output buffer
+ * @buflen: size of @buf
+ *
+ * Returns: number of characters written to @buf
+ *
+ * The lookup rate is sampled over the time since it was last read, but at
+ * least one second.
+ */
+int mesh_pathtbl_stats_fmt(bool mpp, char *buf, int buflen)
+{
+	struct mesh_table_stats *stats;
+	struct mesh_table *tbl;
+	unsigned long elapsed, lookups = 0;
+	unsigned int buckets, entries;
+	bool resizing;
+	int cpu;
+
+	rcu_read_lock();
+	tbl = mpp ? rcu_dereference(mpp_paths) : rcu_dereference(mesh_paths);
+	stats = tbl->stats;
+	buckets = tbl->hash_mask + 1;
+	resizing = rcu_access_pointer(tbl->resize_src) != NULL;
+	rcu_read_unlock();
+
+	entries = atomic_read(&stats->entries);
+	for_each_possible_cpu(cpu)
+		lookups += *per_cpu_ptr(stats->lookups, cpu);
+	elapsed = jiffies - stats->rate_time;
+	if (elapsed >= HZ) {
+		stats->lookup_rate = (lookups - stats->rate_lookups) * HZ /
+				     elapsed;
+		stats->rate_lookups = lookups;
+		stats->rate_time = jiffies;
+	}
+
+	return scnprintf(buf, buflen,
+			 "entries: %u\nbuckets: %u%s\n"
+			 "load_factor: %u.%02u\n"
+			 "lookups: %lu (%lu/s)\n"
+			 "resizes: %u (last %u us)\n"
+			 "migrated_on_access: %u\n",
+			 entries, buckets, resizing ? " (resizing)" : "",
+			 entries / buckets, entries * 100 / buckets % 100,
+			 lookups, stats->lookup_rate,
+			 stats->resizes, stats->resize_usecs,
+			 stats->migrated_on_access);
+}
@@ -1040,7 +1040,6 @@ void ieee80211_dynamic_ps_enable_work(struct work_struct *work)
 			     dynamic_ps_enable_work);
 	struct ieee80211_sub_if_data *sdata = local->ps_sdata;
 	struct ieee80211_if_managed *ifmgd;
-	unsigned long flags;
 	int q;
 
 	/* can only happen when PS was just disabled anyway */
@@ -1067,18 +1066,14 @@ void ieee80211_dynamic_ps_enable_work(struct work_struct *work)
 		 * dynamic_ps_timer expiry. Postpone the ps timer if it
 		 * is not the actual idle state.
 		 */
-		spin_lock_irqsave(&local->queue_stop_reason_lock, flags);
 		for (q = 0; q < local->hw.queues; q++) {
-			if (local->queue_stop_reasons[q]) {
-				spin_unlock_irqrestore(&local->queue_stop_reason_lock,
-						       flags);
+			if (ACCESS_ONCE(local->queue_stop_reasons[q])) {
 				mod_timer(&local->dynamic_ps_timer, jiffies +
 					  msecs_to_jiffies(
 					  local->hw.conf.dynamic_ps_timeout));
 				return;
 			}
 		}
-		spin_unlock_irqrestore(&local->queue_stop_reason_lock, flags);
 	}
 
 	if ((local->hw.flags & IEEE80211_HW_PS_NULLFUNC_STACK) &&
@@ -2339,13 +2334,7 @@ static void ieee80211_rx_mgmt_probe_resp(struct ieee80211_sub_if_data *sdata,
  *	add items it requires. It also needs to be able to tell us to
  *	look out for other vendor IEs.
  */
-static const u64 care_about_ies =
-	(1ULL << WLAN_EID_COUNTRY) |
-	(1ULL << WLAN_EID_ERP_INFO) |
-	(1ULL << WLAN_EID_CHANNEL_SWITCH) |
-	(1ULL << WLAN_EID_PWR_CONSTRAINT) |
-	(1ULL << WLAN_EID_HT_CAPABILITY) |
-	(1ULL << WLAN_EID_HT_OPERATION);
+static const u64 care_about_ies = IEEE80211_BEACON_CRC_IES;
 
 static void ieee80211_rx_mgmt_beacon(struct ieee80211_sub_if_data *sdata,
 				     struct ieee80211_mgmt *mgmt,
@@ -2357,9 +2346,10 @@ static void ieee80211_rx_mgmt_beacon(struct ieee80211_sub_if_data *sdata,
 	size_t baselen;
 	struct ieee802_11_elems elems;
 	struct ieee80211_local *local = sdata->local;
+	struct ieee80211_tim_ie *tim;
 	u32 changed = 0;
 	bool erp_valid, directed_tim = false;
-	u8 erp_value = 0;
+	u8 erp_value = 0, tim_len;
 	u32 ncrc;
 	u8 *bssid;
 
@@ -2473,14 +2463,17 @@ static void ieee80211_rx_mgmt_beacon(struct ieee80211_sub_if_data *sdata,
 	 */
 	ieee80211_sta_reset_beacon_monitor(sdata);
 
+	/*
+	 * Only the TIM is needed for every beacon, the other elements are
+	 * parsed below if the ones we care about changed.
+	 */
 	ncrc = crc32_be(0, (void *)&mgmt->u.beacon.beacon_int, 4);
-	ncrc = ieee802_11_parse_elems_crc(mgmt->u.beacon.variable,
-					  len - baselen, &elems,
-					  care_about_ies, ncrc);
+	ncrc = ieee802_11_elems_crc(mgmt->u.beacon.variable,
+				    len - baselen, care_about_ies, ncrc,
+				    &tim, &tim_len);
 
 	if (local->hw.flags & IEEE80211_HW_PS_NULLFUNC_STACK)
-		directed_tim = ieee80211_check_tim(elems.tim, elems.tim_len,
-						   ifmgd->aid);
+		directed_tim = ieee80211_check_tim(tim, tim_len, ifmgd->aid);
 
 	if (local->hw.flags & IEEE80211_HW_PS_NULLFUNC_STACK) {
 		if (directed_tim) {
@@ -2507,11 +2500,16 @@ static void ieee80211_rx_mgmt_beacon(struct ieee80211_sub_if_data *sdata,
 		}
 	}
 
-	if (ncrc == ifmgd->beacon_crc && ifmgd->beacon_crc_valid)
+	if (ncrc == ifmgd->beacon_crc && ifmgd->beacon_crc_valid) {
+		I802_DEBUG_INC(local->rx_beacons_unchanged);
 		return;
+	}
 	ifmgd->beacon_crc = ncrc;
 	ifmgd->beacon_crc_valid = true;
 
+	ieee802_11_parse_elems(mgmt->u.beacon.variable, len - baselen,
+			       &elems);
+
 	ieee80211_rx_bss_info(sdata, mgmt, len, rx_status, &elems,
 			      true);
 
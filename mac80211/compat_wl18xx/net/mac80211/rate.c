@@ -15,6 +15,7 @@
 #include "rate.h"
 #include "ieee80211_i.h"
 #include "debugfs.h"
+#include "driver-ops.h"
 
 struct rate_control_alg {
 	struct list_head list;
@@ -289,6 +290,37 @@ bool rate_control_send_low(struct ieee80211_sta *sta,
 }
 EXPORT_SYMBOL(rate_control_send_low);
 
+void rate_control_set_rate_policy(struct ieee80211_sta *pubsta,
+				  const struct ieee80211_rate_policy *policy)
+{
+	struct sta_info *sta = container_of(pubsta, struct sta_info, sta);
+
+	drv_set_rate_policy(sta->local, sta->sdata, pubsta, policy);
+}
+EXPORT_SYMBOL(rate_control_set_rate_policy);
+
+void ieee80211_report_rate_stats(struct ieee80211_hw *hw,
+				 struct ieee80211_sta *pubsta,
+				 const struct ieee80211_rate_stats *stats)
+{
+	struct ieee80211_local *local = hw_to_local(hw);
+	struct sta_info *sta = container_of(pubsta, struct sta_info, sta);
+	struct rate_control_ref *ref = sta->rate_ctrl;
+	struct ieee80211_supported_band *sband;
+
+	if (WARN_ON_ONCE(stats->n_rates > IEEE80211_RATE_STATS_MAX))
+		return;
+
+	if (!ref || !ref->ops->stats_report ||
+	    !test_sta_flag(sta, WLAN_STA_RATE_CONTROL))
+		return;
+
+	sband = local->hw.wiphy->bands[sta->sdata->vif.bss_conf.channel->band];
+	ref->ops->stats_report(ref->priv, sband, pubsta, sta->rate_ctrl_priv,
+			       stats);
+}
+EXPORT_SYMBOL(ieee80211_report_rate_stats);
+
 static bool rate_idx_match_legacy_mask(struct ieee80211_tx_rate *rate,
 				       int n_bitrates, u32 mask)
 {
@@ -500,7 +532,8 @@ int ieee80211_init_rate_ctrl_alg(struct ieee80211_local *local,
 	if (local->hw.flags & IEEE80211_HW_HAS_RATE_CONTROL) {
 		if (WARN_ON(!local->ops->set_rts_threshold))
 			return -EINVAL;
-		return 0;
+		if (!(local->hw.flags & IEEE80211_HW_RC_AGGREGATED_STATS))
+			return 0;
 	}
 
 	ref = rate_control_alloc(name, local);
@@ -510,6 +543,30 @@ int ieee80211_init_rate_ctrl_alg(struct ieee80211_local *local,
 		return -ENOENT;
 	}
 
+	/*
+	 * Hardware doing its own rate selection can only make use of
+	 * algorithms consuming aggregated statistics, run without one
+	 * otherwise.
+	 */
+	if ((local->hw.flags & IEEE80211_HW_HAS_RATE_CONTROL) &&
+	    !ref->ops->stats_report) {
+		wiphy_debug(local->hw.wiphy,
+			    "Rate control algorithm '%s' needs per-frame status, not using it\n",
+			    ref->ops->name);
+		rate_control_free(ref);
+		return 0;
+	}
+
+	/* nor can the others drive an algorithm that never selects rates */
+	if (!(local->hw.flags & IEEE80211_HW_HAS_RATE_CONTROL) &&
+	    ref->ops->stats_report) {
+		wiphy_warn(local->hw.wiphy,
+			   "Rate control algorithm '%s' needs aggregated statistics\n",
+			   ref->ops->name);
+		rate_control_free(ref);
+		return -ENOENT;
+	}
+
 	WARN_ON(local->rate_ctrl);
 	local->rate_ctrl = ref;
 
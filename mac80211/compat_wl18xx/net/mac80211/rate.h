@@ -41,6 +41,10 @@ static inline void rate_control_tx_status(struct ieee80211_local *local,
 	if (!ref || !test_sta_flag(sta, WLAN_STA_RATE_CONTROL))
 		return;
 
+	/* per-frame status is meaningless if the hardware selected the rate */
+	if (local->hw.flags & IEEE80211_HW_HAS_RATE_CONTROL)
+		return;
+
 	ref->ops->tx_status(ref->priv, sband, ista, priv_sta, skb);
 }
 
@@ -158,5 +162,18 @@ static inline void rc80211_minstrel_ht_exit(void)
 }
 #endif
 
+#ifdef CONFIG_MAC80211_RC_AIRTIME
+extern int rc80211_airtime_init(void);
+extern void rc80211_airtime_exit(void);
+#else
+static inline int rc80211_airtime_init(void)
+{
+	return 0;
+}
+static inline void rc80211_airtime_exit(void)
+{
+}
+#endif
+
 
 #endif /* IEEE80211_RATE_H */
@@ -0,0 +1,426 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Airtime based rate policies for devices doing their own rate selection.
+ *
+ * The device reports per-rate attempt/success counters aggregated over a
+ * period of time instead of per-frame tx status. From these, the delivery
+ * probability of every rate is tracked with an EWMA and multiplied with the
+ * number of frames that fit into a second of airtime at that rate. The rate
+ * with the highest expected throughput becomes the primary rate of the rate
+ * policy handed to the driver, preceded by the next faster rate so the
+ * device keeps probing upwards, and followed by the most reliable rate and
+ * the lowest rate as fallbacks.
+ *
+ * The device picks the rate of every frame from that policy, this module
+ * never selects a rate per frame itself. It is only instantiated for
+ * hardware with IEEE80211_HW_HAS_RATE_CONTROL, for which mac80211 doesn't
+ * call get_rate().
+ */
+#include <linux/netdevice.h>
+#include <linux/types.h>
+#include <linux/skbuff.h>
+#include <linux/debugfs.h>
+#include <linux/slab.h>
+#include <linux/ieee80211.h>
+#include <net/mac80211.h>
+#include "rate.h"
+#include "rc80211_airtime.h"
+
+#define AIRTIME_PKT_SIZE	1200
+#define AIRTIME_EWMA_LEVEL	75
+
+/* average contention time (DIFS and half of CWmin) in usecs */
+#define AIRTIME_CONTENTION	100
+
+/* required throughput gain in percent before switching the primary rate */
+#define AIRTIME_HYSTERESIS	10
+
+/* tries per rate in the policy retry chain */
+#define AIRTIME_RETRIES		2
+
+/* data bits per OFDM symbol of a single stream, MCS 0-7 */
+static const u16 airtime_ht20_bps[8] = { 26, 52, 78, 104, 156, 208, 234, 260 };
+static const u16 airtime_ht40_bps[8] = { 54, 108, 162, 216, 324, 432, 486, 540 };
+
+static unsigned int
+airtime_ewma(unsigned int old, unsigned int new, unsigned int weight)
+{
+	return (new * (100 - weight) + old * weight) / 100;
+}
+
+/*
+ * Transmit duration of an average sized frame at an MCS rate, including
+ * the HT-mixed preamble
+ */
+static unsigned int
+airtime_ht_duration(int mcs, bool ht40, bool sgi)
+{
+	unsigned int streams = mcs / 8 + 1;
+	unsigned int bps, syms;
+
+	bps = (ht40 ? airtime_ht40_bps : airtime_ht20_bps)[mcs % 8] * streams;
+	syms = DIV_ROUND_UP(AIRTIME_PKT_SIZE << 3, bps);
+
+	/* L-STF, L-LTF, L-SIG, HT-SIG, HT-STF and one HT-LTF per stream */
+	return 32 + 4 * streams +
+	       (sgi ? DIV_ROUND_UP(syms * 18, 5) : syms << 2);
+}
+
+struct airtime_rate *
+airtime_find_rate(struct airtime_sta *as, const struct ieee80211_tx_rate *rate)
+{
+	int i;
+
+	for (i = 0; i < as->n_rates; i++) {
+		struct airtime_rate *r = &as->rates[i];
+
+		if (r->idx == rate->idx &&
+		    !((r->flags ^ rate->flags) & IEEE80211_TX_RC_MCS))
+			return r;
+	}
+
+	return NULL;
+}
+
+int
+airtime_rate_name(char *buf, const struct ieee80211_tx_rate *rate)
+{
+	return sprintf(buf, "%c%d",
+		       rate->flags & IEEE80211_TX_RC_MCS ? 'm' : 'l', rate->idx);
+}
+
+/*
+ * Set up the candidate rates of a station, sorted by decreasing airtime
+ */
+void
+airtime_sta_init(struct airtime_sta *as, struct ieee80211_supported_band *sband,
+		 struct ieee80211_sta *sta)
+{
+	struct ieee80211_sta_ht_cap *ht_cap = &sta->ht_cap;
+	struct airtime_rate *r, tmp;
+	unsigned int overhead;
+	bool ht40, sgi, erp;
+	int i, j;
+
+	memset(as, 0, offsetof(struct airtime_sta, reports));
+	as->band = sband->band;
+
+	overhead = ieee80211_frame_duration(sband->band, 10, 60, 1, 1) +
+		   AIRTIME_CONTENTION;
+
+	for (i = 0; i < sband->n_bitrates; i++) {
+		if (!rate_supported(sta, sband->band, i))
+			continue;
+
+		r = &as->rates[as->n_rates++];
+		r->idx = i;
+		erp = !!(sband->bitrates[i].flags & IEEE80211_RATE_ERP_G);
+		r->airtime = overhead +
+			ieee80211_frame_duration(sband->band, AIRTIME_PKT_SIZE,
+						 sband->bitrates[i].bitrate,
+						 erp, 1);
+	}
+
+	if (ht_cap->ht_supported) {
+		ht40 = !!(ht_cap->cap & IEEE80211_HT_CAP_SUP_WIDTH_20_40);
+		sgi = !!(ht_cap->cap & (ht40 ? IEEE80211_HT_CAP_SGI_40 :
+						IEEE80211_HT_CAP_SGI_20));
+
+		for (i = 0; i < 16; i++) {
+			if (!(ht_cap->mcs.rx_mask[i / 8] & BIT(i % 8)))
+				continue;
+
+			r = &as->rates[as->n_rates++];
+			r->idx = i;
+			r->flags = IEEE80211_TX_RC_MCS;
+			if (ht40)
+				r->flags |= IEEE80211_TX_RC_40_MHZ_WIDTH;
+			if (sgi)
+				r->flags |= IEEE80211_TX_RC_SHORT_GI;
+			r->airtime = overhead + airtime_ht_duration(i, ht40, sgi);
+		}
+	}
+
+	for (i = 1; i < as->n_rates; i++) {
+		tmp = as->rates[i];
+		for (j = i; j > 0 && as->rates[j - 1].airtime < tmp.airtime; j--)
+			as->rates[j] = as->rates[j - 1];
+		as->rates[j] = tmp;
+	}
+
+	for (i = 0; i < as->n_rates; i++)
+		as->rates[i].pps = 1000000 / as->rates[i].airtime;
+}
+
+static void
+airtime_select(struct airtime_sta *as)
+{
+	struct airtime_rate *r, *cur = &as->rates[as->max_tp];
+	int best = as->max_tp, prob = 0;
+	int i;
+
+	for (i = 0; i < as->n_rates; i++) {
+		r = &as->rates[i];
+		if (r->sampled && r->tp > as->rates[best].tp)
+			best = i;
+	}
+
+	/* only move away from a working rate for a clear improvement */
+	if (best != as->max_tp && cur->tp &&
+	    as->rates[best].tp * 100 < cur->tp * (100 + AIRTIME_HYSTERESIS))
+		best = as->max_tp;
+	as->max_tp = best;
+
+	/*
+	 * fall back to the most reliable rate not faster than the primary
+	 * one, preferring throughput among rates delivering at least 90%
+	 */
+	for (i = 1; i <= best; i++) {
+		r = &as->rates[i];
+		if (!r->sampled)
+			continue;
+
+		if (r->prob > as->rates[prob].prob ||
+		    (r->prob >= AIRTIME_FRAC(9, 10) &&
+		     r->tp > as->rates[prob].tp))
+			prob = i;
+	}
+	as->max_prob = prob;
+}
+
+static void
+airtime_set_policy_rate(struct ieee80211_rate_policy *policy, int *n,
+			struct airtime_rate *r, int count)
+{
+	int i;
+
+	for (i = 0; i < *n; i++)
+		if (policy->rates[i].idx == r->idx &&
+		    policy->rates[i].flags == r->flags)
+			return;
+
+	policy->rates[*n].idx = r->idx;
+	policy->rates[*n].flags = r->flags;
+	policy->rates[*n].count = count;
+	(*n)++;
+}
+
+/*
+ * Build the policy for the current selection; returns true if it differs
+ * from the one the driver has
+ */
+static bool
+airtime_update_policy(struct airtime_sta *as)
+{
+	struct ieee80211_rate_policy policy;
+	int n = 0;
+
+	memset(&policy, 0, sizeof(policy));
+
+	if (as->max_tp + 1 < as->n_rates)
+		airtime_set_policy_rate(&policy, &n,
+					&as->rates[as->max_tp + 1], 1);
+	airtime_set_policy_rate(&policy, &n, &as->rates[as->max_tp],
+				AIRTIME_RETRIES);
+	airtime_set_policy_rate(&policy, &n, &as->rates[as->max_prob],
+				AIRTIME_RETRIES);
+	airtime_set_policy_rate(&policy, &n, &as->rates[0], AIRTIME_RETRIES);
+
+	for (; n < IEEE80211_TX_MAX_RATES; n++)
+		policy.rates[n].idx = -1;
+
+	if (as->policy_valid && !memcmp(&policy, &as->policy, sizeof(policy)))
+		return false;
+
+	as->policy = policy;
+	as->policy_valid = true;
+	as->policy_updates++;
+	return true;
+}
+
+/*
+ * Account a statistics report and reselect the rates. Returns true if the
+ * rate policy changed.
+ */
+bool
+airtime_process_stats(struct airtime_sta *as,
+		      const struct ieee80211_rate_stats *stats)
+{
+	struct airtime_rate *r;
+	unsigned int cur_prob;
+	u32 attempts, success;
+	int i;
+
+	if (!as->n_rates)
+		return false;
+
+	as->reports++;
+
+	for (i = 0; i < as->n_rates; i++) {
+		as->rates[i].last_attempts = 0;
+		as->rates[i].last_success = 0;
+	}
+
+	for (i = 0; i < stats->n_rates; i++) {
+		attempts = stats->rates[i].attempts;
+		success = min(stats->rates[i].success, attempts);
+		if (!attempts)
+			continue;
+
+		r = airtime_find_rate(as, &stats->rates[i].rate);
+		if (!r)
+			continue;
+
+		cur_prob = div_u64((u64)success << AIRTIME_SCALE, attempts);
+		if (r->sampled)
+			r->prob = airtime_ewma(r->prob, cur_prob,
+					       AIRTIME_EWMA_LEVEL);
+		else
+			r->prob = cur_prob;
+		r->sampled = true;
+		r->tp = AIRTIME_TRUNC(r->pps * r->prob);
+
+		r->last_attempts = attempts;
+		r->last_success = success;
+		r->att_hist += attempts;
+		r->succ_hist += success;
+	}
+
+	airtime_select(as);
+	return airtime_update_policy(as);
+}
+
+static void
+airtime_stats_report(void *priv, struct ieee80211_supported_band *sband,
+		     struct ieee80211_sta *sta, void *priv_sta,
+		     const struct ieee80211_rate_stats *stats)
+{
+	struct airtime_sta *as = priv_sta;
+
+#ifdef CONFIG_MAC80211_DEBUGFS
+	airtime_trace_record(as, stats);
+#endif
+
+	if (airtime_process_stats(as, stats))
+		rate_control_set_rate_policy(sta, &as->policy);
+}
+
+static void
+airtime_tx_status(void *priv, struct ieee80211_supported_band *sband,
+		  struct ieee80211_sta *sta, void *priv_sta,
+		  struct sk_buff *skb)
+{
+	/* all feedback arrives through airtime_stats_report() */
+}
+
+static void
+airtime_get_rate(void *priv, struct ieee80211_sta *sta, void *priv_sta,
+		 struct ieee80211_tx_rate_control *txrc)
+{
+	/* never called, the device selects rates from the policy */
+}
+
+static void
+airtime_rate_init(void *priv, struct ieee80211_supported_band *sband,
+		  struct ieee80211_sta *sta, void *priv_sta)
+{
+	airtime_sta_init(priv_sta, sband, sta);
+}
+
+static void
+airtime_rate_update(void *priv, struct ieee80211_supported_band *sband,
+		    struct ieee80211_sta *sta, void *priv_sta, u32 changed)
+{
+	airtime_sta_init(priv_sta, sband, sta);
+}
+
+static void *
+airtime_alloc_sta(void *priv, struct ieee80211_sta *sta, gfp_t gfp)
+{
+	struct airtime_sta *as;
+
+	as = kzalloc(sizeof(*as), gfp);
+	if (!as)
+		return NULL;
+
+#ifdef CONFIG_MAC80211_DEBUGFS
+	as->trace = kcalloc(AIRTIME_TRACE_LEN, sizeof(*as->trace), gfp);
+	if (!as->trace) {
+		kfree(as);
+		return NULL;
+	}
+#endif
+
+	return as;
+}
+
+static void
+airtime_free_sta(void *priv, struct ieee80211_sta *sta, void *priv_sta)
+{
+	struct airtime_sta *as = priv_sta;
+
+#ifdef CONFIG_MAC80211_DEBUGFS
+	kfree(as->trace);
+#endif
+	kfree(as);
+}
+
+static void *
+airtime_alloc(struct ieee80211_hw *hw, struct dentry *debugfsdir)
+{
+	struct airtime_priv *ap;
+
+	ap = kzalloc(sizeof(*ap), GFP_KERNEL);
+	if (!ap)
+		return NULL;
+
+	ap->hw = hw;
+#ifdef CONFIG_MAC80211_DEBUGFS
+	airtime_add_debugfs(ap, debugfsdir);
+#endif
+
+	return ap;
+}
+
+static void
+airtime_free(void *priv)
+{
+#ifdef CONFIG_MAC80211_DEBUGFS
+	airtime_remove_debugfs(priv);
+#endif
+	kfree(priv);
+}
+
+static struct rate_control_ops mac80211_airtime = {
+	.name = "airtime",
+	.tx_status = airtime_tx_status,
+	.get_rate = airtime_get_rate,
+	.stats_report = airtime_stats_report,
+	.rate_init = airtime_rate_init,
+	.rate_update = airtime_rate_update,
+	.alloc_sta = airtime_alloc_sta,
+	.free_sta = airtime_free_sta,
+	.alloc = airtime_alloc,
+	.free = airtime_free,
+#ifdef CONFIG_MAC80211_DEBUGFS
+	.add_sta_debugfs = airtime_add_sta_debugfs,
+	.remove_sta_debugfs = airtime_remove_sta_debugfs,
+#endif
+};
+
+int __init
+rc80211_airtime_init(void)
+{
+	return ieee80211_rate_control_register(&mac80211_airtime);
+}
+
+void
+rc80211_airtime_exit(void)
+{
+	ieee80211_rate_control_unregister(&mac80211_airtime);
+}
@@ -0,0 +1,100 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __RC_AIRTIME_H
+#define __RC_AIRTIME_H
+
+/* legacy rates plus MCS 0-15 */
+#define AIRTIME_MAX_RATES	(12 + 16)
+
+/* scaled fraction values */
+#define AIRTIME_SCALE		16
+#define AIRTIME_FRAC(val, div)	(((val) << AIRTIME_SCALE) / (div))
+#define AIRTIME_TRUNC(val)	((val) >> AIRTIME_SCALE)
+
+/* number of reports kept per station for later replay */
+#define AIRTIME_TRACE_LEN	16
+
+struct airtime_rate {
+	/* rate as used in rate policies and statistics reports */
+	s8 idx;
+	u8 flags;
+
+	/* usecs to deliver an average sized frame, including overhead */
+	unsigned int airtime;
+
+	/* frames per second at this rate if every attempt succeeds */
+	unsigned int pps;
+
+	/* delivery probability (EWMA) and resulting frames per second */
+	unsigned int prob;
+	unsigned int tp;
+
+	/* last report and total attempts/success counters */
+	u32 last_attempts, last_success;
+	u64 att_hist, succ_hist;
+
+	bool sampled;
+};
+
+struct airtime_sta {
+	enum ieee80211_band band;
+
+	/* candidate rates, sorted by decreasing airtime */
+	int n_rates;
+	struct airtime_rate rates[AIRTIME_MAX_RATES];
+
+	/* indexes into @rates of the current selection */
+	int max_tp;
+	int max_prob;
+
+	/* policy last handed to the driver */
+	struct ieee80211_rate_policy policy;
+	bool policy_valid;
+
+	unsigned int reports;
+	unsigned int policy_updates;
+
+#ifdef CONFIG_MAC80211_DEBUGFS
+	struct dentry *dbg_stats;
+	struct dentry *dbg_trace;
+
+	/* ring of the last reports, in the order received */
+	struct ieee80211_rate_stats *trace;
+	unsigned int trace_pos;
+#endif
+};
+
+struct airtime_priv {
+	struct ieee80211_hw *hw;
+
+#ifdef CONFIG_MAC80211_DEBUGFS
+	struct dentry *dbg_replay;
+	struct mutex replay_mtx;
+	char *replay_buf;
+	size_t replay_len;
+#endif
+};
+
+void airtime_sta_init(struct airtime_sta *as,
+		      struct ieee80211_supported_band *sband,
+		      struct ieee80211_sta *sta);
+bool airtime_process_stats(struct airtime_sta *as,
+			   const struct ieee80211_rate_stats *stats);
+struct airtime_rate *airtime_find_rate(struct airtime_sta *as,
+				       const struct ieee80211_tx_rate *rate);
+int airtime_rate_name(char *buf, const struct ieee80211_tx_rate *rate);
+
+#ifdef CONFIG_MAC80211_DEBUGFS
+void airtime_trace_record(struct airtime_sta *as,
+			  const struct ieee80211_rate_stats *stats);
+void airtime_add_sta_debugfs(void *priv, void *priv_sta, struct dentry *dir);
+void airtime_remove_sta_debugfs(void *priv, void *priv_sta);
+void airtime_add_debugfs(struct airtime_priv *ap, struct dentry *dir);
+void airtime_remove_debugfs(struct airtime_priv *ap);
+#endif
+
+#endif
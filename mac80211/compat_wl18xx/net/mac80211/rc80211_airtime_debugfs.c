@@ -0,0 +1,428 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/netdevice.h>
+#include <linux/types.h>
+#include <linux/debugfs.h>
+#include <linux/ieee80211.h>
+#include <linux/slab.h>
+#include <linux/export.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <net/mac80211.h>
+#include "rate.h"
+#include "rc80211_airtime.h"
+
+#define AIRTIME_REPLAY_BUF_SIZE	(4 * PAGE_SIZE)
+
+struct airtime_debugfs_info {
+	size_t len;
+	char buf[];
+};
+
+/*
+ * Statistics reports are recorded and replayed in a line based text format:
+ *
+ *   <interval ms> <rate>:<success>/<attempts> ...
+ *
+ * where <rate> is "m<n>" for MCS n or "l<n>" for legacy rate index n of the
+ * band. A line "band <2|5>" selects the band for the lines that follow.
+ */
+static int
+airtime_trace_fmt(char *p, const struct ieee80211_rate_stats *stats)
+{
+	char *start = p;
+	int i;
+
+	p += sprintf(p, "%u", stats->interval);
+	for (i = 0; i < stats->n_rates; i++) {
+		*(p++) = ' ';
+		p += airtime_rate_name(p, &stats->rates[i].rate);
+		p += sprintf(p, ":%u/%u", stats->rates[i].success,
+			     stats->rates[i].attempts);
+	}
+	*(p++) = '\n';
+
+	return p - start;
+}
+
+static int
+airtime_trace_parse(char *line, struct ieee80211_rate_stats *stats)
+{
+	struct ieee80211_tx_rate *rate;
+	unsigned int success, attempts;
+	char *tok, kind;
+	int idx;
+
+	memset(stats, 0, sizeof(*stats));
+
+	tok = strsep(&line, " \t");
+	if (kstrtou32(tok, 0, &stats->interval))
+		return -EINVAL;
+
+	while ((tok = strsep(&line, " \t")) != NULL) {
+		if (!*tok)
+			continue;
+
+		if (stats->n_rates == IEEE80211_RATE_STATS_MAX)
+			return -E2BIG;
+
+		if (sscanf(tok, "%c%d:%u/%u", &kind, &idx, &success,
+			   &attempts) != 4 || (kind != 'm' && kind != 'l') ||
+		    idx < 0 || idx > 127)
+			return -EINVAL;
+
+		rate = &stats->rates[stats->n_rates].rate;
+		rate->idx = idx;
+		rate->flags = kind == 'm' ? IEEE80211_TX_RC_MCS : 0;
+		stats->rates[stats->n_rates].success = success;
+		stats->rates[stats->n_rates].attempts = attempts;
+		stats->n_rates++;
+	}
+
+	return 0;
+}
+
+void
+airtime_trace_record(struct airtime_sta *as,
+		     const struct ieee80211_rate_stats *stats)
+{
+	as->trace[as->trace_pos++ % AIRTIME_TRACE_LEN] = *stats;
+}
+
+static int
+airtime_policy_fmt(char *p, struct airtime_sta *as)
+{
+	char *start = p;
+	int i;
+
+	if (!as->policy_valid)
+		return sprintf(p, "-");
+
+	for (i = 0; i < IEEE80211_TX_MAX_RATES; i++) {
+		if (as->policy.rates[i].idx < 0)
+			break;
+		if (i)
+			*(p++) = ',';
+		p += airtime_rate_name(p, &as->policy.rates[i]);
+		p += sprintf(p, "(%u)", as->policy.rates[i].count);
+	}
+
+	return p - start;
+}
+
+static int
+airtime_stats_open(struct inode *inode, struct file *file)
+{
+	struct airtime_sta *as = inode->i_private;
+	struct airtime_debugfs_info *ai;
+	struct ieee80211_tx_rate rate;
+	unsigned int i, eprob;
+	char name[8], *p;
+
+	ai = kmalloc(sizeof(*ai) + 4096, GFP_KERNEL);
+	if (!ai)
+		return -ENOMEM;
+
+	file->private_data = ai;
+	p = ai->buf;
+	p += sprintf(p, "    rate  airtime  throughput  ewma prob  "
+			"last succ/attempt   success    attempts\n");
+	for (i = 0; i < as->n_rates; i++) {
+		struct airtime_rate *r = &as->rates[i];
+
+		*(p++) = (i == as->max_tp) ? 'T' : ' ';
+		*(p++) = (i == as->max_prob) ? 'P' : ' ';
+		rate.idx = r->idx;
+		rate.flags = r->flags;
+		airtime_rate_name(name, &rate);
+
+		eprob = AIRTIME_TRUNC(r->prob * 1000);
+
+		p += sprintf(p, "  %-4s  %7u  %10u     %4u.%1u   %10u(%u)"
+				"  %8llu    %8llu\n",
+			     name, r->airtime, r->tp,
+			     eprob / 10, eprob % 10,
+			     r->last_success, r->last_attempts,
+			     (unsigned long long)r->succ_hist,
+			     (unsigned long long)r->att_hist);
+	}
+
+	p += sprintf(p, "\nreports: %u  policy updates: %u\npolicy: ",
+		     as->reports, as->policy_updates);
+	p += airtime_policy_fmt(p, as);
+	*(p++) = '\n';
+	ai->len = p - ai->buf;
+
+	return nonseekable_open(inode, file);
+}
+
+static int
+airtime_trace_open(struct inode *inode, struct file *file)
+{
+	struct airtime_sta *as = inode->i_private;
+	struct airtime_debugfs_info *ai;
+	unsigned int i, start;
+	char *p;
+
+	/* worst case per report: interval plus "m127:4294967295/4294967295" */
+	ai = kmalloc(sizeof(*ai) + 16 +
+		     AIRTIME_TRACE_LEN * (12 + IEEE80211_RATE_STATS_MAX * 28),
+		     GFP_KERNEL);
+	if (!ai)
+		return -ENOMEM;
+
+	file->private_data = ai;
+	p = ai->buf;
+	p += sprintf(p, "band %d\n", as->band == IEEE80211_BAND_5GHZ ? 5 : 2);
+
+	start = as->trace_pos > AIRTIME_TRACE_LEN ?
+		as->trace_pos - AIRTIME_TRACE_LEN : 0;
+	for (i = start; i != as->trace_pos; i++)
+		p += airtime_trace_fmt(p, &as->trace[i % AIRTIME_TRACE_LEN]);
+	ai->len = p - ai->buf;
+
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t
+airtime_info_read(struct file *file, char __user *buf, size_t len,
+		  loff_t *ppos)
+{
+	struct airtime_debugfs_info *ai = file->private_data;
+
+	return simple_read_from_buffer(buf, len, ppos, ai->buf, ai->len);
+}
+
+static int
+airtime_info_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations airtime_stat_fops = {
+	.owner = THIS_MODULE,
+	.open = airtime_stats_open,
+	.read = airtime_info_read,
+	.release = airtime_info_release,
+	.llseek = no_llseek,
+};
+
+static const struct file_operations airtime_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = airtime_trace_open,
+	.read = airtime_info_read,
+	.release = airtime_info_release,
+	.llseek = no_llseek,
+};
+
+void
+airtime_add_sta_debugfs(void *priv, void *priv_sta, struct dentry *dir)
+{
+	struct airtime_sta *as = priv_sta;
+
+	as->dbg_stats = debugfs_create_file("rc_stats", S_IRUGO, dir, as,
+					    &airtime_stat_fops);
+	as->dbg_trace = debugfs_create_file("rc_trace", S_IRUGO, dir, as,
+					    &airtime_trace_fops);
+}
+
+void
+airtime_remove_sta_debugfs(void *priv, void *priv_sta)
+{
+	struct airtime_sta *as = priv_sta;
+
+	debugfs_remove(as->dbg_trace);
+	debugfs_remove(as->dbg_stats);
+}
+
+/*
+ * Trace replay
+ *
+ * Writing a recorded trace (e.g. the contents of a station's rc_trace file)
+ * to ieee80211/phyX/rc/replay feeds it to a private station supporting all
+ * rates of the band and this device's HT capabilities. Reading the file
+ * returns the decision taken after every report: the primary and fallback
+ * rates and the resulting rate policy, with changed policies marked by '*'.
+ */
+static struct ieee80211_sta *
+airtime_replay_sta(struct airtime_priv *ap, enum ieee80211_band band)
+{
+	struct ieee80211_supported_band *sband = ap->hw->wiphy->bands[band];
+	struct ieee80211_sta *sta;
+
+	if (!sband)
+		return NULL;
+
+	sta = kzalloc(sizeof(*sta), GFP_KERNEL);
+	if (!sta)
+		return NULL;
+
+	sta->supp_rates[band] = BIT(sband->n_bitrates) - 1;
+	sta->ht_cap = sband->ht_cap;
+
+	return sta;
+}
+
+static ssize_t
+airtime_replay_run(struct airtime_priv *ap, char *script)
+{
+	enum ieee80211_band band = IEEE80211_BAND_2GHZ;
+	struct ieee80211_rate_stats *stats;
+	struct ieee80211_sta *sta = NULL;
+	struct ieee80211_tx_rate rate;
+	struct airtime_sta *as;
+	char tp_name[8], prob_name[8];
+	char *line, *p, *end;
+	unsigned int n = 0;
+	bool changed;
+	int ghz, ret = 0;
+
+	as = kzalloc(sizeof(*as), GFP_KERNEL);
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+	if (!as || !stats) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (!ap->hw->wiphy->bands[band])
+		band = IEEE80211_BAND_5GHZ;
+
+	p = ap->replay_buf;
+	end = p + AIRTIME_REPLAY_BUF_SIZE - 128;
+	p += sprintf(p, "  #  primary  fallback  policy\n");
+
+	while ((line = strsep(&script, "\n")) != NULL) {
+		line = strim(line);
+		if (!*line)
+			continue;
+
+		if (sscanf(line, "band %d", &ghz) == 1) {
+			if (sta || (ghz != 2 && ghz != 5)) {
+				ret = -EINVAL;
+				goto out;
+			}
+			band = ghz == 5 ? IEEE80211_BAND_5GHZ :
+					  IEEE80211_BAND_2GHZ;
+			continue;
+		}
+
+		if (!sta) {
+			sta = airtime_replay_sta(ap, band);
+			if (!sta) {
+				ret = -EOPNOTSUPP;
+				goto out;
+			}
+			airtime_sta_init(as, ap->hw->wiphy->bands[band], sta);
+		}
+
+		ret = airtime_trace_parse(line, stats);
+		if (ret)
+			goto out;
+
+		changed = airtime_process_stats(as, stats);
+
+		if (p >= end) {
+			p += sprintf(p, "...\n");
+			break;
+		}
+
+		rate.idx = as->rates[as->max_tp].idx;
+		rate.flags = as->rates[as->max_tp].flags;
+		airtime_rate_name(tp_name, &rate);
+		rate.idx = as->rates[as->max_prob].idx;
+		rate.flags = as->rates[as->max_prob].flags;
+		airtime_rate_name(prob_name, &rate);
+
+		p += sprintf(p, "%3u  %-7s  %-8s  ", n++, tp_name, prob_name);
+		p += airtime_policy_fmt(p, as);
+		p += sprintf(p, "%s\n", changed ? " *" : "");
+	}
+
+	p += sprintf(p, "\nreports: %u  policy updates: %u\n",
+		     as->reports, as->policy_updates);
+	ap->replay_len = p - ap->replay_buf;
+
+out:
+	kfree(sta);
+	kfree(stats);
+	kfree(as);
+	return ret;
+}
+
+static ssize_t
+airtime_replay_write(struct file *file, const char __user *user_buf,
+		     size_t count, loff_t *ppos)
+{
+	struct airtime_priv *ap = file->private_data;
+	char *script;
+	ssize_t ret;
+
+	if (count > 16 * PAGE_SIZE)
+		return -E2BIG;
+
+	script = kzalloc(count + 1, GFP_KERNEL);
+	if (!script)
+		return -ENOMEM;
+
+	if (copy_from_user(script, user_buf, count)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	mutex_lock(&ap->replay_mtx);
+	ap->replay_len = 0;
+	ret = airtime_replay_run(ap, script);
+	mutex_unlock(&ap->replay_mtx);
+	if (!ret)
+		ret = count;
+
+out:
+	kfree(script);
+	return ret;
+}
+
+static ssize_t
+airtime_replay_read(struct file *file, char __user *user_buf,
+		    size_t count, loff_t *ppos)
+{
+	struct airtime_priv *ap = file->private_data;
+	ssize_t ret;
+
+	mutex_lock(&ap->replay_mtx);
+	ret = simple_read_from_buffer(user_buf, count, ppos,
+				      ap->replay_buf, ap->replay_len);
+	mutex_unlock(&ap->replay_mtx);
+
+	return ret;
+}
+
+static const struct file_operations airtime_replay_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = airtime_replay_read,
+	.write = airtime_replay_write,
+	.llseek = default_llseek,
+};
+
+void
+airtime_add_debugfs(struct airtime_priv *ap, struct dentry *dir)
+{
+	mutex_init(&ap->replay_mtx);
+	ap->replay_buf = kmalloc(AIRTIME_REPLAY_BUF_SIZE, GFP_KERNEL);
+	if (!ap->replay_buf)
+		return;
+
+	ap->dbg_replay = debugfs_create_file("replay", S_IRUSR | S_IWUSR, dir,
+					     ap, &airtime_replay_fops);
+}
+
+void
+airtime_remove_debugfs(struct airtime_priv *ap)
+{
+	debugfs_remove(ap->dbg_replay);
+	kfree(ap->replay_buf);
+}
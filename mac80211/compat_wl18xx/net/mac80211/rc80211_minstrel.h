@@ -67,6 +67,8 @@ struct minstrel_sta_info {
 #endif
 };
 
+struct minstrel_ht_bench;
+
 struct minstrel_priv {
 	struct ieee80211_hw *hw;
 	bool has_mrr;
@@ -88,6 +90,9 @@ struct minstrel_priv {
 	 */
 	u32 fixed_rate_idx;
 	struct dentry *dbg_fixed_rate;
+
+	/* minstrel_ht synthetic feedback benchmark, see rc80211_minstrel_ht_debugfs.c */
+	struct minstrel_ht_bench *ht_bench;
 #endif
 
 };
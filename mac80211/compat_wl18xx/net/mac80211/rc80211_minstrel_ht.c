@@ -36,14 +36,6 @@
 /* Transmit duration for the raw data part of an average sized packet */
 #define MCS_DURATION(streams, sgi, bps) MCS_SYMBOL_TIME(sgi, MCS_NSYMS((streams) * (bps)))
 
-/*
- * Define group sort order: HT40 -> SGI -> #streams
- */
-#define GROUP_IDX(_streams, _sgi, _ht40)	\
-	MINSTREL_MAX_STREAMS * 2 * _ht40 +	\
-	MINSTREL_MAX_STREAMS * _sgi +		\
-	_streams - 1
-
 /* MCS rate information for an MCS group */
 #define MCS_GROUP(_streams, _sgi, _ht40)				\
 	[GROUP_IDX(_streams, _sgi, _ht40)] = {				\
@@ -126,14 +118,21 @@ minstrel_get_ratestats(struct minstrel_ht_sta *mi, int index)
 }
 
 
+static inline unsigned int
+minstrel_ht_sample_skipped(struct minstrel_ht_sta *mi,
+			   struct minstrel_rate_stats *mr)
+{
+	return mi->update_seq - mr->sample_seq;
+}
+
 /*
  * Recalculate success probabilities and counters for a rate using EWMA
  */
 static void
-minstrel_calc_rate_ewma(struct minstrel_rate_stats *mr)
+minstrel_calc_rate_ewma(struct minstrel_ht_sta *mi, struct minstrel_rate_stats *mr)
 {
 	if (unlikely(mr->attempts > 0)) {
-		mr->sample_skipped = 0;
+		mr->sample_seq = mi->update_seq;
 		mr->cur_prob = MINSTREL_FRAC(mr->success, mr->attempts);
 		if (!mr->att_hist)
 			mr->probability = mr->cur_prob;
@@ -142,8 +141,6 @@ minstrel_calc_rate_ewma(struct minstrel_rate_stats *mr)
 				mr->cur_prob, EWMA_LEVEL);
 		mr->att_hist += mr->attempts;
 		mr->succ_hist += mr->success;
-	} else {
-		mr->sample_skipped++;
 	}
 	mr->last_success = mr->success;
 	mr->last_attempts = mr->attempts;
@@ -151,6 +148,29 @@ minstrel_calc_rate_ewma(struct minstrel_rate_stats *mr)
 	mr->attempts = 0;
 }
 
+/*
+ * Precompute the ideal packet rate of every supported rate for the current
+ * average A-MPDU length, so that throughput updates need no division
+ */
+static void
+minstrel_ht_update_tp_base(struct minstrel_ht_sta *mi)
+{
+	struct minstrel_mcs_group_data *mg;
+	unsigned int overhead;
+	int group, i;
+
+	overhead = mi->overhead / mi->tp_ampdu_len;
+	for (group = 0; group < ARRAY_SIZE(minstrel_mcs_groups); group++) {
+		mg = &mi->groups[group];
+		if (!mg->supported)
+			continue;
+
+		for (i = 0; i < MCS_GROUP_RATES; i++)
+			mg->tp_base[i] = 1000000 /
+				(overhead + minstrel_mcs_groups[group].duration[i]);
+	}
+}
+
 /*
  * Calculate throughput based on the average A-MPDU length, taking into account
  * the expected number of retransmissions and their expected length
@@ -158,37 +178,95 @@ minstrel_calc_rate_ewma(struct minstrel_rate_stats *mr)
 static void
 minstrel_ht_calc_tp(struct minstrel_ht_sta *mi, int group, int rate)
 {
-	struct minstrel_rate_stats *mr;
-	unsigned int usecs;
-
-	mr = &mi->groups[group].rates[rate];
+	struct minstrel_mcs_group_data *mg = &mi->groups[group];
+	struct minstrel_rate_stats *mr = &mg->rates[rate];
 
 	if (mr->probability < MINSTREL_FRAC(1, 10)) {
 		mr->cur_tp = 0;
 		return;
 	}
 
-	usecs = mi->overhead / MINSTREL_TRUNC(mi->avg_ampdu_len);
-	usecs += minstrel_mcs_groups[group].duration[rate];
-	mr->cur_tp = MINSTREL_TRUNC((1000000 / usecs) * mr->probability);
+	mr->cur_tp = MINSTREL_TRUNC(mg->tp_base[rate] * mr->probability);
+}
+
+/*
+ * Select the best throughput and probability rates within a group
+ */
+static void
+minstrel_ht_group_select(struct minstrel_ht_sta *mi, int group)
+{
+	struct minstrel_mcs_group_data *mg = &mi->groups[group];
+	struct minstrel_rate_stats *mr;
+	int cur_prob = 0, cur_prob_tp = 0, cur_tp = 0, cur_tp2 = 0;
+	int i, index;
+
+	mg->max_tp_rate = 0;
+	mg->max_tp_rate2 = 0;
+	mg->max_prob_rate = 0;
+
+	for (i = 0; i < MCS_GROUP_RATES; i++) {
+		if (!(mg->supported & BIT(i)))
+			continue;
+
+		mr = &mg->rates[i];
+		index = MCS_GROUP_RATES * group + i;
+
+		if (!mr->cur_tp)
+			continue;
+
+		/* ignore the lowest rate of each single-stream group */
+		if (!i && minstrel_mcs_groups[group].streams == 1)
+			continue;
+
+		if ((mr->cur_tp > cur_prob_tp && mr->probability >
+		     MINSTREL_FRAC(3, 4)) || mr->probability > cur_prob) {
+			mg->max_prob_rate = index;
+			cur_prob = mr->probability;
+			cur_prob_tp = mr->cur_tp;
+		}
+
+		if (mr->cur_tp > cur_tp) {
+			swap(index, mg->max_tp_rate);
+			cur_tp = mr->cur_tp;
+			mr = minstrel_get_ratestats(mi, index);
+		}
+
+		if (index >= mg->max_tp_rate)
+			continue;
+
+		if (mr->cur_tp > cur_tp2) {
+			mg->max_tp_rate2 = index;
+			cur_tp2 = mr->cur_tp;
+		}
+	}
 }
 
 /*
  * Update rate statistics and select new primary rates
  *
+ * Only rates that received tx status during the last two sampling intervals
+ * have their statistics rolled over, and only groups containing such rates
+ * are re-evaluated. If none was, the overall maximum rates are kept. A
+ * change of the average A-MPDU length affects the throughput of every rate
+ * and forces a full recalculation.
+ *
  * Rules for rate selection:
  *  - max_prob_rate must use only one stream, as a tradeoff between delivery
  *    probability and throughput during strong fluctuations
  *  - as long as the max prob rate has a probability of more than 3/4, pick
  *    higher throughput rates, even if the probablity is a bit lower
  */
-static void
+void
 minstrel_ht_update_stats(struct minstrel_priv *mp, struct minstrel_ht_sta *mi)
 {
 	struct minstrel_mcs_group_data *mg;
 	struct minstrel_rate_stats *mr;
 	int cur_prob, cur_prob_tp, cur_tp, cur_tp2;
-	int group, i, index;
+	unsigned int max_tp_rate, max_tp_rate2, max_prob_rate;
+	unsigned int ampdu_len;
+	u8 roll, recalc;
+	bool full = false, reselect;
+	int group, i;
 
 	if (mi->ampdu_packets > 0) {
 		mi->avg_ampdu_len = minstrel_ewma(mi->avg_ampdu_len,
@@ -197,70 +275,61 @@ minstrel_ht_update_stats(struct minstrel_priv *mp, struct minstrel_ht_sta *mi)
 		mi->ampdu_packets = 0;
 	}
 
+	ampdu_len = max_t(unsigned int, MINSTREL_TRUNC(mi->avg_ampdu_len), 1);
+	if (ampdu_len != mi->tp_ampdu_len) {
+		mi->tp_ampdu_len = ampdu_len;
+		minstrel_ht_update_tp_base(mi);
+		full = true;
+	}
+
+	mi->update_seq++;
 	mi->sample_slow = 0;
 	mi->sample_count = 0;
-	mi->max_tp_rate = 0;
-	mi->max_tp_rate2 = 0;
-	mi->max_prob_rate = 0;
+	reselect = full;
 
 	for (group = 0; group < ARRAY_SIZE(minstrel_mcs_groups); group++) {
-		cur_prob = 0;
-		cur_prob_tp = 0;
-		cur_tp = 0;
-		cur_tp2 = 0;
-
 		mg = &mi->groups[group];
 		if (!mg->supported)
 			continue;
 
-		mg->max_tp_rate = 0;
-		mg->max_tp_rate2 = 0;
-		mg->max_prob_rate = 0;
 		mi->sample_count++;
 
-		for (i = 0; i < MCS_GROUP_RATES; i++) {
-			if (!(mg->supported & BIT(i)))
-				continue;
-
-			mr = &mg->rates[i];
-			mr->retry_updated = false;
-			index = MCS_GROUP_RATES * group + i;
-			minstrel_calc_rate_ewma(mr);
-			minstrel_ht_calc_tp(mi, group, i);
-
-			if (!mr->cur_tp)
-				continue;
-
-			/* ignore the lowest rate of each single-stream group */
-			if (!i && minstrel_mcs_groups[group].streams == 1)
-				continue;
+		roll = (mg->changed | mg->last_changed) & mg->supported;
+		recalc = full ? mg->supported : mg->changed & mg->supported;
+		mg->last_changed = mg->changed;
+		mg->changed = 0;
 
-			if ((mr->cur_tp > cur_prob_tp && mr->probability >
-			     MINSTREL_FRAC(3, 4)) || mr->probability > cur_prob) {
-				mg->max_prob_rate = index;
-				cur_prob = mr->probability;
-				cur_prob_tp = mr->cur_tp;
-			}
+		for (i = 0; roll; i++, roll >>= 1)
+			if (roll & 1)
+				minstrel_calc_rate_ewma(mi, &mg->rates[i]);
 
-			if (mr->cur_tp > cur_tp) {
-				swap(index, mg->max_tp_rate);
-				cur_tp = mr->cur_tp;
-				mr = minstrel_get_ratestats(mi, index);
-			}
+		if (!recalc)
+			continue;
 
-			if (index >= mg->max_tp_rate)
+		reselect = true;
+		for (i = 0; i < MCS_GROUP_RATES; i++) {
+			if (!(recalc & BIT(i)))
 				continue;
 
-			if (mr->cur_tp > cur_tp2) {
-				mg->max_tp_rate2 = index;
-				cur_tp2 = mr->cur_tp;
-			}
+			mg->rates[i].retry_updated = false;
+			minstrel_ht_calc_tp(mi, group, i);
 		}
+
+		minstrel_ht_group_select(mi, group);
 	}
 
 	/* try to sample up to half of the available rates during each interval */
 	mi->sample_count *= 4;
 
+	mi->stats_update = jiffies;
+
+	/* no group maximum moved, neither can the overall ones */
+	if (!reselect)
+		return;
+
+	max_tp_rate = 0;
+	max_tp_rate2 = 0;
+	max_prob_rate = 0;
 	cur_prob = 0;
 	cur_prob_tp = 0;
 	cur_tp = 0;
@@ -273,27 +342,30 @@ minstrel_ht_update_stats(struct minstrel_priv *mp, struct minstrel_ht_sta *mi)
 		mr = minstrel_get_ratestats(mi, mg->max_prob_rate);
 		if (cur_prob_tp < mr->cur_tp &&
 		    minstrel_mcs_groups[group].streams == 1) {
-			mi->max_prob_rate = mg->max_prob_rate;
+			max_prob_rate = mg->max_prob_rate;
 			cur_prob = mr->cur_prob;
 			cur_prob_tp = mr->cur_tp;
 		}
 
 		mr = minstrel_get_ratestats(mi, mg->max_tp_rate);
 		if (cur_tp < mr->cur_tp) {
-			mi->max_tp_rate2 = mi->max_tp_rate;
+			max_tp_rate2 = max_tp_rate;
 			cur_tp2 = cur_tp;
-			mi->max_tp_rate = mg->max_tp_rate;
+			max_tp_rate = mg->max_tp_rate;
 			cur_tp = mr->cur_tp;
 		}
 
 		mr = minstrel_get_ratestats(mi, mg->max_tp_rate2);
 		if (cur_tp2 < mr->cur_tp) {
-			mi->max_tp_rate2 = mg->max_tp_rate2;
+			max_tp_rate2 = mg->max_tp_rate2;
 			cur_tp2 = mr->cur_tp;
 		}
 	}
 
-	mi->stats_update = jiffies;
+	/* rate lookups don't take a lock, never let them see a partial result */
+	mi->max_tp_rate = max_tp_rate;
+	mi->max_tp_rate2 = max_tp_rate2;
+	mi->max_prob_rate = max_prob_rate;
 }
 
 static bool
@@ -375,31 +447,33 @@ minstrel_aggr_check(struct ieee80211_sta *pubsta, struct sk_buff *skb)
 	if (skb_get_queue_mapping(skb) == IEEE80211_AC_VO)
 		return;
 
+	/* mac80211 manages the sessions from the traffic rate itself */
+	if (sta->local->hw.flags & IEEE80211_HW_TX_AMPDU_AUTO)
+		return;
+
 	ieee80211_start_tx_ba_session(pubsta, tid, 5000);
 }
 
-static void
-minstrel_ht_tx_status(void *priv, struct ieee80211_supported_band *sband,
-                      struct ieee80211_sta *sta, void *priv_sta,
-                      struct sk_buff *skb)
+/*
+ * Account tx status information for a frame. Only the raw counters are
+ * touched here, the statistics are recalculated by minstrel_ht_update_stats()
+ * once per update interval. Returns false if the frame carries no status
+ * information.
+ */
+bool
+minstrel_ht_tx_status_info(struct minstrel_ht_sta *mi,
+			   struct ieee80211_tx_info *info)
 {
-	struct minstrel_ht_sta_priv *msp = priv_sta;
-	struct minstrel_ht_sta *mi = &msp->ht;
-	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
 	struct ieee80211_tx_rate *ar = info->status.rates;
 	struct minstrel_rate_stats *rate, *rate2;
-	struct minstrel_priv *mp = priv;
 	bool last = false;
 	int group;
 	int i = 0;
 
-	if (!msp->is_ht)
-		return mac80211_minstrel.tx_status(priv, sband, sta, &msp->legacy, skb);
-
 	/* This packet was aggregated but doesn't carry status info */
 	if ((info->flags & IEEE80211_TX_CTL_AMPDU) &&
 	    !(info->flags & IEEE80211_TX_STAT_AMPDU))
-		return;
+		return false;
 
 	if (!(info->flags & IEEE80211_TX_STAT_AMPDU)) {
 		info->status.ampdu_ack_len =
@@ -428,6 +502,7 @@ minstrel_ht_tx_status(void *priv, struct ieee80211_supported_band *sband,
 
 		group = minstrel_ht_get_group_idx(&ar[i]);
 		rate = &mi->groups[group].rates[ar[i].idx % 8];
+		mi->groups[group].changed |= BIT(ar[i].idx % 8);
 
 		if (last)
 			rate->success += info->status.ampdu_ack_len;
@@ -451,6 +526,29 @@ minstrel_ht_tx_status(void *priv, struct ieee80211_supported_band *sband,
 	    MINSTREL_FRAC(20, 100))
 		minstrel_downgrade_rate(mi, &mi->max_tp_rate2, false);
 
+	return true;
+}
+
+static void
+minstrel_ht_tx_status(void *priv, struct ieee80211_supported_band *sband,
+                      struct ieee80211_sta *sta, void *priv_sta,
+                      struct sk_buff *skb)
+{
+	struct minstrel_ht_sta_priv *msp = priv_sta;
+	struct minstrel_ht_sta *mi = &msp->ht;
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+	struct minstrel_priv *mp = priv;
+
+	if (!msp->is_ht)
+		return mac80211_minstrel.tx_status(priv, sband, sta, &msp->legacy, skb);
+
+	if (!minstrel_ht_tx_status_info(mi, info))
+		return;
+
+	/*
+	 * The update runs here, serialized with the counter accounting above
+	 * by tx status, and only visits the rates that saw traffic.
+	 */
 	if (time_after(jiffies, mi->stats_update + (mp->update_interval / 2 * HZ) / 1000)) {
 		minstrel_ht_update_stats(mp, mi);
 		if (!(info->flags & IEEE80211_TX_CTL_AMPDU))
@@ -587,7 +685,7 @@ minstrel_get_sample_rate(struct minstrel_priv *mp, struct minstrel_ht_sta *mi)
 	 */
 	if (minstrel_get_duration(sample_idx) >
 	    minstrel_get_duration(mi->max_tp_rate)) {
-		if (mr->sample_skipped < 20)
+		if (minstrel_ht_sample_skipped(mi, mr) < 20)
 			return -1;
 
 		if (mi->sample_slow++ > 2)
@@ -597,31 +695,19 @@ minstrel_get_sample_rate(struct minstrel_priv *mp, struct minstrel_ht_sta *mi)
 	return sample_idx;
 }
 
-static void
-minstrel_ht_get_rate(void *priv, struct ieee80211_sta *sta, void *priv_sta,
-                     struct ieee80211_tx_rate_control *txrc)
+/*
+ * Fill in the multi-rate retry chain of a frame from the current primary
+ * rates, optionally using the frame for sampling
+ */
+void
+minstrel_ht_select_rates(struct minstrel_priv *mp, struct minstrel_ht_sta *mi,
+			 struct ieee80211_tx_info *info, bool may_sample)
 {
-	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(txrc->skb);
 	struct ieee80211_tx_rate *ar = info->status.rates;
-	struct minstrel_ht_sta_priv *msp = priv_sta;
-	struct minstrel_ht_sta *mi = &msp->ht;
-	struct minstrel_priv *mp = priv;
-	int sample_idx;
+	int sample_idx = -1;
 	bool sample = false;
 
-	if (rate_control_send_low(sta, priv_sta, txrc))
-		return;
-
-	if (!msp->is_ht)
-		return mac80211_minstrel.get_rate(priv, sta, &msp->legacy, txrc);
-
-	info->flags |= mi->tx_flags;
-
-	/* Don't use EAPOL frames for sampling on non-mrr hw */
-	if (mp->hw->max_rates == 1 &&
-	    txrc->skb->protocol == cpu_to_be16(ETH_P_PAE))
-		sample_idx = -1;
-	else
+	if (may_sample)
 		sample_idx = minstrel_get_sample_rate(mp, mi);
 
 #ifdef CONFIG_MAC80211_DEBUGFS
@@ -689,33 +775,42 @@ minstrel_ht_get_rate(void *priv, struct ieee80211_sta *sta, void *priv_sta,
 }
 
 static void
-minstrel_ht_update_caps(void *priv, struct ieee80211_supported_band *sband,
-                        struct ieee80211_sta *sta, void *priv_sta)
+minstrel_ht_get_rate(void *priv, struct ieee80211_sta *sta, void *priv_sta,
+                     struct ieee80211_tx_rate_control *txrc)
 {
-	struct minstrel_priv *mp = priv;
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(txrc->skb);
 	struct minstrel_ht_sta_priv *msp = priv_sta;
 	struct minstrel_ht_sta *mi = &msp->ht;
-	struct ieee80211_mcs_info *mcs = &sta->ht_cap.mcs;
-	u16 sta_cap = sta->ht_cap.cap;
-	int n_supported = 0;
-	int ack_dur;
-	int stbc;
-	int i;
-	unsigned int smps;
+	struct minstrel_priv *mp = priv;
 
-	/* fall back to the old minstrel for legacy stations */
-	if (!sta->ht_cap.ht_supported)
-		goto use_legacy;
+	if (rate_control_send_low(sta, priv_sta, txrc))
+		return;
 
-	BUILD_BUG_ON(ARRAY_SIZE(minstrel_mcs_groups) !=
-		MINSTREL_MAX_STREAMS * MINSTREL_STREAM_GROUPS);
+	if (!msp->is_ht)
+		return mac80211_minstrel.get_rate(priv, sta, &msp->legacy, txrc);
+
+	info->flags |= mi->tx_flags;
+
+	/* Don't use EAPOL frames for sampling on non-mrr hw */
+	minstrel_ht_select_rates(mp, mi, info,
+				 mp->hw->max_rates != 1 ||
+				 txrc->skb->protocol != cpu_to_be16(ETH_P_PAE));
+}
+
+/*
+ * Reset the per-station state, leaving all MCS groups unsupported
+ */
+void
+minstrel_ht_sta_init(struct minstrel_priv *mp, struct minstrel_ht_sta *mi,
+		     enum ieee80211_band band)
+{
+	int ack_dur;
 
-	msp->is_ht = true;
 	memset(mi, 0, sizeof(*mi));
 	mi->stats_update = jiffies;
 
-	ack_dur = ieee80211_frame_duration(sband->band, 10, 60, 1, 1);
-	mi->overhead = ieee80211_frame_duration(sband->band, 0, 60, 1, 1) + ack_dur;
+	ack_dur = ieee80211_frame_duration(band, 10, 60, 1, 1);
+	mi->overhead = ieee80211_frame_duration(band, 0, 60, 1, 1) + ack_dur;
 	mi->overhead_rtscts = mi->overhead + 2 * ack_dur;
 
 	mi->avg_ampdu_len = MINSTREL_FRAC(1, 1);
@@ -729,6 +824,31 @@ minstrel_ht_update_caps(void *priv, struct ieee80211_supported_band *sband,
 		mi->sample_wait = 8;
 	}
 	mi->sample_tries = 4;
+}
+
+static void
+minstrel_ht_update_caps(void *priv, struct ieee80211_supported_band *sband,
+                        struct ieee80211_sta *sta, void *priv_sta)
+{
+	struct minstrel_priv *mp = priv;
+	struct minstrel_ht_sta_priv *msp = priv_sta;
+	struct minstrel_ht_sta *mi = &msp->ht;
+	struct ieee80211_mcs_info *mcs = &sta->ht_cap.mcs;
+	u16 sta_cap = sta->ht_cap.cap;
+	int n_supported = 0;
+	int stbc;
+	int i;
+	unsigned int smps;
+
+	/* fall back to the old minstrel for legacy stations */
+	if (!sta->ht_cap.ht_supported)
+		goto use_legacy;
+
+	BUILD_BUG_ON(ARRAY_SIZE(minstrel_mcs_groups) !=
+		MINSTREL_MAX_STREAMS * MINSTREL_STREAM_GROUPS);
+
+	msp->is_ht = true;
+	minstrel_ht_sta_init(mp, mi, sband->band);
 
 	stbc = (sta_cap & IEEE80211_HT_CAP_RX_STBC) >>
 		IEEE80211_HT_CAP_RX_STBC_SHIFT;
@@ -847,12 +967,22 @@ minstrel_ht_free_sta(void *priv, struct ieee80211_sta *sta, void *priv_sta)
 static void *
 minstrel_ht_alloc(struct ieee80211_hw *hw, struct dentry *debugfsdir)
 {
-	return mac80211_minstrel.alloc(hw, debugfsdir);
+	struct minstrel_priv *mp;
+
+	mp = mac80211_minstrel.alloc(hw, debugfsdir);
+#ifdef CONFIG_MAC80211_DEBUGFS
+	if (mp)
+		minstrel_ht_add_bench_debugfs(mp, debugfsdir);
+#endif
+	return mp;
 }
 
 static void
 minstrel_ht_free(void *priv)
 {
+#ifdef CONFIG_MAC80211_DEBUGFS
+	minstrel_ht_remove_bench_debugfs(priv);
+#endif
 	mac80211_minstrel.free(priv);
 }
 
@@ -23,6 +23,14 @@
 
 #define MCS_GROUP_RATES	8
 
+/*
+ * Define group sort order: HT40 -> SGI -> #streams
+ */
+#define GROUP_IDX(_streams, _sgi, _ht40)	\
+	MINSTREL_MAX_STREAMS * 2 * _ht40 +	\
+	MINSTREL_MAX_STREAMS * _sgi +		\
+	_streams - 1
+
 struct mcs_group {
 	u32 flags;
 	unsigned int streams;
@@ -50,7 +58,9 @@ struct minstrel_rate_stats {
 	unsigned int retry_count_rtscts;
 
 	bool retry_updated;
-	u8 sample_skipped;
+
+	/* value of minstrel_ht_sta::update_seq when this rate was last tried */
+	unsigned int sample_seq;
 };
 
 struct minstrel_mcs_group_data {
@@ -60,6 +70,17 @@ struct minstrel_mcs_group_data {
 	/* bitfield of supported MCS rates of this group */
 	u8 supported;
 
+	/*
+	 * bitfields of rates that received tx status during the current
+	 * and the previous sampling interval; only these need their
+	 * statistics rolled over on the next update
+	 */
+	u8 changed;
+	u8 last_changed;
+
+	/* ideal packets per second for each rate at the current A-MPDU length */
+	unsigned int tp_base[MCS_GROUP_RATES];
+
 	/* selected primary rates */
 	unsigned int max_tp_rate;
 	unsigned int max_tp_rate2;
@@ -89,6 +110,12 @@ struct minstrel_ht_sta {
 	/* time of last status update */
 	unsigned long stats_update;
 
+	/* number of statistics updates so far */
+	unsigned int update_seq;
+
+	/* truncated A-MPDU length the tp_base tables were computed for */
+	unsigned int tp_ampdu_len;
+
 	/* overhead time in usec for each frame */
 	unsigned int overhead;
 	unsigned int overhead_rtscts;
@@ -127,4 +154,18 @@ struct minstrel_ht_sta_priv {
 void minstrel_ht_add_sta_debugfs(void *priv, void *priv_sta, struct dentry *dir);
 void minstrel_ht_remove_sta_debugfs(void *priv, void *priv_sta);
 
+/* entry points used by the synthetic feedback benchmark */
+void minstrel_ht_sta_init(struct minstrel_priv *mp, struct minstrel_ht_sta *mi,
+			  enum ieee80211_band band);
+void minstrel_ht_update_stats(struct minstrel_priv *mp, struct minstrel_ht_sta *mi);
+bool minstrel_ht_tx_status_info(struct minstrel_ht_sta *mi,
+				struct ieee80211_tx_info *info);
+void minstrel_ht_select_rates(struct minstrel_priv *mp, struct minstrel_ht_sta *mi,
+			      struct ieee80211_tx_info *info, bool may_sample);
+
+#ifdef CONFIG_MAC80211_DEBUGFS
+void minstrel_ht_add_bench_debugfs(struct minstrel_priv *mp, struct dentry *dir);
+void minstrel_ht_remove_bench_debugfs(struct minstrel_priv *mp);
+#endif
+
 #endif
@@ -11,6 +11,10 @@
 #include <linux/debugfs.h>
 #include <linux/ieee80211.h>
 #include <linux/export.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
 #include <net/mac80211.h>
 #include "rc80211_minstrel.h"
 #include "rc80211_minstrel_ht.h"
@@ -118,3 +122,348 @@ minstrel_ht_remove_sta_debugfs(void *priv, void *priv_sta)
 
 	debugfs_remove(msp->dbg_stats);
 }
+
+/*
+ * Synthetic feedback benchmark
+ *
+ * Writing a script to ieee80211/phyX/rc/ht_bench drives a private station
+ * through the rate selection and tx status code with simulated feedback.
+ * The script consists of segments separated by newlines or ';', each of the
+ * form "<frames> <p0> <p1> ...", where pN is the per-attempt delivery
+ * probability in percent of MCS N (missing values are 0). Reading the file
+ * returns the report of the last run: CPU time spent per tx status and per
+ * statistics update, and for every segment how long (in simulated airtime)
+ * it took until the best throughput rate was selected.
+ */
+#define MINSTREL_HT_BENCH_SEGMENTS	16
+#define MINSTREL_HT_BENCH_MAX_FRAMES	1000000
+#define MINSTREL_HT_BENCH_MCS		(MINSTREL_MAX_STREAMS * MCS_GROUP_RATES)
+
+struct minstrel_ht_bench_seg {
+	unsigned int frames;
+	u8 prob[MINSTREL_HT_BENCH_MCS];
+};
+
+struct minstrel_ht_bench {
+	struct mutex mtx;
+	struct dentry *dbg;
+	size_t len;
+	char buf[4096];
+};
+
+static u32
+minstrel_ht_bench_rand(u32 *state)
+{
+	*state = *state * 1664525 + 1013904223;
+	return *state >> 16;
+}
+
+static unsigned int
+minstrel_ht_bench_airtime(struct minstrel_ht_sta *mi, int index)
+{
+	const struct mcs_group *group = &minstrel_mcs_groups[index / MCS_GROUP_RATES];
+
+	return mi->overhead + group->duration[index % MCS_GROUP_RATES];
+}
+
+static unsigned int
+minstrel_ht_bench_tp(struct minstrel_ht_sta *mi,
+		     struct minstrel_ht_bench_seg *seg, int index)
+{
+	int mcs = (minstrel_mcs_groups[index / MCS_GROUP_RATES].streams - 1) *
+		  MCS_GROUP_RATES + index % MCS_GROUP_RATES;
+
+	return 10000000 / minstrel_ht_bench_airtime(mi, index) * seg->prob[mcs];
+}
+
+static int
+minstrel_ht_bench_rate_name(char *p, int index)
+{
+	const struct mcs_group *group = &minstrel_mcs_groups[index / MCS_GROUP_RATES];
+
+	return sprintf(p, "HT%c0/%cGI MCS%-2u",
+		       group->flags & IEEE80211_TX_RC_40_MHZ_WIDTH ? '4' : '2',
+		       group->flags & IEEE80211_TX_RC_SHORT_GI ? 'S' : 'L',
+		       (group->streams - 1) * MCS_GROUP_RATES +
+		       index % MCS_GROUP_RATES);
+}
+
+/*
+ * Simulate the transmission of a frame along its retry chain. Returns the
+ * airtime used in usecs.
+ */
+static unsigned int
+minstrel_ht_bench_tx(struct minstrel_ht_sta *mi, struct minstrel_ht_bench_seg *seg,
+		     struct ieee80211_tx_info *info, u32 *rnd)
+{
+	struct ieee80211_tx_rate *ar = info->status.rates;
+	unsigned int airtime = 0;
+	int i, j, t, group, index;
+
+	for (i = 0; i < IEEE80211_TX_MAX_RATES; i++) {
+		if (ar[i].idx < 0 || !ar[i].count)
+			break;
+
+		group = GROUP_IDX(ar[i].idx / MCS_GROUP_RATES + 1,
+				  !!(ar[i].flags & IEEE80211_TX_RC_SHORT_GI),
+				  !!(ar[i].flags & IEEE80211_TX_RC_40_MHZ_WIDTH));
+		index = group * MCS_GROUP_RATES + ar[i].idx % MCS_GROUP_RATES;
+
+		for (t = 0; t < ar[i].count; t++) {
+			airtime += minstrel_ht_bench_airtime(mi, index);
+			if (minstrel_ht_bench_rand(rnd) % 100 >= seg->prob[ar[i].idx])
+				continue;
+
+			ar[i].count = t + 1;
+			for (j = i + 1; j < IEEE80211_TX_MAX_RATES; j++) {
+				ar[j].idx = -1;
+				ar[j].count = 0;
+			}
+			info->flags |= IEEE80211_TX_STAT_ACK;
+			return airtime;
+		}
+	}
+
+	return airtime;
+}
+
+static void
+minstrel_ht_bench_run(struct minstrel_priv *mp, struct minstrel_ht_bench *bench,
+		      struct minstrel_ht_bench_seg *segs, int n_segs, int n_mcs)
+{
+	struct ieee80211_supported_band *sband = NULL;
+	struct ieee80211_tx_info info;
+	struct minstrel_ht_sta *mi;
+	u64 status_ns = 0, update_ns = 0;
+	unsigned int n_status = 0, n_updates = 0;
+	unsigned long now = 0, last_update = 0, interval;
+	unsigned int best_tp, frame;
+	int seg, group, i, best, conv_frame;
+	unsigned long conv_time, seg_start;
+	u32 rnd = 1;
+	ktime_t t;
+	char *p = bench->buf;
+
+	for (i = 0; i < IEEE80211_NUM_BANDS && !sband; i++)
+		sband = mp->hw->wiphy->bands[i];
+
+	mi = kzalloc(sizeof(*mi), GFP_KERNEL);
+	if (!sband || !mi) {
+		kfree(mi);
+		bench->len = sprintf(p, "unable to set up station\n");
+		return;
+	}
+
+	minstrel_ht_sta_init(mp, mi, sband->band);
+	for (group = 0; group < ARRAY_SIZE(minstrel_mcs_groups); group++)
+		if ((minstrel_mcs_groups[group].streams - 1) * MCS_GROUP_RATES < n_mcs)
+			mi->groups[group].supported = 0xff;
+
+	/* statistics update interval in usecs of simulated airtime */
+	interval = mp->update_interval / 2 * 1000;
+
+	p += sprintf(p, "segment  frames    best rate          "
+			"converged after (ms / frames)\n");
+	for (seg = 0; seg < n_segs; seg++) {
+		best = 0;
+		best_tp = 0;
+		for (i = 0; i < ARRAY_SIZE(mi->groups) * MCS_GROUP_RATES; i++) {
+			if (!mi->groups[i / MCS_GROUP_RATES].supported)
+				continue;
+			if (minstrel_ht_bench_tp(mi, &segs[seg], i) > best_tp) {
+				best = i;
+				best_tp = minstrel_ht_bench_tp(mi, &segs[seg], i);
+			}
+		}
+
+		conv_frame = -1;
+		conv_time = 0;
+		seg_start = now;
+		for (frame = 0; frame < segs[seg].frames; frame++) {
+			memset(&info, 0, sizeof(info));
+			minstrel_ht_select_rates(mp, mi, &info, true);
+			now += minstrel_ht_bench_tx(mi, &segs[seg], &info, &rnd);
+
+			t = ktime_get();
+			minstrel_ht_tx_status_info(mi, &info);
+			status_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+			n_status++;
+
+			if (now - last_update >= interval) {
+				t = ktime_get();
+				minstrel_ht_update_stats(mp, mi);
+				update_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+				n_updates++;
+				last_update = now;
+			}
+
+			if (conv_frame < 0 &&
+			    minstrel_ht_bench_tp(mi, &segs[seg], mi->max_tp_rate) == best_tp) {
+				conv_frame = frame;
+				conv_time = now - seg_start;
+			}
+
+			if (!(frame % 1024))
+				cond_resched();
+		}
+
+		p += sprintf(p, "%-7d  %-8u  ", seg, segs[seg].frames);
+		p += minstrel_ht_bench_rate_name(p, best);
+		if (conv_frame < 0)
+			p += sprintf(p, "   not converged\n");
+		else
+			p += sprintf(p, "   %lu.%03lu / %d\n", conv_time / 1000,
+				     conv_time % 1000, conv_frame);
+	}
+
+	do_div(status_ns, max(n_status, 1U));
+	do_div(update_ns, max(n_updates, 1U));
+	p += sprintf(p, "\ntx status: %u calls, %llu ns/call\n", n_status,
+		     (unsigned long long)status_ns);
+	p += sprintf(p, "stats update: %u calls, %llu ns/call\n", n_updates,
+		     (unsigned long long)update_ns);
+	bench->len = p - bench->buf;
+
+	kfree(mi);
+}
+
+static int
+minstrel_ht_bench_parse(char *script, struct minstrel_ht_bench_seg *segs,
+			int *n_mcs)
+{
+	unsigned int frames = 0, val;
+	char *line, *tok;
+	int n_segs = 0, i;
+
+	*n_mcs = 0;
+	while ((line = strsep(&script, "\n;")) != NULL) {
+		tok = strsep(&line, " \t");
+		while (tok && !*tok)
+			tok = strsep(&line, " \t");
+		if (!tok)
+			continue;
+
+		if (n_segs == MINSTREL_HT_BENCH_SEGMENTS)
+			return -E2BIG;
+
+		if (kstrtouint(tok, 0, &segs[n_segs].frames) ||
+		    !segs[n_segs].frames)
+			return -EINVAL;
+
+		frames += segs[n_segs].frames;
+		if (frames > MINSTREL_HT_BENCH_MAX_FRAMES)
+			return -E2BIG;
+
+		i = 0;
+		while ((tok = strsep(&line, " \t")) != NULL) {
+			if (!*tok)
+				continue;
+			if (i == MINSTREL_HT_BENCH_MCS ||
+			    kstrtouint(tok, 0, &val) || val > 100)
+				return -EINVAL;
+			segs[n_segs].prob[i++] = val;
+		}
+		*n_mcs = max(*n_mcs, i);
+		n_segs++;
+	}
+
+	return n_segs;
+}
+
+static ssize_t
+minstrel_ht_bench_write(struct file *file, const char __user *user_buf,
+			size_t count, loff_t *ppos)
+{
+	struct minstrel_priv *mp = file->private_data;
+	struct minstrel_ht_bench *bench = mp->ht_bench;
+	struct minstrel_ht_bench_seg *segs;
+	char *script;
+	int n_segs, n_mcs;
+	ssize_t ret;
+
+	if (mp->fixed_rate_idx != -1)
+		return -EBUSY;
+
+	if (count >= PAGE_SIZE)
+		return -E2BIG;
+
+	script = kzalloc(count + 1, GFP_KERNEL);
+	segs = kcalloc(MINSTREL_HT_BENCH_SEGMENTS, sizeof(*segs), GFP_KERNEL);
+	if (!script || !segs) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(script, user_buf, count)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	n_segs = minstrel_ht_bench_parse(script, segs, &n_mcs);
+	if (n_segs <= 0 || !n_mcs) {
+		ret = n_segs < 0 ? n_segs : -EINVAL;
+		goto out;
+	}
+
+	mutex_lock(&bench->mtx);
+	minstrel_ht_bench_run(mp, bench, segs, n_segs, n_mcs);
+	mutex_unlock(&bench->mtx);
+	ret = count;
+
+out:
+	kfree(segs);
+	kfree(script);
+	return ret;
+}
+
+static ssize_t
+minstrel_ht_bench_read(struct file *file, char __user *user_buf,
+		       size_t count, loff_t *ppos)
+{
+	struct minstrel_priv *mp = file->private_data;
+	struct minstrel_ht_bench *bench = mp->ht_bench;
+	ssize_t ret;
+
+	mutex_lock(&bench->mtx);
+	ret = simple_read_from_buffer(user_buf, count, ppos,
+				      bench->buf, bench->len);
+	mutex_unlock(&bench->mtx);
+
+	return ret;
+}
+
+static const struct file_operations minstrel_ht_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = minstrel_ht_bench_read,
+	.write = minstrel_ht_bench_write,
+	.llseek = default_llseek,
+};
+
+void
+minstrel_ht_add_bench_debugfs(struct minstrel_priv *mp, struct dentry *dir)
+{
+	struct minstrel_ht_bench *bench;
+
+	bench = kzalloc(sizeof(*bench), GFP_KERNEL);
+	if (!bench)
+		return;
+
+	mutex_init(&bench->mtx);
+	bench->dbg = debugfs_create_file("ht_bench", S_IRUSR | S_IWUSR, dir,
+					 mp, &minstrel_ht_bench_fops);
+	mp->ht_bench = bench;
+}
+
+void
+minstrel_ht_remove_bench_debugfs(struct minstrel_priv *mp)
+{
+	struct minstrel_ht_bench *bench = mp->ht_bench;
+
+	if (!bench)
+		return;
+
+	debugfs_remove(bench->dbg);
+	kfree(bench);
+	mp->ht_bench = NULL;
+}
@@ -1809,7 +1809,8 @@ ieee80211_rx_h_amsdu(struct ieee80211_rx_data *rx)
 	skb->dev = dev;
 	__skb_queue_head_init(&frame_list);
 
-	if (skb_linearize(skb))
+	/* paged data is split without copying, a frag list is not */
+	if (skb_has_frag_list(skb) && skb_linearize(skb))
 		return RX_DROP_UNUSABLE;
 
 	ieee80211_amsdu_to_8023s(skb, &frame_list, dev->dev_addr,
@@ -1819,6 +1820,12 @@ ieee80211_rx_h_amsdu(struct ieee80211_rx_data *rx)
 	while (!skb_queue_empty(&frame_list)) {
 		rx->skb = __skb_dequeue(&frame_list);
 
+		/* skb itself is only compared, it may have been consumed */
+		if (rx->skb == skb || skb_shinfo(rx->skb)->nr_frags)
+			I802_DEBUG_INC(rx->local->rx_amsdu_subframes_shared);
+		else
+			I802_DEBUG_INC(rx->local->rx_amsdu_subframes_copied);
+
 		if (!ieee80211_frame_allowed(rx, fc)) {
 			dev_kfree_skb(rx->skb);
 			continue;
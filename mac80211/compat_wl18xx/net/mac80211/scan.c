@@ -30,6 +30,42 @@
 #define IEEE80211_CHANNEL_TIME (HZ / 33)
 #define IEEE80211_PASSIVE_CHANNEL_TIME (HZ / 8)
 
+/* upper bound on a single off-channel burst while associated */
+#define IEEE80211_SCAN_MAX_BURST (HZ / 2)
+/* an AC counts as busy if it transmitted this recently before a burst */
+#define IEEE80211_SCAN_AC_ACTIVE (HZ / 2)
+/* time back on the operating channel between bursts ... */
+#define IEEE80211_SCAN_ONCHANNEL_TIME (HZ / 5)
+/* ... and how often/long it is extended while the queues still drain */
+#define IEEE80211_SCAN_EXTEND_TIME (HZ / 10)
+#define IEEE80211_SCAN_MAX_EXTENSIONS 3
+
+/*
+ * Time (in msecs) each access category tolerates being off-channel while
+ * it has traffic, and how many frames may pile up in it before we go back
+ * to the operating channel regardless.
+ */
+static const unsigned int ieee80211_scan_ac_latency[IEEE80211_NUM_ACS] = {
+	[IEEE80211_AC_VO] = 30,
+	[IEEE80211_AC_VI] = 60,
+	[IEEE80211_AC_BE] = 150,
+	[IEEE80211_AC_BK] = 300,
+};
+
+static const unsigned int ieee80211_scan_ac_max_queued[IEEE80211_NUM_ACS] = {
+	[IEEE80211_AC_VO] = 4,
+	[IEEE80211_AC_VI] = 16,
+	[IEEE80211_AC_BE] = 64,
+	[IEEE80211_AC_BK] = 128,
+};
+
+struct ieee80211_scan_load {
+	unsigned int queued[IEEE80211_NUM_ACS];
+	unsigned int total;
+	unsigned long active; /* bitmap of ACs with recent traffic */
+	unsigned long min_beacon_int;
+};
+
 static bool disable_scan_while_active;
 module_param(disable_scan_while_active, bool, 0644);
 MODULE_PARM_DESC(disable_scan_while_active,
@@ -276,6 +312,43 @@ static bool ieee80211_prep_hw_scan(struct ieee80211_local *local)
 	return true;
 }
 
+static void ieee80211_scan_burst_start(struct ieee80211_local *local)
+{
+	local->leave_oper_channel_time = jiffies;
+	local->scan_off_channel = true;
+	local->scan_stats.bursts++;
+}
+
+static void ieee80211_scan_burst_end(struct ieee80211_local *local)
+{
+	unsigned long burst;
+
+	if (!local->scan_off_channel)
+		return;
+
+	burst = jiffies - local->leave_oper_channel_time;
+	local->scan_off_channel = false;
+	local->scan_stats.off_channel += burst;
+	local->scan_stats.max_burst = max(local->scan_stats.max_burst, burst);
+}
+
+static void ieee80211_scan_account(struct ieee80211_local *local)
+{
+	struct ieee80211_scan_stats *last = &local->scan_stats;
+	struct ieee80211_scan_stats *total = &local->scan_stats_total;
+
+	ieee80211_scan_burst_end(local);
+
+	total->scans += last->scans;
+	total->channels += last->channels;
+	total->bursts += last->bursts;
+	total->stalls += last->stalls;
+	total->extended += last->extended;
+	total->max_queued = max(total->max_queued, last->max_queued);
+	total->off_channel += last->off_channel;
+	total->max_burst = max(total->max_burst, last->max_burst);
+}
+
 static void __ieee80211_scan_completed(struct ieee80211_hw *hw, bool aborted,
 				       bool was_hw_scan)
 {
@@ -310,6 +383,9 @@ static void __ieee80211_scan_completed(struct ieee80211_hw *hw, bool aborted,
 	kfree(local->hw_scan_req);
 	local->hw_scan_req = NULL;
 
+	if (test_bit(SCAN_SW_SCANNING, &local->scanning))
+		ieee80211_scan_account(local);
+
 	if (local->scan_req != local->int_scan_req)
 		cfg80211_scan_done(local->scan_req, aborted);
 	local->scan_req = NULL;
@@ -365,7 +441,9 @@ static int ieee80211_start_sw_scan(struct ieee80211_local *local)
 	 */
 	drv_sw_scan_start(local);
 
-	local->leave_oper_channel_time = jiffies;
+	memset(&local->scan_stats, 0, sizeof(local->scan_stats));
+	local->scan_stats.scans = 1;
+	ieee80211_scan_burst_start(local);
 	local->next_scan_state = SCAN_DECISION;
 	local->scan_channel_idx = 0;
 
@@ -602,47 +680,121 @@ ieee80211_scan_get_channel_time(struct ieee80211_channel *chan)
 	return IEEE80211_PROBE_DELAY + IEEE80211_CHANNEL_TIME;
 }
 
-static void ieee80211_scan_state_decision(struct ieee80211_local *local,
-					  unsigned long *next_delay)
+/*
+ * Collect what is waiting to go out on the associated station interfaces,
+ * per AC, and which ACs carried traffic shortly before the current burst.
+ * Returns whether any station interface is associated at all.
+ */
+static bool ieee80211_scan_get_load(struct ieee80211_local *local,
+				    struct ieee80211_scan_load *load)
 {
-	bool associated = false;
-	bool tx_empty = true;
-	bool bad_latency;
-	bool listen_int_exceeded;
-	unsigned long min_beacon_int = 0;
+	unsigned long since = local->leave_oper_channel_time -
+			      IEEE80211_SCAN_AC_ACTIVE;
 	struct ieee80211_sub_if_data *sdata;
-	struct ieee80211_channel *next_chan;
+	bool associated = false;
+
+	memset(load, 0, sizeof(*load));
 
-	/*
-	 * check if at least one STA interface is associated,
-	 * check if at least one STA interface has pending tx frames
-	 * and grab the lowest used beacon interval
-	 */
 	mutex_lock(&local->iflist_mtx);
 	list_for_each_entry(sdata, &local->interfaces, list) {
+		struct net_device *dev = sdata->dev;
+		unsigned int i;
+
 		if (!ieee80211_sdata_running(sdata))
 			continue;
 
-		if (sdata->vif.type == NL80211_IFTYPE_STATION) {
-			if (sdata->u.mgd.associated) {
-				associated = true;
+		if (sdata->vif.type != NL80211_IFTYPE_STATION ||
+		    !sdata->u.mgd.associated)
+			continue;
 
-				if (sdata->vif.bss_conf.beacon_int <
-				    min_beacon_int || min_beacon_int == 0)
-					min_beacon_int =
-						sdata->vif.bss_conf.beacon_int;
+		associated = true;
 
-				if (!qdisc_all_tx_empty(sdata->dev)) {
-					tx_empty = false;
-					break;
-				}
-			}
+		if (sdata->vif.bss_conf.beacon_int < load->min_beacon_int ||
+		    load->min_beacon_int == 0)
+			load->min_beacon_int = sdata->vif.bss_conf.beacon_int;
+
+		/* as in qdisc_all_tx_empty(), the qdisc may be replaced */
+		rcu_read_lock();
+		for (i = 0; i < dev->num_tx_queues; i++) {
+			struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+			struct Qdisc *q = rcu_dereference(txq->qdisc);
+			unsigned int qlen = q->q.qlen;
+			int ac = IEEE80211_AC_BE;
+
+			/* without per-AC queues everything counts as BE */
+			if (dev->num_tx_queues == IEEE80211_NUM_ACS)
+				ac = i;
+
+			load->queued[ac] += qlen;
+			load->total += qlen;
+
+			if (qlen || time_after(txq->trans_start, since))
+				__set_bit(ac, &load->active);
 		}
+		rcu_read_unlock();
 	}
 	mutex_unlock(&local->iflist_mtx);
 
+	return associated;
+}
+
+/*
+ * How long we may stay away from the operating channel in this burst:
+ * bounded by the pm_qos latency, the listen interval, a fixed maximum so
+ * long scans are split up, and the latency target of every AC that has
+ * seen traffic.
+ */
+static unsigned long
+ieee80211_scan_burst_budget(struct ieee80211_local *local,
+			    struct ieee80211_scan_load *load)
+{
+	unsigned long budget = IEEE80211_SCAN_MAX_BURST;
+	int ac;
+
+	budget = min_t(unsigned long, budget,
+		       usecs_to_jiffies(pm_qos_request(PM_QOS_NETWORK_LATENCY)));
+	budget = min_t(unsigned long, budget,
+		       usecs_to_jiffies(load->min_beacon_int * 1024) *
+		       local->hw.conf.listen_interval);
+
+	for (ac = 0; ac < IEEE80211_NUM_ACS; ac++)
+		if (test_bit(ac, &load->active))
+			budget = min_t(unsigned long, budget,
+				msecs_to_jiffies(ieee80211_scan_ac_latency[ac]));
+
+	return budget;
+}
+
+static bool ieee80211_scan_overloaded(struct ieee80211_scan_load *load)
+{
+	int ac;
+
+	for (ac = 0; ac < IEEE80211_NUM_ACS; ac++)
+		if (load->queued[ac] > ieee80211_scan_ac_max_queued[ac])
+			return true;
+
+	return false;
+}
+
+static void ieee80211_scan_state_decision(struct ieee80211_local *local,
+					  unsigned long *next_delay)
+{
+	struct ieee80211_scan_load load;
+	struct ieee80211_channel *next_chan;
+	unsigned long budget;
+
+	*next_delay = 0;
+
+	if (!ieee80211_scan_get_load(local, &load)) {
+		local->next_scan_state = SCAN_SET_CHANNEL;
+		return;
+	}
+
 	next_chan = local->scan_req->channels[local->scan_channel_idx];
 
+	local->scan_stats.max_queued = max(local->scan_stats.max_queued,
+					   load.total);
+
 	/*
 	 * we're currently scanning a different channel, let's
 	 * see if we can scan another channel without interfering
@@ -650,32 +802,25 @@ static void ieee80211_scan_state_decision(struct ieee80211_local *local,
 	 *
 	 * Since we don't know if the AP has pending frames for us
 	 * we can only check for our tx queues and use the current
-	 * pm_qos requirements for rx. Hence, if no tx traffic occurs
-	 * at all we will scan as many channels in a row as the pm_qos
-	 * latency allows us to. Additionally we also check for the
-	 * currently negotiated listen interval to prevent losing
-	 * frames unnecessarily.
+	 * pm_qos requirements for rx. Each AC that is carrying
+	 * traffic limits the burst to its latency target, and an
+	 * AC with more frames waiting than it should buffer sends
+	 * us back right away. Idle links get the pm_qos latency
+	 * and the negotiated listen interval, so that we don't
+	 * lose frames unnecessarily, capped by the maximum burst.
 	 *
 	 * Otherwise switch back to the operating channel.
 	 */
+	budget = ieee80211_scan_burst_budget(local, &load);
 
-	bad_latency = time_after(jiffies +
-			ieee80211_scan_get_channel_time(next_chan),
-			local->leave_oper_channel_time +
-			usecs_to_jiffies(pm_qos_request(PM_QOS_NETWORK_LATENCY)));
-
-	listen_int_exceeded = time_after(jiffies +
-			ieee80211_scan_get_channel_time(next_chan),
-			local->leave_oper_channel_time +
-			usecs_to_jiffies(min_beacon_int * 1024) *
-			local->hw.conf.listen_interval);
-
-	if (associated && (!tx_empty || bad_latency || listen_int_exceeded))
+	if (ieee80211_scan_overloaded(&load) ||
+	    time_after(jiffies + ieee80211_scan_get_channel_time(next_chan),
+		       local->leave_oper_channel_time + budget)) {
+		if (load.total)
+			local->scan_stats.stalls++;
 		local->next_scan_state = SCAN_SUSPEND;
-	else
+	} else
 		local->next_scan_state = SCAN_SET_CHANNEL;
-
-	*next_delay = 0;
 }
 
 static void ieee80211_scan_state_set_channel(struct ieee80211_local *local,
@@ -701,6 +846,8 @@ static void ieee80211_scan_state_set_channel(struct ieee80211_local *local,
 		return;
 	}
 
+	local->scan_stats.channels++;
+
 	/*
 	 * Probe delay is used to update the NAV, cf. 11.1.3.2.2
 	 * (which unfortunately doesn't say _why_ step a) is done,
@@ -736,8 +883,10 @@ static void ieee80211_scan_state_suspend(struct ieee80211_local *local,
 	 * on-channel at the end of scanning.
 	 */
 	ieee80211_offchannel_return(local, false);
+	ieee80211_scan_burst_end(local);
 
-	*next_delay = HZ / 5;
+	*next_delay = IEEE80211_SCAN_ONCHANNEL_TIME;
+	local->scan_extensions = 0;
 	/* afterwards, resume scan & go to next channel */
 	local->next_scan_state = SCAN_RESUME;
 }
@@ -745,6 +894,20 @@ static void ieee80211_scan_state_suspend(struct ieee80211_local *local,
 static void ieee80211_scan_state_resume(struct ieee80211_local *local,
 					unsigned long *next_delay)
 {
+	struct ieee80211_scan_load load;
+
+	/*
+	 * If the queues haven't drained while we were back, give the
+	 * traffic a little longer before leaving again.
+	 */
+	if (local->scan_extensions < IEEE80211_SCAN_MAX_EXTENSIONS &&
+	    ieee80211_scan_get_load(local, &load) && load.total) {
+		local->scan_extensions++;
+		local->scan_stats.extended++;
+		*next_delay = IEEE80211_SCAN_EXTEND_TIME;
+		return;
+	}
+
 	/* PS already is in off-channel mode */
 	ieee80211_offchannel_stop_vifs(local, false);
 
@@ -755,7 +918,7 @@ static void ieee80211_scan_state_resume(struct ieee80211_local *local,
 		*next_delay = HZ / 10;
 
 	/* remember when we left the operating channel */
-	local->leave_oper_channel_time = jiffies;
+	ieee80211_scan_burst_start(local);
 
 	/* advance to the next channel to be scanned */
 	local->next_scan_state = SCAN_SET_CHANNEL;
@@ -91,6 +91,20 @@ static int sta_info_hash_del(struct ieee80211_local *local,
 	return -ENOENT;
 }
 
+static void sta_ps_buf_account(struct sta_info *sta, int bytes)
+{
+	struct ieee80211_local *local = sta->local;
+	int new = atomic_add_return(bytes, &sta->ps_buf_bytes);
+	int old = new - bytes;
+
+	atomic_add(bytes, &local->total_ps_buf_bytes);
+
+	if (!old && new)
+		atomic_inc(&local->ps_buf_stations);
+	else if (old && !new)
+		atomic_dec(&local->ps_buf_stations);
+}
+
 static void free_sta_work(struct work_struct *wk)
 {
 	struct sta_info *sta = container_of(wk, struct sta_info, free_sta_wk);
@@ -98,6 +112,7 @@ static void free_sta_work(struct work_struct *wk)
 	struct tid_ampdu_tx *tid_tx;
 	struct ieee80211_sub_if_data *sdata = sta->sdata;
 	struct ieee80211_local *local = sdata->local;
+	unsigned long flags;
 
 	/*
 	 * At this point, when being called as call_rcu callback,
@@ -115,11 +130,19 @@ static void free_sta_work(struct work_struct *wk)
 		sta_info_recalc_tim(sta);
 	}
 
+	spin_lock_irqsave(&local->ps_expiry_lock, flags);
+	if (!list_empty(&sta->ps_expiry_list)) {
+		list_del_init(&sta->ps_expiry_list);
+		local->ps_expiry_count--;
+	}
+	spin_unlock_irqrestore(&local->ps_expiry_lock, flags);
+
 	for (ac = 0; ac < IEEE80211_NUM_ACS; ac++) {
 		local->total_ps_buffered -= skb_queue_len(&sta->ps_tx_buf[ac]);
 		__skb_queue_purge(&sta->ps_tx_buf[ac]);
 		__skb_queue_purge(&sta->tx_filtered[ac]);
 	}
+	sta_ps_buf_account(sta, -atomic_read(&sta->ps_buf_bytes));
 
 #ifdef CONFIG_MAC80211_MESH
 	if (ieee80211_vif_is_mesh(&sdata->vif)) {
@@ -142,7 +165,7 @@ static void free_sta_work(struct work_struct *wk)
 		if (!tid_tx)
 			continue;
 		__skb_queue_purge(&tid_tx->pending);
-		kfree(tid_tx);
+		ieee80211_free_tid_tx(local, tid_tx, false);
 	}
 
 	sta_info_free(local, sta);
@@ -279,7 +302,7 @@ static void sta_unblock(struct work_struct *wk)
 static int sta_prepare_rate_control(struct ieee80211_local *local,
 				    struct sta_info *sta, gfp_t gfp)
 {
-	if (local->hw.flags & IEEE80211_HW_HAS_RATE_CONTROL)
+	if (!local->rate_ctrl)
 		return 0;
 
 	sta->rate_ctrl = local->rate_ctrl;
@@ -337,6 +360,7 @@ struct sta_info *sta_info_alloc(struct ieee80211_sub_if_data *sdata,
 		skb_queue_head_init(&sta->ps_tx_buf[i]);
 		skb_queue_head_init(&sta->tx_filtered[i]);
 	}
+	INIT_LIST_HEAD(&sta->ps_expiry_list);
 
 	for (i = 0; i < NUM_RX_DATA_QUEUES; i++)
 		sta->last_seq_ctrl[i] = cpu_to_le16(USHRT_MAX);
@@ -502,22 +526,54 @@ int sta_info_insert(struct sta_info *sta)
 	return err;
 }
 
-static inline void __bss_tim_set(struct ieee80211_if_ap *bss, u16 aid)
+static inline bool __bss_tim_set(struct ieee80211_if_ap *bss, u16 aid)
 {
+	int byte = aid / 8;
+
+	if (bss->tim[byte] & (1 << (aid % 8)))
+		return false;
+
 	/*
 	 * This format has been mandated by the IEEE specifications,
 	 * so this line may not be changed to use the __set_bit() format.
 	 */
-	bss->tim[aid / 8] |= (1 << (aid % 8));
+	bss->tim[byte] |= (1 << (aid % 8));
+
+	if (bss->tim_count++ == 0) {
+		bss->tim_first = byte;
+		bss->tim_last = byte;
+		bss->tim_rescan = false;
+	} else {
+		bss->tim_first = min(bss->tim_first, byte);
+		bss->tim_last = max(bss->tim_last, byte);
+	}
+
+	return true;
 }
 
-static inline void __bss_tim_clear(struct ieee80211_if_ap *bss, u16 aid)
+static inline bool __bss_tim_clear(struct ieee80211_if_ap *bss, u16 aid)
 {
+	int byte = aid / 8;
+
+	if (!(bss->tim[byte] & (1 << (aid % 8))))
+		return false;
+
 	/*
 	 * This format has been mandated by the IEEE specifications,
 	 * so this line may not be changed to use the __clear_bit() format.
 	 */
-	bss->tim[aid / 8] &= ~(1 << (aid % 8));
+	bss->tim[byte] &= ~(1 << (aid % 8));
+
+	if (--bss->tim_count == 0) {
+		bss->tim_first = 0;
+		bss->tim_last = 0;
+		bss->tim_rescan = false;
+	} else if (!bss->tim[byte] &&
+		   (byte == bss->tim_first || byte == bss->tim_last)) {
+		bss->tim_rescan = true;
+	}
+
+	return true;
 }
 
 static unsigned long ieee80211_tids_for_ac(int ac)
@@ -543,7 +599,7 @@ void sta_info_recalc_tim(struct sta_info *sta)
 	struct ieee80211_local *local = sta->local;
 	struct ieee80211_if_ap *bss = sta->sdata->bss;
 	unsigned long flags;
-	bool indicate_tim = false;
+	bool indicate_tim = false, changed;
 	u8 ignore_for_tim = sta->sta.uapsd_queues;
 	int ac;
 
@@ -587,9 +643,19 @@ void sta_info_recalc_tim(struct sta_info *sta)
 	spin_lock_irqsave(&local->tim_lock, flags);
 
 	if (indicate_tim)
-		__bss_tim_set(bss, sta->sta.aid);
+		changed = __bss_tim_set(bss, sta->sta.aid);
 	else
-		__bss_tim_clear(bss, sta->sta.aid);
+		changed = __bss_tim_clear(bss, sta->sta.aid);
+
+	/*
+	 * This is called for every frame buffered or released, most of
+	 * which don't flip the bit; only tell the driver when the TIM
+	 * really changed.
+	 */
+	if (!changed) {
+		I802_DEBUG_INC(local->tx_tim_unchanged);
+		goto out_unlock;
+	}
 
 	if (local->ops->set_tim) {
 		local->tim_in_locked_section = true;
@@ -597,26 +663,231 @@ void sta_info_recalc_tim(struct sta_info *sta)
 		local->tim_in_locked_section = false;
 	}
 
+ out_unlock:
 	spin_unlock_irqrestore(&local->tim_lock, flags);
 }
 
-static bool sta_info_buffer_expired(struct sta_info *sta, struct sk_buff *skb)
+static int sta_info_buffer_timeout(struct sta_info *sta)
 {
-	struct ieee80211_tx_info *info;
 	int timeout;
 
-	if (!skb)
-		return false;
-
-	info = IEEE80211_SKB_CB(skb);
-
 	/* Timeout: (2 * listen_interval * beacon_int * 1024 / 1000000) sec */
 	timeout = (sta->listen_interval *
 		   sta->sdata->vif.bss_conf.beacon_int *
 		   32 / 15625) * HZ;
 	if (timeout < STA_TX_BUFFER_EXPIRE)
 		timeout = STA_TX_BUFFER_EXPIRE;
-	return time_after(jiffies, info->control.jiffies + timeout);
+	return timeout;
+}
+
+static bool sta_info_buffer_expired(struct sta_info *sta, struct sk_buff *skb)
+{
+	struct ieee80211_tx_info *info;
+
+	if (!skb)
+		return false;
+
+	info = IEEE80211_SKB_CB(skb);
+
+	return time_after(jiffies, info->control.jiffies +
+				   sta_info_buffer_timeout(sta));
+}
+
+struct sk_buff *sta_info_ps_buf_dequeue(struct sta_info *sta, int ac)
+{
+	struct sk_buff *skb;
+
+	skb = skb_dequeue(&sta->ps_tx_buf[ac]);
+	if (skb) {
+		sta->local->total_ps_buffered--;
+		sta_ps_buf_account(sta, -skb->truesize);
+	}
+	return skb;
+}
+
+/* drop the oldest frame of the lowest priority AC that has frames */
+static bool sta_ps_buf_drop_oldest(struct sta_info *sta)
+{
+	struct sk_buff *skb;
+	int ac;
+
+	for (ac = IEEE80211_AC_BK; ac >= IEEE80211_AC_VO; ac--) {
+		skb = sta_info_ps_buf_dequeue(sta, ac);
+		if (skb) {
+			dev_kfree_skb(skb);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Pick the station to evict a frame from when the total budget is used
+ * up: the one queueing if it has more than its share, otherwise the one
+ * whose buffered frames expire first. The latter is taken from the front
+ * of the expiry wheel, stations are never walked in the TX path.
+ */
+static struct sta_info *sta_ps_buf_victim(struct sta_info *sta)
+{
+	struct ieee80211_local *local = sta->local;
+	struct sta_info *tmp, *victim = sta;
+	int stations = max(atomic_read(&local->ps_buf_stations), 1);
+	unsigned long flags;
+	int i;
+
+	if (atomic_read(&sta->ps_buf_bytes) >= TOTAL_MAX_PS_BUF_BYTES / stations)
+		return sta;
+
+	spin_lock_irqsave(&local->ps_expiry_lock, flags);
+	for (i = 0; i < STA_PS_EXPIRY_SLOTS; i++) {
+		list_for_each_entry(tmp, &local->ps_expiry_wheel[
+				(local->ps_expiry_cursor + i) % STA_PS_EXPIRY_SLOTS],
+				ps_expiry_list) {
+			/* stations with only filtered frames can't help */
+			if (!tmp->dead && atomic_read(&tmp->ps_buf_bytes)) {
+				victim = tmp;
+				goto out;
+			}
+		}
+	}
+ out:
+	spin_unlock_irqrestore(&local->ps_expiry_lock, flags);
+
+	return victim;
+}
+
+/* must be called under RCU, takes ownership of @skb */
+void sta_info_ps_buf_queue(struct sta_info *sta, int ac, struct sk_buff *skb)
+{
+	struct ieee80211_local *local = sta->local;
+	struct sta_info *victim;
+	int size = skb->truesize;
+
+	if (skb_queue_len(&sta->ps_tx_buf[ac]) >= STA_MAX_TX_BUFFER) {
+		ps_dbg(sta->sdata,
+		       "STA %pM TX buffer for AC %d full - dropping oldest frame\n",
+		       sta->sta.addr, ac);
+		dev_kfree_skb(sta_info_ps_buf_dequeue(sta, ac));
+		sta->ps_buf_dropped++;
+	}
+
+	while (atomic_read(&sta->ps_buf_bytes) + size > STA_MAX_PS_BUF_BYTES &&
+	       sta_ps_buf_drop_oldest(sta))
+		sta->ps_buf_dropped++;
+
+	while (atomic_read(&local->total_ps_buf_bytes) + size >
+	       TOTAL_MAX_PS_BUF_BYTES) {
+		victim = sta_ps_buf_victim(sta);
+		if (!sta_ps_buf_drop_oldest(victim))
+			break;
+		victim->ps_buf_evicted++;
+		if (victim != sta)
+			sta_info_recalc_tim(victim);
+	}
+
+	skb_queue_tail(&sta->ps_tx_buf[ac], skb);
+	local->total_ps_buffered++;
+	sta_ps_buf_account(sta, size);
+
+	sta_info_ps_expiry_add(sta);
+}
+
+/* when the oldest frame buffered for the station expires */
+static bool sta_ps_expiry_time(struct sta_info *sta, unsigned long *expiry)
+{
+	struct sk_buff_head *queues[2] = { sta->tx_filtered, sta->ps_tx_buf };
+	unsigned long flags, ts = 0;
+	struct sk_buff *skb;
+	bool found = false;
+	int ac, i;
+
+	for (i = 0; i < ARRAY_SIZE(queues); i++) {
+		for (ac = 0; ac < IEEE80211_NUM_ACS; ac++) {
+			spin_lock_irqsave(&queues[i][ac].lock, flags);
+			skb = skb_peek(&queues[i][ac]);
+			if (skb && (!found ||
+				    time_before(IEEE80211_SKB_CB(skb)->control.jiffies,
+						ts))) {
+				ts = IEEE80211_SKB_CB(skb)->control.jiffies;
+				found = true;
+			}
+			spin_unlock_irqrestore(&queues[i][ac].lock, flags);
+		}
+	}
+
+	*expiry = ts + sta_info_buffer_timeout(sta) + 1;
+	return found;
+}
+
+/*
+ * The slot at ps_expiry_cursor holds the stations that expire by
+ * ps_expiry_next, each following slot covers HZ jiffies more. Stations
+ * expiring beyond the last slot are put there and moved on when it is
+ * run. Must hold local->ps_expiry_lock.
+ */
+static void __sta_ps_expiry_hash(struct ieee80211_local *local,
+				 struct sta_info *sta, unsigned long expiry)
+{
+	unsigned long slot = 0;
+
+	/* an empty wheel starts over at the current time */
+	if (!local->ps_expiry_count)
+		local->ps_expiry_next = jiffies;
+
+	/* an overdue station is handled with the current slot */
+	if (time_after(expiry, local->ps_expiry_next))
+		slot = min_t(unsigned long,
+			     DIV_ROUND_UP(expiry - local->ps_expiry_next, HZ),
+			     STA_PS_EXPIRY_SLOTS - 1);
+
+	sta->ps_expiry = expiry;
+	list_add_tail(&sta->ps_expiry_list,
+		      &local->ps_expiry_wheel[(local->ps_expiry_cursor + slot) %
+					      STA_PS_EXPIRY_SLOTS]);
+	local->ps_expiry_count++;
+}
+
+/* must hold local->ps_expiry_lock */
+static void sta_ps_expiry_arm(struct ieee80211_local *local)
+{
+	unsigned long expires;
+	int i;
+
+	if (!local->ps_expiry_count || local->quiescing)
+		return;
+
+	for (i = 0; i < STA_PS_EXPIRY_SLOTS - 1; i++)
+		if (!list_empty(&local->ps_expiry_wheel[
+				(local->ps_expiry_cursor + i) % STA_PS_EXPIRY_SLOTS]))
+			break;
+
+	expires = local->ps_expiry_next + i * HZ;
+	if (!timer_pending(&local->sta_cleanup) ||
+	    time_before(expires, local->sta_cleanup.expires))
+		mod_timer(&local->sta_cleanup, expires);
+}
+
+/*
+ * Make sure the frames buffered for the station get expired; a station
+ * already on the wheel stays where its oldest frame put it.
+ */
+void sta_info_ps_expiry_add(struct sta_info *sta)
+{
+	struct ieee80211_local *local = sta->local;
+	unsigned long flags, expiry;
+
+	if (!list_empty(&sta->ps_expiry_list))
+		return;
+
+	if (!sta_ps_expiry_time(sta, &expiry))
+		return;
+
+	spin_lock_irqsave(&local->ps_expiry_lock, flags);
+	if (list_empty(&sta->ps_expiry_list) && !sta->dead) {
+		__sta_ps_expiry_hash(local, sta, expiry);
+		sta_ps_expiry_arm(local);
+	}
+	spin_unlock_irqrestore(&local->ps_expiry_lock, flags);
 }
 
 
@@ -650,6 +921,7 @@ static bool sta_info_cleanup_expire_buffered_ac(struct ieee80211_local *local,
 		 */
 		if (!skb)
 			break;
+		sta->ps_buf_expired++;
 		dev_kfree_skb(skb);
 	}
 
@@ -677,6 +949,8 @@ static bool sta_info_cleanup_expire_buffered_ac(struct ieee80211_local *local,
 			break;
 
 		local->total_ps_buffered--;
+		sta_ps_buf_account(sta, -skb->truesize);
+		sta->ps_buf_expired++;
 		ps_dbg(sta->sdata, "Buffered frame expired (STA %pM)\n",
 		       sta->sta.addr);
 		dev_kfree_skb(skb);
@@ -814,34 +1088,78 @@ int sta_info_destroy_addr_bss(struct ieee80211_sub_if_data *sdata,
 	return ret;
 }
 
+/*
+ * Expire the buffered frames of the stations in the slots that are due,
+ * stations that still have frames buffered are put back according to
+ * their new oldest frame.
+ */
 static void sta_info_cleanup(unsigned long data)
 {
 	struct ieee80211_local *local = (struct ieee80211_local *) data;
+	struct list_head *slot;
 	struct sta_info *sta;
-	bool timer_needed = false;
+	unsigned long flags, expiry, next;
+	bool buffered;
 
 	rcu_read_lock();
-	list_for_each_entry_rcu(sta, &local->sta_list, list)
-		if (sta_info_cleanup_expire_buffered(local, sta))
-			timer_needed = true;
-	rcu_read_unlock();
+	spin_lock_irqsave(&local->ps_expiry_lock, flags);
+
+	while (local->ps_expiry_count &&
+	       time_after_eq(jiffies, local->ps_expiry_next)) {
+		next = local->ps_expiry_next;
+		slot = &local->ps_expiry_wheel[local->ps_expiry_cursor];
+
+		while (!list_empty(slot)) {
+			sta = list_first_entry(slot, struct sta_info,
+					       ps_expiry_list);
+			list_del_init(&sta->ps_expiry_list);
+			local->ps_expiry_count--;
+
+			if (sta->dead)
+				continue;
+
+			/* beyond the wheel when it was hashed, move it on */
+			if (time_before(jiffies, sta->ps_expiry)) {
+				__sta_ps_expiry_hash(local, sta, sta->ps_expiry);
+				continue;
+			}
 
-	if (local->quiescing)
-		return;
+			spin_unlock_irqrestore(&local->ps_expiry_lock, flags);
+			buffered = sta_info_cleanup_expire_buffered(local, sta) &&
+				   sta_ps_expiry_time(sta, &expiry);
+			spin_lock_irqsave(&local->ps_expiry_lock, flags);
 
-	if (!timer_needed)
-		return;
+			if (buffered && !sta->dead &&
+			    list_empty(&sta->ps_expiry_list))
+				__sta_ps_expiry_hash(local, sta, expiry);
+		}
 
-	mod_timer(&local->sta_cleanup,
-		  round_jiffies(jiffies + STA_INFO_CLEANUP_INTERVAL));
+		/* unless the wheel ran empty and was restarted meanwhile */
+		if (local->ps_expiry_next == next) {
+			local->ps_expiry_next += HZ;
+			local->ps_expiry_cursor = (local->ps_expiry_cursor + 1) %
+						  STA_PS_EXPIRY_SLOTS;
+		}
+	}
+
+	sta_ps_expiry_arm(local);
+
+	spin_unlock_irqrestore(&local->ps_expiry_lock, flags);
+	rcu_read_unlock();
 }
 
 void sta_info_init(struct ieee80211_local *local)
 {
+	int i;
+
 	spin_lock_init(&local->tim_lock);
 	mutex_init(&local->sta_mtx);
 	INIT_LIST_HEAD(&local->sta_list);
 
+	spin_lock_init(&local->ps_expiry_lock);
+	for (i = 0; i < STA_PS_EXPIRY_SLOTS; i++)
+		INIT_LIST_HEAD(&local->ps_expiry_wheel[i]);
+
 	setup_timer(&local->sta_cleanup, sta_info_cleanup,
 		    (unsigned long)local);
 }
@@ -960,7 +1278,9 @@ void ieee80211_sta_ps_deliver_wakeup(struct sta_info *sta)
 	struct ieee80211_sub_if_data *sdata = sta->sdata;
 	struct ieee80211_local *local = sdata->local;
 	struct sk_buff_head pending;
-	int filtered = 0, buffered = 0, ac;
+	struct sk_buff *skb;
+	unsigned long flags;
+	int filtered = 0, buffered = 0, bytes = 0, ac;
 
 	clear_sta_flag(sta, WLAN_STA_SP);
 
@@ -981,7 +1301,11 @@ void ieee80211_sta_ps_deliver_wakeup(struct sta_info *sta)
 		filtered += tmp - count;
 		count = tmp;
 
+		spin_lock_irqsave(&sta->ps_tx_buf[ac].lock, flags);
+		skb_queue_walk(&sta->ps_tx_buf[ac], skb)
+			bytes += skb->truesize;
 		skb_queue_splice_tail_init(&sta->ps_tx_buf[ac], &pending);
+		spin_unlock_irqrestore(&sta->ps_tx_buf[ac].lock, flags);
 		tmp = skb_queue_len(&pending);
 		buffered += tmp - count;
 	}
@@ -989,6 +1313,7 @@ void ieee80211_sta_ps_deliver_wakeup(struct sta_info *sta)
 	ieee80211_add_pending_skbs_fn(local, &pending, clear_sta_ps_flags, sta);
 
 	local->total_ps_buffered -= buffered;
+	sta_ps_buf_account(sta, -bytes);
 
 	sta_info_recalc_tim(sta);
 
@@ -1098,12 +1423,9 @@ ieee80211_sta_ps_deliver_response(struct sta_info *sta,
 
 				while (n_frames > 0) {
 					skb = skb_dequeue(&sta->tx_filtered[ac]);
-					if (!skb) {
-						skb = skb_dequeue(
-							&sta->ps_tx_buf[ac]);
-						if (skb)
-							local->total_ps_buffered--;
-					}
+					if (!skb)
+						skb = sta_info_ps_buf_dequeue(
+							sta, ac);
 					if (!skb)
 						break;
 					n_frames--;
@@ -86,6 +86,14 @@ enum ieee80211_sta_info_flags {
 #define HT_AGG_BURST_RETRIES		3
 #define HT_AGG_RETRIES_PERIOD		(15 * HZ)
 
+/* traffic driven session management, see IEEE80211_HW_TX_AMPDU_AUTO */
+#define HT_AGG_RATE_WINDOW		(HZ / 2)
+#define HT_AGG_START_PPS		20
+#define HT_AGG_STOP_PPS			5
+#define HT_AGG_STOP_WINDOWS		4
+#define HT_AGG_HOLDDOWN			(2 * HZ)
+#define HT_AGG_SESSION_TIMEOUT		5000
+
 #define HT_AGG_STATE_DRV_READY		0
 #define HT_AGG_STATE_RESPONSE_RECEIVED	1
 #define HT_AGG_STATE_OPERATIONAL	2
@@ -177,6 +185,37 @@ struct tid_ampdu_rx {
 	u8 dialog_token;
 };
 
+/**
+ * struct tid_tx_stats - TX aggregation manager state and statistics (per TID)
+ *
+ * @window_start: start of the current rate measurement window
+ * @window_pkts: frames sent on the TID in the current window
+ * @pps: frames per second, averaged over the last windows
+ * @low_windows: consecutive windows spent below %HT_AGG_STOP_PPS
+ * @last_stop: time the manager last stopped a session on the TID
+ * @starts: sessions started by the manager
+ * @stops: sessions stopped by the manager for lack of traffic
+ * @refused: starts refused because the device session limit was reached
+ * @ampdus: A-MPDUs reported in TX status
+ * @mpdus: subframes in those A-MPDUs
+ *
+ * The counters are updated from the TX and TX status paths without
+ * locking; they may occasionally miss an update but are only used as
+ * statistics and rate estimates.
+ */
+struct tid_tx_stats {
+	unsigned long window_start;
+	unsigned int window_pkts;
+	unsigned int pps;
+	unsigned int low_windows;
+	unsigned long last_stop;
+	unsigned int starts;
+	unsigned int stops;
+	unsigned int refused;
+	unsigned int ampdus;
+	unsigned long mpdus;
+};
+
 /**
  * struct sta_ampdu_mlme - STA aggregation information.
  *
@@ -186,6 +225,7 @@ struct tid_ampdu_rx {
  * @addba_req_num: number of times addBA request has been sent.
  * @last_addba_req_time: timestamp of the last addBA request.
  * @dialog_token_allocator: dialog token enumerator for each new session;
+ * @tx_stats: per-TID traffic rate and session statistics
  * @work: work struct for starting/stopping aggregation
  * @tid_rx_timer_expired: bitmap indicating on which TIDs the
  *	RX timer expired until the work for it runs
@@ -207,6 +247,7 @@ struct sta_ampdu_mlme {
 	unsigned long last_addba_req_time[STA_TID_NUM];
 	u8 addba_req_num[STA_TID_NUM];
 	u8 dialog_token_allocator;
+	struct tid_tx_stats tx_stats[STA_TID_NUM];
 };
 
 
@@ -240,6 +281,12 @@ struct sta_ampdu_mlme {
  *	entered power saving state, these are also delivered to
  *	the station when it leaves powersave or polls for frames
  * @driver_buffered_tids: bitmap of TIDs the driver has data buffered on
+ * @ps_buf_bytes: truesize of the frames in @ps_tx_buf
+ * @ps_expiry_list: entry in the PS buffer expiry wheel of the local
+ * @ps_expiry: time (in jiffies) the oldest buffered frame expires
+ * @ps_buf_dropped: frames dropped because this station's buffers were full
+ * @ps_buf_evicted: frames dropped to keep within the total memory budget
+ * @ps_buf_expired: frames dropped because the station didn't retrieve them
  * @rx_packets: Number of MSDUs received from this STA
  * @rx_bytes: Number of bytes received from this STA
  * @wep_weak_iv_count: number of weak WEP IVs received from this station
@@ -318,6 +365,10 @@ struct sta_info {
 	struct sk_buff_head ps_tx_buf[IEEE80211_NUM_ACS];
 	struct sk_buff_head tx_filtered[IEEE80211_NUM_ACS];
 	unsigned long driver_buffered_tids;
+	atomic_t ps_buf_bytes;
+	struct list_head ps_expiry_list;
+	unsigned long ps_expiry;
+	unsigned long ps_buf_dropped, ps_buf_evicted, ps_buf_expired;
 
 	/* Updated from RX path only, no locking requirements */
 	unsigned long rx_packets, rx_bytes;
@@ -471,14 +522,16 @@ rcu_dereference_protected_tid_tx(struct sta_info *sta, int tid)
 /* Maximum number of frames to buffer per power saving station per AC */
 #define STA_MAX_TX_BUFFER	64
 
+/* Maximum memory (skb truesize) to buffer per power saving station */
+#define STA_MAX_PS_BUF_BYTES	(128 * 1024)
+
+/* Slots of the buffered frame expiry wheel, each covering a second */
+#define STA_PS_EXPIRY_SLOTS	16
+
 /* Minimum buffered frame expiry time. If STA uses listen interval that is
  * smaller than this value, the minimum value here is used instead. */
 #define STA_TX_BUFFER_EXPIRE (10 * HZ)
 
-/* How often station data is cleaned up (e.g., expiration of buffered frames)
- */
-#define STA_INFO_CLEANUP_INTERVAL (10 * HZ)
-
 /*
  * Get a STA info, must be under RCU read lock.
  */
@@ -543,6 +596,9 @@ int sta_info_destroy_addr_bss(struct ieee80211_sub_if_data *sdata,
 			      const u8 *addr);
 
 void sta_info_recalc_tim(struct sta_info *sta);
+void sta_info_ps_buf_queue(struct sta_info *sta, int ac, struct sk_buff *skb);
+struct sk_buff *sta_info_ps_buf_dequeue(struct sta_info *sta, int ac);
+void sta_info_ps_expiry_add(struct sta_info *sta);
 
 void sta_info_init(struct ieee80211_local *local);
 void sta_info_stop(struct ieee80211_local *local);
@@ -139,11 +139,7 @@ static void ieee80211_handle_filtered_frame(struct ieee80211_local *local,
 	    skb_queue_len(&sta->tx_filtered[ac]) < STA_MAX_TX_BUFFER) {
 		skb_queue_tail(&sta->tx_filtered[ac], skb);
 		sta_info_recalc_tim(sta);
-
-		if (!timer_pending(&local->sta_cleanup))
-			mod_timer(&local->sta_cleanup,
-				  round_jiffies(jiffies +
-						STA_INFO_CLEANUP_INTERVAL));
+		sta_info_ps_expiry_add(sta);
 		return;
 	}
 
@@ -402,6 +398,16 @@ void ieee80211_tx_status(struct ieee80211_hw *hw, struct sk_buff *skb)
 		    (rates_idx != -1))
 			sta->last_tx_rate = info->status.rates[rates_idx];
 
+		if ((info->flags & IEEE80211_TX_STAT_AMPDU) &&
+		    ieee80211_is_data_qos(fc)) {
+			u8 *qc = ieee80211_get_qos_ctl(hdr);
+			struct tid_tx_stats *ts;
+
+			ts = &sta->ampdu_mlme.tx_stats[qc[0] & 0xf];
+			ts->ampdus++;
+			ts->mpdus += info->status.ampdu_len;
+		}
+
 		if ((info->flags & IEEE80211_TX_STAT_AMPDU_NO_BACK) &&
 		    (ieee80211_is_data_qos(fc))) {
 			u16 tid, ssn;
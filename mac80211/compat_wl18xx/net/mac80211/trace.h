@@ -683,6 +683,37 @@ TRACE_EVENT(drv_sta_rc_update,
 	)
 );
 
+TRACE_EVENT(drv_set_rate_policy,
+	TP_PROTO(struct ieee80211_local *local,
+		 struct ieee80211_sub_if_data *sdata,
+		 struct ieee80211_sta *sta,
+		 const struct ieee80211_rate_policy *policy),
+
+	TP_ARGS(local, sdata, sta, policy),
+
+	TP_STRUCT__entry(
+		LOCAL_ENTRY
+		VIF_ENTRY
+		STA_ENTRY
+		__field(s8, idx)
+		__field(u8, flags)
+	),
+
+	TP_fast_assign(
+		LOCAL_ASSIGN;
+		VIF_ASSIGN;
+		STA_ASSIGN;
+		__entry->idx = policy->rates[0].idx;
+		__entry->flags = policy->rates[0].flags;
+	),
+
+	TP_printk(
+		LOCAL_PR_FMT  VIF_PR_FMT  STA_PR_FMT " rate: %d flags: 0x%x",
+		LOCAL_PR_ARG, VIF_PR_ARG, STA_PR_ARG,
+		__entry->idx, __entry->flags
+	)
+);
+
 TRACE_EVENT(drv_sta_add,
 	TP_PROTO(struct ieee80211_local *local,
 		 struct ieee80211_sub_if_data *sdata,
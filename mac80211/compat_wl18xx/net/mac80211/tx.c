@@ -350,7 +350,7 @@ static void purge_old_ps_buffers(struct ieee80211_local *local)
 		int ac;
 
 		for (ac = IEEE80211_AC_BK; ac >= IEEE80211_AC_VO; ac--) {
-			skb = skb_dequeue(&sta->ps_tx_buf[ac]);
+			skb = sta_info_ps_buf_dequeue(sta, ac);
 			total += skb_queue_len(&sta->ps_tx_buf[ac]);
 			if (skb) {
 				purged++;
@@ -438,7 +438,6 @@ ieee80211_tx_h_unicast_ps_buf(struct ieee80211_tx_data *tx)
 	struct sta_info *sta = tx->sta;
 	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(tx->skb);
 	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)tx->skb->data;
-	struct ieee80211_local *local = tx->local;
 
 	if (unlikely(!sta))
 		return TX_CONTINUE;
@@ -459,26 +458,13 @@ ieee80211_tx_h_unicast_ps_buf(struct ieee80211_tx_data *tx)
 
 		ps_dbg(sta->sdata, "STA %pM aid %d: PS buffer for AC %d\n",
 		       sta->sta.addr, sta->sta.aid, ac);
-		if (tx->local->total_ps_buffered >= TOTAL_MAX_TX_BUFFER)
-			purge_old_ps_buffers(tx->local);
-		if (skb_queue_len(&sta->ps_tx_buf[ac]) >= STA_MAX_TX_BUFFER) {
-			struct sk_buff *old = skb_dequeue(&sta->ps_tx_buf[ac]);
-			ps_dbg(tx->sdata,
-			       "STA %pM TX buffer for AC %d full - dropping oldest frame\n",
-			       sta->sta.addr, ac);
-			dev_kfree_skb(old);
-		} else
-			tx->local->total_ps_buffered++;
 
 		info->control.jiffies = jiffies;
 		info->control.vif = &tx->sdata->vif;
 		info->flags |= IEEE80211_TX_INTFL_NEED_TXPROCESSING;
-		skb_queue_tail(&sta->ps_tx_buf[ac], tx->skb);
 
-		if (!timer_pending(&local->sta_cleanup))
-			mod_timer(&local->sta_cleanup,
-				  round_jiffies(jiffies +
-						STA_INFO_CLEANUP_INTERVAL));
+		/* evicts older frames as needed to stay within budget */
+		sta_info_ps_buf_queue(sta, ac, tx->skb);
 
 		/*
 		 * We queued up some frames, so the TIM bit might
@@ -1164,6 +1150,10 @@ ieee80211_tx_prepare(struct ieee80211_sub_if_data *sdata,
 		tid = *qc & IEEE80211_QOS_CTL_TID_MASK;
 
 		tid_tx = rcu_dereference(tx->sta->ampdu_mlme.tid_tx[tid]);
+
+		if (local->hw.flags & IEEE80211_HW_TX_AMPDU_AUTO)
+			ieee80211_agg_tx_track(tx->sta, tid, tid_tx);
+
 		if (tid_tx) {
 			bool queued;
 
@@ -1219,25 +1209,37 @@ static bool ieee80211_tx_frags(struct ieee80211_local *local,
 		}
 #endif
 
-		spin_lock_irqsave(&local->queue_stop_reason_lock, flags);
-		if (local->queue_stop_reasons[q] ||
+		/*
+		 * Only take the lock if the queue looks stopped or has
+		 * frames pending that this one must not overtake; the
+		 * common case of a running, empty queue goes straight on.
+		 */
+		if (ACCESS_ONCE(local->queue_stop_reasons[q]) ||
 		    (!txpending && !skb_queue_empty(&local->pending[q]))) {
-			/*
-			 * Since queue is stopped, queue up frames for later
-			 * transmission from the tx-pending tasklet when the
-			 * queue is woken again.
-			 */
-			if (txpending)
-				skb_queue_splice_init(skbs, &local->pending[q]);
-			else
-				skb_queue_splice_tail_init(skbs,
-							   &local->pending[q]);
-
+			spin_lock_irqsave(&local->queue_stop_reason_lock,
+					  flags);
+			if (local->queue_stop_reasons[q] ||
+			    (!txpending &&
+			     !skb_queue_empty(&local->pending[q]))) {
+				/*
+				 * Since queue is stopped, queue up frames for
+				 * later transmission from the tx-pending
+				 * tasklet when the queue is woken again.
+				 */
+				if (txpending)
+					skb_queue_splice_init(skbs,
+							&local->pending[q]);
+				else
+					skb_queue_splice_tail_init(skbs,
+							&local->pending[q]);
+
+				spin_unlock_irqrestore(
+					&local->queue_stop_reason_lock, flags);
+				return false;
+			}
 			spin_unlock_irqrestore(&local->queue_stop_reason_lock,
 					       flags);
-			return false;
 		}
-		spin_unlock_irqrestore(&local->queue_stop_reason_lock, flags);
 
 		info->control.vif = vif;
 		info->control.sta = sta;
@@ -2232,6 +2234,25 @@ void ieee80211_tx_pending(unsigned long data)
 
 /* functions for drivers to get certain frames */
 
+/*
+ * Tighten the cached TIM bounds after a bit at either end was cleared.
+ * Everything still set lies within the old bounds, so only that range
+ * is looked at rather than the whole bitmap.
+ */
+static void ieee80211_beacon_tim_bounds(struct ieee80211_if_ap *bss)
+{
+	int first = bss->tim_first, last = bss->tim_last;
+
+	while (first < last && !bss->tim[first])
+		first++;
+	while (last > first && !bss->tim[last])
+		last--;
+
+	bss->tim_first = first;
+	bss->tim_last = last;
+	bss->tim_rescan = false;
+}
+
 static void ieee80211_beacon_add_tim(struct ieee80211_sub_if_data *sdata,
 				     struct ieee80211_if_ap *bss,
 				     struct sk_buff *skb,
@@ -2239,15 +2260,12 @@ static void ieee80211_beacon_add_tim(struct ieee80211_sub_if_data *sdata,
 {
 	u8 *pos, *tim;
 	int aid0 = 0;
-	int i, have_bits = 0, n1, n2;
+	int have_bits = 0, n1, n2;
 
 	/* Generate bitmap for TIM only if there are any STAs in power save
 	 * mode. */
 	if (atomic_read(&bss->num_sta_ps) > 0)
-		/* in the hope that this is faster than
-		 * checking byte-for-byte */
-		have_bits = !bitmap_empty((unsigned long*)bss->tim,
-					  IEEE80211_MAX_AID+1);
+		have_bits = bss->tim_count > 0;
 
 	if (bss->dtim_count == 0)
 		bss->dtim_count = sdata->vif.bss_conf.dtim_period - 1;
@@ -2266,23 +2284,14 @@ static void ieee80211_beacon_add_tim(struct ieee80211_sub_if_data *sdata,
 	bss->dtim_bc_mc = aid0 == 1;
 
 	if (have_bits) {
+		if (bss->tim_rescan)
+			ieee80211_beacon_tim_bounds(bss);
+
 		/* Find largest even number N1 so that bits numbered 1 through
 		 * (N1 x 8) - 1 in the bitmap are 0 and number N2 so that bits
 		 * (N2 + 1) x 8 through 2007 are 0. */
-		n1 = 0;
-		for (i = 0; i < IEEE80211_MAX_TIM_LEN; i++) {
-			if (bss->tim[i]) {
-				n1 = i & 0xfe;
-				break;
-			}
-		}
-		n2 = n1;
-		for (i = IEEE80211_MAX_TIM_LEN - 1; i >= n1; i--) {
-			if (bss->tim[i]) {
-				n2 = i;
-				break;
-			}
-		}
+		n1 = bss->tim_first & 0xfe;
+		n2 = bss->tim_last;
 
 		/* Bitmap control */
 		*pos++ = n1 | aid0;
@@ -305,15 +305,16 @@ static void __ieee80211_wake_queue(struct ieee80211_hw *hw, int queue,
 	if (WARN_ON(queue >= hw->queues))
 		return;
 
-	if (!test_bit(reason, &local->queue_stop_reasons[queue]))
+	if (!test_and_clear_bit(reason, &local->queue_stop_reasons[queue]))
 		return;
 
-	__clear_bit(reason, &local->queue_stop_reasons[queue]);
-
 	if (local->queue_stop_reasons[queue] != 0)
 		/* someone still has this queue stopped */
 		return;
 
+	if (reason != IEEE80211_QUEUE_STOP_REASON_SKB_ADD)
+		local->queue_wake_events[queue]++;
+
 	if (skb_queue_empty(&local->pending[queue])) {
 		rcu_read_lock();
 		ieee80211_propagate_queue_wake(local, queue);
@@ -322,12 +323,29 @@ static void __ieee80211_wake_queue(struct ieee80211_hw *hw, int queue,
 		tasklet_schedule(&local->tx_pending_tasklet);
 }
 
+/*
+ * The stop reasons are only modified under queue_stop_reason_lock, but
+ * with atomic bitops so they can be tested without it. Drivers doing
+ * flow control tend to call stop/wake over and over for a queue that
+ * already is in the requested state; those calls return right away
+ * without touching the lock.
+ */
+static bool ieee80211_queue_reason_set(struct ieee80211_local *local,
+				       int queue, enum queue_stop_reason reason)
+{
+	return test_bit(reason, &local->queue_stop_reasons[queue]);
+}
+
 void ieee80211_wake_queue_by_reason(struct ieee80211_hw *hw, int queue,
 				    enum queue_stop_reason reason)
 {
 	struct ieee80211_local *local = hw_to_local(hw);
 	unsigned long flags;
 
+	if (queue < hw->queues &&
+	    !ieee80211_queue_reason_set(local, queue, reason))
+		return;
+
 	spin_lock_irqsave(&local->queue_stop_reason_lock, flags);
 	__ieee80211_wake_queue(hw, queue, reason);
 	spin_unlock_irqrestore(&local->queue_stop_reason_lock, flags);
@@ -352,10 +370,12 @@ static void __ieee80211_stop_queue(struct ieee80211_hw *hw, int queue,
 	if (WARN_ON(queue >= hw->queues))
 		return;
 
-	if (test_bit(reason, &local->queue_stop_reasons[queue]))
-		return;
+	if (!local->queue_stop_reasons[queue] &&
+	    reason != IEEE80211_QUEUE_STOP_REASON_SKB_ADD)
+		local->queue_stop_events[queue]++;
 
-	__set_bit(reason, &local->queue_stop_reasons[queue]);
+	if (test_and_set_bit(reason, &local->queue_stop_reasons[queue]))
+		return;
 
 	if (local->hw.queues < IEEE80211_NUM_ACS)
 		n_acs = 1;
@@ -379,6 +399,10 @@ void ieee80211_stop_queue_by_reason(struct ieee80211_hw *hw, int queue,
 	struct ieee80211_local *local = hw_to_local(hw);
 	unsigned long flags;
 
+	if (queue < hw->queues &&
+	    ieee80211_queue_reason_set(local, queue, reason))
+		return;
+
 	spin_lock_irqsave(&local->queue_stop_reason_lock, flags);
 	__ieee80211_stop_queue(hw, queue, reason);
 	spin_unlock_irqrestore(&local->queue_stop_reason_lock, flags);
@@ -453,6 +477,12 @@ void ieee80211_stop_queues_by_reason(struct ieee80211_hw *hw,
 	unsigned long flags;
 	int i;
 
+	for (i = 0; i < hw->queues; i++)
+		if (!ieee80211_queue_reason_set(local, i, reason))
+			break;
+	if (i == hw->queues)
+		return;
+
 	spin_lock_irqsave(&local->queue_stop_reason_lock, flags);
 
 	for (i = 0; i < hw->queues; i++)
@@ -471,16 +501,11 @@ EXPORT_SYMBOL(ieee80211_stop_queues);
 int ieee80211_queue_stopped(struct ieee80211_hw *hw, int queue)
 {
 	struct ieee80211_local *local = hw_to_local(hw);
-	unsigned long flags;
-	int ret;
 
 	if (WARN_ON(queue >= hw->queues))
 		return true;
 
-	spin_lock_irqsave(&local->queue_stop_reason_lock, flags);
-	ret = !!local->queue_stop_reasons[queue];
-	spin_unlock_irqrestore(&local->queue_stop_reason_lock, flags);
-	return ret;
+	return !!ACCESS_ONCE(local->queue_stop_reasons[queue]);
 }
 EXPORT_SYMBOL(ieee80211_queue_stopped);
 
@@ -491,6 +516,12 @@ void ieee80211_wake_queues_by_reason(struct ieee80211_hw *hw,
 	unsigned long flags;
 	int i;
 
+	for (i = 0; i < hw->queues; i++)
+		if (ieee80211_queue_reason_set(local, i, reason))
+			break;
+	if (i == hw->queues)
+		return;
+
 	spin_lock_irqsave(&local->queue_stop_reason_lock, flags);
 
 	for (i = 0; i < hw->queues; i++)
@@ -610,19 +641,107 @@ void ieee80211_queue_delayed_work(struct ieee80211_hw *hw,
 }
 EXPORT_SYMBOL(ieee80211_queue_delayed_work);
 
-u32 ieee802_11_parse_elems_crc(u8 *start, size_t len,
-			       struct ieee802_11_elems *elems,
-			       u64 filter, u32 crc)
+/*
+ * Where ieee802_11_parse_elems_crc() stores the elements it knows about,
+ * indexed by element ID. Elements that are only kept as a pointer to a
+ * structure have no length field and need at least @min_len bytes.
+ * The element types that need more than a pointer and a length (TIM,
+ * quiet and vendor specific) are handled by the parser itself; a zero
+ * @ptr marks an element that isn't recorded at all.
+ */
+struct ieee802_11_elem_desc {
+	u16 ptr;
+	u16 len;
+	u8 min_len;
+};
+
+#define ELEM_NO_LEN	0xffff
+
+#define ELEM(_id, _ptr, _len)						\
+	[_id] = {							\
+		.ptr = offsetof(struct ieee802_11_elems, _ptr),		\
+		.len = offsetof(struct ieee802_11_elems, _len),		\
+	}
+#define ELEM_STRUCT(_id, _ptr, _type)					\
+	[_id] = {							\
+		.ptr = offsetof(struct ieee802_11_elems, _ptr),		\
+		.len = ELEM_NO_LEN,					\
+		.min_len = sizeof(_type),				\
+	}
+
+static const struct ieee802_11_elem_desc ieee802_11_elem_descs[256] = {
+	ELEM(WLAN_EID_SSID, ssid, ssid_len),
+	ELEM(WLAN_EID_SUPP_RATES, supp_rates, supp_rates_len),
+	ELEM(WLAN_EID_FH_PARAMS, fh_params, fh_params_len),
+	ELEM(WLAN_EID_DS_PARAMS, ds_params, ds_params_len),
+	ELEM(WLAN_EID_CF_PARAMS, cf_params, cf_params_len),
+	ELEM(WLAN_EID_IBSS_PARAMS, ibss_params, ibss_params_len),
+	ELEM(WLAN_EID_CHALLENGE, challenge, challenge_len),
+	ELEM(WLAN_EID_RSN, rsn, rsn_len),
+	ELEM(WLAN_EID_ERP_INFO, erp_info, erp_info_len),
+	ELEM(WLAN_EID_EXT_SUPP_RATES, ext_supp_rates, ext_supp_rates_len),
+	ELEM_STRUCT(WLAN_EID_HT_CAPABILITY, ht_cap_elem,
+		    struct ieee80211_ht_cap),
+	ELEM_STRUCT(WLAN_EID_HT_OPERATION, ht_operation,
+		    struct ieee80211_ht_operation),
+	ELEM(WLAN_EID_MESH_ID, mesh_id, mesh_id_len),
+	ELEM_STRUCT(WLAN_EID_MESH_CONFIG, mesh_config,
+		    struct ieee80211_meshconf_ie),
+	ELEM(WLAN_EID_PEER_MGMT, peering, peering_len),
+	ELEM(WLAN_EID_PREQ, preq, preq_len),
+	ELEM(WLAN_EID_PREP, prep, prep_len),
+	ELEM(WLAN_EID_PERR, perr, perr_len),
+	ELEM_STRUCT(WLAN_EID_RANN, rann, struct ieee80211_rann_ie),
+	ELEM(WLAN_EID_CHANNEL_SWITCH, ch_switch_elem, ch_switch_elem_len),
+	ELEM(WLAN_EID_COUNTRY, country_elem, country_elem_len),
+	ELEM(WLAN_EID_PWR_CONSTRAINT, pwr_constr_elem, pwr_constr_elem_len),
+	ELEM(WLAN_EID_TIMEOUT_INTERVAL, timeout_int, timeout_int_len),
+};
+
+#undef ELEM
+#undef ELEM_STRUCT
+
+static void ieee802_11_parse_vendor_elem(struct ieee802_11_elems *elems,
+					 u8 *pos, u8 elen)
+{
+	if (pos[3] == 1) {
+		/* OUI Type 1 - WPA IE */
+		elems->wpa = pos;
+		elems->wpa_len = elen;
+	} else if (elen >= 5 && pos[3] == 2) {
+		/* OUI Type 2 - WMM IE */
+		if (pos[4] == 0) {
+			elems->wmm_info = pos;
+			elems->wmm_info_len = elen;
+		} else if (pos[4] == 1) {
+			elems->wmm_param = pos;
+			elems->wmm_param_len = elen;
+		}
+	}
+}
+
+/*
+ * Walk the elements once, computing the CRC over those in @filter and
+ * the Microsoft vendor elements. The elements are only recorded in
+ * @elems if it is given; the TIM is always returned through @tim since
+ * the beacon path needs it even when nothing else changed.
+ */
+static u32 __ieee802_11_parse_elems(u8 *start, size_t len,
+				    struct ieee802_11_elems *elems,
+				    u64 filter, u32 crc,
+				    struct ieee80211_tim_ie **tim, u8 *tim_len,
+				    bool *parse_error)
 {
 	size_t left = len;
 	u8 *pos = start;
 	bool calc_crc = filter != 0;
+	const struct ieee802_11_elem_desc *desc;
 	DECLARE_BITMAP(seen_elems, 256);
 
 	bitmap_zero(seen_elems, 256);
-	memset(elems, 0, sizeof(*elems));
-	elems->ie_start = start;
-	elems->total_len = len;
+	*tim = NULL;
+	*tim_len = 0;
+	*parse_error = false;
 
 	while (left >= 2) {
 		u8 id, elen;
@@ -633,14 +752,14 @@ u32 ieee802_11_parse_elems_crc(u8 *start, size_t len,
 		left -= 2;
 
 		if (elen > left) {
-			elems->parse_error = true;
+			*parse_error = true;
 			break;
 		}
 
 		if (id != WLAN_EID_VENDOR_SPECIFIC &&
 		    id != WLAN_EID_QUIET &&
 		    test_bit(id, seen_elems)) {
-			elems->parse_error = true;
+			*parse_error = true;
 			left -= elen;
 			pos += elen;
 			continue;
@@ -650,43 +769,16 @@ u32 ieee802_11_parse_elems_crc(u8 *start, size_t len,
 			crc = crc32_be(crc, pos - 2, elen + 2);
 
 		elem_parse_failed = false;
+		desc = &ieee802_11_elem_descs[id];
 
 		switch (id) {
-		case WLAN_EID_SSID:
-			elems->ssid = pos;
-			elems->ssid_len = elen;
-			break;
-		case WLAN_EID_SUPP_RATES:
-			elems->supp_rates = pos;
-			elems->supp_rates_len = elen;
-			break;
-		case WLAN_EID_FH_PARAMS:
-			elems->fh_params = pos;
-			elems->fh_params_len = elen;
-			break;
-		case WLAN_EID_DS_PARAMS:
-			elems->ds_params = pos;
-			elems->ds_params_len = elen;
-			break;
-		case WLAN_EID_CF_PARAMS:
-			elems->cf_params = pos;
-			elems->cf_params_len = elen;
-			break;
 		case WLAN_EID_TIM:
 			if (elen >= sizeof(struct ieee80211_tim_ie)) {
-				elems->tim = (void *)pos;
-				elems->tim_len = elen;
+				*tim = (void *)pos;
+				*tim_len = elen;
 			} else
 				elem_parse_failed = true;
 			break;
-		case WLAN_EID_IBSS_PARAMS:
-			elems->ibss_params = pos;
-			elems->ibss_params_len = elen;
-			break;
-		case WLAN_EID_CHALLENGE:
-			elems->challenge = pos;
-			elems->challenge_len = elen;
-			break;
 		case WLAN_EID_VENDOR_SPECIFIC:
 			if (elen >= 4 && pos[0] == 0x00 && pos[1] == 0x50 &&
 			    pos[2] == 0xf2) {
@@ -695,107 +787,37 @@ u32 ieee802_11_parse_elems_crc(u8 *start, size_t len,
 				if (calc_crc)
 					crc = crc32_be(crc, pos - 2, elen + 2);
 
-				if (pos[3] == 1) {
-					/* OUI Type 1 - WPA IE */
-					elems->wpa = pos;
-					elems->wpa_len = elen;
-				} else if (elen >= 5 && pos[3] == 2) {
-					/* OUI Type 2 - WMM IE */
-					if (pos[4] == 0) {
-						elems->wmm_info = pos;
-						elems->wmm_info_len = elen;
-					} else if (pos[4] == 1) {
-						elems->wmm_param = pos;
-						elems->wmm_param_len = elen;
-					}
-				}
+				if (elems)
+					ieee802_11_parse_vendor_elem(elems, pos,
+								     elen);
 			}
 			break;
-		case WLAN_EID_RSN:
-			elems->rsn = pos;
-			elems->rsn_len = elen;
-			break;
-		case WLAN_EID_ERP_INFO:
-			elems->erp_info = pos;
-			elems->erp_info_len = elen;
-			break;
-		case WLAN_EID_EXT_SUPP_RATES:
-			elems->ext_supp_rates = pos;
-			elems->ext_supp_rates_len = elen;
-			break;
-		case WLAN_EID_HT_CAPABILITY:
-			if (elen >= sizeof(struct ieee80211_ht_cap))
-				elems->ht_cap_elem = (void *)pos;
-			else
-				elem_parse_failed = true;
-			break;
-		case WLAN_EID_HT_OPERATION:
-			if (elen >= sizeof(struct ieee80211_ht_operation))
-				elems->ht_operation = (void *)pos;
-			else
-				elem_parse_failed = true;
-			break;
-		case WLAN_EID_MESH_ID:
-			elems->mesh_id = pos;
-			elems->mesh_id_len = elen;
-			break;
-		case WLAN_EID_MESH_CONFIG:
-			if (elen >= sizeof(struct ieee80211_meshconf_ie))
-				elems->mesh_config = (void *)pos;
-			else
-				elem_parse_failed = true;
-			break;
-		case WLAN_EID_PEER_MGMT:
-			elems->peering = pos;
-			elems->peering_len = elen;
-			break;
-		case WLAN_EID_PREQ:
-			elems->preq = pos;
-			elems->preq_len = elen;
-			break;
-		case WLAN_EID_PREP:
-			elems->prep = pos;
-			elems->prep_len = elen;
-			break;
-		case WLAN_EID_PERR:
-			elems->perr = pos;
-			elems->perr_len = elen;
-			break;
-		case WLAN_EID_RANN:
-			if (elen >= sizeof(struct ieee80211_rann_ie))
-				elems->rann = (void *)pos;
-			else
-				elem_parse_failed = true;
-			break;
-		case WLAN_EID_CHANNEL_SWITCH:
-			elems->ch_switch_elem = pos;
-			elems->ch_switch_elem_len = elen;
-			break;
 		case WLAN_EID_QUIET:
+			if (!elems)
+				break;
 			if (!elems->quiet_elem) {
 				elems->quiet_elem = pos;
 				elems->quiet_elem_len = elen;
 			}
 			elems->num_of_quiet_elem++;
 			break;
-		case WLAN_EID_COUNTRY:
-			elems->country_elem = pos;
-			elems->country_elem_len = elen;
-			break;
-		case WLAN_EID_PWR_CONSTRAINT:
-			elems->pwr_constr_elem = pos;
-			elems->pwr_constr_elem_len = elen;
-			break;
-		case WLAN_EID_TIMEOUT_INTERVAL:
-			elems->timeout_int = pos;
-			elems->timeout_int_len = elen;
-			break;
 		default:
+			if (!desc->ptr)
+				break;
+			if (elen < desc->min_len) {
+				elem_parse_failed = true;
+				break;
+			}
+			if (!elems)
+				break;
+			*(u8 **)((u8 *)elems + desc->ptr) = pos;
+			if (desc->len != ELEM_NO_LEN)
+				*((u8 *)elems + desc->len) = elen;
 			break;
 		}
 
 		if (elem_parse_failed)
-			elems->parse_error = true;
+			*parse_error = true;
 		else
 			set_bit(id, seen_elems);
 
@@ -804,17 +826,44 @@ u32 ieee802_11_parse_elems_crc(u8 *start, size_t len,
 	}
 
 	if (left != 0)
-		elems->parse_error = true;
+		*parse_error = true;
 
 	return crc;
 }
 
+u32 ieee802_11_parse_elems_crc(u8 *start, size_t len,
+			       struct ieee802_11_elems *elems,
+			       u64 filter, u32 crc)
+{
+	memset(elems, 0, sizeof(*elems));
+	elems->ie_start = start;
+	elems->total_len = len;
+
+	return __ieee802_11_parse_elems(start, len, elems, filter, crc,
+					&elems->tim, &elems->tim_len,
+					&elems->parse_error);
+}
+
 void ieee802_11_parse_elems(u8 *start, size_t len,
 			    struct ieee802_11_elems *elems)
 {
 	ieee802_11_parse_elems_crc(start, len, elems, 0, 0);
 }
 
+/*
+ * The CRC ieee802_11_parse_elems_crc() would return, along with the TIM,
+ * without recording any other element. This lets the beacon path skip
+ * the full parse as long as nothing it cares about changed.
+ */
+u32 ieee802_11_elems_crc(u8 *start, size_t len, u64 filter, u32 crc,
+			 struct ieee80211_tim_ie **tim, u8 *tim_len)
+{
+	bool parse_error;
+
+	return __ieee802_11_parse_elems(start, len, NULL, filter, crc,
+					tim, tim_len, &parse_error);
+}
+
 void ieee80211_set_wmm_default(struct ieee80211_sub_if_data *sdata,
 			       bool bss_notify)
 {
@@ -18,6 +18,8 @@
 #include <net/cfg80211.h>
 #include "reg.h"
 
+#define CFG80211_BSS_HASH_SIZE	64
+
 struct cfg80211_registered_device {
 	const struct cfg80211_ops *ops;
 	struct list_head list;
@@ -47,6 +49,16 @@ struct cfg80211_registered_device {
 	/* wiphy index, internal only */
 	int wiphy_idx;
 
+	/* per channel regulatory rules, compiled by reg.c under reg_mutex */
+	struct cfg80211_reg_chan *reg_chans[IEEE80211_NUM_BANDS];
+	const struct ieee80211_regdomain *reg_chans_regd;
+	u32 reg_chans_generation;
+	bool reg_chans_valid;
+
+	/* regulatory processing statistics */
+	u32 reg_updates, reg_compiles, reg_cache_hits, reg_beacon_hints;
+	u64 reg_update_ns, reg_update_max_ns;
+
 	/* associated wireless interfaces */
 	struct mutex devlist_mtx;
 	/* protected by devlist_mtx or RCU */
@@ -63,9 +75,29 @@ struct cfg80211_registered_device {
 
 	/* BSSes/scanning */
 	spinlock_t bss_lock;
-	struct list_head bss_list;
+	struct list_head bss_list;	/* ordered by timestamp, oldest first */
+	struct list_head bss_seq_list;	/* ordered by insertion, see seq */
 	struct rb_root bss_tree;
+	struct hlist_head bss_hash_bssid[CFG80211_BSS_HASH_SIZE];
+	struct hlist_head bss_hash_ssid[CFG80211_BSS_HASH_SIZE];
+	struct hlist_head bss_hash_meshid[CFG80211_BSS_HASH_SIZE];
+	unsigned int bss_entries;
+	/* insertion sequence number of the last added entry */
+	u32 bss_seq;
+	/* jiffies all entries have been aged by, see bss_ts() */
+	unsigned long bss_age;
 	u32 bss_generation;
+	/* bss_generation when an entry was last removed */
+	u32 bss_removed_generation;
+
+	/* BSS cache statistics, protected by bss_lock */
+	u32 bss_lookups;
+	u32 bss_lookup_steps;
+	u32 bss_expired;
+	u32 bss_evicted;
+	u32 bss_ies_reused;
+	u32 bss_ies_allocated;
+
 	struct cfg80211_scan_request *scan_req; /* protected by RTNL */
 	struct cfg80211_sched_scan_request *sched_scan_req;
 	unsigned long suspend_at;
@@ -135,15 +167,48 @@ static inline void assert_cfg80211_lock(void)
  */
 #define WIPHY_IDX_STALE -1
 
+/* offset of an element that is not present in a struct cfg80211_bss_ies */
+#define CFG80211_IE_ABSENT	0xffff
+
+/*
+ * Immutable information elements of a BSS entry. Entries (and aliases)
+ * receiving identical elements share one buffer; the offsets of the
+ * elements used to look up and sort entries are found once when the
+ * buffer is built. The buffer is freed after an RCU grace period.
+ */
+struct cfg80211_bss_ies {
+	struct kref ref;
+	struct rcu_head rcu_head;
+	u32 crc;
+	u16 ssid_off;
+	u16 meshid_off;
+	u16 meshconf_off;
+	size_t len;
+	const u8 *data;	/* points to buf[] unless not yet allocated */
+	u8 buf[];
+};
+
 struct cfg80211_internal_bss {
 	struct list_head list;
+	struct list_head seq_list;
 	struct list_head list_aliases;
 	struct rb_node rbn;
+	struct hlist_node bssid_node;
+	struct hlist_node ssid_node;
+	struct hlist_node meshid_node;
+	/* last update, offset by dev->bss_age at that time, use bss_ts() */
 	unsigned long ts;
+	/*
+	 * order of insertion, lookups prefer the earliest added match and
+	 * scan dumps resume by it
+	 */
+	u32 seq;
+	/* bss_generation of the last change to this entry */
+	u32 generation;
 	struct kref ref;
 	atomic_t hold;
-	bool beacon_ies_allocated;
-	bool proberesp_ies_allocated;
+	struct cfg80211_bss_ies *beacon_ies;
+	struct cfg80211_bss_ies *proberesp_ies;
 
 	/* must be last because of priv member */
 	struct cfg80211_bss pub;
@@ -154,6 +219,13 @@ static inline struct cfg80211_internal_bss *bss_from_pub(struct cfg80211_bss *pu
 	return container_of(pub, struct cfg80211_internal_bss, pub);
 }
 
+/* jiffies of the last update of @bss, taking cfg80211_bss_age() into account */
+static inline unsigned long bss_ts(struct cfg80211_registered_device *dev,
+				   struct cfg80211_internal_bss *bss)
+{
+	return bss->ts - dev->bss_age;
+}
+
 static inline void cfg80211_hold_bss(struct cfg80211_internal_bss *bss)
 {
 	atomic_inc(&bss->hold);
@@ -280,8 +352,10 @@ extern int cfg80211_dev_rename(struct cfg80211_registered_device *rdev,
 void ieee80211_set_bitrate_flags(struct wiphy *wiphy);
 
 void cfg80211_bss_expire(struct cfg80211_registered_device *dev);
+const u8 *cfg80211_bss_ssid(struct cfg80211_internal_bss *bss);
 void cfg80211_bss_age(struct cfg80211_registered_device *dev,
                       unsigned long age_secs);
+extern unsigned int cfg80211_bss_entries_limit;
 
 /* IBSS */
 int __cfg80211_join_ibss(struct cfg80211_registered_device *rdev,
@@ -10,6 +10,7 @@
  */
 
 #include <linux/slab.h>
+#include <linux/math64.h>
 #include "core.h"
 #include "debugfs.h"
 
@@ -100,6 +101,102 @@ static const struct file_operations ht40allow_map_ops = {
 	.llseek = default_llseek,
 };
 
+static unsigned int bss_hash_longest(struct hlist_head *hash)
+{
+	struct hlist_node *node;
+	unsigned int i, n, longest = 0;
+
+	for (i = 0; i < CFG80211_BSS_HASH_SIZE; i++) {
+		n = 0;
+		hlist_for_each(node, &hash[i])
+			n++;
+		longest = max(longest, n);
+	}
+
+	return longest;
+}
+
+static ssize_t bss_cache_read(struct file *file, char __user *user_buf,
+			      size_t count, loff_t *ppos)
+{
+	struct wiphy *wiphy = file->private_data;
+	struct cfg80211_registered_device *rdev = wiphy_to_dev(wiphy);
+	char buf[320];
+	unsigned int steps_x10;
+	int len;
+
+	spin_lock_bh(&rdev->bss_lock);
+
+	steps_x10 = rdev->bss_lookups ?
+		    div_u64((u64)rdev->bss_lookup_steps * 10,
+			    rdev->bss_lookups) : 0;
+
+	len = scnprintf(buf, sizeof(buf),
+			"entries: %u (limit %u)\n"
+			"generation: %u\n"
+			"lookups: %u\n"
+			"lookup steps: %u (%u.%u per lookup)\n"
+			"expired: %u\n"
+			"evicted: %u\n"
+			"IE buffers: %u allocated, %u reused\n"
+			"longest chain: bssid %u ssid %u meshid %u\n",
+			rdev->bss_entries, cfg80211_bss_entries_limit,
+			rdev->bss_generation,
+			rdev->bss_lookups,
+			rdev->bss_lookup_steps, steps_x10 / 10, steps_x10 % 10,
+			rdev->bss_expired,
+			rdev->bss_evicted,
+			rdev->bss_ies_allocated, rdev->bss_ies_reused,
+			bss_hash_longest(rdev->bss_hash_bssid),
+			bss_hash_longest(rdev->bss_hash_ssid),
+			bss_hash_longest(rdev->bss_hash_meshid));
+
+	spin_unlock_bh(&rdev->bss_lock);
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static const struct file_operations bss_cache_ops = {
+	.read = bss_cache_read,
+	.open = simple_open,
+	.llseek = default_llseek,
+};
+
+static ssize_t regulatory_read(struct file *file, char __user *user_buf,
+			       size_t count, loff_t *ppos)
+{
+	struct wiphy *wiphy = file->private_data;
+	struct cfg80211_registered_device *rdev = wiphy_to_dev(wiphy);
+	char buf[256];
+	u64 avg_ns;
+	int len;
+
+	avg_ns = rdev->reg_updates ?
+		 div_u64(rdev->reg_update_ns, rdev->reg_updates) : 0;
+
+	len = scnprintf(buf, sizeof(buf),
+			"updates: %u\n"
+			"rule table compiles: %u\n"
+			"rule table reuses: %u\n"
+			"beacon hints applied: %u\n"
+			"update time: %llu us total, %llu us avg, %llu us max\n",
+			rdev->reg_updates,
+			rdev->reg_compiles,
+			rdev->reg_cache_hits,
+			rdev->reg_beacon_hints,
+			div_u64(rdev->reg_update_ns, NSEC_PER_USEC),
+			div_u64(avg_ns, NSEC_PER_USEC),
+			div_u64(rdev->reg_update_max_ns, NSEC_PER_USEC));
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static const struct file_operations regulatory_ops = {
+	.read = regulatory_read,
+	.open = simple_open,
+	.llseek = default_llseek,
+};
+
 #define DEBUGFS_ADD(name)						\
 	debugfs_create_file(#name, S_IRUGO, phyd, &rdev->wiphy, &name## _ops);
 
@@ -112,4 +209,6 @@ void cfg80211_debugfs_rdev_add(struct cfg80211_registered_device *rdev)
 	DEBUGFS_ADD(short_retry_limit);
 	DEBUGFS_ADD(long_retry_limit);
 	DEBUGFS_ADD(ht40allow_map);
+	DEBUGFS_ADD(bss_cache);
+	DEBUGFS_ADD(regulatory);
 }
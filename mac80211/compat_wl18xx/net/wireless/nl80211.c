@@ -363,6 +363,9 @@ static const struct nla_policy nl80211_policy[NL80211_ATTR_MAX+1] = {
 	[NL80211_ATTR_SCHED_SCAN_SHORT_INTERVAL] = { .type = NLA_U32 },
 	[NL80211_ATTR_SCHED_SCAN_NUM_SHORT_INTERVALS] = { .type = NLA_U8 },
 	[NL80211_ATTR_ROAMING_DISABLED] = { .type = NLA_FLAG },
+	[NL80211_ATTR_SCAN_DUMP_GENERATION] = { .type = NLA_U32 },
+	[NL80211_ATTR_SCAN_DUMP_BANDS] = { .type = NLA_U32 },
+	[NL80211_ATTR_SCAN_DUMP_MIN_RSSI] = { .type = NLA_U32 },
 };
 
 /* policy for the key attributes */
@@ -4642,11 +4645,31 @@ static int nl80211_scan_cancel(struct sk_buff *skb, struct genl_info *info)
 	return cfg80211_scan_cancel(info->user_ptr[0]);
 }
 
+/*
+ * Scan dump state, kept in cb->args[2] across the dump callbacks: the
+ * filters from the request and the entry to resume from.
+ */
+struct nl80211_scan_dump {
+	/* referenced, NULL before the first and after the last entry */
+	struct cfg80211_internal_bss *next;
+	bool done;
+
+	bool delta;
+	u32 since_generation;
+	u32 bands;
+	bool min_rssi_set;
+	s32 min_rssi_mbm;
+	bool ssid_set;
+	u8 ssid_len;
+	u8 ssid[IEEE80211_MAX_SSID_LEN];
+};
+
 static int nl80211_send_bss(struct sk_buff *msg, struct netlink_callback *cb,
 			    u32 seq, int flags,
 			    struct cfg80211_registered_device *rdev,
 			    struct wireless_dev *wdev,
-			    struct cfg80211_internal_bss *intbss)
+			    struct cfg80211_internal_bss *intbss,
+			    struct nl80211_scan_dump *state)
 {
 	struct cfg80211_bss *res = &intbss->pub;
 	void *hdr;
@@ -4665,6 +4688,11 @@ static int nl80211_send_bss(struct sk_buff *msg, struct netlink_callback *cb,
 	    nla_put_u32(msg, NL80211_ATTR_IFINDEX, wdev->netdev->ifindex))
 		goto nla_put_failure;
 
+	if (state->delta &&
+	    nla_put_u32(msg, NL80211_ATTR_SCAN_DUMP_GENERATION,
+			state->since_generation))
+		goto nla_put_failure;
+
 	bss = nla_nest_start(msg, NL80211_ATTR_BSS);
 	if (!bss)
 		goto nla_put_failure;
@@ -4688,7 +4716,7 @@ static int nl80211_send_bss(struct sk_buff *msg, struct netlink_callback *cb,
 	if (nla_put_u16(msg, NL80211_BSS_CAPABILITY, res->capability) ||
 	    nla_put_u32(msg, NL80211_BSS_FREQUENCY, res->channel->center_freq) ||
 	    nla_put_u32(msg, NL80211_BSS_SEEN_MS_AGO,
-			jiffies_to_msecs(jiffies - intbss->ts)))
+			jiffies_to_msecs(jiffies - bss_ts(rdev, intbss))))
 		goto nla_put_failure;
 
 	switch (rdev->wiphy.signal_type) {
@@ -4731,20 +4759,91 @@ static int nl80211_send_bss(struct sk_buff *msg, struct netlink_callback *cb,
 	return -EMSGSIZE;
 }
 
+static struct nl80211_scan_dump *
+nl80211_scan_dump_state(void)
+{
+	struct nlattr **attrbuf = nl80211_fam.attrbuf;
+	struct nl80211_scan_dump *state;
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state)
+		return NULL;
+
+	/* attrbuf was filled by nl80211_get_ifidx() for the first callback */
+	if (attrbuf[NL80211_ATTR_SCAN_DUMP_GENERATION]) {
+		state->delta = true;
+		state->since_generation =
+			nla_get_u32(attrbuf[NL80211_ATTR_SCAN_DUMP_GENERATION]);
+	}
+	if (attrbuf[NL80211_ATTR_SCAN_DUMP_BANDS])
+		state->bands = nla_get_u32(attrbuf[NL80211_ATTR_SCAN_DUMP_BANDS]);
+	if (attrbuf[NL80211_ATTR_SCAN_DUMP_MIN_RSSI]) {
+		state->min_rssi_set = true;
+		state->min_rssi_mbm = DBM_TO_MBM((s32)
+			nla_get_u32(attrbuf[NL80211_ATTR_SCAN_DUMP_MIN_RSSI]));
+	}
+	if (attrbuf[NL80211_ATTR_SSID]) {
+		state->ssid_set = true;
+		state->ssid_len = nla_len(attrbuf[NL80211_ATTR_SSID]);
+		memcpy(state->ssid, nla_data(attrbuf[NL80211_ATTR_SSID]),
+		       state->ssid_len);
+	}
+
+	return state;
+}
+
+static bool nl80211_scan_dump_match(struct cfg80211_registered_device *rdev,
+				    struct nl80211_scan_dump *state,
+				    struct cfg80211_internal_bss *bss)
+{
+	const u8 *ssid;
+
+	if (state->since_generation &&
+	    (s32)(bss->generation - state->since_generation) <= 0)
+		return false;
+
+	if (state->bands && !(state->bands & BIT(bss->pub.channel->band)))
+		return false;
+
+	if (state->min_rssi_set &&
+	    rdev->wiphy.signal_type == CFG80211_SIGNAL_TYPE_MBM &&
+	    bss->pub.signal < state->min_rssi_mbm)
+		return false;
+
+	if (state->ssid_set) {
+		ssid = cfg80211_bss_ssid(bss);
+		if (!ssid || ssid[1] != state->ssid_len ||
+		    memcmp(ssid + 2, state->ssid, state->ssid_len))
+			return false;
+	}
+
+	return true;
+}
+
 static int nl80211_dump_scan(struct sk_buff *skb,
 			     struct netlink_callback *cb)
 {
 	struct cfg80211_registered_device *rdev;
 	struct net_device *dev;
-	struct cfg80211_internal_bss *scan;
+	struct cfg80211_internal_bss *scan, *resume;
+	struct nl80211_scan_dump *state = (void *)cb->args[2];
 	struct wireless_dev *wdev;
-	int start = cb->args[1], idx = 0;
+	bool first = !state;
 	int err;
 
 	err = nl80211_prepare_netdev_dump(skb, cb, &rdev, &dev);
 	if (err)
 		return err;
 
+	if (first) {
+		state = nl80211_scan_dump_state();
+		if (!state) {
+			nl80211_finish_netdev_dump(rdev);
+			return -ENOMEM;
+		}
+		cb->args[2] = (long)state;
+	}
+
 	wdev = dev->ieee80211_ptr;
 
 	wdev_lock(wdev);
@@ -4755,26 +4854,73 @@ static int nl80211_dump_scan(struct sk_buff *skb,
 	cb->seq = rdev->bss_generation;
 #endif
 
-	list_for_each_entry(scan, &rdev->bss_list, list) {
-		if (++idx <= start)
-			continue;
-		if (nl80211_send_bss(skb, cb,
-				cb->nlh->nlmsg_seq, NLM_F_MULTI,
-				rdev, wdev, scan) < 0) {
-			idx--;
-			break;
+	/*
+	 * Entries that went away can't be reported as changes, so fall
+	 * back to a full dump if any was removed since the generation
+	 * userspace knows about.
+	 */
+	if (first && state->since_generation &&
+	    (s32)(rdev->bss_removed_generation - state->since_generation) >= 0)
+		state->since_generation = 0;
+
+	/*
+	 * Entries are dumped in the order they were added, which updates
+	 * don't change. Continue from where the last message stopped, or if
+	 * that entry went away meanwhile, from the first one added after it.
+	 */
+	resume = state->next;
+	state->next = NULL;
+	if (state->done) {
+		scan = NULL;
+	} else if (!resume) {
+		scan = list_entry(rdev->bss_seq_list.next,
+				  struct cfg80211_internal_bss, seq_list);
+	} else if (!list_empty(&resume->seq_list)) {
+		scan = resume;
+	} else {
+		list_for_each_entry(scan, &rdev->bss_seq_list, seq_list)
+			if ((s32)(scan->seq - resume->seq) > 0)
+				break;
+	}
+
+	if (scan) {
+		state->done = true;
+		list_for_each_entry_from(scan, &rdev->bss_seq_list, seq_list) {
+			if (nl80211_scan_dump_match(rdev, state, scan) &&
+			    nl80211_send_bss(skb, cb,
+					cb->nlh->nlmsg_seq, NLM_F_MULTI,
+					rdev, wdev, scan, state) < 0) {
+				kref_get(&scan->ref);
+				state->next = scan;
+				state->done = false;
+				break;
+			}
 		}
 	}
 
+	if (resume)
+		cfg80211_put_bss(&resume->pub);
+
 	spin_unlock_bh(&rdev->bss_lock);
 	wdev_unlock(wdev);
 
-	cb->args[1] = idx;
 	nl80211_finish_netdev_dump(rdev);
 
 	return skb->len;
 }
 
+static int nl80211_dump_scan_done(struct netlink_callback *cb)
+{
+	struct nl80211_scan_dump *state = (void *)cb->args[2];
+
+	if (state) {
+		if (state->next)
+			cfg80211_put_bss(&state->next->pub);
+		kfree(state);
+	}
+	return 0;
+}
+
 static int nl80211_send_survey(struct sk_buff *msg, u32 pid, u32 seq,
 				int flags, struct net_device *dev,
 				struct survey_info *survey)
@@ -7227,6 +7373,7 @@ static struct genl_ops nl80211_ops[] = {
 		.cmd = NL80211_CMD_GET_SCAN,
 		.policy = nl80211_policy,
 		.dumpit = nl80211_dump_scan,
+		.done = nl80211_dump_scan_done,
 	},
 	{
 		.cmd = NL80211_CMD_START_SCHED_SCAN,
@@ -55,6 +55,7 @@
 #include <linux/nl80211.h>
 #include <linux/platform_device.h>
 #include <linux/moduleparam.h>
+#include <linux/ktime.h>
 #include <net/cfg80211.h>
 #include "core.h"
 #include "reg.h"
@@ -114,6 +115,12 @@ static inline void assert_reg_lock(void)
 	lockdep_assert_held(&reg_mutex);
 }
 
+/*
+ * Bumped whenever the regulatory domains are replaced, the channel rule
+ * tables of the wiphys compiled before are stale then.
+ */
+static u32 reg_generation;
+
 /* Used to queue up regulatory hints */
 static LIST_HEAD(reg_requests_list);
 static spinlock_t reg_requests_lock;
@@ -182,6 +189,8 @@ MODULE_PARM_DESC(ieee80211_regdom, "IEEE 802.11 regulatory domain code");
 
 static void reset_regdomains(bool full_reset)
 {
+	reg_generation++;
+
 	/* avoid freeing static information or freeing something twice */
 	if (cfg80211_regdomain == cfg80211_world_regdom)
 		cfg80211_regdomain = NULL;
@@ -685,19 +694,10 @@ static u32 map_regdom_flags(u32 rd_flags)
 	return channel_flags;
 }
 
-static int freq_reg_info_regd(struct wiphy *wiphy,
-			      u32 center_freq,
-			      u32 desired_bw_khz,
-			      const struct ieee80211_reg_rule **reg_rule,
-			      const struct ieee80211_regdomain *custom_regd)
+static const struct ieee80211_regdomain *
+reg_get_regd(struct wiphy *wiphy, const struct ieee80211_regdomain *custom_regd)
 {
-	int i;
-	bool band_rule_found = false;
 	const struct ieee80211_regdomain *regd;
-	bool bw_fits = false;
-
-	if (!desired_bw_khz)
-		desired_bw_khz = MHZ_TO_KHZ(20);
 
 	regd = custom_regd ? custom_regd : cfg80211_regdomain;
 
@@ -711,6 +711,24 @@ static int freq_reg_info_regd(struct wiphy *wiphy,
 	    wiphy->regd)
 		regd = wiphy->regd;
 
+	return regd;
+}
+
+static int freq_reg_info_regd(struct wiphy *wiphy,
+			      u32 center_freq,
+			      u32 desired_bw_khz,
+			      const struct ieee80211_reg_rule **reg_rule,
+			      const struct ieee80211_regdomain *custom_regd)
+{
+	int i;
+	bool band_rule_found = false;
+	const struct ieee80211_regdomain *regd;
+	bool bw_fits = false;
+
+	if (!desired_bw_khz)
+		desired_bw_khz = MHZ_TO_KHZ(20);
+
+	regd = reg_get_regd(wiphy, custom_regd);
 	if (!regd)
 		return -EINVAL;
 
@@ -759,6 +777,118 @@ int freq_reg_info(struct wiphy *wiphy,
 }
 EXPORT_SYMBOL(freq_reg_info);
 
+static struct cfg80211_reg_chan *
+reg_alloc_chans(struct ieee80211_supported_band *sband)
+{
+	struct cfg80211_reg_chan *rc;
+	int i, j, freq;
+
+	rc = kcalloc(sband->n_channels, sizeof(*rc), GFP_KERNEL);
+	if (!rc)
+		return NULL;
+
+	/* the channels of a band never change, neither do their neighbours */
+	for (i = 0; i < sband->n_channels; i++) {
+		freq = sband->channels[i].center_freq;
+		rc[i].ht40_below = rc[i].ht40_above = -1;
+		for (j = 0; j < sband->n_channels; j++) {
+			if (sband->channels[j].center_freq == freq - 20)
+				rc[i].ht40_below = j;
+			if (sband->channels[j].center_freq == freq + 20)
+				rc[i].ht40_above = j;
+		}
+	}
+
+	return rc;
+}
+
+/*
+ * Look up the rule of every channel of the wiphy once, unless that was
+ * done already for the regulatory domain in effect, e.g. when the same
+ * country IE is hinted again.
+ */
+static void reg_compile_chans(struct wiphy *wiphy)
+{
+	struct cfg80211_registered_device *rdev = wiphy_to_dev(wiphy);
+	const struct ieee80211_regdomain *regd = reg_get_regd(wiphy, NULL);
+	struct ieee80211_supported_band *sband;
+	struct cfg80211_reg_chan *rc;
+	enum ieee80211_band band;
+	unsigned int i;
+
+	assert_reg_lock();
+
+	if (rdev->reg_chans_valid &&
+	    rdev->reg_chans_generation == reg_generation &&
+	    rdev->reg_chans_regd == regd) {
+		rdev->reg_cache_hits++;
+		return;
+	}
+
+	rdev->reg_chans_valid = false;
+
+	for (band = 0; band < IEEE80211_NUM_BANDS; band++) {
+		sband = wiphy->bands[band];
+		if (!sband)
+			continue;
+
+		if (!rdev->reg_chans[band]) {
+			rdev->reg_chans[band] = reg_alloc_chans(sband);
+			if (!rdev->reg_chans[band])
+				return;
+		}
+
+		rc = rdev->reg_chans[band];
+		for (i = 0; i < sband->n_channels; i++) {
+			rc[i].rule = NULL;
+			rc[i].err = freq_reg_info_regd(wiphy,
+				MHZ_TO_KHZ(sband->channels[i].center_freq),
+				MHZ_TO_KHZ(20), &rc[i].rule, NULL);
+		}
+	}
+
+	rdev->reg_chans_regd = regd;
+	rdev->reg_chans_generation = reg_generation;
+	rdev->reg_chans_valid = true;
+	rdev->reg_compiles++;
+}
+
+static void reg_free_chans(struct wiphy *wiphy)
+{
+	struct cfg80211_registered_device *rdev = wiphy_to_dev(wiphy);
+	enum ieee80211_band band;
+
+	for (band = 0; band < IEEE80211_NUM_BANDS; band++) {
+		kfree(rdev->reg_chans[band]);
+		rdev->reg_chans[band] = NULL;
+	}
+	rdev->reg_chans_valid = false;
+}
+
+/* the rule of a 20 MHz channel, from the compiled table if possible */
+static int reg_chan_rule(struct wiphy *wiphy,
+			 enum ieee80211_band band,
+			 unsigned int chan_idx,
+			 const struct ieee80211_reg_rule **reg_rule)
+{
+	struct cfg80211_registered_device *rdev = wiphy_to_dev(wiphy);
+	struct ieee80211_channel *chan;
+	struct cfg80211_reg_chan *rc;
+
+	if (rdev->reg_chans_valid &&
+	    rdev->reg_chans_generation == reg_generation) {
+		rc = &rdev->reg_chans[band][chan_idx];
+		*reg_rule = rc->rule;
+		return rc->err;
+	}
+
+	chan = &wiphy->bands[band]->channels[chan_idx];
+	return freq_reg_info(wiphy,
+			     MHZ_TO_KHZ(chan->center_freq),
+			     MHZ_TO_KHZ(20),
+			     reg_rule);
+}
+
 #ifdef CONFIG_CFG80211_REG_DEBUG
 static const char *reg_initiator_name(enum nl80211_reg_initiator initiator)
 {
@@ -848,10 +978,7 @@ static void handle_channel(struct wiphy *wiphy,
 
 	flags = chan->orig_flags;
 
-	r = freq_reg_info(wiphy,
-			  MHZ_TO_KHZ(chan->center_freq),
-			  desired_bw_khz,
-			  &reg_rule);
+	r = reg_chan_rule(wiphy, band, chan_idx, &reg_rule);
 
 	if (r) {
 		/*
@@ -1015,23 +1142,30 @@ static bool ignore_reg_update(struct wiphy *wiphy,
 }
 
 static void handle_reg_beacon(struct wiphy *wiphy,
-			      unsigned int chan_idx,
 			      struct reg_beacon *reg_beacon)
 {
 	struct ieee80211_supported_band *sband;
-	struct ieee80211_channel *chan;
+	struct ieee80211_channel *chan = NULL;
 	bool channel_changed = false;
 	struct ieee80211_channel chan_before;
+	unsigned int i;
 
 	assert_cfg80211_lock();
 
 	sband = wiphy->bands[reg_beacon->chan.band];
-	chan = &sband->channels[chan_idx];
-
-	if (likely(chan->center_freq != reg_beacon->chan.center_freq))
+	if (!sband)
 		return;
 
-	if (chan->beacon_found)
+	/* a hint only ever applies to its own channel */
+	for (i = 0; i < sband->n_channels; i++) {
+		if (sband->channels[i].center_freq ==
+		    reg_beacon->chan.center_freq) {
+			chan = &sband->channels[i];
+			break;
+		}
+	}
+
+	if (!chan || chan->beacon_found)
 		return;
 
 	chan->beacon_found = true;
@@ -1039,6 +1173,8 @@ static void handle_reg_beacon(struct wiphy *wiphy,
 	if (wiphy->flags & WIPHY_FLAG_DISABLE_BEACON_HINTS)
 		return;
 
+	wiphy_to_dev(wiphy)->reg_beacon_hints++;
+
 	chan_before.center_freq = chan->center_freq;
 	chan_before.flags = chan->flags;
 
@@ -1063,18 +1199,9 @@ static void handle_reg_beacon(struct wiphy *wiphy,
 static void wiphy_update_new_beacon(struct wiphy *wiphy,
 				    struct reg_beacon *reg_beacon)
 {
-	unsigned int i;
-	struct ieee80211_supported_band *sband;
-
 	assert_cfg80211_lock();
 
-	if (!wiphy->bands[reg_beacon->chan.band])
-		return;
-
-	sband = wiphy->bands[reg_beacon->chan.band];
-
-	for (i = 0; i < sband->n_channels; i++)
-		handle_reg_beacon(wiphy, i, reg_beacon);
+	handle_reg_beacon(wiphy, reg_beacon);
 }
 
 /*
@@ -1082,22 +1209,12 @@ static void wiphy_update_new_beacon(struct wiphy *wiphy,
  */
 static void wiphy_update_beacon_reg(struct wiphy *wiphy)
 {
-	unsigned int i;
-	struct ieee80211_supported_band *sband;
 	struct reg_beacon *reg_beacon;
 
 	assert_cfg80211_lock();
 
-	if (list_empty(&reg_beacon_list))
-		return;
-
-	list_for_each_entry(reg_beacon, &reg_beacon_list, list) {
-		if (!wiphy->bands[reg_beacon->chan.band])
-			continue;
-		sband = wiphy->bands[reg_beacon->chan.band];
-		for (i = 0; i < sband->n_channels; i++)
-			handle_reg_beacon(wiphy, i, reg_beacon);
-	}
+	list_for_each_entry(reg_beacon, &reg_beacon_list, list)
+		handle_reg_beacon(wiphy, reg_beacon);
 }
 
 static bool reg_is_world_roaming(struct wiphy *wiphy)
@@ -1142,9 +1259,11 @@ static void reg_process_ht_flags_channel(struct wiphy *wiphy,
 					 enum ieee80211_band band,
 					 unsigned int chan_idx)
 {
+	struct cfg80211_registered_device *rdev = wiphy_to_dev(wiphy);
 	struct ieee80211_supported_band *sband;
 	struct ieee80211_channel *channel;
 	struct ieee80211_channel *channel_before = NULL, *channel_after = NULL;
+	struct cfg80211_reg_chan *rc;
 	unsigned int i;
 
 	assert_cfg80211_lock();
@@ -1162,12 +1281,20 @@ static void reg_process_ht_flags_channel(struct wiphy *wiphy,
 	 * We need to ensure the extension channels exist to
 	 * be able to use HT40- or HT40+, this finds them (or not)
 	 */
-	for (i = 0; i < sband->n_channels; i++) {
-		struct ieee80211_channel *c = &sband->channels[i];
-		if (c->center_freq == (channel->center_freq - 20))
-			channel_before = c;
-		if (c->center_freq == (channel->center_freq + 20))
-			channel_after = c;
+	if (rdev->reg_chans[band]) {
+		rc = &rdev->reg_chans[band][chan_idx];
+		if (rc->ht40_below >= 0)
+			channel_before = &sband->channels[rc->ht40_below];
+		if (rc->ht40_above >= 0)
+			channel_after = &sband->channels[rc->ht40_above];
+	} else {
+		for (i = 0; i < sband->n_channels; i++) {
+			struct ieee80211_channel *c = &sband->channels[i];
+			if (c->center_freq == (channel->center_freq - 20))
+				channel_before = c;
+			if (c->center_freq == (channel->center_freq + 20))
+				channel_after = c;
+		}
 	}
 
 	/*
@@ -1216,15 +1343,22 @@ static void reg_process_ht_flags(struct wiphy *wiphy)
 static void wiphy_update_regulatory(struct wiphy *wiphy,
 				    enum nl80211_reg_initiator initiator)
 {
+	struct cfg80211_registered_device *rdev = wiphy_to_dev(wiphy);
 	enum ieee80211_band band;
+	ktime_t start;
+	u64 ns;
 
 	assert_reg_lock();
 
 	if (ignore_reg_update(wiphy, initiator))
 		return;
 
+	start = ktime_get();
+
 	last_request->dfs_region = cfg80211_regdomain->dfs_region;
 
+	reg_compile_chans(wiphy);
+
 	for (band = 0; band < IEEE80211_NUM_BANDS; band++) {
 		if (wiphy->bands[band])
 			handle_band(wiphy, band, initiator);
@@ -1232,6 +1366,12 @@ static void wiphy_update_regulatory(struct wiphy *wiphy,
 
 	reg_process_beacons(wiphy);
 	reg_process_ht_flags(wiphy);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	rdev->reg_updates++;
+	rdev->reg_update_ns += ns;
+	rdev->reg_update_max_ns = max(rdev->reg_update_max_ns, ns);
+
 	if (wiphy->reg_notifier)
 		wiphy->reg_notifier(wiphy, last_request);
 }
@@ -2400,6 +2540,7 @@ void wiphy_regulatory_deregister(struct wiphy *wiphy)
 	if (!reg_dev_ignore_cell_hint(wiphy))
 		reg_num_devs_support_basehint--;
 
+	reg_free_chans(wiphy);
 	kfree(wiphy->regd);
 
 	if (last_request)
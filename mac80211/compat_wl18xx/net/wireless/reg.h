@@ -18,6 +18,16 @@
 
 extern const struct ieee80211_regdomain *cfg80211_regdomain;
 
+/*
+ * Regulatory rule of a channel as looked up for the current regulatory
+ * domain, along with the channels 20 MHz below and above it.
+ */
+struct cfg80211_reg_chan {
+	const struct ieee80211_reg_rule *rule;
+	int err;
+	s16 ht40_below, ht40_above;
+};
+
 bool is_world_regdom(const char *alpha2);
 bool reg_is_valid_request(const char *alpha2);
 bool reg_supported_dfs_region(u8 dfs_region);
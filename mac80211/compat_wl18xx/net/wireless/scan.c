@@ -10,6 +10,7 @@
 #include <linux/wireless.h>
 #include <linux/nl80211.h>
 #include <linux/etherdevice.h>
+#include <linux/jhash.h>
 #include <net/arp.h>
 #include <net/cfg80211.h>
 #include <net/cfg80211-wext.h>
@@ -20,6 +21,11 @@
 
 #define IEEE80211_SCAN_RESULT_EXPIRE	(30 * HZ)
 
+unsigned int cfg80211_bss_entries_limit = 1000;
+module_param_named(bss_entries_limit, cfg80211_bss_entries_limit, uint, 0644);
+MODULE_PARM_DESC(bss_entries_limit,
+		 "limit to number of scan BSS entries (per wiphy, default 1000)");
+
 void ___cfg80211_scan_done(struct cfg80211_registered_device *rdev, bool leak)
 {
 	struct cfg80211_scan_request *request;
@@ -220,6 +226,105 @@ int cfg80211_scan_cancel(struct cfg80211_registered_device *rdev)
 	return 0;
 }
 
+static void bss_ies_free(struct kref *ref)
+{
+	struct cfg80211_bss_ies *ies;
+
+	ies = container_of(ref, struct cfg80211_bss_ies, ref);
+	kfree_rcu(ies, rcu_head);
+}
+
+static void bss_ies_put(struct cfg80211_bss_ies *ies)
+{
+	if (ies)
+		kref_put(&ies->ref, bss_ies_free);
+}
+
+static u16 bss_ies_offset(const struct cfg80211_bss_ies *ies, u8 eid)
+{
+	const u8 *ie = cfg80211_find_ie(eid, ies->data, ies->len);
+
+	return ie ? ie - ies->data : CFG80211_IE_ABSENT;
+}
+
+/*
+ * Describe IEs that still live in the caller's buffer, e.g. the received
+ * frame. They are only copied if no entry already has identical ones.
+ */
+static void bss_ies_init(struct cfg80211_bss_ies *ies,
+			 const u8 *data, size_t len)
+{
+	ies->data = data;
+	ies->len = len;
+	ies->crc = jhash(data, len, 0);
+	ies->ssid_off = bss_ies_offset(ies, WLAN_EID_SSID);
+	ies->meshid_off = bss_ies_offset(ies, WLAN_EID_MESH_ID);
+	ies->meshconf_off = bss_ies_offset(ies, WLAN_EID_MESH_CONFIG);
+}
+
+static bool bss_ies_equal(const struct cfg80211_bss_ies *tmp,
+			  const struct cfg80211_bss_ies *match)
+{
+	return match && match->crc == tmp->crc && match->len == tmp->len &&
+	       !memcmp(match->data, tmp->data, tmp->len);
+}
+
+/* a referenced copy of @tmp, made before taking dev->bss_lock */
+static struct cfg80211_bss_ies *
+bss_ies_copy(const struct cfg80211_bss_ies *tmp, gfp_t gfp)
+{
+	struct cfg80211_bss_ies *ies;
+
+	ies = kmalloc(sizeof(*ies) + tmp->len, gfp);
+	if (!ies)
+		return NULL;
+
+	memcpy(ies, tmp, sizeof(*ies));
+	memcpy(ies->buf, tmp->data, tmp->len);
+	ies->data = ies->buf;
+	kref_init(&ies->ref);
+
+	return ies;
+}
+
+/*
+ * Return a referenced buffer with the contents of @tmp: @match itself if
+ * its contents are identical, the copy in @spare otherwise (NULL if there
+ * is none). Must hold dev->bss_lock!
+ */
+static struct cfg80211_bss_ies *
+bss_ies_commit(struct cfg80211_registered_device *dev,
+	       const struct cfg80211_bss_ies *tmp,
+	       struct cfg80211_bss_ies *match,
+	       struct cfg80211_bss_ies **spare)
+{
+	struct cfg80211_bss_ies *ies;
+
+	if (bss_ies_equal(tmp, match)) {
+		kref_get(&match->ref);
+		dev->bss_ies_reused++;
+		return match;
+	}
+
+	ies = *spare;
+	*spare = NULL;
+	if (ies)
+		dev->bss_ies_allocated++;
+
+	return ies;
+}
+
+/* the IEs backing information_elements */
+static const struct cfg80211_bss_ies *bss_cur_ies(struct cfg80211_bss *pub)
+{
+	struct cfg80211_internal_bss *bss = bss_from_pub(pub);
+
+	if (bss->proberesp_ies &&
+	    pub->information_elements == bss->proberesp_ies->data)
+		return bss->proberesp_ies;
+	return bss->beacon_ies;
+}
+
 static void bss_release(struct kref *ref)
 {
 	struct cfg80211_internal_bss *bss;
@@ -228,26 +333,23 @@ static void bss_release(struct kref *ref)
 	if (bss->pub.free_priv)
 		bss->pub.free_priv(&bss->pub);
 
-	if (bss->beacon_ies_allocated)
-		kfree(bss->pub.beacon_ies);
-	if (bss->proberesp_ies_allocated)
-		kfree(bss->pub.proberesp_ies);
+	bss_ies_put(bss->beacon_ies);
+	bss_ies_put(bss->proberesp_ies);
 
 	BUG_ON(atomic_read(&bss->hold));
 
 	kfree(bss);
 }
 
-/* must hold dev->bss_lock! */
+/*
+ * All entries age by the same amount, so rather than adjusting each one
+ * only the offset bss_ts() subtracts from the stored timestamps changes.
+ * Must hold dev->bss_lock!
+ */
 void cfg80211_bss_age(struct cfg80211_registered_device *dev,
                       unsigned long age_secs)
 {
-	struct cfg80211_internal_bss *bss;
-	unsigned long age_jiffies = msecs_to_jiffies(age_secs * MSEC_PER_SEC);
-
-	list_for_each_entry(bss, &dev->bss_list, list) {
-		bss->ts -= age_jiffies;
-	}
+	dev->bss_age += msecs_to_jiffies(age_secs * MSEC_PER_SEC);
 }
 
 /* must hold dev->bss_lock! */
@@ -255,9 +357,17 @@ static void __cfg80211_unlink_bss(struct cfg80211_registered_device *dev,
 				  struct cfg80211_internal_bss *bss)
 {
 	list_del_init(&bss->list);
+	list_del_init(&bss->seq_list);
 	if (!list_empty(&bss->list_aliases))
 		list_del_init(&bss->list_aliases);
 	rb_erase(&bss->rbn, &dev->bss_tree);
+	hlist_del_init(&bss->bssid_node);
+	if (!hlist_unhashed(&bss->ssid_node))
+		hlist_del_init(&bss->ssid_node);
+	if (!hlist_unhashed(&bss->meshid_node))
+		hlist_del_init(&bss->meshid_node);
+	dev->bss_entries--;
+	dev->bss_removed_generation = dev->bss_generation;
 	kref_put(&bss->ref, bss_release);
 }
 
@@ -267,12 +377,18 @@ void cfg80211_bss_expire(struct cfg80211_registered_device *dev)
 	struct cfg80211_internal_bss *bss, *tmp;
 	bool expired = false;
 
+	/*
+	 * The list is ordered by timestamp, so only the stale entries at
+	 * its head need to be looked at.
+	 */
 	list_for_each_entry_safe(bss, tmp, &dev->bss_list, list) {
+		if (!time_after(jiffies,
+				bss_ts(dev, bss) + IEEE80211_SCAN_RESULT_EXPIRE))
+			break;
 		if (atomic_read(&bss->hold))
 			continue;
-		if (!time_after(jiffies, bss->ts + IEEE80211_SCAN_RESULT_EXPIRE))
-			continue;
 		__cfg80211_unlink_bss(dev, bss);
+		dev->bss_expired++;
 		expired = true;
 	}
 
@@ -280,6 +396,27 @@ void cfg80211_bss_expire(struct cfg80211_registered_device *dev)
 		dev->bss_generation++;
 }
 
+/*
+ * The walk stops at the first entry that isn't held, held entries are the
+ * ones in use by a connection so only a few are ever skipped.
+ * Must hold dev->bss_lock!
+ */
+static bool cfg80211_bss_evict_oldest(struct cfg80211_registered_device *dev,
+				      struct cfg80211_internal_bss *keep)
+{
+	struct cfg80211_internal_bss *bss;
+
+	list_for_each_entry(bss, &dev->bss_list, list) {
+		if (bss == keep || atomic_read(&bss->hold))
+			continue;
+		__cfg80211_unlink_bss(dev, bss);
+		dev->bss_evicted++;
+		return true;
+	}
+
+	return false;
+}
+
 const u8 *cfg80211_find_ie(u8 eid, const u8 *ies, int len)
 {
 	while (len > 2 && ies[0] != eid) {
@@ -321,20 +458,23 @@ const u8 *cfg80211_find_vendor_ie(unsigned int oui, u8 oui_type,
 }
 EXPORT_SYMBOL(cfg80211_find_vendor_ie);
 
-static int cmp_ies(u8 num, u8 *ies1, size_t len1, u8 *ies2, size_t len2)
+static int cmp_ies(const struct cfg80211_bss_ies *ies1, u16 off1,
+		   const struct cfg80211_bss_ies *ies2, u16 off2)
 {
-	const u8 *ie1 = cfg80211_find_ie(num, ies1, len1);
-	const u8 *ie2 = cfg80211_find_ie(num, ies2, len2);
+	const u8 *ie1, *ie2;
 
 	/* equal if both missing */
-	if (!ie1 && !ie2)
+	if (off1 == CFG80211_IE_ABSENT && off2 == CFG80211_IE_ABSENT)
 		return 0;
 	/* sort missing IE before (left of) present IE */
-	if (!ie1)
+	if (off1 == CFG80211_IE_ABSENT)
 		return -1;
-	if (!ie2)
+	if (off2 == CFG80211_IE_ABSENT)
 		return 1;
 
+	ie1 = ies1->data + off1;
+	ie2 = ies2->data + off2;
+
 	/* sort by length first, then by contents */
 	if (ie1[1] != ie2[1])
 		return ie2[1] - ie1[1];
@@ -345,6 +485,7 @@ static bool is_bss(struct cfg80211_bss *a,
 		   const u8 *bssid,
 		   const u8 *ssid, size_t ssid_len)
 {
+	const struct cfg80211_bss_ies *ies;
 	const u8 *ssidie;
 
 	if (bssid && !ether_addr_equal(a->bssid, bssid))
@@ -353,62 +494,57 @@ static bool is_bss(struct cfg80211_bss *a,
 	if (!ssid)
 		return true;
 
-	ssidie = cfg80211_find_ie(WLAN_EID_SSID,
-				  a->information_elements,
-				  a->len_information_elements);
-	if (!ssidie)
+	ies = bss_cur_ies(a);
+	if (ies->ssid_off == CFG80211_IE_ABSENT)
 		return false;
+	ssidie = ies->data + ies->ssid_off;
 	if (ssidie[1] != ssid_len)
 		return false;
 	return memcmp(ssidie + 2, ssid, ssid_len) == 0;
 }
 
+/* the SSID element of the current IEs, NULL if missing */
+const u8 *cfg80211_bss_ssid(struct cfg80211_internal_bss *bss)
+{
+	const struct cfg80211_bss_ies *ies = bss_cur_ies(&bss->pub);
+
+	if (ies->ssid_off == CFG80211_IE_ABSENT)
+		return NULL;
+	return ies->data + ies->ssid_off;
+}
+
 static bool is_mesh_bss(struct cfg80211_bss *a)
 {
-	const u8 *ie;
+	const struct cfg80211_bss_ies *ies;
 
 	if (!WLAN_CAPABILITY_IS_STA_BSS(a->capability))
 		return false;
 
-	ie = cfg80211_find_ie(WLAN_EID_MESH_ID,
-			      a->information_elements,
-			      a->len_information_elements);
-	if (!ie)
-		return false;
+	ies = bss_cur_ies(a);
 
-	ie = cfg80211_find_ie(WLAN_EID_MESH_CONFIG,
-			      a->information_elements,
-			      a->len_information_elements);
-	if (!ie)
-		return false;
-
-	return true;
+	return ies->meshid_off != CFG80211_IE_ABSENT &&
+	       ies->meshconf_off != CFG80211_IE_ABSENT;
 }
 
 static bool is_mesh(struct cfg80211_bss *a,
 		    const u8 *meshid, size_t meshidlen,
 		    const u8 *meshcfg)
 {
+	const struct cfg80211_bss_ies *ies;
 	const u8 *ie;
 
-	if (!WLAN_CAPABILITY_IS_STA_BSS(a->capability))
+	if (!is_mesh_bss(a))
 		return false;
 
-	ie = cfg80211_find_ie(WLAN_EID_MESH_ID,
-			      a->information_elements,
-			      a->len_information_elements);
-	if (!ie)
-		return false;
+	ies = bss_cur_ies(a);
+
+	ie = ies->data + ies->meshid_off;
 	if (ie[1] != meshidlen)
 		return false;
 	if (memcmp(ie + 2, meshid, meshidlen))
 		return false;
 
-	ie = cfg80211_find_ie(WLAN_EID_MESH_CONFIG,
-			      a->information_elements,
-			      a->len_information_elements);
-	if (!ie)
-		return false;
+	ie = ies->data + ies->meshconf_off;
 	if (ie[1] != sizeof(struct ieee80211_meshconf_ie))
 		return false;
 
@@ -430,18 +566,15 @@ static int cmp_bss_noessid(struct cfg80211_bss *a,
 		return b->channel->center_freq - a->channel->center_freq;
 
 	if (is_mesh_bss(a) && is_mesh_bss(b)) {
-		r = cmp_ies(WLAN_EID_MESH_ID,
-			    a->information_elements,
-			    a->len_information_elements,
-			    b->information_elements,
-			    b->len_information_elements);
+		const struct cfg80211_bss_ies *ies_a = bss_cur_ies(a);
+		const struct cfg80211_bss_ies *ies_b = bss_cur_ies(b);
+
+		r = cmp_ies(ies_a, ies_a->meshid_off,
+			    ies_b, ies_b->meshid_off);
 		if (r)
 			return r;
-		return cmp_ies(WLAN_EID_MESH_CONFIG,
-			       a->information_elements,
-			       a->len_information_elements,
-			       b->information_elements,
-			       b->len_information_elements);
+		return cmp_ies(ies_a, ies_a->meshconf_off,
+			       ies_b, ies_b->meshconf_off);
 	}
 
 	/*
@@ -454,17 +587,78 @@ static int cmp_bss_noessid(struct cfg80211_bss *a,
 static int cmp_bss(struct cfg80211_bss *a,
 		   struct cfg80211_bss *b)
 {
+	const struct cfg80211_bss_ies *ies_a, *ies_b;
 	int r;
 
 	r = cmp_bss_noessid(a, b);
 	if (r)
 		return r;
 
-	return cmp_ies(WLAN_EID_SSID,
-		       a->information_elements,
-		       a->len_information_elements,
-		       b->information_elements,
-		       b->len_information_elements);
+	ies_a = bss_cur_ies(a);
+	ies_b = bss_cur_ies(b);
+
+	return cmp_ies(ies_a, ies_a->ssid_off, ies_b, ies_b->ssid_off);
+}
+
+static u32 bss_hash(const u8 *key, size_t len)
+{
+	return jhash(key, len, 0) & (CFG80211_BSS_HASH_SIZE - 1);
+}
+
+/*
+ * (Re)index a BSS by the SSID and, for mesh BSSes, the mesh ID of its
+ * current IEs. Must hold dev->bss_lock!
+ */
+static void bss_hash_names(struct cfg80211_registered_device *dev,
+			   struct cfg80211_internal_bss *bss)
+{
+	const struct cfg80211_bss_ies *ies = bss_cur_ies(&bss->pub);
+	const u8 *ie;
+
+	if (!hlist_unhashed(&bss->ssid_node))
+		hlist_del_init(&bss->ssid_node);
+	if (!hlist_unhashed(&bss->meshid_node))
+		hlist_del_init(&bss->meshid_node);
+
+	if (ies->ssid_off != CFG80211_IE_ABSENT) {
+		ie = ies->data + ies->ssid_off;
+		hlist_add_head(&bss->ssid_node,
+			       &dev->bss_hash_ssid[bss_hash(ie + 2, ie[1])]);
+	}
+
+	if (!is_mesh_bss(&bss->pub))
+		return;
+
+	ie = ies->data + ies->meshid_off;
+	hlist_add_head(&bss->meshid_node,
+		       &dev->bss_hash_meshid[bss_hash(ie + 2, ie[1])]);
+}
+
+/*
+ * The hash chains are in no particular order, but lookups used to return
+ * the first match on the list, i.e. the earliest added entry. Keep that.
+ */
+static bool bss_added_before(struct cfg80211_internal_bss *bss,
+			     struct cfg80211_internal_bss *res)
+{
+	return !res || (s32)(bss->seq - res->seq) < 0;
+}
+
+static bool bss_get_match(struct cfg80211_registered_device *dev,
+			  struct cfg80211_internal_bss *bss,
+			  struct ieee80211_channel *channel,
+			  const u8 *bssid, const u8 *ssid, size_t ssid_len,
+			  u16 capa_mask, u16 capa_val, unsigned long now)
+{
+	if ((bss->pub.capability & capa_mask) != capa_val)
+		return false;
+	if (channel && bss->pub.channel != channel)
+		return false;
+	/* Don't get expired BSS structs */
+	if (time_after(now, bss_ts(dev, bss) + IEEE80211_SCAN_RESULT_EXPIRE) &&
+	    !atomic_read(&bss->hold))
+		return false;
+	return is_bss(&bss->pub, bssid, ssid, ssid_len);
 }
 
 struct cfg80211_bss *cfg80211_get_bss(struct wiphy *wiphy,
@@ -475,26 +669,48 @@ struct cfg80211_bss *cfg80211_get_bss(struct wiphy *wiphy,
 {
 	struct cfg80211_registered_device *dev = wiphy_to_dev(wiphy);
 	struct cfg80211_internal_bss *bss, *res = NULL;
+	struct hlist_node *node;
 	unsigned long now = jiffies;
+	u32 steps = 0;
 
 	spin_lock_bh(&dev->bss_lock);
 
-	list_for_each_entry(bss, &dev->bss_list, list) {
-		if ((bss->pub.capability & capa_mask) != capa_val)
-			continue;
-		if (channel && bss->pub.channel != channel)
-			continue;
-		/* Don't get expired BSS structs */
-		if (time_after(now, bss->ts + IEEE80211_SCAN_RESULT_EXPIRE) &&
-		    !atomic_read(&bss->hold))
-			continue;
-		if (is_bss(&bss->pub, bssid, ssid, ssid_len)) {
-			res = bss;
-			kref_get(&res->ref);
-			break;
+	if (bssid) {
+		hlist_for_each_entry(bss, node,
+				     &dev->bss_hash_bssid[bss_hash(bssid, ETH_ALEN)],
+				     bssid_node) {
+			steps++;
+			if (bss_added_before(bss, res) &&
+			    bss_get_match(dev, bss, channel, bssid, ssid,
+					  ssid_len, capa_mask, capa_val, now))
+				res = bss;
+		}
+	} else if (ssid) {
+		hlist_for_each_entry(bss, node,
+				     &dev->bss_hash_ssid[bss_hash(ssid, ssid_len)],
+				     ssid_node) {
+			steps++;
+			if (bss_added_before(bss, res) &&
+			    bss_get_match(dev, bss, channel, bssid, ssid,
+					  ssid_len, capa_mask, capa_val, now))
+				res = bss;
+		}
+	} else {
+		list_for_each_entry(bss, &dev->bss_list, list) {
+			steps++;
+			if (bss_added_before(bss, res) &&
+			    bss_get_match(dev, bss, channel, bssid, ssid,
+					  ssid_len, capa_mask, capa_val, now))
+				res = bss;
 		}
 	}
 
+	if (res)
+		kref_get(&res->ref);
+
+	dev->bss_lookups++;
+	dev->bss_lookup_steps += steps;
+
 	spin_unlock_bh(&dev->bss_lock);
 	if (!res)
 		return NULL;
@@ -509,19 +725,28 @@ struct cfg80211_bss *cfg80211_get_mesh(struct wiphy *wiphy,
 {
 	struct cfg80211_registered_device *dev = wiphy_to_dev(wiphy);
 	struct cfg80211_internal_bss *bss, *res = NULL;
+	struct hlist_node *node;
+	u32 steps = 0;
 
 	spin_lock_bh(&dev->bss_lock);
 
-	list_for_each_entry(bss, &dev->bss_list, list) {
+	hlist_for_each_entry(bss, node,
+			     &dev->bss_hash_meshid[bss_hash(meshid, meshidlen)],
+			     meshid_node) {
+		steps++;
 		if (channel && bss->pub.channel != channel)
 			continue;
-		if (is_mesh(&bss->pub, meshid, meshidlen, meshcfg)) {
+		if (bss_added_before(bss, res) &&
+		    is_mesh(&bss->pub, meshid, meshidlen, meshcfg))
 			res = bss;
-			kref_get(&res->ref);
-			break;
-		}
 	}
 
+	if (res)
+		kref_get(&res->ref);
+
+	dev->bss_lookups++;
+	dev->bss_lookup_steps += steps;
+
 	spin_unlock_bh(&dev->bss_lock);
 	if (!res)
 		return NULL;
@@ -616,33 +841,16 @@ cfg80211_bss_update_bss(struct cfg80211_registered_device *dev,
 	prev->pub.signal = res->pub.signal;
 	prev->pub.capability = res->pub.capability;
 	prev->ts = res->ts;
-
-	/* Update IEs */
-	if (res->pub.proberesp_ies && (force || !prev->pub.proberesp_ies)) {
-		size_t used = dev->wiphy.bss_priv_size + sizeof(*res);
-		size_t ielen = res->pub.len_proberesp_ies;
-
-		if (prev->pub.proberesp_ies &&
-		    !prev->proberesp_ies_allocated &&
-		    ksize(prev) >= used + ielen) {
-			memcpy(prev->pub.proberesp_ies,
-			       res->pub.proberesp_ies, ielen);
-			prev->pub.len_proberesp_ies = ielen;
-		} else {
-			u8 *ies = prev->pub.proberesp_ies;
-
-			if (prev->proberesp_ies_allocated)
-				ies = krealloc(ies, ielen, GFP_ATOMIC);
-			else
-				ies = kmalloc(ielen, GFP_ATOMIC);
-
-			if (ies) {
-				memcpy(ies, res->pub.proberesp_ies,
-				       ielen);
-				prev->proberesp_ies_allocated = true;
-				prev->pub.proberesp_ies = ies;
-				prev->pub.len_proberesp_ies = ielen;
-			}
+	prev->generation = dev->bss_generation;
+
+	/* Update IEs, sharing the buffers of res */
+	if (res->proberesp_ies && (force || !prev->proberesp_ies)) {
+		if (prev->proberesp_ies != res->proberesp_ies) {
+			bss_ies_put(prev->proberesp_ies);
+			kref_get(&res->proberesp_ies->ref);
+			prev->proberesp_ies = res->proberesp_ies;
+			prev->pub.proberesp_ies = prev->proberesp_ies->buf;
+			prev->pub.len_proberesp_ies = prev->proberesp_ies->len;
 		}
 
 		/* Override possible earlier Beacon frame IEs */
@@ -651,34 +859,17 @@ cfg80211_bss_update_bss(struct cfg80211_registered_device *dev,
 		prev->pub.len_information_elements =
 			prev->pub.len_proberesp_ies;
 	}
-	if (res->pub.beacon_ies && (force || !prev->pub.beacon_ies)) {
-		size_t used = dev->wiphy.bss_priv_size + sizeof(*res);
-		size_t ielen = res->pub.len_beacon_ies;
+	if (res->beacon_ies && (force || !prev->beacon_ies)) {
 		bool information_elements_is_beacon_ies =
 			(prev->pub.information_elements ==
 			 prev->pub.beacon_ies);
 
-		if (prev->pub.beacon_ies &&
-		    !prev->beacon_ies_allocated &&
-		    ksize(prev) >= used + ielen) {
-			memcpy(prev->pub.beacon_ies,
-			       res->pub.beacon_ies, ielen);
-			prev->pub.len_beacon_ies = ielen;
-		} else {
-			u8 *ies = prev->pub.beacon_ies;
-
-			if (prev->beacon_ies_allocated)
-				ies = krealloc(ies, ielen, GFP_ATOMIC);
-			else
-				ies = kmalloc(ielen, GFP_ATOMIC);
-
-			if (ies) {
-				memcpy(ies, res->pub.beacon_ies,
-				       ielen);
-				prev->beacon_ies_allocated = true;
-				prev->pub.beacon_ies = ies;
-				prev->pub.len_beacon_ies = ielen;
-			}
+		if (prev->beacon_ies != res->beacon_ies) {
+			bss_ies_put(prev->beacon_ies);
+			kref_get(&res->beacon_ies->ref);
+			prev->beacon_ies = res->beacon_ies;
+			prev->pub.beacon_ies = prev->beacon_ies->buf;
+			prev->pub.len_beacon_ies = prev->beacon_ies->len;
 		}
 
 		/* Override IEs if they were from a beacon before */
@@ -689,6 +880,8 @@ cfg80211_bss_update_bss(struct cfg80211_registered_device *dev,
 				prev->pub.len_beacon_ies;
 		}
 	}
+
+	bss_hash_names(dev, prev);
 }
 
 static void
@@ -700,8 +893,11 @@ cfg80211_bss_update_list(struct cfg80211_registered_device *dev,
 	struct cfg80211_internal_bss *bss;
 
 	cfg80211_bss_update_bss(dev, prev, res, force);
-	list_for_each_entry(bss, &prev->list_aliases, list_aliases)
+	list_move_tail(&prev->list, &dev->bss_list);
+	list_for_each_entry(bss, &prev->list_aliases, list_aliases) {
 		cfg80211_bss_update_bss(dev, bss, res, force);
+		list_move_tail(&bss->list, &dev->bss_list);
+	}
 }
 
 static void
@@ -709,57 +905,256 @@ cfg80211_bss_insert(struct cfg80211_registered_device *dev,
 		    struct cfg80211_internal_bss *alias,
 		    struct cfg80211_internal_bss *res)
 {
-	list_add_tail(&res->list, &dev->bss_list);
+	struct list_head *pos = dev->bss_list.prev;
+
+	/*
+	 * Keep the list ordered by timestamp, a new entry may have taken
+	 * over an older one from its alias.
+	 */
+	while (pos != &dev->bss_list &&
+	       time_after(list_entry(pos, struct cfg80211_internal_bss,
+				     list)->ts, res->ts))
+		pos = pos->prev;
+
+	list_add(&res->list, pos);
+	list_add_tail(&res->seq_list, &dev->bss_seq_list);
+	res->seq = ++dev->bss_seq;
+	res->generation = dev->bss_generation;
 	if (alias)
 		list_add_tail(&res->list_aliases, &alias->list_aliases);
 	rb_insert_bss(dev, res);
+	hlist_add_head(&res->bssid_node,
+		       &dev->bss_hash_bssid[bss_hash(res->pub.bssid, ETH_ALEN)]);
+	bss_hash_names(dev, res);
+	dev->bss_entries++;
+
+	if (dev->bss_entries > cfg80211_bss_entries_limit)
+		cfg80211_bss_evict_oldest(dev, res);
 }
 
-static struct cfg80211_internal_bss *
-cfg80211_bss_update(struct cfg80211_registered_device *dev,
-		    struct cfg80211_internal_bss *res)
+/*
+ * Memory cfg80211_bss_update() may need, allocated with the caller's gfp
+ * flags outside of dev->bss_lock. Whatever isn't used is freed afterwards.
+ */
+struct cfg80211_bss_prealloc {
+	struct cfg80211_internal_bss *bss;
+	struct cfg80211_bss_ies *beacon_ies;
+	struct cfg80211_bss_ies *proberesp_ies;
+};
+
+#define BSS_PREALLOC_ENTRY	BIT(0)
+#define BSS_PREALLOC_BEACON	BIT(1)
+#define BSS_PREALLOC_PROBERESP	BIT(2)
+
+/*
+ * What @pre lacks to add (@new) or update the entry described by @tmp,
+ * given the entry @match whose IEs may be reused. Must hold dev->bss_lock!
+ */
+static u32
+cfg80211_bss_prealloc_missing(struct cfg80211_bss_prealloc *pre,
+			      struct cfg80211_internal_bss *tmp,
+			      struct cfg80211_internal_bss *match, bool new)
 {
-	struct cfg80211_internal_bss *found = NULL, *alias;
+	u32 missing = 0;
+
+	if (new && !pre->bss)
+		missing |= BSS_PREALLOC_ENTRY;
+
+	if (tmp->beacon_ies && !pre->beacon_ies &&
+	    !bss_ies_equal(tmp->beacon_ies, match ? match->beacon_ies : NULL))
+		missing |= BSS_PREALLOC_BEACON;
+
+	if (tmp->proberesp_ies && !pre->proberesp_ies &&
+	    !bss_ies_equal(tmp->proberesp_ies,
+			   match ? match->proberesp_ies : NULL))
+		missing |= BSS_PREALLOC_PROBERESP;
+
+	return missing;
+}
 
+static bool
+cfg80211_bss_prealloc(struct cfg80211_registered_device *dev,
+		      struct cfg80211_bss_prealloc *pre,
+		      struct cfg80211_internal_bss *tmp, u32 missing,
+		      gfp_t gfp)
+{
 	/*
-	 * The reference to "res" is donated to this function.
+	 * The entry is allocated with the private area after it, its IEs
+	 * are kept separately.
 	 */
+	if (missing & BSS_PREALLOC_ENTRY) {
+		pre->bss = kzalloc(sizeof(*pre->bss) + dev->wiphy.bss_priv_size,
+				   gfp);
+		if (!pre->bss)
+			return false;
+	}
 
-	if (WARN_ON(!res->pub.channel)) {
-		kref_put(&res->ref, bss_release);
-		return NULL;
+	if (missing & BSS_PREALLOC_BEACON) {
+		pre->beacon_ies = bss_ies_copy(tmp->beacon_ies, gfp);
+		if (!pre->beacon_ies)
+			return false;
 	}
 
-	res->ts = jiffies;
+	if (missing & BSS_PREALLOC_PROBERESP) {
+		pre->proberesp_ies = bss_ies_copy(tmp->proberesp_ies, gfp);
+		if (!pre->proberesp_ies)
+			return false;
+	}
+
+	return true;
+}
+
+static void cfg80211_bss_prealloc_free(struct cfg80211_bss_prealloc *pre)
+{
+	kfree(pre->bss);
+	kfree(pre->beacon_ies);
+	kfree(pre->proberesp_ies);
+}
 
+/*
+ * Replace the not yet copied IEs of @bss by referenced buffers, reusing
+ * those of @match where the contents are the same and taking the copies
+ * from @pre otherwise. Must hold dev->bss_lock!
+ */
+static bool
+cfg80211_bss_commit_ies(struct cfg80211_registered_device *dev,
+			struct cfg80211_internal_bss *bss,
+			struct cfg80211_internal_bss *match,
+			struct cfg80211_bss_prealloc *pre)
+{
+	struct cfg80211_bss_ies *ies;
+
+	if (bss->beacon_ies) {
+		ies = bss_ies_commit(dev, bss->beacon_ies,
+				     match ? match->beacon_ies : NULL,
+				     &pre->beacon_ies);
+		if (!ies) {
+			bss->beacon_ies = NULL;
+			bss->proberesp_ies = NULL;
+			return false;
+		}
+
+		if (bss->pub.information_elements == bss->pub.beacon_ies)
+			bss->pub.information_elements = ies->buf;
+		bss->beacon_ies = ies;
+		bss->pub.beacon_ies = ies->buf;
+	}
+
+	if (bss->proberesp_ies) {
+		ies = bss_ies_commit(dev, bss->proberesp_ies,
+				     match ? match->proberesp_ies : NULL,
+				     &pre->proberesp_ies);
+		if (!ies) {
+			bss_ies_put(bss->beacon_ies);
+			bss->beacon_ies = NULL;
+			bss->proberesp_ies = NULL;
+			return false;
+		}
+
+		if (bss->pub.information_elements == bss->pub.proberesp_ies)
+			bss->pub.information_elements = ies->buf;
+		bss->proberesp_ies = ies;
+		bss->pub.proberesp_ies = ies->buf;
+	}
+
+	return true;
+}
+
+/*
+ * Add or update the entry described by @tmp, whose IEs are not copied
+ * yet. Returns a referenced entry.
+ *
+ * Nothing is allocated under dev->bss_lock. The lookup first tries to get
+ * by with the IEs already known; if copies or a new entry are needed they
+ * are allocated with @gfp after dropping the lock and the lookup is redone,
+ * as the cache may have changed meanwhile.
+ */
+static struct cfg80211_internal_bss *
+cfg80211_bss_update(struct cfg80211_registered_device *dev,
+		    struct cfg80211_internal_bss *tmp, gfp_t gfp)
+{
+	struct cfg80211_internal_bss *found = NULL, *alias, *new;
+	struct cfg80211_bss_prealloc pre = {};
+	u32 missing;
+
+	if (WARN_ON(!tmp->pub.channel))
+		return NULL;
+
+ again:
 	spin_lock_bh(&dev->bss_lock);
 
-	found = rb_find_bss(dev, res);
+	tmp->ts = jiffies + dev->bss_age;
+
+	/* entries changed below are tagged with the new generation */
+	dev->bss_generation++;
+
+	found = rb_find_bss(dev, tmp);
 
 	if (found) {
-		if (res->pub.beacon_ies)
-			cfg80211_bss_update_list(dev, found, res, 1);
-		else
-			cfg80211_bss_update_bss(dev, found, res, 1);
-		kref_put(&res->ref, bss_release);
+		missing = cfg80211_bss_prealloc_missing(&pre, tmp, found, false);
+		if (missing)
+			goto alloc;
+
+		if (!cfg80211_bss_commit_ies(dev, tmp, found, &pre))
+			goto drop;
+
+		if (tmp->beacon_ies) {
+			cfg80211_bss_update_list(dev, found, tmp, 1);
+		} else {
+			cfg80211_bss_update_bss(dev, found, tmp, 1);
+			list_move_tail(&found->list, &dev->bss_list);
+		}
+
+		bss_ies_put(tmp->beacon_ies);
+		bss_ies_put(tmp->proberesp_ies);
 	} else {
-		alias = rb_find_bss_alias(dev, res);
+		alias = rb_find_bss_alias(dev, tmp);
+
+		missing = cfg80211_bss_prealloc_missing(&pre, tmp, alias, true);
+		if (missing)
+			goto alloc;
+
+		new = pre.bss;
+		pre.bss = NULL;
+		memcpy(new, tmp, sizeof(*new));
+		INIT_LIST_HEAD(&new->list_aliases);
+		kref_init(&new->ref);
+
+		if (!cfg80211_bss_commit_ies(dev, new, alias, &pre)) {
+			kfree(new);
+			goto drop;
+		}
+
 		if (alias) {
-			if (res->pub.beacon_ies)
-				cfg80211_bss_update_list(dev, alias, res, 0);
+			if (new->beacon_ies)
+				cfg80211_bss_update_list(dev, alias, new, 0);
 			else
-				cfg80211_bss_update_bss(dev, res, alias, 0);
+				cfg80211_bss_update_bss(dev, new, alias, 0);
 		}
 		/* this "consumes" the reference */
-		cfg80211_bss_insert(dev, alias, res);
-		found = res;
+		cfg80211_bss_insert(dev, alias, new);
+		found = new;
 	}
 
-	dev->bss_generation++;
+	kref_get(&found->ref);
 	spin_unlock_bh(&dev->bss_lock);
 
-	kref_get(&found->ref);
+	cfg80211_bss_prealloc_free(&pre);
 	return found;
+
+ alloc:
+	spin_unlock_bh(&dev->bss_lock);
+
+	if (cfg80211_bss_prealloc(dev, &pre, tmp, missing, gfp))
+		goto again;
+
+	cfg80211_bss_prealloc_free(&pre);
+	return NULL;
+
+ drop:
+	spin_unlock_bh(&dev->bss_lock);
+	cfg80211_bss_prealloc_free(&pre);
+	return NULL;
 }
 
 struct cfg80211_bss*
@@ -769,29 +1164,22 @@ cfg80211_inform_bss(struct wiphy *wiphy,
 		    u16 beacon_interval, const u8 *ie, size_t ielen,
 		    s32 signal, gfp_t gfp)
 {
-	struct cfg80211_internal_bss *res;
-	size_t privsz;
+	struct cfg80211_internal_bss tmp = {}, *res;
+	struct cfg80211_bss_ies ies;
 
 	if (WARN_ON(!wiphy))
 		return NULL;
 
-	privsz = wiphy->bss_priv_size;
-
 	if (WARN_ON(wiphy->signal_type == CFG80211_SIGNAL_TYPE_UNSPEC &&
 			(signal < 0 || signal > 100)))
 		return NULL;
 
-	res = kzalloc(sizeof(*res) + privsz + ielen, gfp);
-	if (!res)
-		return NULL;
-
-	memcpy(res->pub.bssid, bssid, ETH_ALEN);
-	res->pub.channel = channel;
-	res->pub.signal = signal;
-	res->pub.tsf = tsf;
-	res->pub.beacon_interval = beacon_interval;
-	res->pub.capability = capability;
-	INIT_LIST_HEAD(&res->list_aliases);
+	memcpy(tmp.pub.bssid, bssid, ETH_ALEN);
+	tmp.pub.channel = channel;
+	tmp.pub.signal = signal;
+	tmp.pub.tsf = tsf;
+	tmp.pub.beacon_interval = beacon_interval;
+	tmp.pub.capability = capability;
 	/*
 	 * Since we do not know here whether the IEs are from a Beacon or Probe
 	 * Response frame, we need to pick one of the options and only use it
@@ -800,18 +1188,17 @@ cfg80211_inform_bss(struct wiphy *wiphy,
 	 * override the information_elements pointer should we have received an
 	 * earlier indication of Probe Response data.
 	 *
-	 * The initial buffer for the IEs is allocated with the BSS entry and
-	 * is located after the private area.
+	 * The IEs are only copied by cfg80211_bss_update() if they differ
+	 * from those already known for the BSS.
 	 */
-	res->pub.beacon_ies = (u8 *)res + sizeof(*res) + privsz;
-	memcpy(res->pub.beacon_ies, ie, ielen);
-	res->pub.len_beacon_ies = ielen;
-	res->pub.information_elements = res->pub.beacon_ies;
-	res->pub.len_information_elements = res->pub.len_beacon_ies;
-
-	kref_init(&res->ref);
-
-	res = cfg80211_bss_update(wiphy_to_dev(wiphy), res);
+	bss_ies_init(&ies, ie, ielen);
+	tmp.beacon_ies = &ies;
+	tmp.pub.beacon_ies = (u8 *)ie;
+	tmp.pub.len_beacon_ies = ielen;
+	tmp.pub.information_elements = tmp.pub.beacon_ies;
+	tmp.pub.len_information_elements = tmp.pub.len_beacon_ies;
+
+	res = cfg80211_bss_update(wiphy_to_dev(wiphy), &tmp, gfp);
 	if (!res)
 		return NULL;
 
@@ -829,10 +1216,10 @@ cfg80211_inform_bss_frame(struct wiphy *wiphy,
 			  struct ieee80211_mgmt *mgmt, size_t len,
 			  s32 signal, gfp_t gfp)
 {
-	struct cfg80211_internal_bss *res;
+	struct cfg80211_internal_bss tmp = {}, *res;
+	struct cfg80211_bss_ies ies;
 	size_t ielen = len - offsetof(struct ieee80211_mgmt,
 				      u.probe_resp.variable);
-	size_t privsz;
 
 	if (WARN_ON(!mgmt))
 		return NULL;
@@ -847,41 +1234,33 @@ cfg80211_inform_bss_frame(struct wiphy *wiphy,
 	if (WARN_ON(len < offsetof(struct ieee80211_mgmt, u.probe_resp.variable)))
 		return NULL;
 
-	privsz = wiphy->bss_priv_size;
-
-	res = kzalloc(sizeof(*res) + privsz + ielen, gfp);
-	if (!res)
-		return NULL;
-
-	memcpy(res->pub.bssid, mgmt->bssid, ETH_ALEN);
-	res->pub.channel = channel;
-	res->pub.signal = signal;
-	res->pub.tsf = le64_to_cpu(mgmt->u.probe_resp.timestamp);
-	res->pub.beacon_interval = le16_to_cpu(mgmt->u.probe_resp.beacon_int);
-	res->pub.capability = le16_to_cpu(mgmt->u.probe_resp.capab_info);
-	INIT_LIST_HEAD(&res->list_aliases);
+	memcpy(tmp.pub.bssid, mgmt->bssid, ETH_ALEN);
+	tmp.pub.channel = channel;
+	tmp.pub.signal = signal;
+	tmp.pub.tsf = le64_to_cpu(mgmt->u.probe_resp.timestamp);
+	tmp.pub.beacon_interval = le16_to_cpu(mgmt->u.probe_resp.beacon_int);
+	tmp.pub.capability = le16_to_cpu(mgmt->u.probe_resp.capab_info);
 	/*
-	 * The initial buffer for the IEs is allocated with the BSS entry and
-	 * is located after the private area.
+	 * The IEs are only copied by cfg80211_bss_update() if they differ
+	 * from those already known for the BSS.
 	 */
 	if (ieee80211_is_probe_resp(mgmt->frame_control)) {
-		res->pub.proberesp_ies = (u8 *) res + sizeof(*res) + privsz;
-		memcpy(res->pub.proberesp_ies, mgmt->u.probe_resp.variable,
-		       ielen);
-		res->pub.len_proberesp_ies = ielen;
-		res->pub.information_elements = res->pub.proberesp_ies;
-		res->pub.len_information_elements = res->pub.len_proberesp_ies;
+		bss_ies_init(&ies, mgmt->u.probe_resp.variable, ielen);
+		tmp.proberesp_ies = &ies;
+		tmp.pub.proberesp_ies = mgmt->u.probe_resp.variable;
+		tmp.pub.len_proberesp_ies = ielen;
+		tmp.pub.information_elements = tmp.pub.proberesp_ies;
+		tmp.pub.len_information_elements = tmp.pub.len_proberesp_ies;
 	} else {
-		res->pub.beacon_ies = (u8 *) res + sizeof(*res) + privsz;
-		memcpy(res->pub.beacon_ies, mgmt->u.beacon.variable, ielen);
-		res->pub.len_beacon_ies = ielen;
-		res->pub.information_elements = res->pub.beacon_ies;
-		res->pub.len_information_elements = res->pub.len_beacon_ies;
+		bss_ies_init(&ies, mgmt->u.beacon.variable, ielen);
+		tmp.beacon_ies = &ies;
+		tmp.pub.beacon_ies = mgmt->u.beacon.variable;
+		tmp.pub.len_beacon_ies = ielen;
+		tmp.pub.information_elements = tmp.pub.beacon_ies;
+		tmp.pub.len_information_elements = tmp.pub.len_beacon_ies;
 	}
 
-	kref_init(&res->ref);
-
-	res = cfg80211_bss_update(wiphy_to_dev(wiphy), res);
+	res = cfg80211_bss_update(wiphy_to_dev(wiphy), &tmp, gfp);
 	if (!res)
 		return NULL;
 
@@ -1314,7 +1693,8 @@ ieee80211_bss(struct wiphy *wiphy, struct iw_request_info *info,
 		memset(&iwe, 0, sizeof(iwe));
 		iwe.cmd = IWEVCUSTOM;
 		sprintf(buf, " Last beacon: %ums ago",
-			elapsed_jiffies_msecs(bss->ts));
+			elapsed_jiffies_msecs(bss_ts(wiphy_to_dev(wiphy),
+						     bss)));
 		iwe.u.data.length = strlen(buf);
 		current_ev = iwe_stream_add_point(info, current_ev,
 						  end_buf, &iwe, buf);
@@ -1,9 +1,73 @@
-import re
+import struct
+from bisect import bisect_right
 
 MODE_NONE = 0
 MODE_MSGID = 1
 MODE_STRINGTABLE = 2
 
+# Precompiled dictionary (.ilc), written by IliParser.save():
+#   header, then the string tables, then the messages sorted by id.
+#   A table is a range count followed by (low, high, name length, name).
+#   A message is (id, format length, parameter count, format) followed by
+#   one table number per parameter (0 for raw values).
+ILC_MAGIC = "ILC1"
+ILC_HEADER = struct.Struct("<4sII")	# magic, tables, messages
+ILC_COUNT = struct.Struct("<I")
+ILC_RANGE = struct.Struct("<qqH")	# low, high, name length
+ILC_MSG = struct.Struct("<HHB")		# id, format length, parameter count
+ILC_PARAM = struct.Struct("<H")
+ILC_UNFORMATTABLE = 0xff		# parameter count of messages we can't format
+
+class IliError(Exception): pass
+
+class StringTable(object):
+	"""Value ranges of one message parameter and their names.
+
+	The ranges are sorted and don't overlap, so a value is looked up
+	with a binary search.  When the .ili ranges overlap, the first one
+	listed wins, as it always did.
+	"""
+	def __init__(self, ranges, index):
+		super(StringTable, self).__init__()
+
+		self.index = index
+		self.lows = [r[0] for r in ranges]
+		self.highs = [r[1] for r in ranges]
+		self.names = [r[2] for r in ranges]
+
+	@classmethod
+	def from_entries(cls, entries, index):
+		entries = [e for e in entries if e[0] <= e[1]]
+		ranges = sorted(entries)
+		for prev, cur in zip(ranges, ranges[1:]):
+			if cur[0] <= prev[1]:
+				ranges = cls.split_overlaps(entries)
+				break
+		return cls(ranges, index)
+
+	@staticmethod
+	def split_overlaps(entries):
+		points = sorted(set([e[0] for e in entries] +
+				    [e[1] + 1 for e in entries]))
+		ranges = []
+		for start, stop in zip(points, points[1:]):
+			for low, high, name in entries:
+				if low <= start and stop - 1 <= high:
+					break
+			else:
+				continue
+			if ranges and ranges[-1][1] == start - 1 and ranges[-1][2] == name:
+				ranges[-1] = (ranges[-1][0], stop - 1, name)
+			else:
+				ranges.append((start, stop - 1, name))
+		return ranges
+
+	def lookup(self, value):
+		i = bisect_right(self.lows, value) - 1
+		if i >= 0 and value <= self.highs[i]:
+			return self.names[i]
+		return "[0x%X]" % value
+
 class IliParser(object):
 	def __init__(self, filename):
 		super(IliParser, self).__init__()
@@ -11,11 +75,24 @@ class IliParser(object):
 		self.ili_fname = filename
 		self.msgids = {}
 		self.strings_dict = {}
-		self.parse_ili()
+		self.tables = []
+		self.messages = {}
+
+		f = file(self.ili_fname, "rb")
+		try:
+			compiled = f.read(len(ILC_MAGIC)) == ILC_MAGIC
+		finally:
+			f.close()
+
+		if compiled:
+			self.load()
+		else:
+			self.parse_ili()
+			self.compile()
 
 	def parse_ili(self):
-		ili_lines = file(self.ili_fname, "rb").readlines()
-		for line_num, line in enumerate(ili_lines):
+		mode = MODE_NONE
+		for line in file(self.ili_fname, "rb"):
 			line = line.replace('\r', '').replace('\n', '').strip()
 			if not line:
 				continue
@@ -28,46 +105,147 @@ class IliParser(object):
 					mode = MODE_NONE
 				continue
 			if mode == MODE_MSGID:
-				msgid, msg = re.findall("^(\d+)=(.*)", line)[0]
-				self.msgids[int(msgid)] = msg
+				msgid, sep, msg = line.partition('=')
+				if sep and msgid.isdigit():
+					self.msgids[int(msgid)] = msg
 			elif mode == MODE_STRINGTABLE:
-				if line.startswith('Str'):
-					msgid, param_number, string_tuple = re.findall("^Str(\d+).(\d+)=(.*)", line)[0]
-					li = self.strings_dict.setdefault((int(msgid), int(param_number)), [])
-					li.append(string_tuple.split(','))
+				if not line.startswith('Str'):
+					continue
+				key, sep, string_tuple = line[3:].partition('=')
+				msgid, sep2, param_number = key.partition('.')
+				if not (sep and sep2 and msgid.isdigit() and param_number.isdigit()):
+					continue
+				ps = string_tuple.split(',')
+				try:
+					entry = (int(ps[0]), int(ps[1]), ps[2])
+				except (IndexError, ValueError):
+					continue
+				li = self.strings_dict.setdefault((int(msgid), int(param_number)), [])
+				li.append(entry)
+
+	def compile(self):
+		"""Split every format once, so format_msg() only has to apply it"""
+		tables = {}
+		for key in sorted(self.strings_dict):
+			tables[key] = StringTable.from_entries(self.strings_dict[key],
+							       len(self.tables) + 1)
+			self.tables.append(tables[key])
+
+		for msgid, msg in self.msgids.iteritems():
+			self.messages[msgid] = self.compile_format(msgid, msg, tables)
+
+	@staticmethod
+	def compile_format(msgid, msg, tables):
+		# %1..%9 name a string table and become %s, %% stays escaped and
+		# any other specifier takes the raw parameter
+		out = []
+		param_tables = []
+		i = 0
+		while i < len(msg):
+			if msg[i] != '%':
+				j = msg.find('%', i)
+				if j < 0:
+					j = len(msg)
+				out.append(msg[i:j])
+				i = j
+				continue
+			if i + 1 >= len(msg):
+				# a lone trailing '%' makes formatting fail, keep it so
+				out.append('%')
+				break
+			c = msg[i + 1]
+			if c == '%':
+				out.append('%%')
+			elif '1' <= c <= '9':
+				try:
+					param_tables.append(tables[(msgid, int(c) - 1)])
+				except KeyError:
+					return None
+				out.append('%s')
+			else:
+				param_tables.append(None)
+				out.append('%' + c)
+			i += 2
+		return "".join(out), tuple(param_tables), not any(param_tables)
+
+	def save(self, filename):
+		out = [ILC_HEADER.pack(ILC_MAGIC, len(self.tables), len(self.messages))]
+		for table in self.tables:
+			out.append(ILC_COUNT.pack(len(table.names)))
+			for low, high, name in zip(table.lows, table.highs, table.names):
+				out.append(ILC_RANGE.pack(low, high, len(name)))
+				out.append(name)
+		for msgid in sorted(self.messages):
+			entry = self.messages[msgid]
+			if entry is None:
+				out.append(ILC_MSG.pack(msgid, 0, ILC_UNFORMATTABLE))
+				continue
+			fmt, param_tables, plain = entry
+			out.append(ILC_MSG.pack(msgid, len(fmt), len(param_tables)))
+			out.append(fmt)
+			for table in param_tables:
+				out.append(ILC_PARAM.pack(table and table.index or 0))
+		f = file(filename, "wb")
+		try:
+			f.write("".join(out))
+		finally:
+			f.close()
+
+	def load(self):
+		data = file(self.ili_fname, "rb").read()
+		try:
+			magic, n_tables, n_msgs = ILC_HEADER.unpack_from(data)
+			pos = ILC_HEADER.size
+
+			for index in xrange(1, n_tables + 1):
+				n_ranges, = ILC_COUNT.unpack_from(data, pos)
+				pos += ILC_COUNT.size
+				ranges = []
+				for i in xrange(n_ranges):
+					low, high, name_len = ILC_RANGE.unpack_from(data, pos)
+					pos += ILC_RANGE.size
+					ranges.append((low, high, data[pos:pos + name_len]))
+					pos += name_len
+				self.tables.append(StringTable(ranges, index))
+
+			for i in xrange(n_msgs):
+				msgid, fmt_len, n_params = ILC_MSG.unpack_from(data, pos)
+				pos += ILC_MSG.size
+				if n_params == ILC_UNFORMATTABLE:
+					self.messages[msgid] = None
+					continue
+				fmt = data[pos:pos + fmt_len]
+				pos += fmt_len
+				param_tables = []
+				for j in xrange(n_params):
+					table, = ILC_PARAM.unpack_from(data, pos)
+					pos += ILC_PARAM.size
+					param_tables.append(table and self.tables[table - 1] or None)
+				self.messages[msgid] = (fmt, tuple(param_tables),
+							not any(param_tables))
+		except (struct.error, IndexError):
+			raise IliError("%s: truncated or corrupted dictionary" % self.ili_fname)
+
+		if pos != len(data):
+			raise IliError("%s: trailing data in dictionary" % self.ili_fname)
 
 	def format_msg(self, msgid, params):
 		try:
-			format = list(self.msgids[msgid])
+			entry = self.messages[msgid]
 		except KeyError:
 			return None
-		paramidx = 0
+		if entry is None:
+			return None
+		fmt, param_tables, plain = entry
+		n = len(param_tables)
+		if len(params) < n:
+			raise IndexError("message %d needs %d parameters" % (msgid, n))
+		if plain:
+			return fmt % tuple(params[:n])
 		format_parameters = []
-		i = 0
-		while i < len(format):
-			if format[i] == '%':
-				if i+1 >= len(format):
-					break
-				if format[i+1] == '%': # Ignore escaped %
-					pass
-				elif '1' <= format[i+1] <= '9':
-					try:
-						possible_strings = self.strings_dict[(msgid, int(format[i+1])-1)]
-					except KeyError:
-						return None
-					for ps in possible_strings:
-						if int(ps[0]) <= params[paramidx] <= int(ps[1]):
-							format_parameters.append(ps[2])
-							break
-					else:
-						format_parameters.append("[0x%X]" % params[paramidx])
-					format[i+1] = 's' # Hack - this will be replaced by the format string operator
-					paramidx += 1
-				else:
-					format_parameters.append(params[paramidx])
-					paramidx += 1
-				i += 2
+		for table, param in zip(param_tables, params):
+			if table is None:
+				format_parameters.append(param)
 			else:
-				i += 1
-		return "".join(format) % tuple(format_parameters)
-
+				format_parameters.append(table.lookup(param))
+		return fmt % tuple(format_parameters)
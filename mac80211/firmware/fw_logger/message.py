@@ -46,3 +46,17 @@ def parse_message(message):
 		parameters = struct.unpack_from('<' + ('L' * params_count), message[3:])
 
 	return message_id, parameters
+
+def build_format_table():
+	"""Per header format field (header >> 3): None if it's invalid,
+	otherwise (msg_id_size, parameter unpackers indexed by count)."""
+	codes = { 1: 'B', 2: 'H', 4: 'L' }
+	table = [None] * 32
+	for format in xrange(1, 7):
+		msg_id_size, param_size = parse_message_format(format)
+		unpackers = [struct.Struct('<' + codes[param_size] * count)
+			     for count in xrange(5)]
+		table[format] = (msg_id_size, unpackers)
+	return table
+
+FORMAT_TABLE = build_format_table()
@@ -1,27 +1,214 @@
+import os
 import sys
+import time
 import struct
-from message import parse_message
-from iliparser import IliParser
+from optparse import OptionParser
+from message import FORMAT_TABLE
+from iliparser import IliParser, IliError
 
-BLOCK_SIZE = 256
+BLOCK_SIZE = 64 * 1024
+
+# archives written by ti-utils/fwlogd, see the format description there
+ARCHIVE_MAGIC = "WLFW"
+ARCHIVE_HEADER = struct.Struct("<4sHHIIII")
+ARCHIVE_CHUNK = struct.Struct("<IIH")
+
+class ArchiveError(Exception): pass
+
+def parse_ranges(option, opt, value, parser):
+	"""-l/-m take comma separated values or low-high ranges"""
+	ranges = getattr(parser.values, option.dest) or []
+	for item in value.split(','):
+		low, sep, high = item.partition('-')
+		try:
+			ranges.append((int(low, 0), int(high or low, 0)))
+		except ValueError:
+			parser.error("invalid range '%s' for %s" % (item, opt))
+	setattr(parser.values, option.dest, ranges)
+
+class Decoder(object):
+	"""Decode length-prefixed firmware log records a block at a time"""
+	def __init__(self, ili_parser, levels=None, msgids=None):
+		super(Decoder, self).__init__()
+
+		self.ili_parser = ili_parser
+		self.pending = ''
+		self.decoded = 0
+		self.filtered = 0
+		self.failed = 0
+
+		# levels are 3 bits wide, a lookup beats testing every range
+		self.levels = [True] * 8
+		if levels:
+			self.levels = [any(low <= level <= high for low, high in levels)
+				       for level in xrange(8)]
+		self.msgids = msgids
+
+	def wanted_msgid(self, msg_id):
+		for low, high in self.msgids:
+			if low <= msg_id <= high:
+				return True
+		return False
+
+	def failure(self, record):
+		self.failed += 1
+		# garbage can't be matched against the message id filter
+		if self.msgids:
+			return None
+		return "Could not parse message %r" % record
+
+	def decode_record(self, record):
+		"""Return the text for one record, None if it was filtered out"""
+		if len(record) < 3:
+			return self.failure(record)
+
+		header = ord(record[0])
+		if not self.levels[header & 0x7]:
+			self.filtered += 1
+			return None
+
+		try:
+			msg_id_size, unpackers = FORMAT_TABLE[header >> 3]
+			msg_info = ord(record[1]) | (ord(record[2]) << 8)
+			msg_id = msg_info & ((1 << msg_id_size) - 1)
+			if self.msgids and not self.wanted_msgid(msg_id):
+				self.filtered += 1
+				return None
+			params = unpackers[msg_info >> msg_id_size].unpack_from(record.ljust(4, '\x00'), 3)
+			text = str(self.ili_parser.format_msg(msg_id, params))
+		except:
+			return self.failure(record)
+
+		self.decoded += 1
+		return text
+
+	def feed(self, block):
+		"""Decode all the complete records in block, keep the rest"""
+		buf = self.pending + block if self.pending else block
+		end = len(buf)
+		pos = 0
+		lines = []
+		while pos < end:
+			next_pos = pos + 1 + ord(buf[pos])
+			if next_pos > end:
+				break
+			text = self.decode_record(buf[pos + 1:next_pos])
+			if text is not None:
+				lines.append(text)
+			pos = next_pos
+		self.pending = buf[pos:]
+		return lines
+
+	def flush(self):
+		"""At the end of the stream, decode a truncated last record"""
+		lines = []
+		if self.pending:
+			text = self.decode_record(self.pending[1:])
+			if text is not None:
+				lines.append(text)
+			self.pending = ''
+		return lines
+
+def decode_archive(filename, decoder, out, wall_clock):
+	"""Decode one fwlogd archive, prefixing every record with its time"""
+	data = file(filename, "rb").read()
+	try:
+		magic, version, reserved, real_sec, real_usec, mono_sec, mono_usec = \
+			ARCHIVE_HEADER.unpack_from(data)
+	except struct.error:
+		raise ArchiveError("%s: not a firmware log archive" % filename)
+	if magic != ARCHIVE_MAGIC or version != 1:
+		raise ArchiveError("%s: not a firmware log archive" % filename)
+
+	# monotonic time of every chunk -> wall clock time
+	offset = (real_sec + real_usec / 1e6) - (mono_sec + mono_usec / 1e6)
+
+	pos = ARCHIVE_HEADER.size
+	while pos + ARCHIVE_CHUNK.size <= len(data):
+		sec, usec, length = ARCHIVE_CHUNK.unpack_from(data, pos)
+		pos += ARCHIVE_CHUNK.size
+		if wall_clock:
+			stamp = sec + usec / 1e6 + offset
+			prefix = "[%s.%06d] " % (time.strftime("%Y-%m-%d %H:%M:%S",
+				time.localtime(stamp)), int(stamp * 1e6) % 1000000)
+		else:
+			prefix = "[%5d.%06d] " % (sec, usec)
+		lines = decoder.feed(data[pos:pos + length]) + decoder.flush()
+		write_lines(out, [prefix + line for line in lines])
+		pos += length
+	if pos != len(data):
+		print >> sys.stderr, "%s: truncated chunk at the end" % filename
+
+def write_lines(out, lines):
+	if lines:
+		out.write("\n".join(lines))
+		out.write("\n")
+		out.flush()
+
+def print_stats(options, decoder):
+	if options.stats:
+		print >> sys.stderr, "%d decoded, %d filtered, %d failed" % \
+			(decoder.decoded, decoder.filtered, decoder.failed)
 
 def main(argv):
-	if len(argv) != 2:
-		print "Usage", argv[0], "<firmware.ili>"
+	parser = OptionParser(usage="%prog [options] <firmware.ili|firmware.ilc> [archive...]\n\n"
+			      "Decode the firmware log records read from stdin, or from\n"
+			      "archives written by fwlogd (oldest first).")
+	parser.add_option("-c", "--compile", metavar="FILE",
+			  help="write a precompiled dictionary to FILE and exit")
+	parser.add_option("-l", "--level", dest="levels", metavar="LEVELS",
+			  type="string", action="callback", callback=parse_ranges,
+			  help="only show these levels (eg. 0-2,5)")
+	parser.add_option("-m", "--msgid", dest="msgids", metavar="IDS",
+			  type="string", action="callback", callback=parse_ranges,
+			  help="only show these message ids (eg. 100-200,0x3f0)")
+	parser.add_option("-b", "--block-size", type="int", default=BLOCK_SIZE,
+			  help="bytes read from stdin at a time [default: %default]")
+	parser.add_option("-s", "--stats", action="store_true",
+			  help="print record counters to stderr at the end")
+	parser.add_option("-w", "--wall-clock", action="store_true",
+			  help="stamp archived records with the wall clock time "
+			  "instead of the monotonic one")
+	options, args = parser.parse_args(argv[1:])
+
+	if not args:
+		parser.print_usage()
+		return 1
+
+	try:
+		ili_parser = IliParser(args[0])
+	except (IOError, IliError), e:
+		print >> sys.stderr, e
 		return 1
 
-	ili_parser = IliParser(argv[1])
+	if options.compile:
+		ili_parser.save(options.compile)
+		return 0
+
+	decoder = Decoder(ili_parser, options.levels, options.msgids)
+
+	for archive in args[1:]:
+		try:
+			decode_archive(archive, decoder, sys.stdout, options.wall_clock)
+		except (IOError, ArchiveError), e:
+			print >> sys.stderr, e
+			return 1
+	if len(args) > 1:
+		print_stats(options, decoder)
+		return 0
+
+	fd = sys.stdin.fileno()
 
+	# os.read() returns whatever is available, so a live stream is
+	# decoded as it comes instead of waiting for a full block
 	while True:
-		rec_len = sys.stdin.read(1)
-		if not rec_len:
+		block = os.read(fd, options.block_size)
+		if not block:
 			break
-		record = sys.stdin.read(ord(rec_len))
-		try:
-			msg_id, params = parse_message(record)
-			print ili_parser.format_msg(msg_id, params)
-		except:
-			print "Could not parse message", repr(record)
+		write_lines(sys.stdout, decoder.feed(block))
+	write_lines(sys.stdout, decoder.flush())
+
+	print_stats(options, decoder)
 
 if __name__ == "__main__":
 	sys.exit(main(sys.argv))
@@ -40,5 +40,13 @@ LOCAL_MODULE := calibrator
 
 include $(BUILD_EXECUTABLE)
 
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := fwlogd.c
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := fwlogd
+
+include $(BUILD_EXECUTABLE)
+
 # Build wlconf
 include $(LOCAL_PATH)/wlconf/Android.mk
@@ -0,0 +1,543 @@
+/*
+ * Firmware log capture daemon for TI wireless drivers
+ *
+ * Drains the fwlog sysfs entry of the wlcore driver and stores the log
+ * records, stamped with the host monotonic time, in a size capped and
+ * rotated binary archive.  The archives can be decoded offline by passing
+ * them to firmware/fw_logger/parser.py after the firmware .ili file.
+ *
+ * See README and COPYING for more details.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define FWLOG_DEFAULT_INPUT \
+	"/sys/bus/platform/drivers/wl18xx_driver/wl18xx/fwlog"
+#define FWLOG_DEFAULT_OUTPUT	"/data/misc/wifi/fwlog.bin"
+#define FWLOG_DEFAULT_SIZE	(1024 * 1024)
+#define FWLOG_DEFAULT_FILES	4
+#define FWLOG_DEFAULT_FLUSH	5	/* seconds */
+
+/* the driver never holds more than a page of log */
+#define FWLOG_READ_SIZE		4096
+/* a record is a length byte followed by up to 255 bytes */
+#define FWLOG_MAX_RECORD	256
+#define FWLOG_OUT_SIZE		(16 * 1024)
+
+/*
+ * Archive format, all fields little endian:
+ *
+ * header	"WLFW", u16 version, u16 reserved,
+ *		u32 realtime sec, u32 realtime usec,
+ *		u32 monotonic sec, u32 monotonic usec (taken together)
+ * chunks	u32 monotonic sec, u32 monotonic usec, u16 length,
+ *		followed by length bytes of complete fwlog records
+ */
+#define FWLOG_MAGIC		"WLFW"
+#define FWLOG_VERSION		1
+#define FWLOG_HDR_SIZE		24
+#define FWLOG_CHUNK_HDR_SIZE	10
+
+struct fwlogd {
+	const char *input;
+	const char *output;
+	off_t max_size;
+	int max_files;
+	int flush_interval;
+
+	int in_fd;
+	unsigned char in_buf[FWLOG_READ_SIZE + FWLOG_MAX_RECORD];
+	size_t in_len;		/* partial record left from the last read */
+
+	int out_fd;
+	off_t out_size;		/* bytes already written to out_fd */
+	unsigned char out_buf[FWLOG_OUT_SIZE];
+	size_t out_len;
+
+	unsigned long records;
+	unsigned long bytes;
+	unsigned long files;
+};
+
+static volatile sig_atomic_t stop_requested;
+static volatile sig_atomic_t rotate_requested;
+
+/* the handled signals are blocked, except while we're waiting */
+static sigset_t handled_mask;
+static sigset_t wait_mask;
+
+static void signal_handler(int sig)
+{
+	if (sig == SIGHUP)
+		rotate_requested = 1;
+	else if (sig != SIGALRM)
+		stop_requested = 1;
+}
+
+static int setup_signals(void)
+{
+	struct sigaction sa;
+	int sigs[] = { SIGINT, SIGTERM, SIGHUP, SIGALRM };
+	unsigned int i;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signal_handler;
+	sigemptyset(&sa.sa_mask);
+	/* no SA_RESTART, a signal must get us out of a blocking read */
+	sa.sa_flags = 0;
+
+	for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+		if (sigaction(sigs[i], &sa, NULL) < 0) {
+			perror("sigaction");
+			return -1;
+		}
+
+	/*
+	 * Only let the signals in while we're waiting, otherwise one that
+	 * lands between checking the flags and going to sleep is lost.
+	 */
+	sigemptyset(&handled_mask);
+	for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+		sigaddset(&handled_mask, sigs[i]);
+
+	if (sigprocmask(SIG_BLOCK, &handled_mask, &wait_mask) < 0) {
+		perror("sigprocmask");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* sleep(), but a signal that's already pending cuts it short */
+static void wait_secs(int secs)
+{
+	struct timespec ts = { .tv_sec = secs };
+
+	ppoll(NULL, 0, &ts, &wait_mask);
+}
+
+/*
+ * Read with the signals let in.  The read can block until the driver has
+ * some log, so the alarm is always armed: a signal that lands after the
+ * flags are checked below is only noticed once the read returns.
+ */
+static ssize_t read_input(struct fwlogd *d)
+{
+	ssize_t len;
+
+	sigprocmask(SIG_SETMASK, &wait_mask, NULL);
+	alarm(d->flush_interval);
+
+	if (stop_requested || rotate_requested) {
+		len = -1;
+		errno = EINTR;
+	} else {
+		len = read(d->in_fd, d->in_buf + d->in_len, FWLOG_READ_SIZE);
+	}
+
+	alarm(0);
+	sigprocmask(SIG_BLOCK, &handled_mask, NULL);
+
+	return len;
+}
+
+static unsigned char *put_le16(unsigned char *p, uint16_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = val >> 8;
+	return p + 2;
+}
+
+static unsigned char *put_le32(unsigned char *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = val >> 24;
+	return p + 4;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = write(fd, buf, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int flush_output(struct fwlogd *d)
+{
+	if (!d->out_len)
+		return 0;
+
+	if (write_all(d->out_fd, d->out_buf, d->out_len) < 0) {
+		perror("Error writing fwlog archive");
+		return -1;
+	}
+
+	d->out_size += d->out_len;
+	d->out_len = 0;
+
+	return 0;
+}
+
+/* output -> output.1 -> ... -> output.<max_files - 1>, the oldest goes */
+static void rotate_files(struct fwlogd *d)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+	int i;
+
+	for (i = d->max_files - 1; i > 0; i--) {
+		if (i == 1)
+			snprintf(from, sizeof(from), "%s", d->output);
+		else
+			snprintf(from, sizeof(from), "%s.%d", d->output, i - 1);
+		snprintf(to, sizeof(to), "%s.%d", d->output, i);
+
+		if (rename(from, to) < 0 && errno != ENOENT)
+			fprintf(stderr, "Error renaming %s to %s: %s\n",
+				from, to, strerror(errno));
+	}
+}
+
+/*
+ * Start a new archive file.  Monotonic time restarts on every boot, so
+ * each file carries its own realtime reference and we never append to a
+ * file written by an earlier run.
+ */
+static int open_output(struct fwlogd *d)
+{
+	unsigned char *p = d->out_buf;
+	struct timespec mono;
+	struct timeval now;
+	struct stat st;
+
+	if (!stat(d->output, &st) && st.st_size)
+		rotate_files(d);
+
+	d->out_fd = open(d->output, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (d->out_fd < 0) {
+		fprintf(stderr, "Error opening %s: %s\n", d->output,
+			strerror(errno));
+		return -1;
+	}
+
+	gettimeofday(&now, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+
+	memcpy(p, FWLOG_MAGIC, 4);
+	p = put_le16(p + 4, FWLOG_VERSION);
+	p = put_le16(p, 0);
+	p = put_le32(p, now.tv_sec);
+	p = put_le32(p, now.tv_usec);
+	p = put_le32(p, mono.tv_sec);
+	p = put_le32(p, mono.tv_nsec / 1000);
+
+	d->out_size = 0;
+	d->out_len = p - d->out_buf;
+	d->files++;
+
+	return flush_output(d);
+}
+
+static int reopen_output(struct fwlogd *d)
+{
+	int ret = flush_output(d);
+
+	close(d->out_fd);
+	d->out_fd = -1;
+
+	if (ret < 0)
+		return ret;
+
+	return open_output(d);
+}
+
+static int add_chunk(struct fwlogd *d, const struct timespec *ts,
+		     const unsigned char *data, size_t len)
+{
+	size_t chunk_len = FWLOG_CHUNK_HDR_SIZE + len;
+	unsigned char *p;
+
+	/* keep every file under the cap, unless a single chunk exceeds it */
+	if (d->out_size + (off_t) (d->out_len + chunk_len) > d->max_size &&
+	    d->out_size + (off_t) d->out_len > FWLOG_HDR_SIZE &&
+	    reopen_output(d) < 0)
+		return -1;
+
+	if (d->out_len + chunk_len > sizeof(d->out_buf) &&
+	    flush_output(d) < 0)
+		return -1;
+
+	p = d->out_buf + d->out_len;
+	p = put_le32(p, ts->tv_sec);
+	p = put_le32(p, ts->tv_nsec / 1000);
+	p = put_le16(p, len);
+	memcpy(p, data, len);
+
+	d->out_len += chunk_len;
+	d->bytes += len;
+
+	return 0;
+}
+
+/* archive the complete records in in_buf, keep a trailing partial one */
+static int process_input(struct fwlogd *d, const struct timespec *ts)
+{
+	size_t pos = 0, next;
+	int ret = 0;
+
+	while (pos < d->in_len) {
+		next = pos + 1 + d->in_buf[pos];
+		if (next > d->in_len)
+			break;
+		pos = next;
+		d->records++;
+	}
+
+	if (pos)
+		ret = add_chunk(d, ts, d->in_buf, pos);
+
+	d->in_len -= pos;
+	memmove(d->in_buf, d->in_buf + pos, d->in_len);
+
+	return ret;
+}
+
+/* the entry goes away with the driver, wait for it to come back */
+static int open_input(struct fwlogd *d)
+{
+	int warned = 0;
+
+	d->in_len = 0;
+
+	while (!stop_requested) {
+		d->in_fd = open(d->input, O_RDONLY);
+		if (d->in_fd >= 0)
+			return 0;
+
+		if (!warned && errno != EINTR) {
+			fprintf(stderr, "Waiting for %s: %s\n", d->input,
+				strerror(errno));
+			warned = 1;
+		}
+
+		if (d->out_len && flush_output(d) < 0)
+			return -1;
+
+		wait_secs(1);
+	}
+
+	return -1;
+}
+
+static int capture(struct fwlogd *d)
+{
+	struct pollfd pfd;
+	struct timespec ts, timeout;
+	ssize_t len;
+	int ret;
+
+	if (open_input(d) < 0)
+		return stop_requested ? 0 : -1;
+
+	while (!stop_requested) {
+		if (rotate_requested) {
+			rotate_requested = 0;
+			if (reopen_output(d) < 0)
+				return -1;
+		}
+
+		pfd.fd = d->in_fd;
+		pfd.events = POLLIN | POLLPRI;
+		pfd.revents = 0;
+
+		timeout.tv_sec = d->flush_interval;
+		timeout.tv_nsec = 0;
+
+		/* with nothing buffered there's no reason to wake up */
+		ret = ppoll(&pfd, 1, d->out_len ? &timeout : NULL, &wait_mask);
+		if (ret < 0 && errno != EINTR) {
+			perror("ppoll");
+			return -1;
+		}
+
+		if (ret <= 0) {
+			if (flush_output(d) < 0)
+				return -1;
+			continue;
+		}
+
+		/*
+		 * sysfs binary entries don't implement poll() and always look
+		 * readable, it's the read that blocks until the driver has
+		 * some log.  Don't let buffered records wait on it forever.
+		 */
+		len = read_input(d);
+
+		if (len < 0 && errno == EINTR) {
+			if (flush_output(d) < 0)
+				return -1;
+			continue;
+		}
+
+		if (len <= 0) {
+			/* the driver is going down (or went away) */
+			if (len < 0)
+				fprintf(stderr, "Error reading %s: %s\n",
+					d->input, strerror(errno));
+
+			close(d->in_fd);
+			d->in_fd = -1;
+
+			if (flush_output(d) < 0)
+				return -1;
+
+			wait_secs(1);
+
+			if (open_input(d) < 0)
+				return stop_requested ? 0 : -1;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+
+		d->in_len += len;
+		if (process_input(d, &ts) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void print_usage(const char *executable)
+{
+	printf("Usage:\n\t%s [OPTIONS]\n"
+	       "\n\tOPTIONS\n"
+	       "\t-i, --input\t\tfwlog sysfs entry (%s)\n"
+	       "\t-o, --output\t\tarchive file, rotated to <output>.1, .2... (%s)\n"
+	       "\t-s, --max-size\t\tmaximum size of each archive file in KB (%d)\n"
+	       "\t-n, --max-files\t\tnumber of archive files to keep (%d)\n"
+	       "\t-t, --flush-interval\tseconds records may stay buffered (%d)\n"
+	       "\t-f, --foreground\tdon't detach from the terminal\n"
+	       "\t-h, --help\t\tprint this help\n"
+	       "\n\tSIGHUP starts a new archive file, SIGINT/SIGTERM flush and exit.\n"
+	       "\n",
+	       executable, FWLOG_DEFAULT_INPUT, FWLOG_DEFAULT_OUTPUT,
+	       FWLOG_DEFAULT_SIZE / 1024, FWLOG_DEFAULT_FILES,
+	       FWLOG_DEFAULT_FLUSH);
+}
+
+static struct option long_options[] = {
+	{ "input",		required_argument,	NULL,	'i' },
+	{ "output",		required_argument,	NULL,	'o' },
+	{ "max-size",		required_argument,	NULL,	's' },
+	{ "max-files",		required_argument,	NULL,	'n' },
+	{ "flush-interval",	required_argument,	NULL,	't' },
+	{ "foreground",		no_argument,		NULL,	'f' },
+	{ "help",		no_argument,		NULL,	'h' },
+	{ 0, 0, 0, 0 },
+};
+
+int main(int argc, char **argv)
+{
+	static struct fwlogd d;
+	int foreground = 0;
+	int c, ret;
+
+	d.input = FWLOG_DEFAULT_INPUT;
+	d.output = FWLOG_DEFAULT_OUTPUT;
+	d.max_size = FWLOG_DEFAULT_SIZE;
+	d.max_files = FWLOG_DEFAULT_FILES;
+	d.flush_interval = FWLOG_DEFAULT_FLUSH;
+	d.in_fd = -1;
+	d.out_fd = -1;
+
+	while ((c = getopt_long(argc, argv, "i:o:s:n:t:fh", long_options,
+				NULL)) >= 0) {
+		switch (c) {
+		case 'i':
+			d.input = optarg;
+			break;
+		case 'o':
+			d.output = optarg;
+			break;
+		case 's':
+			d.max_size = strtol(optarg, NULL, 0) * 1024;
+			break;
+		case 'n':
+			d.max_files = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			d.flush_interval = strtol(optarg, NULL, 0);
+			break;
+		case 'f':
+			foreground = 1;
+			break;
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		default:
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (d.max_size < FWLOG_HDR_SIZE || d.max_files < 1 ||
+	    d.flush_interval < 1) {
+		fprintf(stderr, "Invalid size, file count or flush interval\n");
+		return 1;
+	}
+
+	if (setup_signals() < 0)
+		return 1;
+
+	/* open the archive first, so errors still reach the terminal */
+	if (open_output(&d) < 0)
+		return 1;
+
+	if (!foreground && daemon(0, 0) < 0) {
+		perror("daemon");
+		return 1;
+	}
+
+	ret = capture(&d);
+
+	if (flush_output(&d) < 0)
+		ret = -1;
+
+	close(d.out_fd);
+	if (d.in_fd >= 0)
+		close(d.in_fd);
+
+	fprintf(stderr, "%lu records (%lu bytes) archived in %lu files\n",
+		d.records, d.bytes, d.files);
+
+	return ret < 0 ? 1 : 0;
+}
@@ -318,10 +318,13 @@ struct wl12xx_parse_ops {
 	int (*is_dual_mode)(struct wl12xx_ini *p);
 };
 
+struct nvs_image;
+
 struct wl12xx_nvs_ops {
-	int (*nvs_fill_radio_prms)(int fd, struct wl12xx_ini *p, char *buf);
-	int (*nvs_set_autofem)(int fd, char *buf, unsigned char val);
-	int (*nvs_set_fem_manuf)(int fd, char *buf, unsigned char val);
+	int (*nvs_fill_radio_prms)(struct nvs_image *img, struct wl12xx_ini *p,
+		const unsigned char *buf);
+	int (*nvs_set_autofem)(struct nvs_image *img, unsigned char val);
+	int (*nvs_set_fem_manuf)(struct nvs_image *img, unsigned char val);
 };
 
 int nvs_get_arch(int file_size, struct wl12xx_common *cmn);
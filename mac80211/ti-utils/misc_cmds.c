@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <time.h>
 #include "calibrator.h"
 #include "plt.h"
 #include "ini.h"
@@ -18,9 +19,8 @@ SECTION(set);
 static int get_nvs_mac(struct nl80211_state *state, struct nl_cb *cb,
 			struct nl_msg *msg, int argc, char **argv)
 {
-	unsigned char mac_buff[12];
+	struct nvs_image img;
 	char *fname;
-	int fd;
 
 	argc -= 2;
 	argv += 2;
@@ -29,19 +29,17 @@ static int get_nvs_mac(struct nl80211_state *state, struct nl_cb *cb,
 	if (!fname)
 		return 1;
 
-	fd = open(fname, O_RDONLY);
-	if (fd < 0) {
-		perror("Error opening file for reading");
+	if (nvs_image_read(&img, fname))
 		return 1;
-	}
 
-	read(fd, mac_buff, 12);
+	if (img.size < 12) {
+		fprintf(stderr, "NVS too short for a MAC address\n");
+		return 1;
+	}
 
 	printf("MAC addr from NVS: %02x:%02x:%02x:%02x:%02x:%02x\n",
-		mac_buff[11], mac_buff[10], mac_buff[6],
-		mac_buff[5], mac_buff[4], mac_buff[3]);
-
-	close(fd);
+		img.buf[11], img.buf[10], img.buf[6],
+		img.buf[5], img.buf[4], img.buf[3]);
 
 	return 0;
 }
@@ -281,6 +279,100 @@ static int set_fem_manuf(struct nl80211_state *state, struct nl_cb *cb,
 COMMAND(set, fem_manuf, "<0|1> [<nvs file>]", 0, 0, CIB_NONE, set_fem_manuf,
 	"Set FEM manufacturer");
 
+static long elapsed_us(struct timespec *start)
+{
+	struct timespec now;
+	long us;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - start->tv_sec) * 1000000L +
+		(now.tv_nsec - start->tv_nsec) / 1000;
+	*start = now;
+
+	return us;
+}
+
+/*
+ * Applies all the edits to the NVS in memory, so the file is read and
+ * written once whatever their number, and nothing is written unless every
+ * edit went through and the result is valid.
+ */
+static int set_nvs_batch(struct nl80211_state *state, struct nl_cb *cb,
+			struct nl_msg *msg, int argc, char **argv)
+{
+	struct nvs_image img;
+	struct timespec ts;
+	char *infname, *outfname, *value;
+	long read_us, edit_us, valid_us, write_us;
+	int i, edits = 0;
+
+	argc -= 2;
+	argv += 2;
+
+	if (argc < 1)
+		return 1;
+
+	infname = outfname = argv[0];
+	argc--;
+	argv++;
+
+	if (argc && !strchr(argv[0], '=')) {
+		outfname = argv[0];
+		argc--;
+		argv++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	if (nvs_image_read(&img, infname))
+		return 2;
+	read_us = elapsed_us(&ts);
+
+	for (i = 0; i < argc; i++) {
+		value = strchr(argv[i], '=');
+		if (!value) {
+			fprintf(stderr, "Invalid edit %s, expected "
+				"<name>=<value>\n", argv[i]);
+			return 1;
+		}
+
+		*value++ = '\0';
+		if (nvs_image_set(&img, argv[i], value)) {
+			fprintf(stderr, "Fail to set %s, %s left unchanged\n",
+				argv[i], outfname);
+			return 2;
+		}
+		edits++;
+	}
+	edit_us = elapsed_us(&ts);
+
+	if (nvs_image_validate(&img)) {
+		fprintf(stderr, "Invalid NVS, %s left unchanged\n", outfname);
+		return 2;
+	}
+	valid_us = elapsed_us(&ts);
+
+	if (nvs_image_write(&img, outfname))
+		return 2;
+	write_us = elapsed_us(&ts);
+
+	printf("%s: %d edits, %d bytes (%04X)\n", outfname, edits, img.size,
+		img.arch);
+	printf("read %ld us, edit %ld us, validate %ld us, write %ld us\n",
+		read_us, edit_us, valid_us, write_us);
+
+	return 0;
+}
+
+COMMAND(set, nvs_batch, "<nvs file> [<nvs outfile>] [<name>=<value>...]", 0, 0,
+	CIB_NONE, set_nvs_batch,
+	"Edit a NVS file in one pass, then validate it and write it once.\n\n"
+	"mac=XX:XX:XX:XX:XX:XX\tMAC address\n"
+	"autofem=<0|1>\t\tAuto FEM detection\n"
+	"fem_manuf=<0|1>\t\tFEM manufacturer\n"
+	"ini=<ini file>\t\tradio parameters, the INI must be for the same chip\n\n"
+	"Without an output file the NVS file is edited in place.");
+
 static int get_drv_info(struct nl80211_state *state, struct nl_cb *cb,
 			struct nl_msg *msg, int argc, char **argv)
 {
@@ -25,8 +25,7 @@
 #include "calibrator.h"
 #include "plt.h"
 #include "ini.h"
-/* 2048 - it should be enough for any chip, until... 22dec2010 */
-#define BUF_SIZE_4_NVS_FILE	2048
+#include "nvs.h"
 
 static const char if_name_fmt[] = "wlan%d";
 
@@ -64,188 +63,110 @@ char *get_opt_nvsoutfile(int argc, char **argv)
 
 int nvs_set_mac(char *nvsfile, char *mac)
 {
-	unsigned char mac_buff[12];
-	unsigned char in_mac[6];
-	int fd;
-	unsigned int lower;
+	struct nvs_image img;
 
-	if (mac) {
-		int ret =
-		sscanf(mac, "%2x:%2x:%2x:%2x:%2x:%2x",
-		(unsigned int *)&in_mac[0], (unsigned int *)&in_mac[1],
-		(unsigned int *)&in_mac[2], (unsigned int *)&in_mac[3],
-		(unsigned int *)&in_mac[4], (unsigned int *)&in_mac[5]);
-		if (ret != 6) {
-			fprintf(stderr, "MAC address is not valid: %s\n", mac);
-			return -1;
-		}
-	}
-	else {
+	if (!mac) {
 		fprintf(stderr, "No MAC address specified\n");
 		return -1;
 	}
 
-	fd = open(nvsfile, O_RDWR);
-	if (fd < 0) {
-		perror("Error opening file for reading");
+	if (nvs_image_read(&img, nvsfile))
 		return 1;
-	}
-
-	read(fd, mac_buff, 12);
-	mac_buff[11] = in_mac[0];
-	mac_buff[10] = in_mac[1];
-	mac_buff[6]  = in_mac[2];
-	mac_buff[5]  = in_mac[3];
-	mac_buff[4]  = in_mac[4];
-	mac_buff[3]  = in_mac[5];
-
-	lseek(fd, 0L, 0);
 
-	/* we need at least two valid NIC addresses */
-	lower = (in_mac[3] << 16) + (in_mac[4] << 8) + in_mac[5];
-	if (lower + 1 > 0xffffff)
-		fprintf(stderr,
-			"WARNING: NIC part of the MAC address wraps around!\n");
+	if (nvs_image_set_mac(&img, mac))
+		return -1;
 
 	printf("Writing mac address %s to file %s\n", mac, nvsfile);
-	write(fd, mac_buff, 12);
 
-	close(fd);
-	return 0;
+	return nvs_image_write(&img, nvsfile);
 }
 
-
-
-int nvs_fill_radio_params(int fd, struct wl12xx_ini *ini, char *buf)
+static int nvs_put(struct nvs_image *img, const void *data, int len)
 {
-	size_t size;
-	struct wl1271_ini *gp;
-
-	if (ini)
-		gp = &ini->ini1271;
-
-	size  = sizeof(struct wl1271_ini);
-
-	if (ini) {	/* for reference NVS */
-		unsigned char *c = (unsigned char *)gp;
-		size_t i;
-
-		for (i = 0; i < size; i++)
-			write(fd, c++, 1);
-	} else {
-		char *p = buf + 0x1D4;
-		write(fd, (const void *)p, size);
+	if (img->size + len > (int)sizeof(img->buf)) {
+		fprintf(stderr, "NVS image overflow (%d + %d bytes)\n",
+			img->size, len);
+		return 1;
 	}
 
+	memcpy(img->buf + img->size, data, len);
+	img->size += len;
+
 	return 0;
 }
 
-static int nvs_fill_radio_params_128x(int fd, struct wl12xx_ini *ini, char *buf)
+static int nvs_put_tlv_header(struct nvs_image *img, unsigned char type,
+	unsigned short len)
 {
-	int size;
-	struct wl128x_ini *gp = &ini->ini128x;
+	const unsigned char hdr[] = { type, len & 0xff, len >> 8 };
 
-	size  = sizeof(struct wl128x_ini);
+	return nvs_put(img, hdr, sizeof(hdr));
+}
 
-	if (ini) {	/* for reference NVS */
-		unsigned char *c = (unsigned char *)gp;
-		int i;
+int nvs_fill_radio_params(struct nvs_image *img, struct wl12xx_ini *ini,
+	const unsigned char *buf)
+{
+	if (ini)	/* for reference NVS */
+		return nvs_put(img, &ini->ini1271, sizeof(struct wl1271_ini));
 
-		for (i = 0; i < size; i++)
-			write(fd, c++, 1);
+	return nvs_put(img, buf + WL1271_INI_NVS_SECTION_SIZE,
+		sizeof(struct wl1271_ini));
+}
 
-	} else {
-		char *p = buf + 0x1D4;
-		write(fd, p, size);
-	}
+static int nvs_fill_radio_params_128x(struct nvs_image *img,
+	struct wl12xx_ini *ini, const unsigned char *buf)
+{
+	if (ini)	/* for reference NVS */
+		return nvs_put(img, &ini->ini128x, sizeof(struct wl128x_ini));
 
-	return 0;
+	return nvs_put(img, buf + WL1271_INI_NVS_SECTION_SIZE,
+		sizeof(struct wl128x_ini));
 }
 
-int nvs_set_autofem(int fd, char *buf, unsigned char val)
+int nvs_set_autofem(struct nvs_image *img, unsigned char val)
 {
-	size_t size, i;
-	struct wl1271_ini *gp;
-	unsigned char *c;
+	struct wl1271_nvs_file *nvs = (struct wl1271_nvs_file *)img->buf;
 
-	if (buf == NULL)
+	if (img->size < (int)sizeof(*nvs))
 		return 1;
 
-	gp = (struct wl1271_ini *)(buf+0x1d4);
-	gp->general_params.tx_bip_fem_auto_detect = val;
-
-	size  = sizeof(struct wl1271_ini);
-
-	c = (unsigned char *)gp;
-
-	for (i = 0; i < size; i++)
-		write(fd, c++, 1);
+	nvs->general_params.tx_bip_fem_auto_detect = val;
 
 	return 0;
 }
 
-int nvs_set_autofem_128x(int fd, char *buf, unsigned char val)
+int nvs_set_autofem_128x(struct nvs_image *img, unsigned char val)
 {
-	size_t size, i;
-	struct wl128x_ini *gp;
-	unsigned char *c;
+	struct wl128x_nvs_file *nvs = (struct wl128x_nvs_file *)img->buf;
 
-	if (buf == NULL)
+	if (img->size < (int)sizeof(*nvs))
 		return 1;
 
-	gp = (struct wl128x_ini *)(buf+0x1d4);
-	gp->general_params.tx_bip_fem_auto_detect = val;
-
-	size  = sizeof(struct wl128x_ini);
-
-	c = (unsigned char *)gp;
-
-	for (i = 0; i < size; i++)
-		write(fd, c++, 1);
+	nvs->general_params.tx_bip_fem_auto_detect = val;
 
 	return 0;
 }
 
-int nvs_set_fem_manuf(int fd, char *buf, unsigned char val)
+int nvs_set_fem_manuf(struct nvs_image *img, unsigned char val)
 {
-	size_t size, i;
-	struct wl1271_ini *gp;
-	unsigned char *c;
+	struct wl1271_nvs_file *nvs = (struct wl1271_nvs_file *)img->buf;
 
-	if (buf == NULL)
+	if (img->size < (int)sizeof(*nvs))
 		return 1;
 
-	gp = (struct wl1271_ini *)(buf+0x1d4);
-	gp->general_params.tx_bip_fem_manufacturer = val;
-
-	size  = sizeof(struct wl1271_ini);
-
-	c = (unsigned char *)gp;
-
-	for (i = 0; i < size; i++)
-		write(fd, c++, 1);
+	nvs->general_params.tx_bip_fem_manufacturer = val;
 
 	return 0;
 }
 
-int nvs_set_fem_manuf_128x(int fd, char *buf, unsigned char val)
+int nvs_set_fem_manuf_128x(struct nvs_image *img, unsigned char val)
 {
-	size_t size, i;
-	struct wl128x_ini *gp;
-	unsigned char *c;
+	struct wl128x_nvs_file *nvs = (struct wl128x_nvs_file *)img->buf;
 
-	if (buf == NULL)
+	if (img->size < (int)sizeof(*nvs))
 		return 1;
 
-	gp = (struct wl128x_ini *)(buf+0x1d4);
-	gp->general_params.tx_bip_fem_manufacturer = val;
-
-	size  = sizeof(struct wl128x_ini);
-
-	c = (unsigned char *)gp;
-
-	for (i = 0; i < size; i++)
-		write(fd, c++, 1);
+	nvs->general_params.tx_bip_fem_manufacturer = val;
 
 	return 0;
 }
@@ -317,68 +238,322 @@ void cfg_nvs_ops(struct wl12xx_common *cmn)
 		cmn->nvs_ops = &wl128x_nvs_ops;
 }
 
-static int read_from_current_nvs(const char *nvs_file,
-	char *buf, int size, int *nvs_sz)
+static enum wl12xx_arch nvs_image_arch(int size)
+{
+	switch (size) {
+	case WL127X_NVS_FILE_SZ:
+		return WL1271_ARCH;
+	case WL128X_NVS_FILE_SZ:
+		return WL128X_ARCH;
+	}
+
+	return UNKNOWN_ARCH;
+}
+
+static struct wl12xx_nvs_ops *nvs_image_ops(const struct nvs_image *img)
 {
-	int curr_nvs, ret;
+	if (img->arch == WL1271_ARCH)
+		return &wl1271_nvs_ops;
+	if (img->arch == WL128X_ARCH)
+		return &wl128x_nvs_ops;
 
-	curr_nvs = open(nvs_file, O_RDONLY, S_IRUSR | S_IWUSR);
-	if (curr_nvs < 0) {
-		fprintf(stderr, "%s> Unable to open NVS file for reference "
-			"(%s)\n", __func__, strerror(errno));
+	fprintf(stderr, "Unknown NVS architecture (%d bytes)\n", img->size);
+	return NULL;
+}
+
+int nvs_image_read(struct nvs_image *img, const char *nvs_file)
+{
+	struct stat st;
+	int fd, ret;
+
+	fd = open(nvs_file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to open NVS file %s (%s)\n", nvs_file,
+			strerror(errno));
 		return 1;
 	}
 
-	ret = read(curr_nvs, buf, size);
-	if (ret < 0) {
-		fprintf(stderr, "Fail to read file %s (%s)", nvs_file,
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "Unable to stat NVS file %s (%s)\n", nvs_file,
 			strerror(errno));
-		close(curr_nvs);
+		close(fd);
 		return 1;
 	}
 
-	if (nvs_sz)
-		*nvs_sz = ret;
+	if (st.st_size > (off_t)sizeof(img->buf)) {
+		fprintf(stderr, "NVS file %s is too big (%ld bytes)\n",
+			nvs_file, (long)st.st_size);
+		close(fd);
+		return 1;
+	}
 
-	close(curr_nvs);
+	ret = read(fd, img->buf, st.st_size);
+	if (ret != st.st_size) {
+		fprintf(stderr, "Fail to read file %s (%s)\n", nvs_file,
+			ret < 0 ? strerror(errno) : "short read");
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
 
-	//printf("Read NVS file (%s) of size %d\n", nvs_file, ret);
+	img->size = ret;
+	img->arch = nvs_image_arch(ret);
 
 	return 0;
 }
 
-static int read_nvs(const char *nvs_file, char *buf,
-	int size, int *nvs_sz)
+int nvs_image_write(const struct nvs_image *img, const char *nvs_file)
 {
-	int fl_sz;
-	fl_sz = file_exist(nvs_file);
-	if (fl_sz < 0) {
-		fprintf(stderr, "File %s not exists\n", nvs_file);
+	int fd, ret;
+
+	fd = open(nvs_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to open new NVS file %s (%s)\n",
+			nvs_file, strerror(errno));
+		return 1;
+	}
+
+	ret = write(fd, img->buf, img->size);
+	if (ret != img->size) {
+		fprintf(stderr, "Fail to write file %s (%s)\n", nvs_file,
+			ret < 0 ? strerror(errno) : "short write");
+		close(fd);
+		return 1;
+	}
+
+	if (close(fd) < 0) {
+		fprintf(stderr, "Fail to write file %s (%s)\n", nvs_file,
+			strerror(errno));
 		return 1;
 	}
 
-	return read_from_current_nvs(nvs_file, buf, size, nvs_sz);
+	return 0;
 }
 
-static int fill_nvs_def_rx_params(int fd)
+/*
+ * Checks what the driver relies on: a size it knows, the two register
+ * writes holding the MAC address, TLVs which stay within the NVS section
+ * and FEM settings the radio parameters have room for.  18xx has no NVS
+ * file at all, its radio parameters are in the wlconf binary.
+ */
+int nvs_image_validate(const struct nvs_image *img)
 {
-	unsigned char type = eNVS_RADIO_RX_PARAMETERS;
-	unsigned short length = NVS_RX_PARAM_LENGTH;
-	int i;
+	const unsigned char *buf = img->buf;
+	unsigned char auto_fem, fem_manuf;
+	int pos, len;
+
+	switch (img->arch) {
+	case WL1271_ARCH:
+		auto_fem = ((struct wl1271_nvs_file *)buf)->
+			general_params.tx_bip_fem_auto_detect;
+		fem_manuf = ((struct wl1271_nvs_file *)buf)->
+			general_params.tx_bip_fem_manufacturer;
+		break;
+	case WL128X_ARCH:
+		auto_fem = ((struct wl128x_nvs_file *)buf)->
+			general_params.tx_bip_fem_auto_detect;
+		fem_manuf = ((struct wl128x_nvs_file *)buf)->
+			general_params.tx_bip_fem_manufacturer;
+		break;
+	default:
+		fprintf(stderr, "Invalid NVS size %d, expected %d (127x) or "
+			"%d (128x); 18xx uses wlconf instead of NVS\n",
+			img->size, WL127X_NVS_FILE_SZ, WL128X_NVS_FILE_SZ);
+		return 1;
+	}
+
+	if (buf[0] != 0x01 || buf[1] != 0x6d || buf[2] != 0x54 ||
+	    buf[7] != 0x01 || buf[8] != 0x71 || buf[9] != 0x54) {
+		fprintf(stderr, "Invalid NVS header, MAC address not found\n");
+		return 1;
+	}
+
+	for (pos = NVS_PRE_PARAMETERS_LENGTH; ;
+	     pos += START_PARAM_INDEX + len) {
+		if (pos + START_PARAM_INDEX > WL1271_INI_NVS_SECTION_SIZE) {
+			fprintf(stderr, "NVS TLVs overrun the NVS section\n");
+			return 1;
+		}
+
+		if (buf[pos] == eTLV_LAST)
+			break;
+
+		len = buf[pos + START_LENGTH_INDEX] |
+			(buf[pos + START_LENGTH_INDEX + 1] << 8);
+
+		if (pos + START_PARAM_INDEX + len >
+		    WL1271_INI_NVS_SECTION_SIZE) {
+			fprintf(stderr, "NVS TLV at 0x%x overruns the NVS "
+				"section\n", pos);
+			return 1;
+		}
+
+		switch (buf[pos]) {
+		case eNVS_RADIO_TX_PARAMETERS:
+		case eNVS_RADIO_RX_PARAMETERS:
+		case eNVS_VERSION:
+			break;
+		default:
+			fprintf(stderr, "Invalid NVS TLV type 0x%02x at "
+				"0x%x\n", buf[pos], pos);
+			return 1;
+		}
+	}
+
+	if (auto_fem > 1) {
+		fprintf(stderr, "Invalid TXBiPFEMAutoDetect %d\n", auto_fem);
+		return 1;
+	}
+
+	if (fem_manuf >= WL1271_INI_FEM_MODULE_COUNT) {
+		fprintf(stderr, "Invalid TXBiPFEMManufacturer %d\n", fem_manuf);
+		return 1;
+	}
+
+	return 0;
+}
+
+int nvs_image_set_mac(struct nvs_image *img, const char *mac)
+{
+	unsigned int in_mac[MAC_ADDR_LEN];
+	unsigned int lower;
+	int ret;
+
+	ret = sscanf(mac, "%2x:%2x:%2x:%2x:%2x:%2x",
+		&in_mac[0], &in_mac[1], &in_mac[2],
+		&in_mac[3], &in_mac[4], &in_mac[5]);
+	if (ret != MAC_ADDR_LEN) {
+		fprintf(stderr, "MAC address is not valid: %s\n", mac);
+		return 1;
+	}
+
+	if (img->size < 12) {
+		fprintf(stderr, "NVS too short for a MAC address\n");
+		return 1;
+	}
+
+	img->buf[11] = in_mac[0];
+	img->buf[10] = in_mac[1];
+	img->buf[6]  = in_mac[2];
+	img->buf[5]  = in_mac[3];
+	img->buf[4]  = in_mac[4];
+	img->buf[3]  = in_mac[5];
+
+	/* we need at least two valid NIC addresses */
+	lower = (in_mac[3] << 16) + (in_mac[4] << 8) + in_mac[5];
+	if (lower + 1 > 0xffffff)
+		fprintf(stderr,
+			"WARNING: NIC part of the MAC address wraps around!\n");
+
+	return 0;
+}
+
+int nvs_image_set_autofem(struct nvs_image *img, unsigned char val)
+{
+	struct wl12xx_nvs_ops *ops = nvs_image_ops(img);
+
+	if (!ops)
+		return 1;
+
+	if (val > 1) {
+		fprintf(stderr, "Invalid AutoFEM value %d\n", val);
+		return 1;
+	}
+
+	return ops->nvs_set_autofem(img, val);
+}
+
+int nvs_image_set_fem_manuf(struct nvs_image *img, unsigned char val)
+{
+	struct wl12xx_nvs_ops *ops = nvs_image_ops(img);
+
+	if (!ops)
+		return 1;
+
+	if (val >= WL1271_INI_FEM_MODULE_COUNT) {
+		fprintf(stderr, "Invalid FEM manufacturer %d\n", val);
+		return 1;
+	}
 
-	/* Rx type */
-	write(fd, &type, 1);
+	return ops->nvs_set_fem_manuf(img, val);
+}
+
+/* keeps the NVS section and replaces whatever follows it */
+static int nvs_image_fill_radio(struct nvs_image *img,
+	struct wl12xx_common *cmn)
+{
+	if (img->size < WL1271_INI_NVS_SECTION_SIZE) {
+		fprintf(stderr, "NVS too short (%d bytes)\n", img->size);
+		return 1;
+	}
 
-	/* Rx length */
-	write(fd, &length, 2);
+	img->size = WL1271_INI_NVS_SECTION_SIZE;
+	if (cmn->nvs_ops->nvs_fill_radio_prms(img, &cmn->ini, NULL))
+		return 1;
 
-	type = DEFAULT_EFUSE_VALUE; /* just reuse of var */
-	for (i = 0; i < NVS_RX_PARAM_LENGTH; i++)
-		write(fd, &type, 1);
+	img->arch = nvs_image_arch(img->size);
 
 	return 0;
 }
 
+int nvs_image_set_radio_params(struct nvs_image *img,
+	struct wl12xx_common *cmn)
+{
+	if (img->arch != UNKNOWN_ARCH && img->arch != cmn->arch) {
+		fprintf(stderr, "INI file is for %04X, NVS file for %04X\n",
+			cmn->arch, img->arch);
+		return 1;
+	}
+
+	return nvs_image_fill_radio(img, cmn);
+}
+
+static int nvs_image_set_ini(struct nvs_image *img, const char *ini_file)
+{
+	struct wl12xx_common cmn = {
+		.arch = UNKNOWN_ARCH,
+		.parse_ops = NULL
+	};
+
+	if (read_ini(ini_file, &cmn)) {
+		fprintf(stderr, "Fail to read ini file\n");
+		return 1;
+	}
+
+	cfg_nvs_ops(&cmn);
+
+	return nvs_image_set_radio_params(img, &cmn);
+}
+
+int nvs_image_set(struct nvs_image *img, const char *name, const char *value)
+{
+	unsigned long val;
+	char *end;
+
+	if (!strcmp(name, "mac"))
+		return nvs_image_set_mac(img, value);
+
+	if (!strcmp(name, "ini"))
+		return nvs_image_set_ini(img, value);
+
+	if (strcmp(name, "autofem") && strcmp(name, "fem_manuf")) {
+		fprintf(stderr, "Unknown NVS field %s\n", name);
+		return 1;
+	}
+
+	val = strtoul(value, &end, 16);
+	if (end == value || *end || val > 0xff) {
+		fprintf(stderr, "Invalid %s value %s\n", name, value);
+		return 1;
+	}
+
+	if (!strcmp(name, "autofem"))
+		return nvs_image_set_autofem(img, val);
+
+	return nvs_image_set_fem_manuf(img, val);
+}
+
 static void nvs_parse_data(const unsigned char *buf,
 	struct wl1271_cmd_cal_p2g *pdata, unsigned int *pver)
 {
@@ -441,338 +616,201 @@ static void nvs_parse_data(const unsigned char *buf,
 	}
 }
 
-static int nvs_fill_version(int fd, unsigned int *pdata)
+static int nvs_fill_version(struct nvs_image *img, unsigned int ver)
 {
-	unsigned char tmp = eNVS_VERSION;
-	unsigned short tmp2 = NVS_VERSION_PARAMETER_LENGTH;
-
-	write(fd, &tmp, 1);
-
-	write(fd, &tmp2, 2);
-
-	tmp = (*pdata >> 16) & 0xff;
-	write(fd, &tmp, 1);
-
-	tmp = (*pdata >> 8) & 0xff;
-	write(fd, &tmp, 1);
+	const unsigned char data[] = {
+		(ver >> 16) & 0xff, (ver >> 8) & 0xff, ver & 0xff
+	};
 
-	tmp = *pdata & 0xff;
-	write(fd, &tmp, 1);
+	if (nvs_put_tlv_header(img, eNVS_VERSION,
+			NVS_VERSION_PARAMETER_LENGTH))
+		return 1;
 
-	return 0;
+	return nvs_put(img, data, sizeof(data));
 }
 
-static int nvs_fill_old_rx_data(int fd, const unsigned char *buf,
-	unsigned short len)
+/*
+ * The two register writes holding the MAC address, then zeros up to the
+ * first TLV
+ */
+static int nvs_fill_header(struct nvs_image *img, const unsigned char *mac)
 {
-	unsigned short idx;
-	unsigned char rx_type;
-
-	/* RX BiP type */
-	rx_type = eNVS_RADIO_RX_PARAMETERS;
-	write(fd, &rx_type, 1);
-
-	/* RX BIP Length */
-	write(fd, &len, 2);
+	const unsigned char hdr[NVS_PRE_PARAMETERS_LENGTH] = {
+		0x01, 0x6d, 0x54, mac[5], mac[4], mac[3], mac[2],
+		0x01, 0x71, 0x54, mac[1], mac[0]
+	};
 
-	for (idx = 0; idx < len; idx++)
-		write(fd, &(buf[idx]), 1);
+	img->size = 0;
 
-	return 0;
+	return nvs_put(img, hdr, sizeof(hdr));
 }
 
-static int nvs_upd_nvs_part(int fd, char *buf)
+static int nvs_fill_end(struct nvs_image *img)
 {
-	char *p = buf;
-
-	write(fd, p, 0x1D4);
+	const unsigned char end[] = { eTLV_LAST, eTLV_LAST, 0, 0 };
 
-	return 0;
+	return nvs_put(img, end, sizeof(end));
 }
 
-static int nvs_fill_nvs_part(int fd)
+static int nvs_fill_nvs_part(struct nvs_image *img)
 {
-	int i;
 	unsigned char mac_addr[MAC_ADDR_LEN] = {
 		 0x0b, 0xad, 0xde, 0xad, 0xbe, 0xef
 	};
-	__le16 nvs_tx_sz = NVS_TX_PARAM_LENGTH;
-	__le32 nvs_ver = 0x0;
-	const unsigned char vals[] = {
-		0x0, 0x1, 0x6d, 0x54, 0x71, eTLV_LAST, eNVS_RADIO_TX_PARAMETERS
-	};
-
-	write(fd, &vals[1], 1);
-	write(fd, &vals[2], 1);
-	write(fd, &vals[3], 1);
+	unsigned char zeros[NVS_TX_PARAM_LENGTH];
 #if 0
 	if (get_mac_addr(0, mac_addr)) {
 		fprintf(stderr, "%s> Fail to get mac address\n", __func__);
 		return 1;
 	}
 #endif
-	/* write down MAC address in new NVS file */
-	write(fd, &mac_addr[5], 1);
-	write(fd, &mac_addr[4], 1);
-	write(fd, &mac_addr[3], 1);
-	write(fd, &mac_addr[2], 1);
-
-	write(fd, &vals[1], 1);
-	write(fd, &vals[4], 1);
-	write(fd, &vals[3], 1);
-
-	write(fd, &mac_addr[1], 1);
-	write(fd, &mac_addr[0], 1);
+	memset(zeros, 0, sizeof(zeros));
 
-	write(fd, &vals[0], 1);
-	write(fd, &vals[0], 1);
-
-	/* fill end burst transaction zeros */
-	for (i = 0; i < NVS_END_BURST_TRANSACTION_LENGTH; i++)
-		write(fd, &vals[0], 1);
-
-	/* fill zeros to Align TLV start address */
-	for (i = 0; i < NVS_ALING_TLV_START_ADDRESS_LENGTH; i++)
-		write(fd, &vals[0], 1);
+	if (nvs_fill_header(img, mac_addr))
+		return 1;
 
 	/* Fill Tx calibration part */
-	write(fd, &vals[6], 1);
-	write(fd, &nvs_tx_sz, 2);
-
-	for (i = 0; i < nvs_tx_sz; i++)
-		write(fd, &vals[0], 1);
+	if (nvs_put_tlv_header(img, eNVS_RADIO_TX_PARAMETERS,
+			NVS_TX_PARAM_LENGTH) ||
+	    nvs_put(img, zeros, NVS_TX_PARAM_LENGTH))
+		return 1;
 
 	/* Fill Rx calibration part */
-	fill_nvs_def_rx_params(fd);
+	if (nvs_put_tlv_header(img, eNVS_RADIO_RX_PARAMETERS,
+			NVS_RX_PARAM_LENGTH) ||
+	    nvs_put(img, zeros, NVS_RX_PARAM_LENGTH))
+		return 1;
 
 	/* fill NVS version */
-	if (nvs_fill_version(fd, &nvs_ver))
+	if (nvs_fill_version(img, 0)) {
 		fprintf(stderr, "Fail to fill version\n");
+		return 1;
+	}
 
 	/* fill end of NVS */
-	write(fd, &vals[5], 1); /* eTLV_LAST */
-	write(fd, &vals[5], 1); /* eTLV_LAST */
-	write(fd, &vals[0], 1);
-	write(fd, &vals[0], 1);
-
-	return 0;
+	return nvs_fill_end(img);
 }
 
 int prepare_nvs_file(void *arg, char *file_name)
 {
-	int new_nvs, i, nvs_size;
 	unsigned char mac_addr[MAC_ADDR_LEN];
 	struct wl1271_cmd_cal_p2g *pdata;
 	struct wl1271_cmd_cal_p2g old_data[eNUMBER_RADIO_TYPE_PARAMETERS_INFO];
-	char buf[2048];
-	unsigned char *p;
+	struct wl1271_cmd_cal_p2g *old_rx;
+	struct nvs_image old, new;
+	unsigned int old_ver;
 	struct wl12xx_common cmn = {
 		.arch = UNKNOWN_ARCH,
 		.parse_ops = NULL
 	};
 
-	const unsigned char vals[] = {
-		0x0, 0x1, 0x6d, 0x54, 0x71, eTLV_LAST, eNVS_RADIO_TX_PARAMETERS
-	};
-
 	if (arg == NULL) {
 		fprintf(stderr, "%s> Missing args\n", __func__);
 		return 1;
 	}
 
-	if (read_nvs(file_name, buf, BUF_SIZE_4_NVS_FILE, &nvs_size))
+	if (nvs_image_read(&old, file_name))
 		return 1;
 
-	switch (nvs_size) {
-		case NVS_FILE_SIZE_127X:
-			cmn.arch = WL1271_ARCH;
-		break;
-		case NVS_FILE_SIZE_128X:
-			cmn.arch = WL128X_ARCH;
-		break;
-		default:
-			fprintf(stderr, "%s> Wrong file size\n", __func__);
+	if (old.arch == UNKNOWN_ARCH) {
+		fprintf(stderr, "%s> Wrong file size\n", __func__);
 		return 1;
 	}
 
+	cmn.arch = old.arch;
 	cfg_nvs_ops(&cmn);
 
-	/* create new NVS file */
-	new_nvs = open(file_name,
-		O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-	if (new_nvs < 0) {
-		fprintf(stderr, "%s> Unable to open new NVS file\n", __func__);
-		return 1;
-	}
-
-	write(new_nvs, &vals[1], 1);
-	write(new_nvs, &vals[2], 1);
-	write(new_nvs, &vals[3], 1);
-
 	if (get_mac_addr(0, mac_addr)) {
 		fprintf(stderr, "%s> Fail to get mac addr\n", __func__);
-		close(new_nvs);
 		return 1;
 	}
 
 	/* write down MAC address in new NVS file */
-	write(new_nvs, &mac_addr[5], 1);
-	write(new_nvs, &mac_addr[4], 1);
-	write(new_nvs, &mac_addr[3], 1);
-	write(new_nvs, &mac_addr[2], 1);
-
-	write(new_nvs, &vals[1], 1);
-	write(new_nvs, &vals[4], 1);
-	write(new_nvs, &vals[3], 1);
-
-	write(new_nvs, &mac_addr[1], 1);
-	write(new_nvs, &mac_addr[0], 1);
-
-	write(new_nvs, &vals[0], 1);
-	write(new_nvs, &vals[0], 1);
-
-	/* fill end burst transaction zeros */
-	for (i = 0; i < NVS_END_BURST_TRANSACTION_LENGTH; i++)
-		write(new_nvs, &vals[0], 1);
-
-	/* fill zeros to Align TLV start address */
-	for (i = 0; i < NVS_ALING_TLV_START_ADDRESS_LENGTH; i++)
-		write(new_nvs, &vals[0], 1);
+	if (nvs_fill_header(&new, mac_addr))
+		return 1;
 
 	/* Fill TxBip */
 	pdata = (struct wl1271_cmd_cal_p2g *)arg;
 
-	write(new_nvs, &vals[6], 1);
-	write(new_nvs, &pdata->len, 2);
+	if (nvs_put_tlv_header(&new, eNVS_RADIO_TX_PARAMETERS, pdata->len) ||
+	    nvs_put(&new, pdata->buf, pdata->len))
+		return 1;
 
-	p = (unsigned char *)&(pdata->buf);
-	for (i = 0; i < pdata->len; i++)
-		write(new_nvs, p++, 1);
+	/* keep the RxBip of the current NVS */
+	memset(old_data, 0,
+		sizeof(struct wl1271_cmd_cal_p2g)*
+			eNUMBER_RADIO_TYPE_PARAMETERS_INFO);
+	nvs_parse_data(&old.buf[NVS_PRE_PARAMETERS_LENGTH], old_data, &old_ver);
 
-	{
-		unsigned int old_ver;
-#if 0
-		{
-			unsigned char *p = (unsigned char *)buf;
-			for (old_ver = 0; old_ver < 1024; old_ver++) {
-				if (old_ver%16 == 0)
-					printf("\n");
-				printf("%02x ", *p++);
-			}
-		}
-#endif
-		memset(old_data, 0,
-			sizeof(struct wl1271_cmd_cal_p2g)*
-				eNUMBER_RADIO_TYPE_PARAMETERS_INFO);
-		nvs_parse_data((const unsigned char *)&buf[NVS_PRE_PARAMETERS_LENGTH],
-			old_data, &old_ver);
-
-		nvs_fill_old_rx_data(new_nvs,
-			old_data[eNVS_RADIO_RX_TYPE_PARAMETERS_INFO].buf,
-			old_data[eNVS_RADIO_RX_TYPE_PARAMETERS_INFO].len);
-	}
+	old_rx = &old_data[eNVS_RADIO_RX_TYPE_PARAMETERS_INFO];
+	if (nvs_put_tlv_header(&new, eNVS_RADIO_RX_PARAMETERS, old_rx->len) ||
+	    nvs_put(&new, old_rx->buf, old_rx->len))
+		return 1;
 
 	/* fill NVS version */
-	if (nvs_fill_version(new_nvs, &pdata->ver))
+	if (nvs_fill_version(&new, pdata->ver))
 		fprintf(stderr, "Fail to fill version\n");
 
 	/* fill end of NVS */
-	write(new_nvs, &vals[5], 1); /* eTLV_LAST */
-	write(new_nvs, &vals[5], 1); /* eTLV_LAST */
-	write(new_nvs, &vals[0], 1);
-	write(new_nvs, &vals[0], 1);
+	if (nvs_fill_end(&new))
+		return 1;
 
 	/* fill radio params */
-	if (cmn.nvs_ops->nvs_fill_radio_prms(new_nvs, NULL, buf))
+	if (cmn.nvs_ops->nvs_fill_radio_prms(&new, NULL, old.buf))
 		fprintf(stderr, "Fail to fill radio params\n");
 
-	close(new_nvs);
+	new.arch = nvs_image_arch(new.size);
 
-	return 0;
+	return nvs_image_write(&new, file_name);
 }
 
 int create_nvs_file(struct wl12xx_common *cmn)
 {
-	int new_nvs, res = 0;
-	char buf[2048];
-
-	/* create new NVS file */
-	new_nvs = open(cmn->nvs_name,
-		O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-	if (new_nvs < 0) {
-		fprintf(stderr, "%s> Unable to open new NVS file\n", __func__);
-		return 1;
-	}
+	struct nvs_image img;
 
 	/* fill nvs part */
-	if (nvs_fill_nvs_part(new_nvs)) {
+	if (nvs_fill_nvs_part(&img)) {
 		fprintf(stderr, "Fail to fill NVS part\n");
-		res = 1;
-
-		goto out;
+		return 1;
 	}
 
 	/* fill radio params */
-	if (cmn->nvs_ops->nvs_fill_radio_prms(new_nvs, &cmn->ini, buf)) {
+	if (cmn->nvs_ops->nvs_fill_radio_prms(&img, &cmn->ini, NULL)) {
 		fprintf(stderr, "Fail to fill radio params\n");
-		res = 1;
+		return 1;
 	}
 
-out:
-	close(new_nvs);
-
-	return res;
+	return nvs_image_write(&img, cmn->nvs_name);
 }
 
 int update_nvs_file(const char *nvs_infile, const char *nvs_outfile, struct wl12xx_common *cmn)
 {
-	int new_nvs, res = 0;
-	char buf[2048];
+	struct nvs_image img;
 
-	res = read_nvs(nvs_infile, buf, BUF_SIZE_4_NVS_FILE, NULL);
-	if (res)
+	if (nvs_image_read(&img, nvs_infile))
 		return 1;
 
-	/* create new NVS file */
-	new_nvs = open(nvs_outfile,
-		O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-	if (new_nvs < 0) {
-		fprintf(stderr, "%s> Unable to open new NVS file\n", __func__);
-		return 1;
-	}
-
-	/* fill nvs part */
-	if (nvs_upd_nvs_part(new_nvs, buf)) {
-		fprintf(stderr, "Fail to fill NVS part\n");
-		res = 1;
-
-		goto out;
-	}
-
-	/* fill radio params */
-	if (cmn->nvs_ops->nvs_fill_radio_prms(new_nvs, &cmn->ini, buf)) {
+	/* keep the nvs part, fill radio params */
+	if (nvs_image_fill_radio(&img, cmn)) {
 		printf("Fail to fill radio params\n");
-		res = 1;
+		return 1;
 	}
 
-out:
-	close(new_nvs);
-
-	return res;
+	return nvs_image_write(&img, nvs_outfile);
 }
 
 int dump_nvs_file(const char *nvs_file)
 {
-	int sz=0, size;
-	char buf[2048];
-	unsigned char *p = (unsigned char *)buf;
+	int sz=0;
+	struct nvs_image img;
+	unsigned char *p = img.buf;
 
-	if (read_nvs(nvs_file, buf, BUF_SIZE_4_NVS_FILE, &size))
+	if (nvs_image_read(&img, nvs_file))
 		return 1;
 
-	printf("\nThe size is %d bytes\n", size);
+	printf("\nThe size is %d bytes\n", img.size);
 
-	for ( ; sz < size; sz++) {
+	for ( ; sz < img.size; sz++) {
 		if (sz%16 == 0)
 			printf("\n %04X ", sz);
 		printf("%02x ", *p++);
@@ -785,93 +823,47 @@ int dump_nvs_file(const char *nvs_file)
 int set_nvs_file_autofem(const char *nvs_file, unsigned char val,
 	struct wl12xx_common *cmn)
 {
-	int new_nvs, res = 0;
-	char buf[2048];
-	int nvs_file_sz;
+	struct nvs_image img;
 
-	res = read_nvs(nvs_file, buf, BUF_SIZE_4_NVS_FILE, &nvs_file_sz);
-	if (res)
+	if (nvs_image_read(&img, nvs_file))
 		return 1;
 
-	if (nvs_get_arch(nvs_file_sz, cmn)) {
+	if (nvs_get_arch(img.size, cmn)) {
 		fprintf(stderr, "Fail to define architecture\n");
 		return 1;
 	}
 
 	cfg_nvs_ops(cmn);
 
-	/* create new NVS file */
-	new_nvs = open(nvs_file,
-		O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-	if (new_nvs < 0) {
-		fprintf(stderr, "%s> Unable to open new NVS file\n", __func__);
-		return 1;
-	}
-
-	/* fill nvs part */
-	if (nvs_upd_nvs_part(new_nvs, buf)) {
-		fprintf(stderr, "Fail to fill NVS part\n");
-		res = 1;
-
-		goto out;
-	}
-
-	/* fill radio params */
-	if (cmn->nvs_ops->nvs_set_autofem(new_nvs, buf, val)) {
+	if (cmn->nvs_ops->nvs_set_autofem(&img, val)) {
 		printf("Fail to fill radio params\n");
-		res = 1;
+		return 1;
 	}
 
-out:
-	close(new_nvs);
-
-	return res;
+	return nvs_image_write(&img, nvs_file);
 }
 
 int set_nvs_file_fem_manuf(const char *nvs_file, unsigned char val,
 	struct wl12xx_common *cmn)
 {
-	int new_nvs, res = 0;
-	char buf[2048];
-	int nvs_file_sz;
+	struct nvs_image img;
 
-	res = read_nvs(nvs_file, buf, BUF_SIZE_4_NVS_FILE, &nvs_file_sz);
-	if (res)
+	if (nvs_image_read(&img, nvs_file))
 		return 1;
 
-	if (nvs_get_arch(nvs_file_sz, cmn)) {
+	if (nvs_get_arch(img.size, cmn)) {
 		fprintf(stderr, "Fail to define architecture\n");
 		return 1;
 	}
 
 	cfg_nvs_ops(cmn);
 
-	/* create new NVS file */
-	new_nvs = open(nvs_file,
-		O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-	if (new_nvs < 0) {
-		fprintf(stderr, "%s> Unable to open new NVS file\n", __func__);
-		return 1;
-	}
-
-	/* fill nvs part */
-	if (nvs_upd_nvs_part(new_nvs, buf)) {
-		fprintf(stderr, "Fail to fill NVS part\n");
-		res = 1;
-
-		goto out;
-	}
-
-	/* fill radio params */
-	if (cmn->nvs_ops->nvs_set_fem_manuf(new_nvs, buf, val)) {
+	if (cmn->nvs_ops->nvs_set_fem_manuf(&img, val)) {
 		printf("Fail to fill radio params\n");
-		res = 1;
+		return 1;
 	}
 
-out:
-	close(new_nvs);
-
-	return res;
+	return nvs_image_write(&img, nvs_file);
 }
 
 static void _print_hexa(char *name, unsigned char *data, size_t len)
@@ -1122,26 +1114,15 @@ int get_fem_nr(int autodetect, int manuf, int *femcnt, int *femi)
 
 int info_nvs_file(const char *nvs_file)
 {
-	char buf[BUF_SIZE_4_NVS_FILE];
+	struct nvs_image img;
 	int ret, i, femi, femcnt, maxfem;
 
-	int fd =  open(nvs_file, O_RDONLY, S_IRUSR | S_IWUSR);
-	if (fd < 0) {
-		fprintf(stderr, "Unable to open NVS %s ", nvs_file);
+	if (nvs_image_read(&img, nvs_file))
 		return 1;
-	}
-
-	ret = read(fd, buf, BUF_SIZE_4_NVS_FILE);
-	if (ret < 0) {
-		fprintf(stderr, "Fail to read file %s (%s)", nvs_file,
-			strerror(errno));
-		close(fd);
-		return 1;
-	}
-	close(fd);
 
+	ret = img.size;
 	if (ret == sizeof(struct wl1271_nvs_file)) {
-		struct wl1271_nvs_file *nvs = (struct wl1271_nvs_file *) &buf;
+		struct wl1271_nvs_file *nvs = (struct wl1271_nvs_file *) img.buf;
 		printf("#Chip is 127x\n");
 		print_127x_general_params(&nvs->general_params);
 		print_127x_band2_params(&nvs->stat_radio_params_2);
@@ -1166,7 +1147,7 @@ int info_nvs_file(const char *nvs_file)
 		}
 	}
 	else if (ret == sizeof(struct wl128x_nvs_file)) {
-		struct wl128x_nvs_file *nvs = (struct wl128x_nvs_file *) &buf;
+		struct wl128x_nvs_file *nvs = (struct wl128x_nvs_file *) img.buf;
 		printf("#Chip is 128x\n");
 		print_128x_general_params(&nvs->general_params);
 		print_128x_band2_params(&nvs->stat_radio_params_2);
@@ -4,6 +4,37 @@
 #define WL127X_NVS_FILE_SZ		912
 #define WL128X_NVS_FILE_SZ		1113
 
+/* 2048 - it should be enough for any chip, until... 22dec2010 */
+#define BUF_SIZE_4_NVS_FILE	2048
+
+/*
+ * NVS file held in memory: read once, patched in place as many times as
+ * needed and written back with a single write()
+ */
+struct nvs_image {
+	enum wl12xx_arch arch;	/* from the size, UNKNOWN_ARCH if it fits none */
+	int size;
+	unsigned char buf[BUF_SIZE_4_NVS_FILE];
+};
+
+int nvs_image_read(struct nvs_image *img, const char *nvs_file);
+
+int nvs_image_write(const struct nvs_image *img, const char *nvs_file);
+
+int nvs_image_validate(const struct nvs_image *img);
+
+int nvs_image_set_mac(struct nvs_image *img, const char *mac);
+
+int nvs_image_set_autofem(struct nvs_image *img, unsigned char val);
+
+int nvs_image_set_fem_manuf(struct nvs_image *img, unsigned char val);
+
+int nvs_image_set_radio_params(struct nvs_image *img,
+	struct wl12xx_common *cmn);
+
+/* name is one of mac, autofem, fem_manuf or ini (radio params file) */
+int nvs_image_set(struct nvs_image *img, const char *name, const char *value);
+
 char *get_opt_nvsinfile(int argc, char **argv);
 char *get_opt_nvsoutfile(int argc, char **argv);
 
@@ -19,7 +19,8 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
         main.c \
-        crc32.c
+        crc32.c \
+        symtab.c
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)
 LOCAL_CFLAGS += -DWLCONF_DIR=\"/system/etc/wifi/\"
@@ -18,14 +18,20 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <regex.h>
+#include <ctype.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <getopt.h>
 
 #include "crc32.h"
+#include "symtab.h"
 #include "wlconf.h"
 
 #ifdef ANDROID
@@ -63,221 +69,579 @@ out:
 
 static struct dict_entry *dict = NULL;
 static int n_dict_entries = 0;
+static struct symtab *dict_tab = NULL;
 
 static struct structure *structures = NULL;
 static int n_structs = 0;
 
+/* type and struct names -> type index (struct types are >= STRUCT_BASE) */
+static struct symtab *type_tab = NULL;
+
 static int magic		= 0;
 static int version		= 0;
 static int checksum		= 0;
 static int struct_chksum	= 0;
 static int ignore_checksum	= 0;
+static int timing		= 0;
 
-static int get_type(char *type_str)
+static struct symtab *get_type_tab(void)
 {
 	int i;
 
+	if (type_tab)
+		return type_tab;
+
+	type_tab = symtab_alloc(64);
+	if (!type_tab) {
+		fprintf(stderr, "couldn't allocate memory\n");
+		return NULL;
+	}
+
 	for (i = 0; i < (sizeof(types) / sizeof(types[0])); i++)
-		if (!strcmp(type_str, types[i].name))
-			return i;
+		symtab_add(type_tab, types[i].name, strlen(types[i].name), i);
 
-	for (i = 0; i < n_structs; i++) {
-		struct structure *curr_struct;
-		curr_struct = &structures[i];
+	return type_tab;
+}
 
-		if (!strcmp(type_str, curr_struct->name)) {
-			return STRUCT_BASE + i;
-		}
+/* make structures[i] known as a type, the first definition wins */
+static int add_struct_type(int i)
+{
+	const char *name = structures[i].name;
+
+	if (!get_type_tab())
+		return -1;
+
+	if (symtab_find(type_tab, name, strlen(name)) >= 0)
+		return 0;
+
+	return symtab_add(type_tab, name, strlen(name), STRUCT_BASE + i);
+}
+
+/* index the element names of a struct for get_element_pos() */
+static int add_struct_elements(struct structure *structure)
+{
+	int i;
+
+	structure->element_tab = symtab_alloc(structure->n_elements);
+	if (!structure->element_tab) {
+		fprintf(stderr, "couldn't allocate memory\n");
+		return -1;
 	}
 
-	return -1;
+	for (i = 0; i < structure->n_elements; i++) {
+		const char *name = structure->elements[i].name;
+
+		/* keep the first one, as the old linear search did */
+		if (symtab_find(structure->element_tab, name, strlen(name)) >= 0)
+			continue;
+
+		if (symtab_add(structure->element_tab, name, strlen(name), i) < 0)
+			return -1;
+	}
+
+	return 0;
 }
 
-static char *remove_comments(const char *orig_str)
+static int get_type(const char *type_str)
 {
-	regex_t r;
-	char *new_str = NULL;
-	regmatch_t m[6];
+	if (!get_type_tab())
+		return -1;
 
-	if (regcomp(&r, CC_COMMENT_PATTERN, REG_EXTENDED) < 0)
-		goto out;
+	return symtab_find(type_tab, type_str, strlen(type_str));
+}
+
+static struct structure *get_struct(const char *structure)
+{
+	int type = get_type(structure);
 
-	new_str = strdup(orig_str);
+	if (type < STRUCT_BASE)
+		return NULL;
 
-	while (!regexec(&r, new_str, 4, m, 0)) {
-		char *part1, *part2;
+	return &structures[type - STRUCT_BASE];
+}
 
-		part1 = strndup(new_str + m[1].rm_so, m[1].rm_eo - m[1].rm_so);
-		part2 = strndup(new_str + m[3].rm_so, m[3].rm_eo - m[3].rm_so);
+static void timing_start(struct timespec *start)
+{
+	if (timing)
+		clock_gettime(CLOCK_MONOTONIC, start);
+}
 
-		snprintf(new_str, strlen(orig_str), "%s%s", part1, part2);
+/* with -T, tell how long it took to parse one of the input files */
+static void timing_report(const char *what, const char *filename,
+			  const struct timespec *start)
+{
+	struct timespec now;
+	long usec;
 
-		free(part1);
-		free(part2);
-	}
+	if (!timing)
+		return;
 
-	regfree(&r);
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	if (regcomp(&r, C_COMMENT_PATTERN, REG_EXTENDED) < 0)
-		goto out;
+	usec = (now.tv_sec - start->tv_sec) * 1000000 +
+		(now.tv_nsec - start->tv_nsec) / 1000;
+
+	fprintf(stderr, "%s '%s' parsed in %ld.%03ld ms\n",
+		what, filename, usec / 1000, usec % 1000);
+}
+
+static void header_error(const struct tokenizer *tk, unsigned int line,
+			 unsigned int column, const char *fmt, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "%s:%u:%u: ", tk->filename, line, column);
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+
+	fprintf(stderr, "\n");
+}
 
-	while (!regexec(&r, new_str, 6, m, 0)) {
-		char *part1, *part2;
+static int token_is(const struct token *tok, const char *str)
+{
+	return tok->len == strlen(str) && !strncmp(tok->str, str, tok->len);
+}
+
+static int tokenizer_peek(const struct tokenizer *tk, size_t offset)
+{
+	if (offset >= (size_t) (tk->end - tk->pos))
+		return '\0';
 
-		part1 = strndup(new_str + m[1].rm_so, m[1].rm_eo - m[1].rm_so);
-		part2 = strndup(new_str + m[5].rm_so, m[5].rm_eo - m[5].rm_so);
+	return (unsigned char) tk->pos[offset];
+}
 
-		snprintf(new_str, strlen(orig_str), "%s%s", part1, part2);
+static void tokenizer_advance(struct tokenizer *tk, size_t count)
+{
+	while (count-- && tk->pos < tk->end) {
+		if (*tk->pos == '\n') {
+			tk->line++;
+			tk->column = 1;
+			tk->line_start = 1;
+		} else {
+			tk->column++;
+		}
 
-		free(part1);
-		free(part2);
+		tk->pos++;
 	}
+}
 
-	regfree(&r);
-out:
-	return new_str;
+static int is_ident_char(int c)
+{
+	return isalnum(c) || c == '_';
 }
 
-static struct structure *get_struct(const char *structure)
+/* skip a comment at the current position, returns 1 if there was one */
+static int skip_comment(struct tokenizer *tk)
 {
-	int j;
+	unsigned int line = tk->line, column = tk->column;
+
+	if (tokenizer_peek(tk, 0) != '/')
+		return 0;
+
+	if (tokenizer_peek(tk, 1) == '/') {
+		while (tk->pos < tk->end && *tk->pos != '\n')
+			tokenizer_advance(tk, 1);
+		return 1;
+	}
+
+	if (tokenizer_peek(tk, 1) != '*')
+		return 0;
 
-	for (j = 0; j < n_structs; j++)
-		if (!strcmp(structure, structures[j].name))
-			return &structures[j];
+	tokenizer_advance(tk, 2);
+	while (tk->pos < tk->end) {
+		if (tokenizer_peek(tk, 0) == '*' && tokenizer_peek(tk, 1) == '/') {
+			tokenizer_advance(tk, 2);
+			return 1;
+		}
+		tokenizer_advance(tk, 1);
+	}
 
-	return NULL;
+	header_error(tk, line, column, "unterminated comment");
+	return -1;
 }
 
-static int parse_define(const char *buffer, char *symbol, int *value)
+/* read a word (anything up to a blank) on the current directive line */
+static void directive_word(struct tokenizer *tk, struct token *tok,
+			   int ident)
 {
-	regex_t r;
-	int ret;
-	const char *str;
+	while (tokenizer_peek(tk, 0) == ' ' || tokenizer_peek(tk, 0) == '\t')
+		tokenizer_advance(tk, 1);
 
-	ret = regcomp(&r, DEFINE_PATTERN, REG_EXTENDED);
-	if (ret < 0)
-		goto out;
+	tok->type = TOKEN_IDENT;
+	tok->str = tk->pos;
+	tok->line = tk->line;
+	tok->column = tk->column;
+
+	while (tk->pos < tk->end) {
+		int c = tokenizer_peek(tk, 0);
+
+		if (ident ? !is_ident_char(c) : isspace(c))
+			break;
+		tokenizer_advance(tk, 1);
+	}
 
-	str = buffer;
+	tok->len = tk->pos - tok->str;
+}
 
-	while (strlen(str)) {
-		regmatch_t m[3];
-		char *symbol_str, *value_str = NULL;
+/* the only defines we care about are the magic and version symbols */
+static int parse_define(struct tokenizer *tk, const struct token *name,
+			const struct token *value)
+{
+	int *result;
+	const char *symbol;
+	char *value_str;
+	size_t i;
+
+	if (token_is(name, DEFAULT_MAGIC_SYMBOL)) {
+		symbol = DEFAULT_MAGIC_SYMBOL;
+		result = &magic;
+	} else if (token_is(name, DEFAULT_VERSION_SYMBOL)) {
+		symbol = DEFAULT_VERSION_SYMBOL;
+		result = &version;
+	} else {
+		return 0;
+	}
 
-		if (regexec(&r, str, 3, m, 0))
+	/* we only match hex WL12XX and WL18XX magic/version values */
+	for (i = 2; i < value->len; i++)
+		if (!isxdigit((unsigned char) value->str[i]))
 			break;
 
-		symbol_str =
-			strndup(str + m[1].rm_so, m[1].rm_eo - m[1].rm_so);
+	if (value->len < 3 || value->str[0] != '0' ||
+	    (value->str[1] != 'x' && value->str[1] != 'X') || i != value->len) {
+		header_error(tk, value->line, value->column,
+			     "expected a hex value for %s", symbol);
+		return -1;
+	}
+
+	if (*result != 0) {
+		header_error(tk, name->line, name->column,
+			     "symbol %s redefined", symbol);
+		return -1;
+	}
+
+	value_str = strndup(value->str, value->len);
+	if (!value_str)
+		return -1;
 
-		value_str = strndup(str + m[2].rm_so, m[2].rm_eo - m[2].rm_so);
+	*result = strtol(value_str, NULL, 0);
+	printf("symbol %s found %s (%08x)\n", symbol, value_str, *result);
+	free(value_str);
 
-		if (!strcmp(symbol, symbol_str)) {
-			if (*value == 0) {
-				*value = strtol(value_str, NULL, 0);
-				printf("symbol %s found %s (%08x)\n",
-				       symbol, value_str, *value);
-			} else {
-				fprintf(stderr, "symbol %s redefined\n",
-					symbol_str);
-				ret = -1;
-			}
+	return 0;
+}
+
+/*
+ * Handle a preprocessor line, the '#' is at the current position.  Only
+ * #define is looked at, everything else is skipped up to the end of the
+ * (possibly continued) line.
+ */
+static int parse_directive(struct tokenizer *tk)
+{
+	struct token directive, name, value;
+
+	tokenizer_advance(tk, 1);
+	directive_word(tk, &directive, 1);
+
+	if (token_is(&directive, "define")) {
+		directive_word(tk, &name, 1);
+		directive_word(tk, &value, 0);
+
+		if (!name.len) {
+			header_error(tk, name.line, name.column,
+				     "expected a symbol after #define");
+			return -1;
 		}
 
-		free(symbol_str);
-		symbol_str = NULL;
-		free(value_str);
-		value_str = NULL;
+		if (parse_define(tk, &name, &value) < 0)
+			return -1;
+	}
+
+	while (tk->pos < tk->end && *tk->pos != '\n') {
+		int ret;
 
-		str += m[2].rm_eo;
-	};
+		if (tokenizer_peek(tk, 0) == '\\' &&
+		    tokenizer_peek(tk, 1) == '\n') {
+			tokenizer_advance(tk, 2);
+			continue;
+		}
 
-out:
-	regfree(&r);
-	return ret;
+		ret = skip_comment(tk);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			tokenizer_advance(tk, 1);
+	}
+
+	return 0;
 }
 
-static int parse_elements(char *orig_str, struct element **elements,
-			  size_t *size)
+static int next_token(struct tokenizer *tk, struct token *tok)
 {
-	regex_t r;
-	int ret, n_elements = 0;
-	char *str, *clean_str;
+	int c, ret;
 
-	*size = 0;
+	while (tk->pos < tk->end) {
+		c = tokenizer_peek(tk, 0);
 
-	ret = regcomp(&r, ELEMENT_PATTERN, REG_EXTENDED);
-	if (ret < 0)
-		goto out;
+		if (isspace(c)) {
+			tokenizer_advance(tk, 1);
+			continue;
+		}
 
-	clean_str = remove_comments(orig_str);
-	if (!clean_str)
-		goto out;
+		ret = skip_comment(tk);
+		if (ret < 0)
+			return ret;
+		if (ret)
+			continue;
+
+		if (c == '#' && tk->line_start) {
+			ret = parse_directive(tk);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		break;
+	}
+
+	tok->str = tk->pos;
+	tok->line = tk->line;
+	tok->column = tk->column;
+	tk->line_start = 0;
+
+	if (tk->pos >= tk->end) {
+		tok->type = TOKEN_EOF;
+		tok->len = 0;
+		return 0;
+	}
+
+	c = tokenizer_peek(tk, 0);
+	if (is_ident_char(c)) {
+		tok->type = isdigit(c) ? TOKEN_NUMBER : TOKEN_IDENT;
+		while (is_ident_char(tokenizer_peek(tk, 0)))
+			tokenizer_advance(tk, 1);
+	} else {
+		tok->type = TOKEN_PUNCT;
+		tokenizer_advance(tk, 1);
+	}
+
+	tok->len = tk->pos - tok->str;
+
+	return 0;
+}
+
+static void token_error(const struct tokenizer *tk, const struct token *tok,
+			const char *expected)
+{
+	if (tok->type == TOKEN_EOF)
+		header_error(tk, tok->line, tok->column,
+			     "expected %s, got end of file", expected);
+	else
+		header_error(tk, tok->line, tok->column,
+			     "expected %s, got '%.*s'", expected,
+			     (int) tok->len, tok->str);
+}
 
-	*elements = NULL;
+static int expect_token(struct tokenizer *tk, struct token *tok,
+			enum token_type type, const char *str,
+			const char *expected)
+{
+	if (next_token(tk, tok) < 0)
+		return -1;
+
+	if (tok->type != type || (str && !token_is(tok, str))) {
+		token_error(tk, tok, expected);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* look up an element type, "struct" has already been consumed if needed */
+static int token_type_index(const struct tokenizer *tk,
+			    const struct token *tok)
+{
+	int type = -1;
+
+	if (get_type_tab())
+		type = symtab_find(type_tab, tok->str, tok->len);
+
+	if (type < 0)
+		header_error(tk, tok->line, tok->column,
+			     "unknown type '%.*s'", (int) tok->len, tok->str);
+
+	return type;
+}
+
+static size_t type_size(int type)
+{
+	if (type < STRUCT_BASE)
+		return types[type].size;
 
-	str = clean_str;
+	return structures[type - STRUCT_BASE].size;
+}
+
+/* parse "[struct] type name[size];" lines up to the closing brace */
+static int parse_elements(struct tokenizer *tk, struct structure *structure)
+{
+	struct token tok, name;
+	struct element *element;
+	int type;
 
-	while (strlen(str)) {
-		regmatch_t m[6];
-		char *type_str, *array_size_str = NULL;
-		struct element *curr_element;
+	structure->elements = NULL;
+	structure->n_elements = 0;
+	structure->size = 0;
 
-		if (regexec(&r, str, 6, m, 0))
+	while (1) {
+		if (next_token(tk, &tok) < 0)
+			return -1;
+
+		if (tok.type == TOKEN_PUNCT && token_is(&tok, "}"))
 			break;
 
-		*elements = realloc(*elements,
-				    ++n_elements * sizeof(**elements));
-		if (!elements) {
-			ret = -1;
-			goto out_free;
+		if (tok.type == TOKEN_IDENT && token_is(&tok, "struct") &&
+		    expect_token(tk, &tok, TOKEN_IDENT, NULL, "a struct name") < 0)
+			return -1;
+
+		if (tok.type != TOKEN_IDENT) {
+			token_error(tk, &tok, "an element type or '}'");
+			return -1;
 		}
 
-		curr_element = &(*elements)[n_elements - 1];
+		type = token_type_index(tk, &tok);
+		if (type < 0)
+			return -1;
 
-		curr_element->name =
-			strndup(str + m[2].rm_so, m[2].rm_eo - m[2].rm_so);
+		if (expect_token(tk, &name, TOKEN_IDENT, NULL,
+				 "an element name") < 0)
+			return -1;
 
-		curr_element->position = *size;
+		element = realloc(structure->elements,
+				  (structure->n_elements + 1) * sizeof(*element));
+		if (!element) {
+			fprintf(stderr, "couldn't allocate memory\n");
+			return -1;
+		}
+		structure->elements = element;
 
-		if (m[4].rm_so == m[4].rm_eo) {
-			curr_element->array_size = 1;
-		} else {
-			array_size_str =
-				strndup(str + m[4].rm_so, m[4].rm_eo - m[4].rm_so);
-			curr_element->array_size = strtol(array_size_str, NULL, 0);
+		element = &structure->elements[structure->n_elements++];
+		element->name = strndup(name.str, name.len);
+		if (!element->name) {
+			fprintf(stderr, "couldn't allocate memory\n");
+			return -1;
+		}
+
+		element->type = type;
+		element->array_size = 1;
+		element->value = NULL;
+		element->position = structure->size;
+
+		if (next_token(tk, &tok) < 0)
+			return -1;
+
+		if (tok.type == TOKEN_PUNCT && token_is(&tok, "[")) {
+			char *end;
+
+			if (expect_token(tk, &tok, TOKEN_NUMBER, NULL,
+					 "an array size") < 0)
+				return -1;
+
+			element->array_size = strtol(tok.str, &end, 0);
+			if (end != tok.str + tok.len || element->array_size <= 0) {
+				header_error(tk, tok.line, tok.column,
+					     "invalid array size '%.*s'",
+					     (int) tok.len, tok.str);
+				return -1;
+			}
+
+			if (expect_token(tk, &tok, TOKEN_PUNCT, "]", "']'") < 0 ||
+			    next_token(tk, &tok) < 0)
+				return -1;
+		}
+
+		if (tok.type != TOKEN_PUNCT || !token_is(&tok, ";")) {
+			token_error(tk, &tok, "';'");
+			return -1;
 		}
 
-		type_str = strndup(str + m[1].rm_so, m[1].rm_eo - m[1].rm_so);
-		curr_element->type = get_type(type_str);
-		if (curr_element->type == -1)
-			fprintf(stderr, "Error! Unknown type '%s'\n", type_str);
+		structure->size += element->array_size * type_size(type);
+	}
+
+	return structure->n_elements;
+}
 
-		if (curr_element->type < STRUCT_BASE)
-			*size += curr_element->array_size *
-				types[curr_element->type].size;
-		else {
-			struct structure *structure =
-				get_struct(type_str);
+/* skip a declaration we don't care about (enums, prototypes...) */
+static int skip_declaration(struct tokenizer *tk, struct token *tok)
+{
+	unsigned int line = tok->line, column = tok->column;
+	int depth = 0;
 
-			*size += curr_element->array_size *
-				structure->size;
+	while (1) {
+		if (tok->type == TOKEN_EOF) {
+			if (depth)
+				header_error(tk, line, column,
+					     "unterminated declaration");
+			return depth ? -1 : 0;
 		}
 
-		free(type_str);
-		free(array_size_str);
+		if (tok->type == TOKEN_PUNCT) {
+			if (token_is(tok, "{")) {
+				depth++;
+			} else if (token_is(tok, "}")) {
+				if (!depth) {
+					token_error(tk, tok, "a declaration");
+					return -1;
+				}
+				depth--;
+			} else if (token_is(tok, ";") && !depth) {
+				return 0;
+			}
+		}
 
-		str += m[2].rm_eo;
+		if (next_token(tk, tok) < 0)
+			return -1;
 	}
+}
+
+/* "typedef [struct] type name;" makes name an alias of a known type */
+static int parse_typedef(struct tokenizer *tk)
+{
+	struct token type_tok, name, tok;
+	int type;
 
-	ret = n_elements;
+	if (next_token(tk, &type_tok) < 0)
+		return -1;
 
-out_free:
-	free(clean_str);
-	regfree(&r);
-out:
-	return ret;
+	if (type_tok.type == TOKEN_IDENT && token_is(&type_tok, "struct") &&
+	    next_token(tk, &type_tok) < 0)
+		return -1;
+
+	if (type_tok.type != TOKEN_IDENT)
+		return skip_declaration(tk, &type_tok);
+
+	if (next_token(tk, &name) < 0)
+		return -1;
+
+	if (name.type != TOKEN_IDENT)
+		return skip_declaration(tk, &name);
+
+	if (next_token(tk, &tok) < 0)
+		return -1;
+
+	/* anything fancier (enums, pointers, inline structs) is ignored */
+	if (tok.type != TOKEN_PUNCT || !token_is(&tok, ";"))
+		return skip_declaration(tk, &tok);
+
+	if (!get_type_tab())
+		return -1;
+
+	type = symtab_find(type_tab, type_tok.str, type_tok.len);
+	if (type < 0)
+		return 0;
+
+	return symtab_add(type_tab, name.str, name.len, type);
 }
 
 static void print_usage(char *executable)
@@ -289,16 +653,24 @@ static void print_usage(char *executable)
 	       "\t-i, --input-config\tlocation of the input binary configuration file\n"
 	       "\t-o, --output-config\tlocation of the input binary configuration file\n"
 	       "\t-X, --ignore-checksum\tignore file checksum error detection\n"
+	       "\t-T, --timing\t\treport how long parsing the header and text files took\n"
 	       "\n\tCOMMANDS\n"
 	       "\t-D, --create-default\tcreate default configuration bin file (%s)\n"
 	       "\t-g, --get\t\tget the value of the specified element (element[.element...]) or\n"
 	       "\t\t\t\tprint the entire tree if no element is specified\n"
-	       "\t-s, --set\t\tset the value of the specified element (element[.element...])\n"
+	       "\t-s, --set\t\tset the value of the specified element (element[.element...][[index]])\n"
+	       "\t\t\t\tto a value or, for a whole array, a comma separated list\n"
 	       "\t-G, --generate-struct\tgenerate the binary structure file from\n"
 	       "\t\t\t\tthe specified source file\n"
 	       "\t-C, --parse-text-conf\tparse the specified text config and set the values accordingly\n"
 	       "\t-I, --parse-ini\t\tparse the specified INI file and set the values accordingly\n"
 	       "\t\t\t\tin the output binary configuration file\n"
+	       "\t-B, --batch\t\tapply the get/set operations listed in the specified file\n"
+	       "\t\t\t\t(- for stdin), updating the checksum once at the end\n"
+	       "\t-d, --diff\t\tprint the elements that differ between the input and the\n"
+	       "\t\t\t\tspecified binary, as a text config with the values of the latter\n"
+	       "\t-m, --merge\t\tmerge the changes between <base>,<theirs> binaries into the input\n"
+	       "\t\t\t\tand write the output binary configuration file\n"
 	       "\t-p, --print-struct\tprint out the structure\n"
 	       "\t-h, --help\t\tprint this help\n"
 	       "\n",
@@ -310,10 +682,15 @@ static void free_structs(void)
 {
 	int i;
 
-	for (i = 0; i < n_structs; i++)
+	for (i = 0; i < n_structs; i++) {
 		free(structures[i].elements);
+		symtab_free(structures[i].element_tab);
+	}
 
 	free(structures);
+
+	symtab_free(type_tab);
+	type_tab = NULL;
 }
 
 static void free_dict(void)
@@ -326,63 +703,109 @@ static void free_dict(void)
 	}
 
 	free(dict);
+
+	symtab_free(dict_tab);
+	dict_tab = NULL;
 }
 
-static int parse_header(const char *buffer)
+static int parse_header(const char *filename, const char *buffer,
+			size_t size)
 {
-	regex_t r;
-	const char *str;
+	struct tokenizer tk;
+	struct token tok, name;
+	struct timespec start;
 	int ret;
 
-	ret = parse_define(buffer, DEFAULT_MAGIC_SYMBOL, &magic);
-	if (ret < 0)
-		goto out;
+	timing_start(&start);
 
-	ret = parse_define(buffer, DEFAULT_VERSION_SYMBOL, &version);
-	if (ret < 0)
-		goto out;
+	tk.filename = filename;
+	tk.pos = buffer;
+	tk.end = buffer + size;
+	tk.line = 1;
+	tk.column = 1;
+	tk.line_start = 1;
 
-	ret = regcomp(&r, STRUCT_PATTERN, REG_EXTENDED);
-	if (ret < 0)
-		goto out;
+	while (1) {
+		struct structure *curr_struct;
 
-	str = buffer;
+		ret = next_token(&tk, &tok);
+		if (ret < 0 || tok.type == TOKEN_EOF)
+			break;
 
-	while (strlen(str)) {
-		char *elements_str;
-		struct structure *curr_struct;
-		regmatch_t m[4];
+		if (tok.type == TOKEN_IDENT && token_is(&tok, "typedef")) {
+			ret = parse_typedef(&tk);
+			if (ret < 0)
+				break;
+			continue;
+		}
+
+		if (tok.type != TOKEN_IDENT || !token_is(&tok, "struct")) {
+			ret = skip_declaration(&tk, &tok);
+			if (ret < 0)
+				break;
+			continue;
+		}
 
-		if (regexec(&r, str, 4, m, 0))
+		ret = expect_token(&tk, &name, TOKEN_IDENT, NULL,
+				   "a struct name");
+		if (ret < 0)
+			break;
+
+		ret = next_token(&tk, &tok);
+		if (ret < 0)
 			break;
 
+		/* only definitions are interesting */
+		if (tok.type != TOKEN_PUNCT || !token_is(&tok, "{")) {
+			ret = skip_declaration(&tk, &tok);
+			if (ret < 0)
+				break;
+			continue;
+		}
+
 		structures = realloc(structures, ++n_structs *
 				     sizeof(struct structure));
 		if (!structures) {
 			ret = -1;
-			goto out_free;
+			break;
 		}
 
 		curr_struct = &structures[n_structs - 1];
+		curr_struct->element_tab = NULL;
+
+		curr_struct->name = strndup(name.str, name.len);
 
-		curr_struct->name =
-			strndup(str + m[1].rm_so, m[1].rm_eo - m[1].rm_so);
+		ret = parse_elements(&tk, curr_struct);
+		if (ret < 0)
+			break;
 
-		elements_str = strndup(str + m[2].rm_so, m[2].rm_eo - m[2].rm_so);
+		ret = add_struct_elements(curr_struct);
+		if (ret < 0)
+			break;
 
-		ret = parse_elements(elements_str, &curr_struct->elements,
-				     &curr_struct->size);
+		ret = add_struct_type(n_structs - 1);
 		if (ret < 0)
 			break;
 
-		curr_struct->n_elements = ret;
+		/* attributes (__packed) up to the closing ';' */
+		do {
+			ret = next_token(&tk, &tok);
+			if (ret < 0)
+				break;
+		} while (tok.type == TOKEN_IDENT);
+
+		if (ret < 0)
+			break;
 
-		str += m[2].rm_eo;
+		if (tok.type != TOKEN_PUNCT || !token_is(&tok, ";")) {
+			token_error(&tk, &tok, "';'");
+			ret = -1;
+			break;
+		}
 	}
 
-out_free:
-	regfree(&r);
-out:
+	timing_report("header", filename, &start);
+
 	return ret;
 }
 
@@ -557,7 +980,7 @@ static void free_file(void *buffer)
 static int write_file(const char *filename, const void *buffer, size_t size)
 {
 	FILE *file;
-	int ret;
+	int ret = 0;
 
 	file = fopen(filename, "w");
 	if (!file) {
@@ -585,50 +1008,244 @@ static int get_element_pos(struct structure *structure, const char *argument,
 	int i, pos = 0;
 	struct structure *curr_struct = structure;
 	struct element *curr_element = NULL;
-	char *str, *arg = strdup(argument);
+	const char *str = argument, *end;
+	size_t len;
 
-	str = strtok(arg, ".");
+	while (*str) {
+		/* empty path components are skipped, as strtok did */
+		if (*str == '.') {
+			str++;
+			continue;
+		}
 
-	while(str) {
+		end = strchr(str, '.');
+		len = end ? (size_t) (end - str) : strlen(str);
 
-		for (i = 0; i < curr_struct->n_elements; i++)
-			if (!strcmp(str, curr_struct->elements[i].name)) {
-				curr_element = &curr_struct->elements[i];
-				pos += curr_element->position;
-				break;
+		if (curr_element) {
+			if (curr_element->type < STRUCT_BASE) {
+				fprintf(stderr, "element %s is not a struct\n",
+					curr_element->name);
+				pos = -1;
+				goto out;
 			}
 
-		if (i == curr_struct->n_elements) {
-			pos = -1;
-			goto out;
+			curr_struct =
+				&structures[curr_element->type - STRUCT_BASE];
 		}
 
-		str = strtok(NULL, ".");
-		if (str && curr_element->type < STRUCT_BASE) {
-			fprintf(stderr, "element %s is not a struct\n",
-				curr_element->name);
+		i = symtab_find(curr_struct->element_tab, str, len);
+		if (i < 0) {
 			pos = -1;
 			goto out;
 		}
 
-		if (str)
-			curr_struct =
-				&structures[curr_element->type - STRUCT_BASE];
+		curr_element = &curr_struct->elements[i];
+		pos += curr_element->position;
+
+		str += len;
 	}
 
+	if (!curr_element)
+		pos = -1;
+
 out:
 	*element = curr_element;
-	free(arg);
 	return pos;
 }
 
-static void get_value(void *buffer, struct structure *structure,
-		      char *argument)
+/*
+ * Strip a trailing "[<index>]" from element_str.  index is set to -1 if
+ * there's none.
+ */
+static int parse_index(char *element_str, int *index)
 {
-	int pos;
-	struct element *element, *root_element = NULL;
+	char *open, *end;
+
+	*index = -1;
+
+	open = strchr(element_str, '[');
+	if (!open)
+		return 0;
+
+	*index = strtol(open + 1, &end, 0);
+	if (end == open + 1 || *end != ']' || end[1] != '\0' || *index < 0) {
+		fprintf(stderr, "invalid array index in %s\n", element_str);
+		return -1;
+	}
+
+	*open = '\0';
+
+	return 0;
+}
+
+/* parse a comma separated list of up to max values */
+static int parse_values(char *value_str, uint32_t *values, int max)
+{
+	char *str, *end;
+	int n = 0;
+
+	str = strtok(value_str, ",");
+	while (str) {
+		if (n == max)
+			return max + 1;
+
+		values[n] = strtoul(str, &end, 0);
+		while (*end == ' ' || *end == '\t')
+			end++;
+		if (end == str || *end != '\0') {
+			fprintf(stderr, "invalid value '%s'\n", str);
+			return -1;
+		}
+
+		n++;
+		str = strtok(NULL, ",");
+	}
+
+	return n;
+}
+
+/*
+ * Resolve "<element>[.<element>...][[index]]" and, for sets, the value
+ * list into op.  element_str is modified.  Nothing is touched in the
+ * configuration buffer, so a whole batch can be checked before applying.
+ */
+static int compile_op(struct structure *structure, char *element_str,
+		      char *value_str, struct element_op *op)
+{
+	int pos, n, expected;
+
+	op->set = value_str != NULL;
+	op->element_str = element_str;
+	op->values = NULL;
+	op->n_values = 0;
+
+	if (parse_index(element_str, &op->index) < 0)
+		return -1;
+
+	pos = get_element_pos(structure, element_str, &op->element);
+	if (pos < 0) {
+		fprintf(stderr, "couldn't find %s\n", element_str);
+		return -1;
+	}
+	op->position = pos;
+
+	if (op->index >= 0) {
+		if (op->element->type >= STRUCT_BASE) {
+			fprintf(stderr,
+				"indexing arrays of structures is not supported.\n");
+			return -1;
+		}
+
+		if (op->index >= op->element->array_size) {
+			fprintf(stderr, "index %d out of range, %s has %d entries\n",
+				op->index, element_str, op->element->array_size);
+			return -1;
+		}
+
+		op->position += op->index * types[op->element->type].size;
+	}
+
+	if (!op->set)
+		return 0;
+
+	if (op->element->type >= STRUCT_BASE) {
+		fprintf(stderr,
+			"setting entire structures is not supported.\n");
+		return -1;
+	}
+
+	expected = op->index >= 0 ? 1 : op->element->array_size;
+
+	op->values = malloc(expected * sizeof(*op->values));
+	if (!op->values) {
+		fprintf(stderr, "couldn't allocate memory\n");
+		return -1;
+	}
+
+	n = parse_values(value_str, op->values, expected);
+	if (n < 0)
+		goto out_free;
+
+	if (n != expected) {
+		fprintf(stderr, "invalid array size, expected %d got %d\n",
+			expected, n);
+		goto out_free;
+	}
+
+	op->n_values = n;
+
+	return 0;
+
+out_free:
+	free(op->values);
+	op->values = NULL;
+	return -1;
+}
+
+static void apply_op(void *buffer, struct element_op *op)
+{
+	char *pos = ((char *)buffer) + op->position;
+	struct element single;
+	int i;
+
+	if (op->set) {
+		for (i = 0; i < op->n_values; i++) {
+			set_data(op->element, pos, &op->values[i]);
+			pos += types[op->element->type].size;
+		}
+		return;
+	}
+
+	if (op->index < 0) {
+		char *parent = strdup(op->element_str), *elim;
+
+		if (!parent) {
+			fprintf(stderr, "couldn't allocate memory\n");
+			return;
+		}
+
+		/* printed with the parent path as prefix, like --get does */
+		elim = strrchr(parent, '.');
+		if (elim)
+			*elim = '\0';
+
+		print_element(op->element, elim ? parent : NULL, pos);
+		free(parent);
+		return;
+	}
+
+	/* a single array entry is printed like an element of its own */
+	single = *op->element;
+	single.array_size = 1;
+
+	printf("%s[%d] = ", op->element_str, op->index);
+	print_data(&single, pos);
+}
+
+static void free_op(struct element_op *op)
+{
+	free(op->values);
+	op->values = NULL;
+}
+
+static void get_value(void *buffer, struct structure *structure,
+		      char *argument)
+{
+	int pos;
+	struct element *element, *root_element = NULL;
+	struct element_op op;
 	char *elim;
 
+	if (argument && strchr(argument, '[')) {
+		if (compile_op(structure, argument, NULL, &op) < 0)
+			return;
+
+		if (op.index >= 0 && buffer) {
+			apply_op(buffer, &op);
+			return;
+		}
+	}
+
 	if (argument) {
 		pos = get_element_pos(structure, argument, &element);
 		if (pos < 0) {
@@ -664,15 +1281,14 @@ static void get_value(void *buffer, struct structure *structure,
 static int set_value(void *buffer, struct structure *structure,
 		     char *argument)
 {
-	int pos, ret = 0;
+	int ret = 0;
 	char *split_point, *element_str, *value_str;
-	struct element *element;
-	uint32_t value;
+	struct element_op op;
 
 	split_point = strchr(argument, '=');
 	if (!split_point) {
 		fprintf(stderr,
-			"--set requires the format <element>[.<element>...]=<value>\n");
+			"--set requires the format <element>[.<element>...][[index]]=<value>[,<value>...]\n");
 		ret = -1;
 		goto out;
 	}
@@ -681,28 +1297,12 @@ static int set_value(void *buffer, struct structure *structure,
 	element_str = argument;
 	value_str = split_point + 1;
 
-	pos = get_element_pos(structure, element_str, &element);
-	if (pos < 0) {
-		fprintf(stderr, "couldn't find %s\n", element_str);
-		ret = -1;
-		goto out;
-	}
-
-	if (element->array_size > 1) {
-		fprintf(stderr, "setting arrays not supported yet\n");
-		ret = -1;
-		goto out;
-	}
-
-	if (element->type >= STRUCT_BASE) {
-		fprintf(stderr,
-			"setting entire structures is not supported.\n");
-		ret = -1;
+	ret = compile_op(structure, element_str, value_str, &op);
+	if (ret < 0)
 		goto out;
-	}
 
-	value = strtoul(value_str, NULL, 0);
-	ret = set_data(element, ((char *)buffer) + pos, &value);
+	apply_op(buffer, &op);
+	free_op(&op);
 
 out:
 	return ret;
@@ -791,196 +1391,742 @@ static int read_element(FILE *file, struct element *element)
 	READ_INT32(element->array_size, (int), file);
 	READ_INT32(element->position, (size_t), file);
 
-out:
-	return ret;
+out:
+	return ret;
+}
+
+static int read_struct(FILE *file, struct structure *structure)
+{
+	size_t name_len;
+	int i, ret = 0;
+
+	READ_INT32(name_len, (size_t), file);
+
+	structure->name = malloc(name_len + 1);
+	if (!structure->name) {
+		fprintf(stderr, "Couldn't allocate enough memory (%d)\n",
+			name_len);
+		ret = -1;
+		goto out;
+	}
+
+	fread(structure->name, 1, name_len, file);
+	structure->name[name_len] = '\0';
+
+	READ_INT32(structure->n_elements, (int), file);
+	READ_INT32(structure->size, (size_t), file);
+
+	structure->elements = malloc(structure->n_elements *
+				     sizeof(struct element));
+	if (!structure->elements) {
+		fprintf(stderr, "Couldn't allocate enough memory (%d)\n",
+			structure->n_elements * sizeof(struct element));
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < structure->n_elements; i++) {
+		ret = read_element(file, &structure->elements[i]);
+		if (ret < 0)
+			goto out;
+	}
+
+	ret = add_struct_elements(structure);
+
+out:
+	return ret;
+}
+
+static int read_binary_struct(const char *filename)
+{
+	FILE *file;
+	int i, ret = 0;
+
+	file = fopen(filename, "r");
+	if (!file) {
+		fprintf(stderr, "Couldn't open file '%s' for reading\n",
+			filename);
+		ret = -1;
+		goto out;
+	}
+
+	READ_INT32(magic, (int), file);
+	READ_INT32(version, (int), file);
+	READ_INT32(struct_chksum, (int), file);
+	READ_INT32(n_structs, (int), file);
+
+	structures = calloc(n_structs, sizeof(struct structure));
+	if (!structures) {
+		fprintf(stderr, "Couldn't allocate enough memory (%d)\n",
+			n_structs * sizeof(struct structure));
+		ret = -1;
+		goto out_close;
+	}
+
+	for (i = 0; i < n_structs; i++) {
+		ret = read_struct(file, &structures[i]);
+		if (ret < 0)
+			break;
+
+		ret = add_struct_type(i);
+		if (ret < 0)
+			break;
+	}
+
+out_close:
+	fclose(file);
+out:
+	return ret;
+}
+static int get_value_int(void *buffer, struct structure *structure,
+			 int *value, char *element_str)
+{
+	int pos, ret = 0;
+	struct element *element;
+
+	pos = get_element_pos(structure, element_str, &element);
+	if (pos < 0) {
+		fprintf(stderr, "couldn't find %s\n", element_str);
+		ret = pos;
+		goto out;
+	}
+
+	if ((element->type != get_type("u32")) &&
+	    (element->type != get_type("__le32"))) {
+		fprintf(stderr,
+			"element %s has invalid type (expected u32 or le32)\n",
+			element_str);
+		ret = -1;
+		goto out;
+	}
+
+	*value = *(int *) (((char *)buffer) + pos);
+
+out:
+	return ret;
+}
+
+static int set_value_int(void *buffer, struct structure *structure,
+			 int value, char *element_str)
+{
+	int pos, ret = 0;
+	struct element *element;
+
+	pos = get_element_pos(structure, element_str, &element);
+	if (pos < 0) {
+		fprintf(stderr, "couldn't find %s\n", element_str);
+		ret = pos;
+		goto out;
+	}
+
+	if ((element->type != get_type("u32")) &&
+	    (element->type != get_type("__le32"))) {
+		fprintf(stderr,
+			"element %s has invalid type (expected u32 or le32)\n",
+			element_str);
+		ret = -1;
+		goto out;
+	}
+
+	*(int *) (((char *)buffer) + pos) = value;
+
+out:
+	return ret;
+}
+
+/*
+ * Validate the magic, version and checksum of a configuration buffer.  On
+ * success the checksum element is left zeroed, ready for recalculation.
+ */
+static int check_input(void *buffer, struct structure *structure)
+{
+	int ret;
+	int input_magic, input_version, input_checksum;
+
+	ret = get_value_int(buffer, structure, &input_magic,
+			    DEFAULT_MAGIC_ELEMENT);
+	if (ret < 0)
+		goto out;
+
+	ret = get_value_int(buffer, structure, &input_version,
+			    DEFAULT_VERSION_ELEMENT);
+	if (ret < 0)
+		goto out;
+
+	ret = get_value_int(buffer, structure, &input_checksum,
+			    DEFAULT_CHKSUM_ELEMENT);
+	if (ret < 0)
+		goto out;
+
+	/* after reading the checksum, set it to 0 for checksum calculation */
+	ret = set_value_int(buffer, structure, 0, DEFAULT_CHKSUM_ELEMENT);
+	if (ret < 0)
+		goto out;
+
+	checksum = calc_crc32(buffer, structure->size);
+
+	if ((magic != input_magic) ||
+	    (version != input_version)) {
+		fprintf(stderr, "incompatible binary file\n"
+			"expected 0x%08x 0x%08x\n"
+			"got 0x%08x 0x%08x\n",
+			magic, version, input_magic, input_version);
+		ret = -1;
+		goto out_restore;
+	}
+
+	if (!ignore_checksum && (checksum != input_checksum)) {
+		fprintf(stderr, "corrupted binary file\n"
+			"expected checksum 0x%08x got 0x%08x\n",
+			checksum, input_checksum);
+		ret = -1;
+		goto out_restore;
+	}
+
+	return 0;
+
+out_restore:
+	/* the buffer may be a shared mapping, don't leave it modified */
+	set_value_int(buffer, structure, input_checksum,
+		      DEFAULT_CHKSUM_ELEMENT);
+out:
+	return ret;
+}
+
+static int read_input(const char *filename, void **buffer,
+		      struct structure *structure)
+{
+	int ret;
+
+	ret = read_file(filename, buffer, structure->size);
+	if (ret < 0)
+		goto out;
+
+	ret = check_input(*buffer, structure);
+out:
+	return ret;
+}
+
+/*
+ * Map the first size bytes of filename.  If shared, changes go straight
+ * into the file, otherwise they stay private to this process.
+ */
+static int map_file(const char *filename, int shared, void **buffer,
+		    size_t size)
+{
+	struct stat st;
+	int fd, ret = 0;
+
+	fd = open(filename, shared ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Couldn't open file '%s'\n", filename);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < size) {
+		fprintf(stderr, "File '%s' is too small\n", filename);
+		ret = -1;
+		goto out;
+	}
+
+	*buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if (*buffer == MAP_FAILED) {
+		fprintf(stderr, "Couldn't map file '%s'\n", filename);
+		*buffer = NULL;
+		ret = -1;
+	}
+
+out:
+	close(fd);
+	return ret;
+}
+
+static int same_file(const char *filename1, const char *filename2)
+{
+	struct stat st1, st2;
+
+	if (stat(filename1, &st1) < 0 || stat(filename2, &st2) < 0)
+		return 0;
+
+	return st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+}
+
+static char *trim(char *str)
+{
+	char *end;
+
+	while (*str == ' ' || *str == '\t')
+		str++;
+
+	end = str + strlen(str);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' ||
+			     end[-1] == '\r'))
+		end--;
+	*end = '\0';
+
+	return str;
+}
+
+/*
+ * Read all operations from a batch file and resolve them against the
+ * struct definitions.  Nothing is applied if any of them fails.
+ */
+static int parse_batch(const char *filename, struct structure *structure,
+		       struct element_op **ops, int *n_ops, int *n_sets)
+{
+	FILE *file;
+	unsigned int parse_errors = 0, line_number = 0;
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	*ops = NULL;
+	*n_ops = 0;
+	*n_sets = 0;
+
+	if (!strcmp(filename, "-")) {
+		file = stdin;
+	} else {
+		file = fopen(filename, "r");
+		if (!file) {
+			fprintf(stderr, "Couldn't open file '%s'\n", filename);
+			return -1;
+		}
+	}
+
+	while (getline(&line, &len, file) >= 0) {
+		char *str, *arg, *element_str, *value_str = NULL, *elim;
+		struct element_op *op;
+
+		line_number++;
+
+		/* eliminate comments and newline */
+		elim = strchr(line, '#');
+		if (elim)
+			*elim = '\0';
+		elim = strchr(line, '\n');
+		if (elim)
+			*elim = '\0';
+
+		str = trim(line);
+		if (!strlen(str))
+			continue;
+
+		arg = str + strcspn(str, " \t");
+		if (*arg)
+			*arg++ = '\0';
+		arg = trim(arg);
+
+		if (!strcmp(str, "set")) {
+			elim = strchr(arg, '=');
+			if (!elim) {
+				fprintf(stderr,
+					"line %d: set requires <element>=<value>\n",
+					line_number);
+				parse_errors++;
+				continue;
+			}
+			*elim = '\0';
+			value_str = trim(elim + 1);
+			arg = trim(arg);
+		} else if (strcmp(str, "get")) {
+			fprintf(stderr, "line %d: unknown operation '%s'\n",
+				line_number, str);
+			parse_errors++;
+			continue;
+		}
+
+		element_str = strdup(arg);
+		if (!element_str) {
+			fprintf(stderr, "couldn't allocate memory\n");
+			ret = -1;
+			break;
+		}
+
+		op = realloc(*ops, (*n_ops + 1) * sizeof(**ops));
+		if (!op) {
+			fprintf(stderr, "couldn't allocate memory\n");
+			free(element_str);
+			ret = -1;
+			break;
+		}
+		*ops = op;
+		op = &(*ops)[*n_ops];
+
+		if (compile_op(structure, element_str, value_str, op) < 0) {
+			fprintf(stderr, "line %d: invalid operation\n",
+				line_number);
+			free(element_str);
+			parse_errors++;
+			continue;
+		}
+
+		op->line = line_number;
+		(*n_ops)++;
+		if (op->set)
+			(*n_sets)++;
+	}
+
+	free(line);
+
+	if (file != stdin)
+		fclose(file);
+
+	if (parse_errors) {
+		fprintf(stderr,
+			"%d errors found, output file was not generated.\n",
+			parse_errors);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Apply a batch of get/set operations.  The configuration is mapped
+ * instead of read; when the input is also the output, sets go straight
+ * into the file.  The checksum is only recalculated once, at the end.
+ */
+static int run_batch(const char *batch_filename, const char *input_filename,
+		     const char *output_filename, struct structure *structure)
+{
+	struct element_op *ops;
+	int i, n_ops, n_sets, in_place, ret;
+	void *buffer = NULL;
+
+	ret = parse_batch(batch_filename, structure, &ops, &n_ops, &n_sets);
+	if (ret < 0)
+		goto out_free;
+
+	in_place = n_sets && same_file(input_filename, output_filename);
+
+	ret = map_file(input_filename, in_place, &buffer, structure->size);
+	if (ret < 0)
+		goto out_free;
+
+	ret = check_input(buffer, structure);
+	if (ret < 0)
+		goto out_unmap;
+
+	for (i = 0; i < n_ops; i++)
+		apply_op(buffer, &ops[i]);
+
+	if (!n_sets)
+		goto out_unmap;
+
+	/* update the checksum for writing */
+	ret = set_value_int(buffer, structure,
+			    calc_crc32(buffer, structure->size),
+			    DEFAULT_CHKSUM_ELEMENT);
+	if (ret < 0)
+		goto out_unmap;
+
+	if (in_place)
+		ret = msync(buffer, structure->size, MS_SYNC);
+	else
+		ret = write_file(output_filename, buffer, structure->size);
+
+	if (ret < 0)
+		fprintf(stderr, "Failed to write file '%s'\n",
+			output_filename);
+
+out_unmap:
+	munmap(buffer, structure->size);
+out_free:
+	for (i = 0; i < n_ops; i++) {
+		free_op(&ops[i]);
+		free(ops[i].element_str);
+	}
+	free(ops);
+
+	return ret;
+}
+
+/*
+ * Structural comparison of configuration binaries.  The struct definitions
+ * are walked and each element's byte range is compared raw in all the
+ * buffers; whole structs that are identical are skipped without looking at
+ * their elements, so only the differences are ever decoded.
+ */
+typedef int (*diff_fn)(struct element *element, const char *path,
+		       char **buffers, size_t position, void *priv);
+
+static int ranges_differ(char **buffers, int n_buffers, size_t position,
+			 size_t len)
+{
+	int i;
+
+	for (i = 1; i < n_buffers; i++)
+		if (memcmp(buffers[0] + position, buffers[i] + position, len))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Whether the last buffer (the one whose changes are looked for) differs
+ * from all the others in the range, i.e. it holds a change nobody has.
+ */
+static int range_changed(char **buffers, int n_buffers, size_t position,
+			 size_t len)
+{
+	int i;
+
+	for (i = 0; i < n_buffers - 1; i++)
+		if (!memcmp(buffers[i] + position,
+			    buffers[n_buffers - 1] + position, len))
+			return 0;
+
+	return 1;
+}
+
+static size_t element_size(struct element *element)
+{
+	if (element->type < STRUCT_BASE)
+		return types[element->type].size;
+
+	return structures[element->type - STRUCT_BASE].size;
 }
 
-static int read_struct(FILE *file, struct structure *structure)
+static int diff_struct(struct structure *structure, char *prefix,
+		       size_t prefix_len, size_t position, char **buffers,
+		       int n_buffers, diff_fn fn, void *priv,
+		       int *n_unaddressable)
 {
-	size_t name_len;
+	struct element *element;
+	size_t len, elem_pos, size;
 	int i, ret = 0;
 
-	READ_INT32(name_len, (size_t), file);
+	for (i = 0; i < structure->n_elements; i++) {
+		element = &structure->elements[i];
+		elem_pos = position + element->position;
+		size = element_size(element);
+
+		if (!ranges_differ(buffers, n_buffers, elem_pos,
+				   size * element->array_size))
+			continue;
+
+		len = prefix_len + strlen(element->name) + (prefix_len ? 1 : 0);
+		if (len + 1 > MAX_ARRAY_STR_LEN) {
+			fprintf(stderr, "element path too long\n");
+			return -1;
+		}
 
-	structure->name = malloc(name_len + 1);
-	if (!structure->name) {
-		fprintf(stderr, "Couldn't allocate enough memory (%d)\n",
-			name_len);
-		ret = -1;
-		goto out;
-	}
+		sprintf(prefix + prefix_len, "%s%s", prefix_len ? "." : "",
+			element->name);
 
-	fread(structure->name, 1, name_len, file);
-	structure->name[name_len] = '\0';
+		/* the checksum always differs and is recalculated anyway */
+		if (!strcmp(prefix, DEFAULT_CHKSUM_ELEMENT))
+			continue;
 
-	READ_INT32(structure->n_elements, (int), file);
-	READ_INT32(structure->size, (size_t), file);
+		if (element->type < STRUCT_BASE) {
+			ret = fn(element, prefix, buffers, elem_pos, priv);
+		} else {
+			/*
+			 * Only the first struct of an array can be addressed,
+			 * the caller has to fail on changes beyond it.
+			 */
+			if (element->array_size > 1 &&
+			    range_changed(buffers, n_buffers, elem_pos + size,
+					  size * (element->array_size - 1))) {
+				fprintf(stderr,
+					"%s: changes beyond the first entry can't be expressed\n",
+					prefix);
+				(*n_unaddressable)++;
+			}
 
-	structure->elements = malloc(structure->n_elements *
-				     sizeof(struct element));
-	if (!structure->elements) {
-		fprintf(stderr, "Couldn't allocate enough memory (%d)\n",
-			structure->n_elements * sizeof(struct element));
-		ret = -1;
-		goto out;
-	}
+			ret = diff_struct(
+				&structures[element->type - STRUCT_BASE],
+				prefix, len, elem_pos, buffers, n_buffers,
+				fn, priv, n_unaddressable);
+		}
 
-	for (i = 0; i < structure->n_elements; i++) {
-		ret = read_element(file, &structure->elements[i]);
 		if (ret < 0)
 			break;
 	}
 
-out:
+	prefix[prefix_len] = '\0';
+
 	return ret;
 }
 
-static int read_binary_struct(const char *filename)
+static int walk_diff(struct structure *structure, char **buffers,
+		     int n_buffers, diff_fn fn, void *priv,
+		     int *n_unaddressable)
 {
-	FILE *file;
-	int i, ret = 0;
+	char *prefix;
+	int ret;
 
-	file = fopen(filename, "r");
-	if (!file) {
-		fprintf(stderr, "Couldn't open file '%s' for reading\n",
-			filename);
-		ret = -1;
-		goto out;
+	prefix = malloc(MAX_ARRAY_STR_LEN);
+	if (!prefix) {
+		fprintf(stderr, "couldn't allocate memory\n");
+		return -1;
 	}
+	prefix[0] = '\0';
 
-	READ_INT32(magic, (int), file);
-	READ_INT32(version, (int), file);
-	READ_INT32(struct_chksum, (int), file);
-	READ_INT32(n_structs, (int), file);
+	*n_unaddressable = 0;
+	ret = diff_struct(structure, prefix, 0, 0, buffers, n_buffers,
+			  fn, priv, n_unaddressable);
 
-	structures = malloc(n_structs * sizeof(struct structure));
-	if (!structures) {
-		fprintf(stderr, "Couldn't allocate enough memory (%d)\n",
-			n_structs * sizeof(struct structure));
-		ret = -1;
-		goto out_close;
-	}
+	free(prefix);
+	return ret;
+}
 
-	for (i = 0; i < n_structs; i++) {
-		ret = read_struct(file, &structures[i]);
-		if (ret < 0)
-			break;
-	}
+/* print the element as in the second buffer, in --parse-text-conf syntax */
+static int print_diff(struct element *element, const char *path,
+		      char **buffers, size_t position, void *priv)
+{
+	int *n_diffs = priv;
 
-out_close:
-	fclose(file);
-out:
-	return ret;
+	printf("%s = ", path);
+	print_data(element, buffers[1] + position);
+	(*n_diffs)++;
+
+	return 0;
 }
 
-static int get_value_int(void *buffer, struct structure *structure,
-			 int *value, char *element_str)
+static int diff_files(const char *filename, const char *other_filename,
+		      struct structure *structure)
 {
-	int pos, ret = 0;
-	struct element *element;
+	void *buffers[2] = { NULL, NULL };
+	int ret, n_diffs = 0, n_unaddressable;
 
-	pos = get_element_pos(structure, element_str, &element);
-	if (pos < 0) {
-		fprintf(stderr, "couldn't find %s\n", element_str);
-		ret = pos;
+	ret = read_input(filename, &buffers[0], structure);
+	if (ret < 0)
 		goto out;
-	}
 
-	if ((element->type != get_type("u32")) &&
-	    (element->type != get_type("__le32"))) {
-		fprintf(stderr,
-			"element %s has invalid type (expected u32 or le32)\n",
-			element_str);
-		ret = -1;
+	ret = read_input(other_filename, &buffers[1], structure);
+	if (ret < 0)
 		goto out;
-	}
 
-	*value = *(int *) (((char *)buffer) + pos);
+	printf("# changes from %s to %s\n", filename, other_filename);
+
+	ret = walk_diff(structure, (char **) buffers, 2, print_diff,
+			&n_diffs, &n_unaddressable);
+	if (ret < 0)
+		goto out;
+
+	printf("# %d elements differ\n", n_diffs);
 
+	if (n_unaddressable) {
+		fprintf(stderr, "%d arrays differ beyond the first entry, "
+			"the changes above are incomplete.\n",
+			n_unaddressable);
+		ret = -1;
+	}
 out:
+	free_file(buffers[0]);
+	free_file(buffers[1]);
 	return ret;
 }
 
-static int set_value_int(void *buffer, struct structure *structure,
-			 int value, char *element_str)
+struct merge_data {
+	char *output;
+	int n_changes;
+	int n_conflicts;
+};
+
+/*
+ * buffers are base, ours and theirs.  Each array entry is merged on its
+ * own: an entry changed only on one side takes that side's value, one
+ * changed differently on both sides is a conflict.
+ */
+static int merge_element(struct element *element, const char *path,
+			 char **buffers, size_t position, void *priv)
 {
-	int pos, ret = 0;
-	struct element *element;
+	struct merge_data *merge = priv;
+	size_t size = types[element->type].size;
+	char *base, *ours, *theirs;
+	int i;
 
-	pos = get_element_pos(structure, element_str, &element);
-	if (pos < 0) {
-		fprintf(stderr, "couldn't find %s\n", element_str);
-		ret = pos;
-		goto out;
-	}
+	for (i = 0; i < element->array_size; i++) {
+		base = buffers[0] + position + i * size;
+		ours = buffers[1] + position + i * size;
+		theirs = buffers[2] + position + i * size;
 
-	if ((element->type != get_type("u32")) &&
-	    (element->type != get_type("__le32"))) {
-		fprintf(stderr,
-			"element %s has invalid type (expected u32 or le32)\n",
-			element_str);
-		ret = -1;
-		goto out;
-	}
+		if (!memcmp(base, theirs, size) || !memcmp(ours, theirs, size))
+			continue;
 
-	*(int *) (((char *)buffer) + pos) = value;
+		if (!memcmp(base, ours, size)) {
+			memcpy(merge->output + position + i * size, theirs,
+			       size);
+			merge->n_changes++;
+			continue;
+		}
 
-out:
-	return ret;
+		fprintf(stderr, "conflict in %s[%d]\n", path, i);
+		merge->n_conflicts++;
+	}
+
+	return 0;
 }
 
-static int read_input(const char *filename, void **buffer,
-		      struct structure *structure)
+/*
+ * Three-way merge: apply the changes between base_filename and
+ * theirs_filename on top of filename and write the result.
+ */
+static int merge_files(const char *filename, const char *base_filename,
+		       const char *theirs_filename, const char *output_filename,
+		       struct structure *structure)
 {
-	int ret;
-	int input_magic, input_version, input_checksum;
+	void *buffers[3] = { NULL, NULL, NULL };
+	struct merge_data merge = { NULL, 0, 0 };
+	int ret, n_unaddressable;
 
-	ret = read_file(filename, buffer, structure->size);
+	ret = read_input(base_filename, &buffers[0], structure);
 	if (ret < 0)
 		goto out;
 
-	ret = get_value_int(*buffer, structure, &input_magic,
-			    DEFAULT_MAGIC_ELEMENT);
+	ret = read_input(filename, &buffers[1], structure);
 	if (ret < 0)
 		goto out;
 
-	ret = get_value_int(*buffer, structure, &input_version,
-			    DEFAULT_VERSION_ELEMENT);
+	ret = read_input(theirs_filename, &buffers[2], structure);
 	if (ret < 0)
 		goto out;
 
-	ret = get_value_int(*buffer, structure, &input_checksum,
-			    DEFAULT_CHKSUM_ELEMENT);
-	if (ret < 0)
+	merge.output = malloc(structure->size);
+	if (!merge.output) {
+		fprintf(stderr, "couldn't allocate memory\n");
+		ret = -1;
 		goto out;
+	}
+	memcpy(merge.output, buffers[1], structure->size);
 
-	/* after reading the checksum, set it to 0 for checksum calculation */
-	ret = set_value_int(*buffer, structure, 0, DEFAULT_CHKSUM_ELEMENT);
+	ret = walk_diff(structure, (char **) buffers, 3, merge_element,
+			&merge, &n_unaddressable);
 	if (ret < 0)
 		goto out;
 
-	checksum = calc_crc32(*buffer, structure->size);
+	/* their changes there would be silently dropped */
+	merge.n_conflicts += n_unaddressable;
 
-	if ((magic != input_magic) ||
-	    (version != input_version)) {
-		fprintf(stderr, "incompatible binary file\n"
-			"expected 0x%08x 0x%08x\n"
-			"got 0x%08x 0x%08x\n",
-			magic, version, input_magic, input_version);
+	if (merge.n_conflicts) {
+		fprintf(stderr,
+			"%d conflicts found, output file was not generated.\n",
+			merge.n_conflicts);
 		ret = -1;
 		goto out;
 	}
 
-	if (!ignore_checksum && (checksum != input_checksum)) {
-		fprintf(stderr, "corrupted binary file\n"
-			"expected checksum 0x%08x got 0x%08x\n",
-			checksum, input_checksum);
-		ret = -1;
+	/* update the checksum for writing */
+	ret = set_value_int(merge.output, structure,
+			    calc_crc32(merge.output, structure->size),
+			    DEFAULT_CHKSUM_ELEMENT);
+	if (ret < 0)
 		goto out;
-	}
 
+	ret = write_file(output_filename, merge.output, structure->size);
+	if (ret < 0)
+		goto out;
 
+	printf("%d changes merged\n", merge.n_changes);
 out:
+	free(merge.output);
+	free_file(buffers[0]);
+	free_file(buffers[1]);
+	free_file(buffers[2]);
 	return ret;
 }
 
@@ -990,16 +2136,16 @@ static int translate_ini(char **element_str, char **value_array)
 	char *translated_array, *translated_value, *value_str;
 	size_t len;
 
-	for (i = 0; i < n_dict_entries; i++)
-		if (!strcmp(dict[i].ini_str, *element_str)) {
-			free(*element_str);
-			*element_str = strdup(dict[i].element_str);
-			if (!element_str) {
-				fprintf(stderr, "couldn't allocate memory\n");
-				ret = -1;
-				goto out;
-			}
+	i = symtab_find(dict_tab, *element_str, strlen(*element_str));
+	if (i >= 0) {
+		free(*element_str);
+		*element_str = strdup(dict[i].element_str);
+		if (!*element_str) {
+			fprintf(stderr, "couldn't allocate memory\n");
+			ret = -1;
+			goto out;
 		}
+	}
 
 	translated_array = malloc(MAX_ARRAY_STR_LEN);
 	translated_value = malloc(MAX_VALUE_STR_LEN);
@@ -1051,27 +2197,130 @@ out:
 	return ret;
 }
 
+static const char *skip_blanks(const char *str)
+{
+	while (*str == ' ' || *str == '\t')
+		str++;
+
+	return str;
+}
+
+static const char *skip_name(const char *str, int dots)
+{
+	if (!isalpha((unsigned char) *str) && *str != '_')
+		return str;
+
+	do
+		str++;
+	while (is_ident_char((unsigned char) *str) || (dots && *str == '.'));
+
+	return str;
+}
+
+static int is_value_char(int c, enum text_file_type type)
+{
+	if (c == ' ' || c == '\t')
+		return 1;
+
+	if (type == TEXT_FILE_INI)
+		return isxdigit(c);
+
+	return is_ident_char(c) || c == ',';
+}
+
+/*
+ * Split a "name = value" line of a text config or INI file.  Returns 0
+ * with name and value allocated, the (1-based) column where the syntax
+ * broke, or -1 if we ran out of memory.  Whatever follows the value is
+ * ignored, like it always was.
+ */
+static int scan_assignment(const char *line, enum text_file_type type,
+			   char **name, char **value)
+{
+	const char *name_start, *name_end, *value_start, *str;
+
+	name_start = skip_blanks(line);
+	name_end = skip_name(name_start, type == TEXT_FILE_CONF);
+	if (name_end == name_start)
+		return name_start - line + 1;
+
+	str = skip_blanks(name_end);
+	if (*str != '=')
+		return str - line + 1;
+
+	value_start = skip_blanks(str + 1);
+	for (str = value_start; *str; str++)
+		if (!is_value_char((unsigned char) *str, type))
+			break;
+
+	if (str == value_start)
+		return value_start - line + 1;
+
+	*name = strndup(name_start, name_end - name_start);
+	*value = strndup(value_start, str - value_start);
+	if (!*name || !*value) {
+		free(*name);
+		free(*value);
+		fprintf(stderr, "couldn't allocate memory\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* same for the "ini_name element.path" lines of the dictionary */
+static int scan_dict_entry(const char *line, char **ini_str,
+			   char **element_str)
+{
+	const char *ini_start, *ini_end, *element_start, *element_end;
+
+	ini_start = skip_blanks(line);
+	ini_end = skip_name(ini_start, 0);
+	if (ini_end == ini_start)
+		return ini_start - line + 1;
+
+	element_start = skip_blanks(ini_end);
+	element_end = skip_name(element_start, 1);
+	if (element_start == ini_end || element_end == element_start)
+		return element_start - line + 1;
+
+	*ini_str = strndup(ini_start, ini_end - ini_start);
+	*element_str = strndup(element_start, element_end - element_start);
+	if (!*ini_str || !*element_str) {
+		free(*ini_str);
+		free(*element_str);
+		fprintf(stderr, "couldn't allocate memory\n");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int parse_dict(const char *filename)
 {
-	regex_t r;
 	FILE *file;
 	unsigned int parse_errors = 0, line_number = 0;
+	struct timespec start;
 	int ret;
 
+	timing_start(&start);
+
 	file = fopen(filename, "r");
 	if (!file) {
 		fprintf(stderr, "Couldn't open file '%s'\n", filename);
 		return -1;
 	}
 
-	ret = regcomp(&r, DICT_PATTERN, REG_EXTENDED);
-	if (ret < 0)
+	dict_tab = symtab_alloc(256);
+	if (!dict_tab) {
+		fprintf(stderr, "couldn't allocate memory\n");
+		ret = -1;
 		goto out;
+	}
 
 	while (!feof(file)) {
 		char *ini_str = NULL, *element_str = NULL, *line = NULL;
 		char *elim;
-		regmatch_t m[3];
 		size_t len;
 
 		ret = getline(&line, &len, file);
@@ -1095,37 +2344,41 @@ static int parse_dict(const char *filename)
 		if (!strlen(line))
 			goto cont;
 
-		if (regexec(&r, line, 3, m, 0)) {
-			fprintf(stderr, "line %d: invalid syntax: '%s'\n",
-				line_number, line);
+		ret = scan_dict_entry(line, &ini_str, &element_str);
+		if (ret < 0) {
+			free(line);
+			goto out;
+		} else if (ret > 0) {
+			fprintf(stderr, "line %d:%d: invalid syntax: '%s'\n",
+				line_number, ret, line);
 
 			parse_errors++;
 			goto cont;
 		}
 
-		ini_str =
-			strndup(line + m[1].rm_so, m[1].rm_eo - m[1].rm_so);
-
-		element_str = strndup(line + m[2].rm_so,
-				      m[2].rm_eo - m[2].rm_so);
-
 		dict = realloc(dict, ++n_dict_entries *
 			       sizeof(struct dict_entry));
 		if (!dict) {
 			free(line);
 			ret = -1;
-			goto out_free;
+			goto out;
 		}
 
 		dict[n_dict_entries - 1].ini_str = ini_str;
 		dict[n_dict_entries - 1].element_str = element_str;
 
+		/* later entries override earlier ones */
+		if (symtab_add(dict_tab, ini_str, strlen(ini_str),
+			       n_dict_entries - 1) < 0) {
+			free(line);
+			ret = -1;
+			goto out;
+		}
+
 	cont:
 		free(line);
 	};
 
-out_free:
-	regfree(&r);
 out:
 	if (parse_errors) {
 		fprintf(stderr,
@@ -1135,35 +2388,29 @@ out:
 	}
 
 	fclose(file);
+	timing_report("dictionary", filename, &start);
 	return ret;
 }
 
 static int parse_text_file(char *conf_buffer, struct structure *structure,
 			   const char *filename, enum text_file_type type)
 {
-	regex_t r;
 	FILE *file;
 	unsigned int parse_errors = 0, line_number = 0;
+	struct timespec start;
 	int ret = -1;
 
+	timing_start(&start);
+
 	file = fopen(filename, "r");
 	if (!file) {
 		fprintf(stderr, "Couldn't open file '%s'\n", filename);
 		return -1;
 	}
 
-	if (type == TEXT_FILE_CONF)
-		ret = regcomp(&r, TEXT_CONF_PATTERN, REG_EXTENDED);
-	else if (type == TEXT_FILE_INI)
-		ret = regcomp(&r, TEXT_INI_PATTERN, REG_EXTENDED);
-
-	if (ret < 0)
-		goto out;
-
 	while (!feof(file)) {
 		char *element_str = NULL, *line = NULL, *elim;
 		char *value_str = NULL, *value_array = NULL;
-		regmatch_t m[3];
 		struct element *element;
 		long int value;
 		int pos, i;
@@ -1190,19 +2437,18 @@ static int parse_text_file(char *conf_buffer, struct structure *structure,
 		if (!strlen(line))
 			goto cont;
 
-		if (regexec(&r, line, 3, m, 0)) {
-			fprintf(stderr, "line %d: invalid syntax: '%s'\n",
-				line_number, line);
+		ret = scan_assignment(line, type, &element_str, &value_array);
+		if (ret < 0) {
+			free(line);
+			goto out;
+		} else if (ret > 0) {
+			fprintf(stderr, "line %d:%d: invalid syntax: '%s'\n",
+				line_number, ret, line);
 
 			parse_errors++;
 			goto cont;
 		}
 
-		element_str =
-			strndup(line + m[1].rm_so, m[1].rm_eo - m[1].rm_so);
-
-		value_array = strndup(line + m[2].rm_so, m[2].rm_eo - m[2].rm_so);
-
 		if (type == TEXT_FILE_INI) {
 			ret = translate_ini(&element_str, &value_array);
 			if (ret < 0) {
@@ -1258,7 +2504,6 @@ static int parse_text_file(char *conf_buffer, struct structure *structure,
 		free(line);
 	};
 
-	regfree(&r);
 out:
 	if (parse_errors) {
 		fprintf(stderr,
@@ -1268,6 +2513,8 @@ out:
 	}
 
 	fclose(file);
+	timing_report(type == TEXT_FILE_INI ? "INI file" : "text config",
+		      filename, &start);
 	return ret;
 }
 
@@ -1321,7 +2568,7 @@ out:
 	return ret;
 }
 
-#define SHORT_OPTIONS "S:s:b:i:o:g::G:C:I:phXD"
+#define SHORT_OPTIONS "S:s:b:i:o:g::G:C:I:B:d:m:phXDT"
 
 struct option long_options[] = {
 	{ "binary-struct",	required_argument,	NULL,	'b' },
@@ -1329,12 +2576,16 @@ struct option long_options[] = {
 	{ "input-config",	required_argument,	NULL,	'i' },
 	{ "output-config",	required_argument,	NULL,	'o' },
 	{ "ignore-checksum",	no_argument,		NULL,	'X' },
+	{ "timing",		no_argument,		NULL,	'T' },
 	{ "create-default",	no_argument,		NULL,	'D' },
 	{ "get",		optional_argument,	NULL,	'g' },
 	{ "set",		required_argument,	NULL,	's' },
 	{ "generate-struct",	required_argument,	NULL,	'G' },
 	{ "parse-text-conf",	required_argument,	NULL,	'C' },
 	{ "parse-ini",		required_argument,	NULL,	'I' },
+	{ "batch",		required_argument,	NULL,	'B' },
+	{ "diff",		required_argument,	NULL,	'd' },
+	{ "merge",		required_argument,	NULL,	'm' },
 	{ "print-struct",	no_argument,		NULL,	'p' },
 	{ "help",		no_argument,		NULL,	'h' },
 	{ 0, 0, 0, 0 },
@@ -1381,6 +2632,10 @@ int main(int argc, char **argv)
 			ignore_checksum = 1;
 			break;
 
+		case 'T':
+			timing = 1;
+			break;
+
 		case 'D':
 			/* Build default configuration bin file (default input) */
 			if (output_filename) {
@@ -1396,6 +2651,9 @@ int main(int argc, char **argv)
 		case 's':
 		case 'C':
 		case 'I':
+		case 'B':
+		case 'd':
+		case 'm':
 			command_arg = optarg;
 			/* Fall through */
 		case 'p':
@@ -1435,12 +2693,8 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	if (!header_filename && !binary_struct_filename) {
+	if (!header_filename && !binary_struct_filename)
 		binary_struct_filename = strdup(DEFAULT_BIN_FILENAME);
-		ret = read_binary_struct(binary_struct_filename);
-		if (ret < 0)
-			goto out;
-	}
 
 	if (binary_struct_filename) {
 		ret = read_binary_struct(binary_struct_filename);
@@ -1449,11 +2703,20 @@ int main(int argc, char **argv)
 	}
 
 	if (header_filename) {
-		ret = read_file(header_filename, &header_buf, 0);
+		struct stat st;
+
+		ret = stat(header_filename, &st);
+		if (ret < 0) {
+			fprintf(stderr, "Couldn't get file size '%s'\n",
+				header_filename);
+			goto out;
+		}
+
+		ret = read_file(header_filename, &header_buf, st.st_size);
 		if (ret < 0)
 			goto out;
 
-		ret = parse_header(header_buf);
+		ret = parse_header(header_filename, header_buf, st.st_size);
 		if (ret < 0)
 			goto out;
 	}
@@ -1567,6 +2830,31 @@ int main(int argc, char **argv)
 
 		break;
 
+	case 'B':
+		ret = run_batch(command_arg, input_filename, output_filename,
+				root_struct);
+		break;
+
+	case 'd':
+		ret = diff_files(input_filename, command_arg, root_struct);
+		break;
+
+	case 'm': {
+		char *theirs = strchr(command_arg, ',');
+
+		if (!theirs) {
+			fprintf(stderr,
+				"--merge requires the format <base>,<theirs>\n");
+			ret = -1;
+			break;
+		}
+		*theirs++ = '\0';
+
+		ret = merge_files(input_filename, command_arg, theirs,
+				  output_filename, root_struct);
+		break;
+	}
+
 	case 'p':
 		get_value(NULL, root_struct, NULL);
 		break;
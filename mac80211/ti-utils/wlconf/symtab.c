@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2012 Texas Instruments Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symtab.h"
+
+#define SYMTAB_MIN_BUCKETS	16
+
+struct symbol {
+	struct symbol *next;
+	uint32_t hash;
+	int value;
+	size_t key_len;
+	char key[];
+};
+
+struct symtab {
+	struct symbol **buckets;
+	unsigned int n_buckets;
+	unsigned int n_symbols;
+};
+
+/* FNV-1a */
+static uint32_t symtab_hash(const char *key, size_t key_len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < key_len; i++) {
+		hash ^= (unsigned char) key[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+struct symtab *symtab_alloc(unsigned int size_hint)
+{
+	struct symtab *tab;
+	unsigned int n_buckets = SYMTAB_MIN_BUCKETS;
+
+	while (n_buckets < size_hint)
+		n_buckets <<= 1;
+
+	tab = malloc(sizeof(*tab));
+	if (!tab)
+		return NULL;
+
+	tab->buckets = calloc(n_buckets, sizeof(*tab->buckets));
+	if (!tab->buckets) {
+		free(tab);
+		return NULL;
+	}
+
+	tab->n_buckets = n_buckets;
+	tab->n_symbols = 0;
+
+	return tab;
+}
+
+void symtab_free(struct symtab *tab)
+{
+	struct symbol *sym, *next;
+	unsigned int i;
+
+	if (!tab)
+		return;
+
+	for (i = 0; i < tab->n_buckets; i++)
+		for (sym = tab->buckets[i]; sym; sym = next) {
+			next = sym->next;
+			free(sym);
+		}
+
+	free(tab->buckets);
+	free(tab);
+}
+
+static void symtab_grow(struct symtab *tab)
+{
+	struct symbol **buckets, *sym, *next;
+	unsigned int i, n_buckets = tab->n_buckets << 1;
+
+	buckets = calloc(n_buckets, sizeof(*buckets));
+	if (!buckets)
+		return; /* keep going with longer chains */
+
+	for (i = 0; i < tab->n_buckets; i++)
+		for (sym = tab->buckets[i]; sym; sym = next) {
+			next = sym->next;
+			sym->next = buckets[sym->hash & (n_buckets - 1)];
+			buckets[sym->hash & (n_buckets - 1)] = sym;
+		}
+
+	free(tab->buckets);
+	tab->buckets = buckets;
+	tab->n_buckets = n_buckets;
+}
+
+static struct symbol *symtab_lookup(struct symtab *tab, const char *key,
+				    size_t key_len, uint32_t hash)
+{
+	struct symbol *sym;
+
+	for (sym = tab->buckets[hash & (tab->n_buckets - 1)]; sym;
+	     sym = sym->next)
+		if (sym->hash == hash && sym->key_len == key_len &&
+		    !memcmp(sym->key, key, key_len))
+			return sym;
+
+	return NULL;
+}
+
+int symtab_add(struct symtab *tab, const char *key, size_t key_len, int value)
+{
+	uint32_t hash = symtab_hash(key, key_len);
+	struct symbol *sym;
+
+	sym = symtab_lookup(tab, key, key_len, hash);
+	if (sym) {
+		sym->value = value;
+		return 0;
+	}
+
+	sym = malloc(sizeof(*sym) + key_len + 1);
+	if (!sym)
+		return -1;
+
+	sym->hash = hash;
+	sym->value = value;
+	sym->key_len = key_len;
+	memcpy(sym->key, key, key_len);
+	sym->key[key_len] = '\0';
+
+	sym->next = tab->buckets[hash & (tab->n_buckets - 1)];
+	tab->buckets[hash & (tab->n_buckets - 1)] = sym;
+
+	if (++tab->n_symbols > 2 * tab->n_buckets)
+		symtab_grow(tab);
+
+	return 0;
+}
+
+int symtab_find(struct symtab *tab, const char *key, size_t key_len)
+{
+	struct symbol *sym;
+
+	if (!tab)
+		return -1;
+
+	sym = symtab_lookup(tab, key, key_len, symtab_hash(key, key_len));
+
+	return sym ? sym->value : -1;
+}
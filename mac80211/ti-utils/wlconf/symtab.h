@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2012 Texas Instruments Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef __SYMTAB_H__
+#define __SYMTAB_H__
+
+#include <stddef.h>
+
+/*
+ * Simple string -> int hash table.  Keys are copied, so callers can
+ * look up and add substrings of larger buffers without duplicating them.
+ */
+struct symtab;
+
+struct symtab *symtab_alloc(unsigned int size_hint);
+void symtab_free(struct symtab *tab);
+
+/* adds or replaces the value for key; returns 0 or -1 on allocation error */
+int symtab_add(struct symtab *tab, const char *key, size_t key_len, int value);
+
+/* returns the value for key or -1 if it's not in the table */
+int symtab_find(struct symtab *tab, const char *key, size_t key_len);
+
+#endif /* __SYMTAB_H__ */
@@ -33,6 +33,7 @@ struct structure {
 	int n_elements;
 	struct element *elements;
 	size_t size;
+	struct symtab *element_tab;
 };
 
 struct type {
@@ -41,6 +42,43 @@ struct type {
 	char *format;
 };
 
+/* a get or set operation with its element already resolved */
+struct element_op {
+	int set;
+	char *element_str;
+	struct element *element;
+	size_t position;
+	int index;		/* array index or -1 for the whole element */
+	uint32_t *values;	/* values to set, one per array entry */
+	int n_values;
+	unsigned int line;	/* line in the batch file, 0 if none */
+};
+
+/* tokens of the C subset found in the conf header, see parse_header() */
+enum token_type {
+	TOKEN_EOF,
+	TOKEN_IDENT,
+	TOKEN_NUMBER,
+	TOKEN_PUNCT,
+};
+
+struct token {
+	enum token_type type;
+	const char *str;	/* not NUL terminated */
+	size_t len;
+	unsigned int line;
+	unsigned int column;
+};
+
+struct tokenizer {
+	const char *filename;
+	const char *pos;
+	const char *end;
+	unsigned int line;
+	unsigned int column;
+	int line_start;		/* only blanks so far, '#' starts a directive */
+};
+
 struct dict_entry {
 	char *ini_str;
 	char *element_str;
@@ -88,31 +126,6 @@ struct type types[] = {
 #define MAX_ARRAY_STR_LEN	4096
 #define MAX_VALUE_STR_LEN	256
 
-#define STRUCT_PATTERN 	"[\n\t\r ]*struct[\n\t\r ]+([a-zA-Z0-9_]+)"	\
-	"[\n\t\r ]*\\{[\n\t\r ]*([^}]*)\\}[\n\t\r ]*"			\
-	"[a-zA-Z0-9_]*;[\n\t\r ]*"
-
-#define ELEMENT_PATTERN	"[\n\t\r ]*([A-Za-z0-9_]+)[\n\t\r ]+" \
-	"([a-zA-Z_][a-zA-Z0-9_]*)(\\[([0-9]+)\\])?[\n\t\r ]*;[\n\t\r ]*"
-
-#define TEXT_CONF_PATTERN	"^[\t ]*([A-Za-z_][A-Za-z0-9_.]*)" \
-	"[\t ]*=[\t ]*([A-Za-z0-9_, \t]+)"
-
-#define TEXT_INI_PATTERN	"^[\t ]*([A-Za-z_][A-Za-z0-9_]*)" \
-	"[\t ]*=[\t ]*([0-9A-Fa-f \t]+)"
-
-#define DICT_PATTERN		"^[\t ]*([A-Za-z_][A-Za-z0-9_]*)" \
-	"[\t ]+([A-Za-z_][A-Za-z0-9_.]*)"
-
-#define CC_COMMENT_PATTERN	"(([^/]|[/][^/])*)//[^\n]*\n(.*)"
-
-#define C_COMMENT_PATTERN	"(([^/]|[/][^*])*)/\\*(([^*]|[*][^/])*)\\*/(.*)"
-
-
-/* we only match WL12XX and WL18XX magic */
-#define DEFINE_PATTERN	"#define[\n\t\r ]+([A-Za-z_][A-Za-z0-9_]*)"	\
-	"[\n\t\r ]+(0x[0-9A-Fa-f]+)"
-
 #define WRITE_INT32(from, file) {			\
 		int32_t val = (int32_t) from;		\
 		fwrite(&val, 1, sizeof(val), file);	\
@@ -814,52 +814,144 @@ static void wpa_driver_wext_set_scan_timeout(void *priv)
 }
 
 
+/*
+ * SIOCGIWSCAN result buffer. cfg80211 serializes the whole BSS list again for
+ * every call, so retrying with doubling buffers on E2BIG is expensive. The
+ * buffer is kept across scans and sized from the last result, which usually
+ * lets the first ioctl succeed.
+ */
+struct wext_scan_buf {
+    char ifname[IFNAMSIZ + 1];
+    u8 *buf;
+    size_t size;
+    size_t last_len;
+    unsigned int scans;
+    unsigned int retries;
+    unsigned int retries_avoided;
+};
+
+static struct wext_scan_buf scan_buf;
+
+#define WEXT_SCAN_BUF_MAX 65535 /* 16-bit length field */
+
+static int wext_scan_buf_resize(size_t size)
+{
+    u8 *buf;
+
+    if (size <= scan_buf.size) {
+        return 0;
+    }
+
+    /* the old contents are never needed, so don't let realloc copy them */
+    buf = os_malloc(size);
+    if (buf == NULL) {
+        return -1;
+    }
+    os_free(scan_buf.buf);
+    scan_buf.buf = buf;
+    scan_buf.size = size;
+    return 0;
+}
+
+static void wext_scan_buf_free(void)
+{
+    os_free(scan_buf.buf);
+    os_memset(&scan_buf, 0, sizeof(scan_buf));
+}
+
+/* number of E2BIG rounds a fresh IW_SCAN_MAX_DATA buffer needs for @len */
+static unsigned int wext_scan_buf_rounds(size_t len)
+{
+    size_t size = IW_SCAN_MAX_DATA;
+    unsigned int rounds = 0;
+
+    while (size < len && size < WEXT_SCAN_BUF_MAX) {
+        size *= 2;
+        if (size > WEXT_SCAN_BUF_MAX) {
+            size = WEXT_SCAN_BUF_MAX;
+        }
+        rounds++;
+    }
+    return rounds;
+}
+
+/*
+ * Fetch the scan results into the shared scan buffer. The returned pointer
+ * stays owned by the buffer and is only valid until the next call.
+ */
 static u8 * wpa_driver_wext_giwscan(struct wpa_driver_wext_data *drv,
                     size_t *len)
 {
     struct iwreq iwr;
-    u8 *res_buf;
     size_t res_buf_len;
+    unsigned int retries = 0, rounds;
+
+    if (os_strncmp(scan_buf.ifname, drv->ifname, IFNAMSIZ) != 0) {
+        scan_buf.last_len = 0;
+        os_strlcpy(scan_buf.ifname, drv->ifname, sizeof(scan_buf.ifname));
+    }
+
+    /* start from the last result plus some room for new BSSes */
+    res_buf_len = scan_buf.last_len + scan_buf.last_len / 4;
+    if (res_buf_len < IW_SCAN_MAX_DATA) {
+        res_buf_len = IW_SCAN_MAX_DATA;
+    } else if (res_buf_len > WEXT_SCAN_BUF_MAX) {
+        res_buf_len = WEXT_SCAN_BUF_MAX;
+    }
+
+    /* never hand the kernel less than what is already allocated */
+    if (res_buf_len < scan_buf.size) {
+        res_buf_len = scan_buf.size;
+    }
 
-    res_buf_len = IW_SCAN_MAX_DATA;
     for (;;) {
-        res_buf = os_malloc(res_buf_len);
-        if (res_buf == NULL) {
+        if (wext_scan_buf_resize(res_buf_len) < 0) {
             return NULL;
         }
         os_memset(&iwr, 0, sizeof(iwr));
         os_strlcpy(iwr.ifr_name, drv->ifname, IFNAMSIZ);
-        iwr.u.data.pointer = res_buf;
+        iwr.u.data.pointer = scan_buf.buf;
         iwr.u.data.length = res_buf_len;
 
         if (ioctl(drv->ioctl_sock, SIOCGIWSCAN, &iwr) == 0) {
             break;
         }
 
-        if (errno == E2BIG && res_buf_len < 65535) {
-            os_free(res_buf);
-            res_buf = NULL;
+        if (errno == E2BIG && res_buf_len < WEXT_SCAN_BUF_MAX) {
             res_buf_len *= 2;
-            if (res_buf_len > 65535) {
-                res_buf_len = 65535; /* 16-bit length field */
+            if (res_buf_len > WEXT_SCAN_BUF_MAX) {
+                res_buf_len = WEXT_SCAN_BUF_MAX;
             }
+            retries++;
             wpa_printf(MSG_DEBUG, "Scan results did not fit - "
                    "trying larger buffer (%lu bytes)",
                    (unsigned long) res_buf_len);
         } else {
             wpa_printf(MSG_ERROR, "ioctl[SIOCGIWSCAN]: %d", errno);
-            os_free(res_buf);
+            scan_buf.retries += retries;
             return NULL;
         }
     }
 
     if (iwr.u.data.length > res_buf_len) {
-        os_free(res_buf);
         return NULL;
     }
     *len = iwr.u.data.length;
 
-    return res_buf;
+    rounds = wext_scan_buf_rounds(*len);
+    scan_buf.scans++;
+    scan_buf.retries += retries;
+    if (rounds > retries) {
+        scan_buf.retries_avoided += rounds - retries;
+    }
+    scan_buf.last_len = *len;
+
+    wpa_printf(MSG_DEBUG, "SIOCGIWSCAN: %lu bytes in a %lu byte buffer, "
+           "%u retries (total %u, %u avoided over %u scans)",
+           (unsigned long) *len, (unsigned long) res_buf_len, retries,
+           scan_buf.retries, scan_buf.retries_avoided, scan_buf.scans);
+
+    return scan_buf.buf;
 }
 
 
@@ -871,12 +963,39 @@ struct wext_scan_data {
     struct wpa_scan_res res;
     u8 *ie;
     size_t ie_len;
+    size_t ie_size;
     u8 ssid[32];
     size_t ssid_len;
     int maxrate;
 };
 
 
+/*
+ * Make room for @bytes more IE data and return where it goes. The IE buffer
+ * is shared by all entries of one scan result and only ever grows, so
+ * parsing does not reallocate it for every BSS.
+ */
+static u8 * wext_scan_ie_reserve(struct wext_scan_data *res, size_t bytes)
+{
+    size_t size;
+    u8 *tmp;
+
+    if (res->ie_len + bytes > res->ie_size) {
+        size = res->ie_size ? res->ie_size : 256;
+        while (size < res->ie_len + bytes) {
+            size *= 2;
+        }
+        tmp = os_realloc(res->ie, size);
+        if (tmp == NULL) {
+            return NULL;
+        }
+        res->ie = tmp;
+        res->ie_size = size;
+    }
+    return res->ie + res->ie_len;
+}
+
+
 static void wext_get_scan_mode(struct iw_event *iwe,
                    struct wext_scan_data *res)
 {
@@ -1015,12 +1134,11 @@ static void wext_get_scan_iwevgenie(struct iw_event *iwe,
         return;
     }
 
-    tmp = os_realloc(res->ie, res->ie_len + gend - gpos);
+    tmp = wext_scan_ie_reserve(res, gend - gpos);
     if (tmp == NULL) {
         return;
     }
-    os_memcpy(tmp + res->ie_len, gpos, gend - gpos);
-    res->ie = tmp;
+    os_memcpy(tmp, gpos, gend - gpos);
     res->ie_len += gend - gpos;
 }
 
@@ -1046,12 +1164,11 @@ static void wext_get_scan_custom(struct iw_event *iwe,
             return;
         }
         bytes /= 2;
-        tmp = os_realloc(res->ie, res->ie_len + bytes);
+        tmp = wext_scan_ie_reserve(res, bytes);
         if (tmp == NULL) {
             return;
         }
-        hexstr2bin(spos, tmp + res->ie_len, bytes);
-        res->ie = tmp;
+        hexstr2bin(spos, tmp, bytes);
         res->ie_len += bytes;
     } else if (clen > 7 && os_strncmp(custom, "rsn_ie=", 7) == 0) {
         char *spos;
@@ -1062,12 +1179,11 @@ static void wext_get_scan_custom(struct iw_event *iwe,
             return;
         }
         bytes /= 2;
-        tmp = os_realloc(res->ie, res->ie_len + bytes);
+        tmp = wext_scan_ie_reserve(res, bytes);
         if (tmp == NULL) {
             return;
         }
-        hexstr2bin(spos, tmp + res->ie_len, bytes);
-        res->ie = tmp;
+        hexstr2bin(spos, tmp, bytes);
         res->ie_len += bytes;
     } else if (clen > 4 && os_strncmp(custom, "tsf=", 4) == 0) {
         char *spos;
@@ -1168,6 +1284,118 @@ static void wpa_driver_wext_add_scan_entry(struct wpa_scan_results *res,
 }
 
 
+/**
+ * wpa_driver_wext_get_scan_results_custom - Fetch the latest scan results
+ * @priv: Pointer to private wext data from wpa_driver_wext_init()
+ * Returns: Scan results on success, %NULL on failure
+ *
+ * Same as wpa_driver_wext_get_scan_results(), but the result buffer and the
+ * IE buffer used while parsing are reused instead of being reallocated for
+ * every scan and every BSS.
+ */
+static struct wpa_scan_results * wpa_driver_wext_get_scan_results_custom(void *priv)
+{
+    struct wpa_driver_wext_data *drv = priv;
+    size_t len;
+    int first;
+    u8 *res_buf, *ie;
+    size_t ie_size;
+    struct iw_event iwe_buf, *iwe = &iwe_buf;
+    char *pos, *end, *custom;
+    struct wpa_scan_results *res;
+    struct wext_scan_data data;
+
+    res_buf = wpa_driver_wext_giwscan(drv, &len);
+    if (res_buf == NULL) {
+        return NULL;
+    }
+
+    first = 1;
+
+    res = os_zalloc(sizeof(*res));
+    if (res == NULL) {
+        return NULL;
+    }
+
+    pos = (char *) res_buf;
+    end = (char *) res_buf + len;
+    os_memset(&data, 0, sizeof(data));
+
+    while (pos + IW_EV_LCP_LEN <= end) {
+        /* Event data may be unaligned, so make a local, aligned copy
+         * before processing. */
+        os_memcpy(&iwe_buf, pos, IW_EV_LCP_LEN);
+        if (iwe->len <= IW_EV_LCP_LEN) {
+            break;
+        }
+
+        custom = pos + IW_EV_POINT_LEN;
+        if (wext_19_iw_point(drv, iwe->cmd)) {
+            /* WE-19 removed the pointer from struct iw_point */
+            char *dpos = (char *) &iwe_buf.u.data.length;
+            int dlen = dpos - (char *) &iwe_buf;
+            os_memcpy(dpos, pos + IW_EV_LCP_LEN,
+                  sizeof(struct iw_event) - dlen);
+        } else {
+            os_memcpy(&iwe_buf, pos, sizeof(struct iw_event));
+            custom += IW_EV_POINT_OFF;
+        }
+
+        switch (iwe->cmd) {
+        case SIOCGIWAP:
+            if (!first) {
+                wpa_driver_wext_add_scan_entry(res, &data);
+            }
+            first = 0;
+            /* keep the IE buffer for the next entry */
+            ie = data.ie;
+            ie_size = data.ie_size;
+            os_memset(&data, 0, sizeof(data));
+            data.ie = ie;
+            data.ie_size = ie_size;
+            os_memcpy(data.res.bssid,
+                  iwe->u.ap_addr.sa_data, ETH_ALEN);
+            break;
+        case SIOCGIWMODE:
+            wext_get_scan_mode(iwe, &data);
+            break;
+        case SIOCGIWESSID:
+            wext_get_scan_ssid(iwe, &data, custom, end);
+            break;
+        case SIOCGIWFREQ:
+            wext_get_scan_freq(iwe, &data);
+            break;
+        case IWEVQUAL:
+            wext_get_scan_qual(iwe, &data);
+            break;
+        case SIOCGIWENCODE:
+            wext_get_scan_encode(iwe, &data);
+            break;
+        case SIOCGIWRATE:
+            wext_get_scan_rate(iwe, &data, pos, end);
+            break;
+        case IWEVGENIE:
+            wext_get_scan_iwevgenie(iwe, &data, custom, end);
+            break;
+        case IWEVCUSTOM:
+            wext_get_scan_custom(iwe, &data, custom, end);
+            break;
+        }
+
+        pos += iwe->len;
+    }
+    if (!first) {
+        wpa_driver_wext_add_scan_entry(res, &data);
+    }
+    os_free(data.ie);
+
+    wpa_printf(MSG_DEBUG, "Received %lu bytes of scan results (%lu BSSes)",
+           (unsigned long) len, (unsigned long) res->num);
+
+    return res;
+}
+
+
 
 static int wpa_driver_wext_get_range(void *priv)
 {
@@ -1732,112 +1960,205 @@ static char *wpa_driver_get_country_code(int channels)
     return country;
 }
 
-/* global NL structures */
-struct nl_handle *nl_sock;
-struct nl_cache *nl_cache;
-struct genl_family *nl80211;
+/*
+ * nl80211 context used by the private driver commands. The framework polls
+ * some of them several times a second, so the socket, the resolved family
+ * id and the callbacks are set up on first use and kept around instead of
+ * being rebuilt for every message. The wext driver data is owned by the
+ * supplicant core, so the context is kept per process rather than hung off
+ * the driver instance. A socket error drops it and the next command starts
+ * from scratch.
+ */
+struct wpa_driver_nl_ctx {
+    struct nl_handle *sock;
+    struct nl_cb *cb;
+    int family_id;
+    int err;
+};
+
+static struct wpa_driver_nl_ctx nl_ctx;
+
+static int nl_error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+    int *ret = (int *)arg;
+    *ret = err->error;
+    return NL_STOP;
+}
+
+static int nl_finish_handler(struct nl_msg *msg, void *arg)
+{
+     int *ret = (int *)arg;
+     *ret = 0;
+     return NL_SKIP;
+}
+
+static int nl_ack_handler(struct nl_msg *msg, void *arg)
+{
+    int *ret = (int *)arg;
+    *ret = 0;
+    return NL_STOP;
+}
+
+static void wpa_driver_deinit_nl(void)
+{
+    if (nl_ctx.cb)
+        nl_cb_put(nl_ctx.cb);
+    if (nl_ctx.sock)
+        nl_socket_free(nl_ctx.sock);
+    os_memset(&nl_ctx, 0, sizeof(nl_ctx));
+}
 
-static int wpa_driver_init_nl() {
+static int wpa_driver_init_nl(void)
+{
+    struct nl_cache *cache = NULL;
+    struct genl_family *nl80211;
     int err;
 
-    nl_sock = nl_socket_alloc();
-    if (!nl_sock) {
+    if (nl_ctx.sock)
+        return 0;
+
+    nl_ctx.sock = nl_socket_alloc();
+    if (!nl_ctx.sock) {
         wpa_printf(MSG_DEBUG,"Failed to allocate netlink socket.");
         return -ENOMEM;
     }
 
-    if (genl_connect(nl_sock)) {
+    if (genl_connect(nl_ctx.sock)) {
         wpa_printf(MSG_DEBUG,"Failed to connect to generic netlink.");
         err = -ENOLINK;
-        goto out_handle_destroy;
+        goto out_deinit;
     }
 
-    genl_ctrl_alloc_cache(nl_sock, &nl_cache);
-    if (!nl_cache) {
+    /* the cache is only needed to resolve the family id once */
+    genl_ctrl_alloc_cache(nl_ctx.sock, &cache);
+    if (!cache) {
         wpa_printf(MSG_DEBUG,"Failed to allocate generic netlink cache.");
         err = -ENOMEM;
-        goto out_handle_destroy;
+        goto out_deinit;
     }
 
-    nl80211 = genl_ctrl_search_by_name(nl_cache, "nl80211");
+    nl80211 = genl_ctrl_search_by_name(cache, "nl80211");
     if (!nl80211) {
         wpa_printf(MSG_DEBUG,"nl80211 not found.");
         err = -ENOENT;
         goto out_cache_free;
     }
 
+    nl_ctx.family_id = genl_family_get_id(nl80211);
+    genl_family_put(nl80211);
+    nl_cache_free(cache);
+
+    nl_ctx.cb = nl_cb_alloc(NL_CB_DEFAULT);
+    if (!nl_ctx.cb) {
+        wpa_printf(MSG_DEBUG,"failed to allocate netlink callbacks");
+        err = -ENOMEM;
+        goto out_deinit;
+    }
+
+    nl_cb_err(nl_ctx.cb, NL_CB_CUSTOM, nl_error_handler, &nl_ctx.err);
+    nl_cb_set(nl_ctx.cb, NL_CB_FINISH, NL_CB_CUSTOM, nl_finish_handler,
+              &nl_ctx.err);
+    nl_cb_set(nl_ctx.cb, NL_CB_ACK, NL_CB_CUSTOM, nl_ack_handler,
+              &nl_ctx.err);
+
     return 0;
 
 out_cache_free:
-    nl_cache_free(nl_cache);
-out_handle_destroy:
-    nl_socket_free(nl_sock);
+    nl_cache_free(cache);
+out_deinit:
+    wpa_driver_deinit_nl();
     return err;
 }
 
-static void wpa_driver_deinit_nl() {
-    genl_family_put(nl80211);
-    nl_cache_free(nl_cache);
-    nl_socket_free(nl_sock);
-}
-
-static int nl_error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+/*
+ * Allocate an nl80211 message for @cmd on @iface, with the interface index
+ * already in place. The caller adds its own attributes and hands the
+ * message to wpa_driver_send_nl().
+ */
+static struct nl_msg *wpa_driver_alloc_nl(char *iface, int cmd)
 {
-    int *ret = (int *)arg;
-    *ret = err->error;
-    return NL_STOP;
-}
+    struct nl_msg *msg;
+    int devidx;
 
-static int nl_finish_handler(struct nl_msg *msg, void *arg)
-{
-     int *ret = (int *)arg;
-     *ret = 0;
-     return NL_SKIP;
-}
+    if (wpa_driver_init_nl() != 0)
+        return NULL;
 
-static int nl_ack_handler(struct nl_msg *msg, void *arg)
-{
-    int *ret = (int *)arg;
-    *ret = 0;
-    return NL_STOP;
+    devidx = if_nametoindex(iface);
+    if (devidx == 0) {
+        wpa_printf(MSG_DEBUG,"failed to translate ifname to idx");
+        return NULL;
+    }
+
+    msg = nlmsg_alloc();
+    if (!msg) {
+        wpa_printf(MSG_DEBUG,"failed to allocate netlink message");
+        return NULL;
+    }
+
+    genlmsg_put(msg, 0, 0, nl_ctx.family_id, 0, 0, cmd, 0);
+    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, devidx);
+
+    return msg;
+
+nla_put_failure:
+    nlmsg_free(msg);
+    return NULL;
 }
 
-static int wpa_driver_set_power_save(char *iface, int state)
+/*
+ * Send @msg on the shared socket and wait for the kernel's answer. Replies
+ * other than the ack are passed to @handler, if any. The message is always
+ * consumed. Returns 0 on success, the negative nl80211 error otherwise.
+ */
+static int wpa_driver_send_nl_reply(struct nl_msg *msg,
+                                    int (*handler)(struct nl_msg *, void *),
+                                    void *arg)
 {
-    int ret;
-    struct nl_cb *cb;
-    struct nl_msg *msg;
-    int devidx = 0;
     int err;
-    enum nl80211_ps_state ps_state;
 
-    ret = wpa_driver_init_nl();
-    if (ret != 0) {
-        return ret;
+    err = nl_send_auto_complete(nl_ctx.sock, msg);
+    nlmsg_free(msg);
+    if (err < 0) {
+        wpa_printf(MSG_DEBUG, "could not send auto_complete: %d", err);
+        goto out_reset;
     }
 
-    ret = -1;
+    if (handler)
+        nl_cb_set(nl_ctx.cb, NL_CB_VALID, NL_CB_CUSTOM, handler, arg);
 
-        devidx = if_nametoindex(iface);
-        if (devidx == 0) {
-            wpa_printf(MSG_DEBUG,"failed to translate ifname to idx");
-            goto exit;
+    nl_ctx.err = 1;
+    while (nl_ctx.err > 0) {
+        err = nl_recvmsgs(nl_ctx.sock, nl_ctx.cb);
+        if (err < 0) {
+            wpa_printf(MSG_DEBUG, "failed to receive netlink answer: %d",
+                       err);
+            goto out_reset;
         }
-
-    msg = nlmsg_alloc();
-    if (!msg) {
-        wpa_printf(MSG_DEBUG,"failed to allocate netlink message");
-        goto exit;
     }
 
-    cb = nl_cb_alloc(NL_CB_DEFAULT);
-    if (!cb) {
-        wpa_printf(MSG_DEBUG,"failed to allocate netlink callbacks");
-        goto out_free_msg;
-    }
+    if (handler)
+        nl_cb_set(nl_ctx.cb, NL_CB_VALID, NL_CB_DEFAULT, NULL, NULL);
+
+    return nl_ctx.err;
+
+out_reset:
+    wpa_driver_deinit_nl();
+    return -1;
+}
+
+static int wpa_driver_send_nl(struct nl_msg *msg)
+{
+    return wpa_driver_send_nl_reply(msg, NULL, NULL);
+}
+
+static int wpa_driver_set_power_save(char *iface, int state)
+{
+    struct nl_msg *msg;
+    enum nl80211_ps_state ps_state;
 
-    genlmsg_put(msg, 0, 0, genl_family_get_id(nl80211), 0, 0,
-            NL80211_CMD_SET_POWER_SAVE, 0);
+    msg = wpa_driver_alloc_nl(iface, NL80211_CMD_SET_POWER_SAVE);
+    if (!msg)
+        return -1;
 
     if (state != 0) {
         ps_state = NL80211_PS_ENABLED;
@@ -1845,104 +2166,347 @@ static int wpa_driver_set_power_save(char *iface, int state)
         ps_state = NL80211_PS_DISABLED;
     }
 
-    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, devidx);
     NLA_PUT_U32(msg, NL80211_ATTR_PS_STATE, ps_state);
 
-    err = nl_send_auto_complete(nl_sock, msg);
-    if (err < 0) {
-        wpa_printf(MSG_DEBUG, "could not send auto_complete: %d", err);
-        goto out;
+    return wpa_driver_send_nl(msg);
+
+nla_put_failure:
+    nlmsg_free(msg);
+    return -1;
+}
+
+static int wpa_driver_set_country(char *iface, char *country)
+{
+    struct nl_msg *msg;
+    char alpha2[3];
+
+    msg = wpa_driver_alloc_nl(iface, NL80211_CMD_REQ_SET_REG);
+    if (!msg)
+        return -1;
+
+    alpha2[0] = country[0];
+    alpha2[1] = country[1];
+    alpha2[2] = '\0';
+
+    NLA_PUT_STRING(msg, NL80211_ATTR_REG_ALPHA2, alpha2);
+
+    return wpa_driver_send_nl(msg);
+
+nla_put_failure:
+    nlmsg_free(msg);
+    return -1;
+}
+
+/*
+ * Cache for the RSSI and link speed answers. Android polls both constantly,
+ * and every SIOCGIWSTATS/SIOCGIWRATE makes the driver wake the chip and read
+ * firmware statistics over the bus. Values are reused for up to max_age ms
+ * (property wlan.driver.link_cache_ms, 0 disables the cache). When nl80211
+ * events are available, CQM notifications and connection changes drop the
+ * cached values early, so a threshold crossing or a roam is never hidden
+ * behind a stale answer.
+ *
+ * A CQM RSSI trigger replaces whatever trigger is configured for the
+ * interface, so one is only programmed on request: property
+ * wlan.driver.link_cache_cqm set to "<threshold dBm>,<hysteresis dB>".
+ * Otherwise CQM notifications only arrive for triggers set up elsewhere.
+ *
+ * The cache belongs to the first interface asking for these values, the
+ * events are filtered on its ifindex. Other interfaces of this driver (e.g.
+ * p2p0 next to wlan0) always query the driver.
+ */
+#define WPA_DRIVER_LINK_CACHE_MS "1000"
+
+struct wpa_driver_link_cache {
+    int initialized;
+    int max_age;
+    /* owner; its ifindex is updated when the interface is recreated */
+    struct wpa_driver_wext_data *drv;
+
+    int rssi;
+    int rssi_valid;
+    struct os_time rssi_time;
+
+    int linkspeed;
+    int linkspeed_valid;
+    struct os_time linkspeed_time;
+
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int events;
+
+    struct nl_handle *event_sock;
+    struct nl_cb *event_cb;
+};
+
+static struct wpa_driver_link_cache link_cache;
+
+struct wpa_driver_mcast_group {
+    const char *name;
+    int id;
+};
+
+static int nl_family_handler(struct nl_msg *msg, void *arg)
+{
+    struct wpa_driver_mcast_group *group = arg;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[CTRL_ATTR_MAX + 1];
+    struct nlattr *mcgrp;
+    int i;
+
+    nla_parse(tb, CTRL_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+              genlmsg_attrlen(gnlh, 0), NULL);
+    if (!tb[CTRL_ATTR_MCAST_GROUPS])
+        return NL_SKIP;
+
+    nla_for_each_nested(mcgrp, tb[CTRL_ATTR_MCAST_GROUPS], i) {
+        struct nlattr *tb2[CTRL_ATTR_MCAST_GRP_MAX + 1];
+
+        nla_parse(tb2, CTRL_ATTR_MCAST_GRP_MAX, nla_data(mcgrp),
+                  nla_len(mcgrp), NULL);
+        if (!tb2[CTRL_ATTR_MCAST_GRP_NAME] ||
+            !tb2[CTRL_ATTR_MCAST_GRP_ID] ||
+            os_strncmp(nla_data(tb2[CTRL_ATTR_MCAST_GRP_NAME]), group->name,
+                       nla_len(tb2[CTRL_ATTR_MCAST_GRP_NAME])) != 0)
+            continue;
+        group->id = nla_get_u32(tb2[CTRL_ATTR_MCAST_GRP_ID]);
+        break;
     }
 
-    err = 1;
+    return NL_SKIP;
+}
+
+/* look up the id of nl80211 multicast group @name, -1 if there is none */
+static int wpa_driver_nl_mcast_id(const char *name)
+{
+    struct wpa_driver_mcast_group group = { name, -1 };
+    struct nl_msg *msg;
+
+    if (wpa_driver_init_nl() != 0)
+        return -1;
 
-    nl_cb_err(cb, NL_CB_CUSTOM, nl_error_handler, &err);
-    nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, nl_finish_handler, &err);
-    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, nl_ack_handler, &err);
+    msg = nlmsg_alloc();
+    if (!msg)
+        return -1;
 
-    while (err > 0)
-        nl_recvmsgs(nl_sock, cb);
+    genlmsg_put(msg, 0, 0, GENL_ID_CTRL, 0, 0, CTRL_CMD_GETFAMILY, 0);
+    NLA_PUT_STRING(msg, CTRL_ATTR_FAMILY_NAME, "nl80211");
 
-    ret = 0;
-out:
-    nl_cb_put(cb);
-out_free_msg:
+    if (wpa_driver_send_nl_reply(msg, nl_family_handler, &group) != 0)
+        return -1;
+
+    return group.id;
+
+nla_put_failure:
     nlmsg_free(msg);
+    return -1;
+}
+
+static int wpa_driver_set_cqm(char *iface, int thold, int hyst)
+{
+    struct nl_msg *msg;
+    struct nlattr *cqm;
+
+    msg = wpa_driver_alloc_nl(iface, NL80211_CMD_SET_CQM);
+    if (!msg)
+        return -1;
+
+    cqm = nla_nest_start(msg, NL80211_ATTR_CQM);
+    if (!cqm)
+        goto nla_put_failure;
+    NLA_PUT_U32(msg, NL80211_ATTR_CQM_RSSI_THOLD, thold);
+    NLA_PUT_U32(msg, NL80211_ATTR_CQM_RSSI_HYST, hyst);
+    nla_nest_end(msg, cqm);
+
+    return wpa_driver_send_nl(msg);
+
 nla_put_failure:
+    nlmsg_free(msg);
+    return -1;
+}
 
-exit:
-    wpa_driver_deinit_nl();
-    return ret;
+static int nl_no_seq_check(struct nl_msg *msg, void *arg)
+{
+    return NL_OK;
 }
 
-static int wpa_driver_set_country(char *iface, char *country)
+static int nl_link_event_handler(struct nl_msg *msg, void *arg)
 {
-    int ret;
-    struct nl_cb *cb;
-    struct nl_msg *msg;
-    int devidx = 0;
-    int err;
-    char alpha2[3];
-    ret = wpa_driver_init_nl();
-    if (ret != 0) {
-        return ret;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+
+    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+              genlmsg_attrlen(gnlh, 0), NULL);
+
+    if (tb[NL80211_ATTR_IFINDEX] &&
+        (int)nla_get_u32(tb[NL80211_ATTR_IFINDEX]) != link_cache.drv->ifindex)
+        return NL_SKIP;
+
+    switch (gnlh->cmd) {
+    case NL80211_CMD_NOTIFY_CQM:
+        link_cache.rssi_valid = 0;
+        break;
+    case NL80211_CMD_CONNECT:
+    case NL80211_CMD_ROAM:
+    case NL80211_CMD_DISCONNECT:
+    case NL80211_CMD_DEAUTHENTICATE:
+    case NL80211_CMD_DISASSOCIATE:
+        link_cache.rssi_valid = 0;
+        link_cache.linkspeed_valid = 0;
+        break;
+    default:
+        return NL_SKIP;
     }
 
-    ret = -1;
+    link_cache.events++;
+    wpa_printf(MSG_DEBUG, "%s: nl80211 event %d dropped cached link info",
+               __func__, gnlh->cmd);
+    return NL_SKIP;
+}
 
-    devidx = if_nametoindex(iface);
-    if (devidx == 0) {
-        wpa_printf(MSG_DEBUG,"failed to translate ifname to idx");
-        goto exit;
+static void wpa_driver_link_event_receive(int sock, void *eloop_ctx,
+                                          void *sock_ctx)
+{
+    if (nl_recvmsgs(link_cache.event_sock, link_cache.event_cb) < 0) {
+        /* events may have been lost, don't trust the cache any more */
+        link_cache.rssi_valid = 0;
+        link_cache.linkspeed_valid = 0;
     }
+}
 
-    msg = nlmsg_alloc();
-    if (!msg) {
-        wpa_printf(MSG_DEBUG,"failed to allocate netlink message");
-        goto exit;
+static void wpa_driver_link_events_deinit(void)
+{
+    if (link_cache.event_sock) {
+        eloop_unregister_read_sock(nl_socket_get_fd(link_cache.event_sock));
+        nl_socket_free(link_cache.event_sock);
+    }
+    if (link_cache.event_cb)
+        nl_cb_put(link_cache.event_cb);
+    link_cache.event_sock = NULL;
+    link_cache.event_cb = NULL;
+}
+
+static int wpa_driver_link_events_init(char *iface)
+{
+    char prop[PROPERTY_VALUE_MAX];
+    int mlme, thold, hyst;
+
+    mlme = wpa_driver_nl_mcast_id("mlme");
+    if (mlme < 0) {
+        wpa_printf(MSG_DEBUG, "nl80211 mlme events not available");
+        return -1;
     }
 
-    cb = nl_cb_alloc(NL_CB_DEFAULT);
-    if (!cb) {
-        wpa_printf(MSG_DEBUG,"failed to allocate netlink callbacks");
-        goto out_free_msg;
+    link_cache.event_cb = nl_cb_alloc(NL_CB_DEFAULT);
+    link_cache.event_sock = nl_socket_alloc();
+    if (!link_cache.event_cb || !link_cache.event_sock)
+        goto out_deinit;
+
+    if (genl_connect(link_cache.event_sock) ||
+        nl_socket_add_membership(link_cache.event_sock, mlme)) {
+        wpa_printf(MSG_DEBUG, "failed to join nl80211 mlme events");
+        goto out_deinit;
     }
 
-    alpha2[0] = country[0];
-    alpha2[1] = country[1];
-    alpha2[2] = '\0';
+    nl_cb_set(link_cache.event_cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM,
+              nl_no_seq_check, NULL);
+    nl_cb_set(link_cache.event_cb, NL_CB_VALID, NL_CB_CUSTOM,
+              nl_link_event_handler, NULL);
 
-    genlmsg_put(msg, 0, 0, genl_family_get_id(nl80211), 0, 0,
-            NL80211_CMD_REQ_SET_REG, 0);
+    eloop_register_read_sock(nl_socket_get_fd(link_cache.event_sock),
+                             wpa_driver_link_event_receive, NULL, NULL);
 
-    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, devidx);
-    NLA_PUT_STRING(msg, NL80211_ATTR_REG_ALPHA2, alpha2);
+    property_get("wlan.driver.link_cache_cqm", prop, "");
+    if (sscanf(prop, "%d,%d", &thold, &hyst) == 2 &&
+        wpa_driver_set_cqm(iface, thold, hyst) != 0)
+        wpa_printf(MSG_DEBUG, "failed to set CQM RSSI trigger");
 
-    err = nl_send_auto_complete(nl_sock, msg);
-    if (err < 0) {
-        wpa_printf(MSG_DEBUG, "could not send auto_complete: %d", err);
-        goto out;
+    return 0;
+
+out_deinit:
+    wpa_driver_link_events_deinit();
+    return -1;
+}
+
+static void wpa_driver_link_cache_init(struct wpa_driver_wext_data *drv)
+{
+    char prop[PROPERTY_VALUE_MAX];
+
+    if (link_cache.initialized)
+        return;
+
+    property_get("wlan.driver.link_cache_ms", prop, WPA_DRIVER_LINK_CACHE_MS);
+    link_cache.max_age = atoi(prop);
+    link_cache.drv = drv;
+    link_cache.initialized = 1;
+
+    if (link_cache.max_age > 0)
+        wpa_driver_link_events_init(drv->ifname);
+
+    wpa_printf(MSG_DEBUG, "%s: max age %d ms, events %s", __func__,
+               link_cache.max_age, link_cache.event_sock ? "on" : "off");
+}
+
+static void wpa_driver_link_cache_deinit(void)
+{
+    wpa_driver_link_events_deinit();
+    os_memset(&link_cache, 0, sizeof(link_cache));
+}
+
+/* whether a value read at @t is still young enough to be reused */
+static int wpa_driver_link_cache_fresh(int valid, struct os_time *t)
+{
+    struct os_time now;
+    long age;
+
+    if (!valid || link_cache.max_age <= 0)
+        return 0;
+
+    os_get_time(&now);
+    age = (now.sec - t->sec) * 1000 + (now.usec - t->usec) / 1000;
+    return age >= 0 && age < link_cache.max_age;
+}
+
+static int wpa_driver_get_rssi_cached(struct wpa_driver_wext_data *drv)
+{
+    wpa_driver_link_cache_init(drv);
+
+    if (drv != link_cache.drv)
+        return wpa_driver_wext_get_rssi(drv);
+
+    if (wpa_driver_link_cache_fresh(link_cache.rssi_valid,
+                                    &link_cache.rssi_time)) {
+        link_cache.hits++;
+        return link_cache.rssi;
     }
 
-    err = 1;
+    link_cache.misses++;
+    link_cache.rssi = wpa_driver_wext_get_rssi(drv);
+    link_cache.rssi_valid = link_cache.rssi != -1;
+    os_get_time(&link_cache.rssi_time);
 
-    nl_cb_err(cb, NL_CB_CUSTOM, nl_error_handler, &err);
-    nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, nl_finish_handler, &err);
-    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, nl_ack_handler, &err);
+    return link_cache.rssi;
+}
 
-    while (err > 0)
-        nl_recvmsgs(nl_sock, cb);
+static int wpa_driver_get_linkspeed_cached(struct wpa_driver_wext_data *drv)
+{
+    wpa_driver_link_cache_init(drv);
 
-    ret = 0;
-out:
-    nl_cb_put(cb);
-out_free_msg:
-    nlmsg_free(msg);
-nla_put_failure:
+    if (drv != link_cache.drv)
+        return wpa_driver_wext_get_linkspeed(drv);
 
-exit:
-    wpa_driver_deinit_nl();
-    return ret;
+    if (wpa_driver_link_cache_fresh(link_cache.linkspeed_valid,
+                                    &link_cache.linkspeed_time)) {
+        link_cache.hits++;
+        return link_cache.linkspeed;
+    }
+
+    link_cache.misses++;
+    link_cache.linkspeed = wpa_driver_wext_get_linkspeed(drv);
+    link_cache.linkspeed_valid = link_cache.linkspeed != -1;
+    os_get_time(&link_cache.linkspeed_time);
+
+    return link_cache.linkspeed;
 }
 
 static int wpa_driver_toggle_btcoex_state(char state)
@@ -1975,14 +2539,18 @@ u8 g_scan_type = IW_SCAN_TYPE_ACTIVE;
 /* start with "world" num of channels */
 int g_num_channels = 13;
 
-static int wpa_driver_priv_driver_cmd( void *priv, char *cmd, char *buf, size_t buf_len )
+/* private commands slower than this are logged at info level */
+#define WPA_DRIVER_CMD_SLOW_USEC 50000
+
+/* separator between the sub-commands of a "BATCH" command */
+#define WPA_DRIVER_CMD_BATCH_SEP ";"
+
+static int wpa_driver_priv_cmd_one(void *priv, char *cmd, char *buf, size_t buf_len)
 {
     struct wpa_driver_wext_data *drv = priv;
     struct wpa_supplicant *wpa_s = (struct wpa_supplicant *)(drv->ctx);
     int ret = 0, flags;
 
-    wpa_printf(MSG_DEBUG, "%s %s len = %d", __func__, cmd, buf_len);
-
     if (os_strcasecmp(cmd, "STOP") == 0) {
         if ((wpa_driver_wext_get_ifflags(drv, &flags) == 0) &&
             (flags & IFF_UP)) {
@@ -2008,7 +2576,7 @@ static int wpa_driver_priv_driver_cmd( void *priv, char *cmd, char *buf, size_t
         u8 ssid[MAX_SSID_LEN];
         int rssi;
 
-        rssi = wpa_driver_wext_get_rssi(priv);
+        rssi = wpa_driver_get_rssi_cached(drv);
         if ((rssi != -1) && (wpa_driver_wext_get_ssid(priv, ssid) > 0)) {
             ret = os_snprintf(buf, buf_len, "%s rssi %d\n", ssid, rssi);
         } else {
@@ -2017,12 +2585,16 @@ static int wpa_driver_priv_driver_cmd( void *priv, char *cmd, char *buf, size_t
     } else if (os_strcasecmp(cmd, "LINKSPEED") == 0) {
         int linkspeed;
 
-        linkspeed = wpa_driver_wext_get_linkspeed(priv);
+        linkspeed = wpa_driver_get_linkspeed_cached(drv);
         if (linkspeed != -1) {
             ret = os_snprintf(buf, buf_len, "LinkSpeed %d\n", linkspeed);
         } else {
             ret = -1;
         }
+    } else if (os_strcasecmp(cmd, "LINKCACHE") == 0) {
+        ret = os_snprintf(buf, buf_len, "LinkCache age %d hits %u misses %u "
+                          "events %u\n", link_cache.max_age, link_cache.hits,
+                          link_cache.misses, link_cache.events);
     } else if( os_strcasecmp(cmd, "RELOAD") == 0 ) {
         wpa_msg(wpa_s, MSG_INFO, WPA_EVENT_DRIVER_STATE "HANGED");
     } else if( os_strcasecmp(cmd, "SCAN-PASSIVE") == 0 ) {
@@ -2084,6 +2656,80 @@ out:
     return ret;
 }
 
+/*
+ * Run @cmd and log how long it took. Every private command, including each
+ * part of a batch, goes through here so slow driver paths show up in the
+ * log with the command that hit them.
+ */
+static int wpa_driver_priv_cmd_timed(void *priv, char *cmd, char *buf, size_t buf_len)
+{
+    struct os_time start, end;
+    long usec;
+    int ret;
+
+    os_get_time(&start);
+    ret = wpa_driver_priv_cmd_one(priv, cmd, buf, buf_len);
+    os_get_time(&end);
+
+    usec = (end.sec - start.sec) * 1000000 + (end.usec - start.usec);
+    wpa_printf(usec > WPA_DRIVER_CMD_SLOW_USEC ? MSG_INFO : MSG_DEBUG,
+               "%s: %s took %ld usec, ret %d (link cache hits %u misses %u)",
+               __func__, cmd, usec, ret, link_cache.hits, link_cache.misses);
+
+    return ret;
+}
+
+/*
+ * "BATCH cmd1;cmd2;..." runs the listed commands in order within a single
+ * request, so the framework can poll e.g. RSSI and LINKSPEED together. The
+ * replies are concatenated into @buf. Processing stops at the first command
+ * that fails and the whole batch then fails.
+ */
+static int wpa_driver_priv_cmd_batch(void *priv, char *cmds, char *buf, size_t buf_len)
+{
+    char *list, *cmd, *pos;
+    size_t len = 0;
+    int ret = 0;
+
+    list = os_strdup(cmds);
+    if (!list)
+        return -1;
+
+    for (cmd = strtok_r(list, WPA_DRIVER_CMD_BATCH_SEP, &pos); cmd;
+         cmd = strtok_r(NULL, WPA_DRIVER_CMD_BATCH_SEP, &pos)) {
+        while (*cmd == ' ')
+            cmd++;
+        if (*cmd == '\0')
+            continue;
+
+        ret = wpa_driver_priv_cmd_timed(priv, cmd, buf + len, buf_len - len);
+        if (ret < 0)
+            break;
+
+        /* a truncated reply still fills the buffer up to its end */
+        if ((size_t)ret >= buf_len - len)
+            ret = buf_len - len - 1;
+        len += ret;
+        buf[len] = '\0';
+    }
+
+    os_free(list);
+    return ret < 0 ? -1 : (int)len;
+}
+
+static int wpa_driver_priv_driver_cmd( void *priv, char *cmd, char *buf, size_t buf_len )
+{
+    wpa_printf(MSG_DEBUG, "%s %s len = %d", __func__, cmd, buf_len);
+
+    if (buf_len == 0)
+        return -1;
+
+    if (os_strncasecmp(cmd, "BATCH ", 6) == 0)
+        return wpa_driver_priv_cmd_batch(priv, cmd + 6, buf, buf_len);
+
+    return wpa_driver_priv_cmd_timed(priv, cmd, buf, buf_len);
+}
+
 #endif
 
 /**
@@ -2150,6 +2796,23 @@ int wpa_driver_wext_scan_custom(void *priv, const u8 *ssid, size_t ssid_len)
     return ret;
 }
 
+/**
+ * wpa_driver_wext_deinit_custom - Deinitialize WE driver interface
+ * @priv: Pointer to private wext data from wpa_driver_wext_init()
+ *
+ * Releases the buffers and sockets this file keeps across calls on top of
+ * what wpa_driver_wext_deinit() does.
+ */
+static void wpa_driver_wext_deinit_custom(void *priv)
+{
+    wpa_driver_wext_deinit(priv);
+    wext_scan_buf_free();
+#ifdef ANDROID
+    wpa_driver_link_cache_deinit();
+    wpa_driver_deinit_nl();
+#endif
+}
+
 const struct wpa_driver_ops wpa_driver_custom_ops = {
     .name = "mac80211_wext",
     .desc = "mac80211 station driver for TI wl12xx",
@@ -2160,14 +2823,14 @@ const struct wpa_driver_ops wpa_driver_custom_ops = {
     .set_countermeasures = wpa_driver_wext_set_countermeasures,
     .set_drop_unencrypted = wpa_driver_wext_set_drop_unencrypted,
     .scan = wpa_driver_wext_scan_custom,
-    .get_scan_results2 = wpa_driver_wext_get_scan_results,
+    .get_scan_results2 = wpa_driver_wext_get_scan_results_custom,
     .deauthenticate = wpa_driver_wext_deauthenticate,
     .disassociate = wpa_driver_wext_disassociate,
     .set_mode = wpa_driver_wext_set_mode,
     .associate = wpa_driver_wext_associate,
     .set_auth_alg = wpa_driver_wext_set_auth_alg,
     .init = wpa_driver_wext_init,
-    .deinit = wpa_driver_wext_deinit,
+    .deinit = wpa_driver_wext_deinit_custom,
     .add_pmkid = wpa_driver_wext_add_pmkid,
     .remove_pmkid = wpa_driver_wext_remove_pmkid,
     .flush_pmkid = wpa_driver_wext_flush_pmkid,